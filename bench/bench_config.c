@@ -0,0 +1,280 @@
+#define _GNU_SOURCE
+#include "config.h"
+#include "topogen.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MIN_NS 50000000ull // Each round runs for at least 50 ms
+#define BENCH_ROUNDS 15           // Best round counts, to shed noise
+#define BENCH_TOLERANCE 0.30      // Slowdown allowed by --check
+#define CORPUS_SIZE 4096          // Strings in the cidr and rule corpora
+#define CORPUS_NAMESPACES 10000   // Namespaces in the topology corpus
+
+/*
+ * Allocations of the code under test, counted through the linker's
+ * --wrap=malloc,calloc,realloc so the parser itself is left untouched
+ */
+static unsigned long long alloc_count, alloc_bytes;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    alloc_count++;
+    alloc_bytes += nmemb * size;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+/* One benchmarked function; a pass runs it over its whole corpus */
+typedef struct {
+    const char *name;
+    int (*pass)(void); /* Returns the operations run, -1 on a parse error */
+} bench_t;
+
+/* Result of a benchmark, or a line of a baseline file */
+typedef struct {
+    char name[32];
+    double ns_per_op;
+    double allocs_per_op;
+    double bytes_per_op;
+} result_t;
+
+static char *cidrs[CORPUS_SIZE];
+static char *rules[CORPUS_SIZE];
+static char **lines;
+static int line_count;
+static config_t rule_config; // namespaces the rules refer to
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int pass_parse_cidr(void) {
+    for (int i = 0; i < CORPUS_SIZE; i++) {
+        struct in_addr addr;
+        u_int8_t mask;
+        if (parse_cidr(cidrs[i], &addr, &mask) != 0) {
+            return -1;
+        }
+    }
+    return CORPUS_SIZE;
+}
+
+static int pass_parse_fw_rule(void) {
+    for (int i = 0; i < CORPUS_SIZE; i++) {
+        fw_rule_t rule;
+        if (parse_fw_rule(rules[i], &rule_config, &rule) != 0) {
+            return -1;
+        }
+    }
+    return CORPUS_SIZE;
+}
+
+/* A whole topology, one line at a time, into a fresh configuration */
+static int pass_parse_config_line(void) {
+    config_t config;
+    init_config(&config);
+    for (int i = 0; i < line_count; i++) {
+        if (parse_config_line(lines[i], &config) != 0) {
+            free_config(&config);
+            return -1;
+        }
+    }
+    free_config(&config);
+    return line_count;
+}
+
+static const bench_t benches[] = {
+    {"parse_cidr", pass_parse_cidr},
+    {"parse_fw_rule", pass_parse_fw_rule},
+    {"parse_config_line", pass_parse_config_line},
+};
+
+/* Random but repeatable corpora, built before anything is measured */
+static int build_corpora(void) {
+    srand(1);
+    for (int i = 0; i < CORPUS_SIZE; i++) {
+        if (asprintf(&cidrs[i], "%d.%d.%d.%d/%d", rand() % 224 + 1,
+                     rand() % 256, rand() % 256, rand() % 256,
+                     rand() % 33) < 0) {
+            return -1;
+        }
+    }
+
+    init_config(&rule_config);
+    char line[64];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(line, sizeof line, "namespace = tenant%d", i);
+        if (parse_config_line(line, &rule_config) != 0) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < CORPUS_SIZE; i++) {
+        int dst = rand() % 1001;
+        char dst_name[32] = "INTERNET";
+        if (dst < 1000) {
+            snprintf(dst_name, sizeof dst_name, "tenant%d", dst);
+        }
+        if (asprintf(&rules[i], "tenant%d -> %s", rand() % 1000, dst_name) <
+            0) {
+            return -1;
+        }
+    }
+
+    char *text;
+    size_t size;
+    FILE *fp = open_memstream(&text, &size);
+    topogen_t spec = {
+        .namespaces = CORPUS_NAMESPACES,
+        .bridges = CORPUS_NAMESPACES / 250,
+        .rules = CORPUS_NAMESPACES,
+        .seed = 1,
+        .uplink = "eth0",
+    };
+    if (fp == NULL || topogen_write(fp, &spec) != 0 || fclose(fp) != 0) {
+        return -1;
+    }
+    lines = malloc((size + 1) * sizeof *lines);
+    if (lines == NULL) {
+        return -1;
+    }
+    for (char *tok = strtok(text, "\n"); tok != NULL;
+         tok = strtok(NULL, "\n")) {
+        lines[line_count++] = tok;
+    }
+    return 0;
+}
+
+static int run_bench(const bench_t *bench, result_t *result) {
+    snprintf(result->name, sizeof result->name, "%s", bench->name);
+    result->ns_per_op = 0;
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        unsigned long long ops = 0;
+        alloc_count = alloc_bytes = 0;
+        uint64_t start = now_ns(), elapsed;
+        do {
+            int n = bench->pass();
+            if (n < 0) {
+                fprintf(stderr, "%s failed on its corpus\n", bench->name);
+                return -1;
+            }
+            ops += n;
+            elapsed = now_ns() - start;
+        } while (elapsed < BENCH_MIN_NS);
+
+        double ns_per_op = (double)elapsed / ops;
+        if (round == 0 || ns_per_op < result->ns_per_op) {
+            result->ns_per_op = ns_per_op;
+        }
+        result->allocs_per_op = (double)alloc_count / ops;
+        result->bytes_per_op = (double)alloc_bytes / ops;
+    }
+    return 0;
+}
+
+static int load_baseline(const char *path, result_t *baseline, int max) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror("Cannot open baseline");
+        return -1;
+    }
+    int count = 0;
+    char line[128];
+    while (count < max && fgets(line, sizeof line, fp) != NULL) {
+        result_t *b = &baseline[count];
+        if (line[0] != '#' &&
+            sscanf(line, "%31s %lf %lf %lf", b->name, &b->ns_per_op,
+                   &b->allocs_per_op, &b->bytes_per_op) == 4) {
+            count++;
+        }
+    }
+    fclose(fp);
+    return count;
+}
+
+/* Slower past the tolerance, or allocating more at all, is a regression */
+static bool regressed(const result_t *result, const result_t *baseline) {
+    return result->ns_per_op > baseline->ns_per_op * (1 + BENCH_TOLERANCE) ||
+           result->allocs_per_op > baseline->allocs_per_op + 0.01 ||
+           result->bytes_per_op > baseline->bytes_per_op * 1.01 + 1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *check = NULL, *save = NULL;
+    if (argc == 3 && strcmp(argv[1], "--check") == 0) {
+        check = argv[2];
+    } else if (argc == 3 && strcmp(argv[1], "--save") == 0) {
+        save = argv[2];
+    } else if (argc != 1) {
+        fprintf(stderr, "Usage: %s [--check|--save baseline_file]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int bench_count = sizeof benches / sizeof *benches;
+    result_t baseline[sizeof benches / sizeof *benches];
+    int baseline_count =
+        check ? load_baseline(check, baseline, bench_count) : 0;
+    if (baseline_count < 0 || build_corpora() != 0) {
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = save ? fopen(save, "w") : NULL;
+    if (save && out == NULL) {
+        perror("Cannot write baseline");
+        return EXIT_FAILURE;
+    }
+    if (out != NULL) {
+        fprintf(out, "# name ns/op allocs/op bytes/op\n");
+    }
+
+    int status = EXIT_SUCCESS;
+    for (int i = 0; i < bench_count; i++) {
+        result_t result;
+        if (run_bench(&benches[i], &result) != 0) {
+            return EXIT_FAILURE;
+        }
+        printf("%-20s %10.1f ns/op %8.3f allocs/op %10.1f B/op\n",
+               result.name, result.ns_per_op, result.allocs_per_op,
+               result.bytes_per_op);
+        if (out != NULL) {
+            fprintf(out, "%s %.1f %.3f %.1f\n", result.name,
+                    result.ns_per_op, result.allocs_per_op,
+                    result.bytes_per_op);
+        }
+        for (int b = 0; b < baseline_count; b++) {
+            if (strcmp(baseline[b].name, result.name) == 0 &&
+                regressed(&result, &baseline[b])) {
+                fprintf(stderr,
+                        "%s regressed: %.1f ns/op %.3f allocs/op %.1f B/op, "
+                        "baseline %.1f ns/op %.3f allocs/op %.1f B/op\n",
+                        result.name, result.ns_per_op, result.allocs_per_op,
+                        result.bytes_per_op, baseline[b].ns_per_op,
+                        baseline[b].allocs_per_op, baseline[b].bytes_per_op);
+                status = EXIT_FAILURE;
+            }
+        }
+    }
+    if (out != NULL && fclose(out) != 0) {
+        status = EXIT_FAILURE;
+    }
+    return status;
+}
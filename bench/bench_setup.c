@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include "config.h"
+#include "network.h"
+#include "plan.h"
+#include "topogen.h"
+#include "validate.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_TOPOLOGY "/var/run/lvr-bench.ini" // Inside the private /run
+#define BENCH_PER_BRIDGE 250 // Namespaces per bridge of a generated topology
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * Run in a network namespace of our own with a private /run, so namespaces,
+ * links, the ruleset and the manifest never reach the host.
+ */
+static int isolate(void) {
+    if (unshare(CLONE_NEWNET | CLONE_NEWNS) != 0) {
+        perror("Cannot unshare the network and mount namespaces");
+        return -1;
+    }
+    if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) != 0 ||
+        mount("tmpfs", "/var/run", "tmpfs", 0, NULL) != 0) {
+        perror("Cannot mount a private /var/run");
+        return -1;
+    }
+    return 0;
+}
+
+static void print_busy(FILE *out, const plan_t *plan) {
+    fprintf(out, "{");
+    for (int k = 0; k < OP_KIND_COUNT; k++) {
+        fprintf(out, "%s\"%s\": %.3f", k ? ", " : "", plan_kind_name(k),
+                plan->busy_ns[k] / 1e6);
+    }
+    fprintf(out, "}");
+}
+
+/*
+ * Bring one generated topology up and down, timing the steps network_up()
+ * and network_down() take one by one. Returns -1 if it failed before its
+ * result was written, 1 if the result records a failure.
+ */
+static int bench_one(FILE *out, const topogen_t *spec, bool first) {
+    FILE *fp = fopen(BENCH_TOPOLOGY, "w");
+    if (fp == NULL || topogen_write(fp, spec) != 0 || fclose(fp) != 0) {
+        fprintf(stderr, "Cannot write %s\n", BENCH_TOPOLOGY);
+        return -1;
+    }
+
+    config_t config;
+    init_config(&config);
+    plan_t plan = {0};
+    int status = -1;
+
+    double t0 = now_ms();
+    if (parse_config_file(BENCH_TOPOLOGY, &config) != 0) {
+        goto out;
+    }
+    double t1 = now_ms();
+    if (config_assign_addresses(&config, NULL) != 0) {
+        goto out;
+    }
+    double t1b = now_ms();
+    if (validate_config(&config) != 0) {
+        goto out;
+    }
+    double t2 = now_ms();
+    if (plan_build(&config, &plan) != 0) {
+        goto out;
+    }
+    double t3 = now_ms();
+    int up = plan_run(&plan, false);
+    double t4 = now_ms();
+    fprintf(out, "%s    {\"namespaces\": %d, \"bridges\": %d, \"rules\": %d, "
+                 "\"operations\": %d,\n",
+            first ? "" : ",\n", spec->namespaces, spec->bridges, spec->rules,
+            plan.node_count);
+    fprintf(out,
+            "     \"parse_ms\": %.3f, \"assign_ms\": %.3f, "
+            "\"validate_ms\": %.3f, \"plan_build_ms\": %.3f,\n",
+            t1 - t0, t1b - t1, t2 - t1b, t3 - t2);
+    fprintf(out, "     \"up_ms\": %.3f, \"up_busy_ms\": ", t4 - t3);
+    print_busy(out, &plan);
+
+    double t5 = now_ms();
+    int saved = up == 0 ? save_manifest(&config) : -1;
+    double t6 = now_ms();
+    // tear down even after a failed bring-up so the next size starts clean
+    int down = plan_run(&plan, true);
+    double t7 = now_ms();
+    remove_manifest();
+
+    fprintf(out, ",\n     \"manifest_ms\": %.3f, \"down_ms\": %.3f, "
+                 "\"down_busy_ms\": ",
+            t6 - t5, t7 - t6);
+    print_busy(out, &plan);
+    fprintf(out, ",\n     \"ok\": %s}", up == 0 && saved == 0 && down == 0
+                                             ? "true"
+                                             : "false");
+    status = up == 0 && saved == 0 && down == 0 ? 0 : 1;
+
+out:
+    plan_free(&plan);
+    free_config(&config);
+    unlink(BENCH_TOPOLOGY);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    const char *sizes = "10,100,1000,10000";
+    int rules_per_ns = 1;
+    const char *output = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:o:")) != -1) {
+        switch (opt) {
+        case 'n':
+            sizes = optarg;
+            break;
+        case 'r':
+            rules_per_ns = atoi(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            fprintf(stderr,
+                    "Usage: %s [-n sizes,...] [-r rules_per_namespace] "
+                    "[-o output.json]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (geteuid() != 0) {
+        fprintf(stderr, "The benchmark creates namespaces and needs root\n");
+        return EXIT_FAILURE;
+    }
+    if (isolate() != 0) {
+        return EXIT_FAILURE;
+    }
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (out == NULL) {
+        perror("Cannot open output file");
+        return EXIT_FAILURE;
+    }
+
+    int status = 0;
+    fprintf(out, "{\"benchmark\": \"setup\", \"runs\": [\n");
+    char *list = strdup(sizes);
+    bool first = true;
+    for (char *tok = strtok(list, ","); tok != NULL;
+         tok = strtok(NULL, ",")) {
+        int n = atoi(tok);
+        topogen_t spec = {
+            .namespaces = n,
+            .bridges = (n + BENCH_PER_BRIDGE - 1) / BENCH_PER_BRIDGE,
+            .rules = n * rules_per_ns,
+            .seed = 1,
+            .uplink = "lo",
+        };
+        int result = bench_one(out, &spec, first);
+        if (result != 0) {
+            fprintf(stderr, "Benchmark of %d namespaces failed\n", n);
+            status = -1;
+        }
+        first = first && result < 0;
+        fflush(out);
+    }
+    fprintf(out, "\n]}\n");
+    free(list);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,32 @@
+#include "topogen.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char *argv[]) {
+    if (argc < 4 || argc > 5) {
+        fprintf(stderr,
+                "Usage: %s <namespaces> <bridges> <rules> [output_file]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    topogen_t spec = {
+        .namespaces = atoi(argv[1]),
+        .bridges = atoi(argv[2]),
+        .rules = atoi(argv[3]),
+        .seed = 1,
+        .uplink = "eth0",
+    };
+    FILE *fp = argc == 5 ? fopen(argv[4], "w") : stdout;
+    if (fp == NULL) {
+        perror("Cannot open output file");
+        return EXIT_FAILURE;
+    }
+    int status = topogen_write(fp, &spec);
+    if ((fp != stdout && fclose(fp) != 0) || status != 0) {
+        fprintf(stderr, "Failed to write the topology\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+#include "topogen.h"
+
+#include <stdint.h>
+
+static void print_ip(FILE *fp, uint32_t ip) {
+    fprintf(fp, "%u.%u.%u.%u", ip >> 24, ip >> 16 & 0xff, ip >> 8 & 0xff,
+            ip & 0xff);
+}
+
+/* Same sequence on every platform, unlike rand() */
+static uint32_t next_random(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+int topogen_write(FILE *fp, const topogen_t *spec) {
+    int n = spec->namespaces, m = spec->bridges;
+    if (n < 0 || m < 0 || spec->rules < 0 || m > TOPOGEN_MAX_BRIDGES ||
+        (m > 0 && (n + m - 1) / m > TOPOGEN_MAX_PER_BRIDGE) ||
+        (m == 0 && n > TOPOGEN_MAX_VETH)) {
+        fprintf(stderr, "%d namespaces on %d bridges do not fit\n", n, m);
+        return -1;
+    }
+
+    fprintf(fp, "# %d namespaces, %d bridges, %d rules\n", n, m,
+            spec->rules);
+    fprintf(fp, "enable_ipv4_forwarding = true\n");
+    fprintf(fp, "nat_outgoing_interface = %s\n", spec->uplink);
+    fprintf(fp, "firewall_forward_default = DROP\n");
+
+    for (int j = 0; j < m; j++) {
+        uint32_t network = 10u << 24 | (uint32_t)j << 12;
+        fprintf(fp, "bridge = br%d\nbridge.br%d.ip = ", j, j);
+        print_ip(fp, network + 1);
+        fprintf(fp, "/20\nenable_nat = ");
+        print_ip(fp, network);
+        fprintf(fp, "/20\n");
+    }
+    if (m == 0 && n > 0) {
+        fprintf(fp, "enable_nat = 100.64.0.0/10\n");
+    }
+
+    for (int i = 0; i < n; i++) {
+        uint32_t network, host, mask;
+        if (m > 0) {
+            network = 10u << 24 | (uint32_t)(i % m) << 12;
+            host = network + 2 + i / m;
+            mask = 20;
+        } else {
+            network = (100u << 24 | 64u << 16) + 4 * (uint32_t)i;
+            host = network + 2;
+            mask = 30;
+        }
+        fprintf(fp, "namespace = ns%d\nnamespace.ns%d.ip = ", i, i);
+        print_ip(fp, host);
+        fprintf(fp, "/%u\nnamespace.ns%d.gateway = ", mask, i);
+        print_ip(fp, network + 1);
+        if (m > 0) {
+            fprintf(fp, "\nnamespace.ns%d.connect_via = bridge:br%d\n", i,
+                    i % m);
+        } else {
+            fprintf(fp, "\nnamespace.ns%d.connect_via = veth\n", i);
+        }
+    }
+
+    uint32_t state = spec->seed ? spec->seed : 1;
+    for (int r = 0; n > 0 && r < spec->rules; r++) {
+        int src = next_random(&state) % n;
+        uint32_t dst = next_random(&state);
+        if (dst % 4 == 0) {
+            fprintf(fp, "firewall_allow_forward = ns%d -> INTERNET\n", src);
+        } else {
+            fprintf(fp, "firewall_allow_forward = ns%d -> ns%u\n", src,
+                    dst / 4 % n);
+        }
+    }
+    return ferror(fp) ? -1 : 0;
+}
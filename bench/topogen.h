@@ -0,0 +1,35 @@
+/*
+ * topogen.h
+ *
+ * Synthetic topologies of a given size for the benchmarks
+ */
+#ifndef _TOPOGEN_H
+#define _TOPOGEN_H
+
+#include <stdio.h>
+
+#define TOPOGEN_MAX_BRIDGES 4096     // Each bridge gets a /20 of 10.0.0.0/8
+#define TOPOGEN_MAX_PER_BRIDGE 4093  // Hosts of a /20 minus the gateway
+#define TOPOGEN_MAX_VETH (1 << 20)   // Each veth pair gets a /30 of a /10
+
+/* Shape of a generated topology */
+typedef struct {
+    int namespaces;     /* Number of namespaces */
+    int bridges;        /* Number of bridges, 0 for veth pairs only */
+    int rules;          /* Number of firewall rules */
+    unsigned seed;      /* Seed of the rule endpoints */
+    const char *uplink; /* nat_outgoing_interface */
+} topogen_t;
+
+/**
+ * Write a topology file. Namespaces are spread round-robin over the
+ * bridges, or each get their own veth pair without bridges; every rule
+ * allows one namespace to reach another or the internet.
+ *
+ * @param fp Stream to write to
+ * @param spec Shape of the topology
+ * @return 0 on success, -1 if the shape does not fit the address plan
+ */
+int topogen_write(FILE *fp, const topogen_t *spec);
+
+#endif /* _TOPOGEN_H */
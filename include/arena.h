@@ -0,0 +1,60 @@
+/*
+ * arena.h
+ *
+ * Bump allocator whose allocations are all released at once
+ */
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+typedef struct arena_block arena_block_t;
+
+/* An arena; zero-initialized it is empty and ready for use */
+typedef struct {
+    arena_block_t *head; /* Block allocations come from, linked to older ones */
+} arena_t;
+
+/**
+ * Allocate zeroed memory from an arena
+ *
+ * @param arena The arena
+ * @param size Number of bytes
+ * @return Memory aligned for any type, or NULL on failure
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * Resize an allocation. The most recent allocation grows in place when its
+ * block has room; otherwise the contents move to a new allocation and the
+ * old space is only reclaimed by arena_release().
+ *
+ * @param arena The arena ptr was allocated from
+ * @param ptr Allocation to resize, NULL to allocate
+ * @param old_size Current size of the allocation
+ * @param new_size Requested size, at least old_size
+ * @return The resized allocation with new bytes zeroed, or NULL on failure
+ */
+void *arena_realloc(arena_t *arena, void *ptr, size_t old_size,
+                    size_t new_size);
+
+/**
+ * Make room for one more element in a capacity-doubling array
+ *
+ * @param arena The arena the array lives in
+ * @param data Pointer to the array, updated when it moves
+ * @param count Number of elements in use
+ * @param cap Pointer to the capacity in elements, updated when it grows
+ * @param size Size of one element
+ * @return The zeroed element at index count, or NULL on failure
+ */
+void *arena_push(arena_t *arena, void *data, int count, int *cap, size_t size);
+
+/**
+ * Release all memory of an arena, leaving it empty
+ *
+ * @param arena The arena
+ */
+void arena_release(arena_t *arena);
+
+#endif /* _ARENA_H */
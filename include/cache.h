@@ -0,0 +1,101 @@
+/*
+ * cache.h
+ *
+ * Compiled binary form of a configuration that loads with a single mmap
+ */
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include "config.h"
+
+#include <stdint.h>
+
+#define CACHE_SUFFIX ".cache"   // Appended to the configuration file name
+#define CACHE_MAGIC 0x4352564cu // "LVRC" read as a little-endian word
+#define CACHE_VERSION 6         // Bumped whenever the layout or meaning
+                                // changes
+
+/* Location of one array in the cache file */
+typedef struct {
+    uint64_t offset; /* Bytes from the start of the file, 8-byte aligned */
+    uint32_t count;  /* Number of elements */
+    uint32_t size;   /* Size of one element */
+} cache_section_t;
+
+/*
+ * File header. Everything after it is addressed by offset, records refer
+ * to names by their offset in the string table, so the file can be mapped
+ * at any address.
+ */
+typedef struct {
+    uint32_t magic;       /* CACHE_MAGIC, also catches a foreign byte order */
+    uint32_t version;     /* CACHE_VERSION */
+    uint64_t source_hash; /* FNV-1a hash of the configuration file */
+    uint64_t size;        /* Size of the whole file */
+    uint8_t ipv4_forwrd;  /* config_t.ipv4_forwrd */
+    uint8_t flow_offload; /* config_t.flow_offload */
+    uint8_t fw_default;   /* config_t.fw_default_action */
+    uint8_t dataplane;    /* config_t.dataplane */
+    uint32_t ct_flows;    /* config_t.conntrack_flows */
+    uint32_t workers;     /* config_t.dataplane_workers */
+    char nat_outgoing_interface[MAX_IF_NAME_LEN]; /* Uplink for NAT */
+    cache_section_t namespaces; /* cache_namespace_t records */
+    cache_section_t bridges;    /* cache_bridge_t records */
+    cache_section_t fw_rules;   /* fw_rule_t, used in place */
+    cache_section_t nat_rules;  /* nat_rule_t, used in place */
+    cache_section_t ns_index;   /* Slots of config_t.ns_index, in place */
+    cache_section_t br_index;   /* Slots of config_t.br_index, in place */
+    cache_section_t strings;    /* NUL-terminated names */
+} cache_header_t;
+
+/* A namespace with its names as string table offsets */
+typedef struct {
+    uint32_t name;          /* Offset of the namespace name */
+    uint32_t connect_name;  /* Offset of the connect_via value */
+    struct in_addr ip_addr; /* namespace_t.ip_addr */
+    struct in_addr gateway; /* namespace_t.gateway */
+    uint8_t mask;           /* namespace_t.mask */
+    uint8_t connect_type;   /* namespace_t.connect_type */
+    uint8_t auto_ip;        /* namespace_t.auto_ip */
+    uint8_t reserved;       /* Zero */
+} cache_namespace_t;
+
+/* A bridge with its name as a string table offset */
+typedef struct {
+    uint32_t name;          /* Offset of the bridge name */
+    struct in_addr ip_addr; /* bridge_t.ip_addr */
+    uint8_t mask;           /* bridge_t.mask */
+    uint8_t reserved[3];    /* Zero */
+} cache_bridge_t;
+
+/**
+ * Get the path of the cache that belongs to a configuration file
+ *
+ * @param filename Path to the configuration file
+ * @return Newly allocated path, or NULL on failure
+ */
+char *cache_path(const char *filename);
+
+/**
+ * Write the compiled form of a configuration next to its file
+ *
+ * @param filename Path to the configuration file config was parsed from
+ * @param config Parsed configuration with its ranges expanded and its
+ *        ip = auto addresses not assigned yet, which config_assign_addresses()
+ *        does after loading
+ * @return 0 on success, -1 on failure
+ */
+int compile_config(const char *filename, const config_t *config);
+
+/**
+ * Load a configuration from its compiled cache. The cache is mapped and
+ * config points into it until free_config().
+ *
+ * @param filename Path to the configuration file
+ * @param config Pointer to an initialized, empty config_t
+ * @return 0 on success, -1 when there is no cache, it is stale or it is
+ *         damaged, in which case the file has to be parsed
+ */
+int load_config_cache(const char *filename, config_t *config);
+
+#endif /* _CACHE_H */
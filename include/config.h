@@ -6,15 +6,56 @@
 #ifndef _CONFIG_H
 #define _CONFIG_H
 
+#include "arena.h"
 #include "constants.h"
 #include "firewall.h"
+#include "ipam.h"
 #include "net_dev.h"
 #include "net_ns.h"
 
 #include <netdb.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#define TEMPLATE_MAX_INSTANCES (1u << 24)  // Namespaces in one range
+#define CONNTRACK_FLOWS_DEFAULT (1u << 18) // Flows per forwarding thread
+#define CONNTRACK_FLOWS_MIN 1024           // Smallest conntrack_flows
+#define CONNTRACK_FLOWS_MAX (1u << 26)     // Largest conntrack_flows
+#define DATAPLANE_WORKERS_MAX 64           // Most forwarding threads
+
+/* Where forwarded traffic between namespaces is switched */
+typedef enum {
+    DATAPLANE_KERNEL, /* The kernel's IP forwarding and nftables */
+    DATAPLANE_AFXDP   /* Userspace forwarding over AF_XDP, see dataplane.h */
+} dataplane_mode_t;
+
+/* Open-addressing hash index from names to array positions */
+typedef struct {
+    int *slots;   /* Entry index + 1 per slot, 0 for an empty slot */
+    int capacity; /* Number of slots, a power of two */
+} name_index_t;
+
+/* Set of interned strings, each stored once in the config arena */
+typedef struct {
+    const char **slots; /* Open-addressing table, NULL for an empty slot */
+    int capacity;       /* Number of slots, a power of two */
+    int count;          /* Number of strings */
+} strtab_t;
+
+/*
+ * Namespaces generated from a range, e.g. namespace = tenant[1..5000]. The
+ * instances tenant1 ... tenant5000 only exist once config_expand() runs.
+ */
+typedef struct {
+    const char *base;  /* Name prefix of the instances, interned */
+    uint32_t first;    /* Number of the first instance */
+    uint32_t last;     /* Number of the last instance, inclusive */
+    namespace_t proto; /* Properties every instance starts from */
+    int first_ns;      /* Index of the first instance in namespaces[], -1
+                          until expanded */
+} ns_template_t;
+
 /* Overall configuration structure */
 typedef struct {
     bool ipv4_forwrd;                             /* Enable IPv4 forwarding */
@@ -22,13 +63,36 @@ typedef struct {
                                                      access for NAT */
     namespace_t *namespaces;       /* Array of namespace configurations */
     int namespace_count;           /* Number of namespaces */
+    int namespace_cap;             /* Allocated namespace entries */
     bridge_t *bridges;             /* Array of bridge configurations */
     int bridge_count;              /* Number of bridges */
+    int bridge_cap;                /* Allocated bridge entries */
     fw_action_t fw_default_action; /* Default firewall action (ALLOW/DROP) */
     fw_rule_t *fw_rules;           /* Array of firewall rules */
     int fw_rule_count;             /* Number of firewall rules */
+    int fw_rule_cap;               /* Allocated firewall rule entries */
     nat_rule_t *nat_rules;         /* Array of NAT rules */
     int nat_rule_count;            /* Number of NAT rules */
+    int nat_rule_cap;              /* Allocated NAT rule entries */
+    bool flow_offload;             /* Software flow offload of established
+                                      forwarded connections */
+    dataplane_mode_t dataplane;    /* Data plane run by the daemon */
+    uint32_t conntrack_flows;      /* Connections each userspace
+                                      forwarding thread can track */
+    uint32_t dataplane_workers;    /* Userspace forwarding threads */
+    name_index_t ns_index;         /* Namespace names to namespaces[] */
+    name_index_t br_index;         /* Bridge names to bridges[] */
+    strtab_t names;                /* Interned namespace and bridge names */
+    ns_template_t *ns_templates;   /* Namespace ranges, expanded lazily */
+    int ns_template_count;         /* Number of namespace ranges */
+    int ns_template_cap;           /* Allocated namespace range entries */
+    int ns_templates_expanded;     /* Number of ranges already in
+                                      namespaces[] */
+    bool addresses_assigned;       /* ip = auto namespaces have addresses */
+    arena_t arena;                 /* Owns the arrays and indexes above */
+    void *cache;                   /* Mapped compiled cache the arrays may
+                                      point into, or NULL */
+    size_t cache_size;             /* Size of the mapping */
 } config_t;
 
 /**
@@ -74,13 +138,63 @@ void free_config(config_t *config);
 void init_config(config_t *config);
 
 /**
- * Parse a firewall rule string (e.g., "private1 -> INTERNET")
+ * Look up a namespace by name
+ *
+ * @param config Pointer to a parsed config_t structure
+ * @param ns_name Name of the namespace
+ * @return The namespace defined last under that name, or NULL
+ */
+namespace_t *find_namespace_by_name(const config_t *config,
+                                    const char *ns_name);
+
+/**
+ * Look up a bridge by name
+ *
+ * @param config Pointer to a parsed config_t structure
+ * @param br_name Name of the bridge
+ * @return The bridge defined last under that name, or NULL
+ */
+bridge_t *find_bridge_by_name(const config_t *config, const char *br_name);
+
+/**
+ * Parse a firewall rule string (e.g., "private1 -> INTERNET"), resolving
+ * namespace names to their index in the configuration. Naming an instance
+ * of a namespace range expands the ranges.
  *
  * @param rule_str The rule string to parse
+ * @param config Configuration the referenced namespaces are defined in
  * @param rule Pointer to fw_rule_t structure to fill
+ * @return 0 on success, -1 on failure or for an undefined namespace
+ */
+int parse_fw_rule(const char *rule_str, config_t *config, fw_rule_t *rule);
+
+/**
+ * Turn the namespace ranges into namespaces, appended in range order. The
+ * network layer calls this before it needs the namespaces; ranges already
+ * expanded, for instance because a line named one of their instances, are
+ * left alone, so it is cheap to call again.
+ *
+ * @param config Pointer to config_t structure to expand
  * @return 0 on success, -1 on failure
  */
-int parse_fw_rule(const char *rule_str, fw_rule_t *rule);
+int config_expand(config_t *config);
+
+/**
+ * Give every ip = auto namespace an address, after expanding the ranges.
+ * Each bridge subnet and each subnet of an ip = <cidr> auto is a pool;
+ * written addresses and gateways are taken first, then namespaces get the
+ * free addresses in order. A namespace whose gateway is not set gets the
+ * address of its bridge or the first host address of its subnet. The pools
+ * are built anew on every call, so addresses of namespaces that previous
+ * has and config does not are free again.
+ *
+ * @param config Pointer to config_t structure to assign addresses in
+ * @param previous Configuration being replaced, whose namespaces keep their
+ *        addresses where they can, or NULL
+ * @return 0 on success, -1 when a pool runs out or a namespace has no
+ *         subnet to take an address from
+ */
+int config_assign_addresses(config_t *config, const config_t *previous);
 
 /**
  * Debug function to print the entire configuration
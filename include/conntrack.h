@@ -0,0 +1,222 @@
+/*
+ * conntrack.h
+ *
+ * Connection tracking and port translation for the userspace data plane.
+ * Each forwarding thread owns a table it alone writes; any thread can read.
+ */
+#ifndef _CONNTRACK_H
+#define _CONNTRACK_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define CT_BUCKET_SLOTS 7     // Entries per 64-byte bucket
+#define CT_SEARCH_NODES 256   // Buckets a cuckoo path search looks at
+#define CT_WHEEL_SLOTS 4096   // One-second slots of the expiry wheel
+#define CT_EXPIRE_TICKS 4     // Seconds ct_expire() processes per call
+#define CT_NAT_PORT_MIN 61000 // Translated ports, above the host's
+#define CT_NAT_PORT_MAX 65535 // default ip_local_port_range
+#define CT_NAT_TRIES 64       // Ports tried before a flow is refused
+#define CT_NAT_REFS (4 * (CT_NAT_PORT_MAX - CT_NAT_PORT_MIN + 1)) // Counters
+#define CT_NONE UINT32_MAX    // No flow, or the end of a list
+
+#define CT_DIR_ORIGINAL 0 // Packet goes the way the flow started
+#define CT_DIR_REPLY 1    // Packet answers it
+
+#define CT_REPLIED 0x1 // A packet went the reply direction
+#define CT_CLOSING 0x2 // TCP FIN seen
+#define CT_RESET 0x4   // TCP RST seen
+#define CT_NAT 0x8     // Reply tuple is addressed to the NAT address
+
+/* Timeouts in seconds; TCP and UDP ones are the RFC 5382 and 4787 minima */
+#define CT_TIMEOUT_TCP_NEW 120          // Until the first reply
+#define CT_TIMEOUT_TCP_ESTABLISHED 7440 // Replied, not closing
+#define CT_TIMEOUT_TCP_CLOSING 120      // After a FIN
+#define CT_TIMEOUT_TCP_RESET 10         // After a RST
+#define CT_TIMEOUT_UDP_NEW 30           // Until the first reply
+#define CT_TIMEOUT_UDP_REPLIED 120      // Once replied
+#define CT_TIMEOUT_ICMP 30              // Echo requests and replies
+
+/*
+ * Identity of a packet. The fields are in network byte order, as copied
+ * from the headers; ICMP echo carries its identifier in both ports.
+ */
+typedef struct {
+    uint32_t src;   /* Source address */
+    uint32_t dst;   /* Destination address */
+    uint16_t sport; /* Source port or echo identifier */
+    uint16_t dport; /* Destination port or echo identifier */
+    uint8_t proto;  /* IPPROTO_TCP, IPPROTO_UDP or IPPROTO_ICMP */
+    uint8_t pad[3]; /* Zero, the tuple is hashed and compared whole */
+} ct_tuple_t;
+
+/* A connection, found under the tuples of both of its directions */
+typedef struct {
+    ct_tuple_t tuple[2]; /* As sent by the originator, as its reply
+                            arrives; they differ in the NAT address */
+    uint32_t expires;    /* Second the flow times out at */
+    uint32_t next;       /* Next flow in the wheel slot or free list */
+    uint32_t prev;       /* Previous flow in the wheel slot */
+    uint16_t slot;       /* Wheel slot the flow is linked into */
+    uint16_t state;      /* CT_* flags */
+} ct_flow_t;
+
+/*
+ * One cache line of the hash. An entry is a 16-bit signature of the tuple
+ * above flow << 1 | direction, so a lookup only touches the flows whose
+ * signature matches. seq is odd while the writer changes the bucket.
+ */
+typedef struct {
+    _Alignas(64) _Atomic(uint64_t) seq;
+    _Atomic(uint64_t) slots[CT_BUCKET_SLOTS]; /* 0 when empty */
+} ct_bucket_t;
+
+/*
+ * Every tuple can live in two buckets, picked by its hash and by its hash
+ * mixed with the signature, so the other bucket of an entry follows from
+ * its bucket and signature alone. When both are full, entries are moved
+ * to their other buckets along the shortest path that frees a slot.
+ * Readers take no lock: they retry when a bucket changed under them, and
+ * after a miss that overlapped moves, which may have carried the entry
+ * past them. Expiry is a wheel of one-second slots that only visits the
+ * flows due in the second it processes.
+ */
+typedef struct {
+    ct_bucket_t *buckets; /* bucket_mask + 1 buckets */
+    uint32_t bucket_mask; /* Number of buckets - 1, a power of two */
+    atomic_uint moving;   /* Odd while entries move between buckets */
+    ct_flow_t *flows;     /* capacity flows, mapped lazily */
+    uint32_t capacity;    /* Most flows at once */
+    uint32_t count;       /* Flows in use */
+    uint32_t used;        /* Flows ever handed out; the rest are untouched */
+    uint32_t free_list;   /* First released flow, or CT_NONE */
+    uint32_t *wheel;      /* First flow of each slot, or CT_NONE */
+    uint32_t tick;        /* Next second the wheel processes */
+    uint32_t nat_addr;    /* Address flows are translated to, network
+                             byte order, 0 if there is none */
+    uint16_t port_lo;     /* First port of this table's NAT range */
+    uint16_t port_hi;     /* Last port of the range */
+    uint16_t port_next;   /* Where the search for a free port goes on */
+    _Atomic(uint64_t) *nat_refs; /* Translated flows per port and
+                                    protocol, see ct_nat_refs(), or NULL */
+} ct_table_t;
+
+/**
+ * Create an empty table
+ *
+ * @param ct Table to initialize
+ * @param capacity Most flows the table holds at once
+ * @param now Current second, see ct_now()
+ * @return 0 on success, -1 on failure
+ */
+int ct_init(ct_table_t *ct, uint32_t capacity, uint32_t now);
+
+/**
+ * Free a table
+ *
+ * @param ct The table
+ */
+void ct_free(ct_table_t *ct);
+
+/**
+ * Set the address and the ports flows leaving through NAT are given.
+ * Tables running side by side need disjoint ranges.
+ *
+ * @param ct The table
+ * @param addr NAT address, network byte order
+ * @param lo First port, host byte order
+ * @param hi Last port, host byte order
+ */
+void ct_nat_range(ct_table_t *ct, uint32_t addr, uint16_t lo, uint16_t hi);
+
+/**
+ * Count the translated flows of every NAT port in refs, for whoever needs
+ * to know which ports are in use without looking at the flows: counter
+ * (port - CT_NAT_PORT_MIN) * 4 + n is for TCP, UDP and ICMP with n = 0, 1
+ * and 2. Flows already in the table are added to the counters. Tables may
+ * share the counters.
+ *
+ * @param ct The table
+ * @param refs CT_NAT_REFS counters, or NULL to stop counting
+ */
+void ct_nat_refs(ct_table_t *ct, _Atomic(uint64_t) *refs);
+
+/**
+ * Current second of a clock that never jumps
+ *
+ * @return Seconds since boot
+ */
+uint32_t ct_now(void);
+
+/**
+ * Find the flow a packet belongs to. Safe from any thread while the
+ * owner changes the table.
+ *
+ * @param ct The table
+ * @param tuple The packet
+ * @return flow << 1 | CT_DIR_*, or CT_NONE if the packet starts nothing
+ *         known
+ */
+uint32_t ct_lookup(const ct_table_t *ct, const ct_tuple_t *tuple);
+
+/**
+ * Pick a NAT port for a new flow: the reply tuple's destination port is
+ * kept if it is in range and free, otherwise the next free one is taken.
+ * Only the owner may call it.
+ *
+ * @param ct The table
+ * @param reply Reply tuple with the NAT address as destination and the
+ *              original source port; its port is replaced
+ * @return 0 on success, -1 if no port was found
+ */
+int ct_nat_port(ct_table_t *ct, ct_tuple_t *reply);
+
+/**
+ * Add a flow. Only the owner may call it, and neither tuple may be in the
+ * table already.
+ *
+ * @param ct The table
+ * @param original Tuple of the packet that starts the flow
+ * @param reply Tuple its replies will have
+ * @param state CT_NAT or 0
+ * @param now Current second
+ * @return The flow, or CT_NONE when the table is full
+ */
+uint32_t ct_insert(ct_table_t *ct, const ct_tuple_t *original,
+                   const ct_tuple_t *reply, uint16_t state, uint32_t now);
+
+/**
+ * Account a packet to its flow: note replies, follow TCP to its close and
+ * move the expiry accordingly. Only the owner may call it.
+ *
+ * @param ct The table
+ * @param flow The flow
+ * @param dir CT_DIR_* of the packet
+ * @param tcp_flags Flags byte of the TCP header, 0 for other protocols
+ * @param now Current second
+ */
+void ct_update(ct_table_t *ct, uint32_t flow, int dir, uint8_t tcp_flags,
+               uint32_t now);
+
+/**
+ * Remove the flows that timed out. Each call advances the wheel by at
+ * most CT_EXPIRE_TICKS seconds, so a late call does not stall the owner.
+ *
+ * @param ct The table
+ * @param now Current second
+ * @return Number of flows removed
+ */
+uint32_t ct_expire(ct_table_t *ct, uint32_t now);
+
+/**
+ * Flow of a reference returned by ct_lookup()
+ *
+ * @param ct The table
+ * @param ref The reference
+ * @return The flow
+ */
+static inline ct_flow_t *ct_flow(const ct_table_t *ct, uint32_t ref) {
+    return &ct->flows[ref >> 1];
+}
+
+#endif /* _CONNTRACK_H */
@@ -0,0 +1,27 @@
+/*
+ * daemon.h
+ *
+ * Resident router that re-applies the topology whenever its file changes
+ */
+#ifndef _DAEMON_H
+#define _DAEMON_H
+
+#include "config.h"
+
+#define DAEMON_DEBOUNCE_MS 200 // Quiet time after the last write to the file
+
+/**
+ * Apply a configuration, then watch its file and re-apply on every change
+ *
+ * Edits are debounced so that an editor saving in several steps causes a
+ * single apply. A file that fails to parse is reported and the running
+ * topology is left alone. SIGHUP forces a reload, SIGINT and SIGTERM stop
+ * the daemon without tearing the topology down.
+ *
+ * @param filename Path to the configuration file
+ * @param config Configuration parsed from filename, owned by the daemon
+ * @return 0 on a clean shutdown, -1 on failure
+ */
+int run_daemon(const char *filename, config_t *config);
+
+#endif /* _DAEMON_H */
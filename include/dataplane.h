@@ -0,0 +1,236 @@
+/*
+ * dataplane.h
+ *
+ * Userspace forwarding between namespaces over AF_XDP sockets
+ */
+#ifndef _DATAPLANE_H
+#define _DATAPLANE_H
+
+#include "arena.h"
+#include "config.h"
+#include "conntrack.h"
+#include "lpm.h"
+#include "pktpool.h"
+#include "rcu.h"
+#include "rss.h"
+#include "spsc.h"
+#include "xdp.h"
+
+#include <linux/if_ether.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DATAPLANE_BATCH 64              // Frames a port handles per round
+#define DATAPLANE_IDLE_MS 100           // Poll timeout once nothing moves
+#define DATAPLANE_MAX_FRAMES (1u << 17) // UMEM frames, 256 MB
+#define DATAPLANE_RESOLVE_TRIES 20      // Looks for the gateway's address
+#define DATAPLANE_RESOLVE_MS 50         // Wait between two of them
+#define DATAPLANE_RING_SIZE 1024        // Frames between two workers
+
+#define DP_HOP_KERNEL 1                 // Route to something the kernel has
+#define DP_HOP_PORT(port) ((port) + 2u) // Route to a port
+
+/*
+ * The host end of a namespace's veth pair, or the uplink when the data
+ * plane masquerades; one AF_XDP socket per queue
+ */
+typedef struct {
+    char ifname[IF_NAMESIZE];   /* Host end of the veth pair */
+    const char *ns_name;        /* Namespace behind it, NULL for the
+                                   uplink */
+    int ifindex;                /* Index of ifname, 0 until started */
+    uint32_t network;           /* Subnet of the link, host byte order */
+    uint32_t hostmask;          /* Host bits of the subnet */
+    uint32_t gateway;           /* Host address on the link, host order */
+    uint8_t host_mac[ETH_ALEN]; /* Address of ifname */
+    _Atomic(uint64_t) peer;     /* Address of the namespace end, or of the
+                                   uplink's gateway, in its first
+                                   ETH_ALEN bytes; 0 while unknown. Any
+                                   worker may learn it. */
+    bool nat;                   /* Traffic to the uplink is masqueraded */
+    bool csum_off;              /* Checksum offload of the namespace end
+                                   was turned off */
+    uint32_t xdp_flags;         /* Mode the program is attached in, 0 if
+                                   it is not attached */
+    int prog_fd;                /* Steering program, -1 if not loaded */
+    uint32_t max_queues;        /* Queues the device was created with */
+    uint32_t queues;            /* Queues with a socket, 0 until started */
+    int first_queue;            /* Socket of queue 0 in dataplane_t.queues,
+                                   the rest follow */
+} dp_port_t;
+
+/* One queue of a port, with its socket. Only one worker touches it. */
+typedef struct {
+    int port;             /* Port of the queue */
+    uint32_t id;          /* Queue of the device */
+    xsk_t xsk;            /* Socket on the queue */
+    uint32_t fill_target; /* Frames kept in the fill ring */
+    bool tx_pending;      /* Frames reserved on tx, not submitted */
+} dp_queue_t;
+
+/*
+ * What the forwarding threads consult per frame. A reload builds a new one
+ * and swaps it in whole while the threads keep running, see rcu.h.
+ */
+typedef struct {
+    lpm_table_t routes;   /* Port subnets, bridge subnets, NAT prefixes and
+                             host addresses, to DP_HOP_* */
+    uint32_t default_hop; /* Hop of addresses without a route */
+    uint64_t *allowed;    /* Sorted in << 32 | out port pairs */
+    int allowed_count;    /* Number of allowed pairs */
+    bool allow_all;       /* Forward policy accepts everything */
+    bool track;           /* Packets are looked up in the flow tables */
+} dp_fib_t;
+
+typedef struct dataplane dataplane_t;
+
+/*
+ * A forwarding thread. Worker w receives on queue q of every port with
+ * q % workers == w and transmits on queue w, so each socket ring has a
+ * single user. A flow belongs to one worker, which alone tracks and
+ * translates it: frames received by another one are handed over on a
+ * ring. Frames come from a pool shared by all workers, through a cache
+ * of each.
+ */
+typedef struct {
+    _Alignas(64) int index;  /* Position in dataplane_t.workers */
+    dataplane_t *dp;         /* Data plane it belongs to */
+    ct_table_t ct;           /* Flows it owns */
+    uint32_t now;            /* Second it last read the clock */
+    int *rx;                 /* Queues it receives on, in dp->queues */
+    int rx_count;            /* Number of them */
+    pktpool_cache_t cache;   /* Unused frames at hand */
+    spsc_frame_t *outbox;    /* DATAPLANE_BATCH frames per worker, not
+                                yet on the ring to it */
+    uint32_t *outbox_count;  /* Frames staged per worker */
+    int reader;              /* rcu slot of the thread, -1 before */
+    int wake_fd;             /* eventfd that interrupts it when idle */
+    atomic_bool idle;        /* Polling; whoever hands it frames wakes it */
+    pthread_t thread;        /* The thread */
+    bool running;            /* thread was started */
+    uint64_t forwarded;      /* Frames it transmitted */
+    uint64_t dropped;        /* Frames it received and did not forward */
+    uint64_t handed_off;     /* Frames it passed to their flow's owner */
+} dp_worker_t;
+
+/*
+ * Forwarding state. Only veth-connected namespaces get a port: namespaces
+ * behind a bridge and the host itself stay with the kernel, and so does
+ * every frame that is not IPv4 unicast between two ports. The uplink gets
+ * a port when namespaces with one are masqueraded; then their TCP, UDP and
+ * ping to addresses the host has no specific route for are translated
+ * here, and only the replies come back through the uplink's sockets.
+ */
+struct dataplane {
+    arena_t arena;           /* Owns ports, names and prefixes */
+    dp_port_t *ports;        /* One per veth-connected namespace, then the
+                                uplink */
+    int port_count;          /* Number of ports */
+    int uplink;              /* Port of the uplink, or -1 */
+    lpm_prefix_t *prefixes;  /* Routes of the configuration */
+    int prefix_count;        /* Number of routes */
+    _Atomic(dp_fib_t *) fib; /* Current routes and policy */
+    rcu_t rcu;               /* Lets fib be replaced under the threads */
+    dp_worker_t *workers;    /* Forwarding threads, as configured */
+    int worker_count;        /* Number of workers */
+    int active;              /* Workers that run: at most one per queue
+                                of the port with the fewest */
+    rss_t rss;               /* Picks the worker of a flow */
+    uint32_t nat_span;       /* NAT ports of each worker */
+    spsc_ring_t *rings;      /* From worker i to j at i * active + j */
+    dp_queue_t *queues;      /* Queues of every port */
+    int queue_count;         /* Number of queues */
+    int queue_cap;           /* Queues allocated */
+    xdp_filter_t filter;     /* Maps of the steering programs */
+    pktpool_t pool;          /* Frames, and those no worker holds */
+    xdp_umem_t umem;         /* The pool's region, shared by all sockets */
+    bool running;            /* Workers were started */
+    atomic_bool stop;        /* Set to end the forwarding threads */
+};
+
+/**
+ * Initialize an empty data plane
+ *
+ * @param dp Data plane to initialize
+ */
+void dataplane_init(dataplane_t *dp);
+
+/**
+ * Compute ports, routes and the forward policy from a configuration. The
+ * data plane keeps no reference to it.
+ *
+ * @param dp Empty data plane
+ * @param config Validated configuration with its addresses assigned
+ * @return 0 on success, -1 on failure
+ */
+int dataplane_build(dataplane_t *dp, const config_t *config);
+
+/**
+ * Replace the routes and the policy with those of a new configuration,
+ * without stopping. Only works while the configuration has the same ports
+ * and workers.
+ *
+ * @param dp Built data plane, started or not
+ * @param config Validated configuration with its addresses assigned
+ * @return 0 on success, -1 if the ports differ or on failure
+ */
+int dataplane_update(dataplane_t *dp, const config_t *config);
+
+/**
+ * Pick the worker that handles a frame received on a port: the one whose
+ * NAT ports hold the destination port of a reply on the uplink, otherwise
+ * the one the symmetric Toeplitz hash of the flow picks, so that both
+ * directions of a flow meet on the same worker
+ *
+ * @param dp Built data plane
+ * @param in_port Port the frame arrived on
+ * @param frame The frame, starting with its Ethernet header
+ * @param len Length of the frame
+ * @return The worker, or -1 if the frame has no flow and any worker will do
+ */
+int dataplane_owner(const dataplane_t *dp, int in_port, const uint8_t *frame,
+                    uint32_t len);
+
+/**
+ * Decide where a frame received on a port goes and rewrite it for that
+ * port: new Ethernet addresses, TTL decremented, checksum updated.
+ *
+ * @param dp Built data plane
+ * @param worker Worker whose flows the frame is checked against, see
+ *               dataplane_owner()
+ * @param in_port Port the frame arrived on
+ * @param frame The frame, starting with its Ethernet header
+ * @param len Length of the frame
+ * @return Port to transmit on, or -1 to drop the frame
+ */
+int dataplane_route(dataplane_t *dp, int worker, int in_port, uint8_t *frame,
+                    uint32_t len);
+
+/**
+ * Attach the steering programs and sockets to the ports, which must exist,
+ * and start forwarding on the workers, each pinned to a CPU of its own
+ * where there are enough
+ *
+ * @param dp Built data plane
+ * @return 0 on success, -1 on failure with nothing left attached
+ */
+int dataplane_start(dataplane_t *dp);
+
+/**
+ * Stop forwarding and hand the ports back to the kernel
+ *
+ * @param dp Data plane, started or not
+ */
+void dataplane_stop(dataplane_t *dp);
+
+/**
+ * Stop forwarding and free everything, leaving an empty data plane
+ *
+ * @param dp Data plane to free
+ */
+void dataplane_free(dataplane_t *dp);
+
+#endif /* _DATAPLANE_H */
@@ -20,11 +20,9 @@ typedef enum {
 /* Firewall rule structure */
 typedef struct {
     endpoint_t src_type; /* Source endpoint type */
-    char
-        src_name[MAX_NAME_LEN]; /* Source name (namespace name or "INTERNET") */
-    endpoint_t dst_type;        /* Destination endpoint type */
-    char dst_name[MAX_NAME_LEN]; /* Destination name (namespace name or
-                                    "INTERNET") */
+    int src_ns;          /* Source namespace index, for ENDPOINT_NS */
+    endpoint_t dst_type; /* Destination endpoint type */
+    int dst_ns;          /* Destination namespace index, for ENDPOINT_NS */
     fw_action_t
         action; /* Action to take on matching traffic (default: FW_ALLOW) */
 } fw_rule_t;
@@ -0,0 +1,74 @@
+/*
+ * ipam.h
+ *
+ * Address pools that hand out the host addresses of a subnet
+ */
+#ifndef _IPAM_H
+#define _IPAM_H
+
+#include "arena.h"
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define IPAM_MIN_MASK 8 // Largest pool is a /8, 2 MB of bitmap
+
+/*
+ * A subnet as a two-level bitmap: one bit per address, and one bit per
+ * 64-bit word of those that is set once the word is full. Finding a free
+ * address scans the summary for a word with room, then that word.
+ */
+typedef struct {
+    uint32_t network; /* First address, host byte order */
+    uint8_t mask;     /* Prefix length of the subnet */
+    uint32_t size;    /* Number of addresses, including unusable ones */
+    uint32_t used;    /* Addresses taken */
+    uint32_t cursor;  /* Summary word the last allocation came from */
+    uint64_t *bits;   /* One bit per address, set when taken */
+    uint64_t *full;   /* One bit per word of bits, set when it is full */
+} ipam_pool_t;
+
+/**
+ * Set up a pool for a subnet. The network and broadcast addresses are
+ * taken, except in /31 and /32 subnets, which have neither.
+ *
+ * @param pool Pool to initialize
+ * @param arena Arena the bitmaps are allocated from
+ * @param network Any address of the subnet
+ * @param mask Prefix length, from IPAM_MIN_MASK to 32
+ * @return 0 on success, -1 for a bad mask or when out of memory
+ */
+int ipam_init(ipam_pool_t *pool, arena_t *arena, struct in_addr network,
+              uint8_t mask);
+
+/**
+ * Check whether an address belongs to the subnet of a pool
+ *
+ * @param pool The pool
+ * @param addr The address
+ * @return true if addr is in the subnet
+ */
+bool ipam_contains(const ipam_pool_t *pool, struct in_addr addr);
+
+/**
+ * Take a given address, e.g. one written in the configuration
+ *
+ * @param pool The pool
+ * @param addr The address
+ * @return 0 on success, -1 if it is outside the subnet or already taken
+ */
+int ipam_reserve(ipam_pool_t *pool, struct in_addr addr);
+
+/**
+ * Take a free address. The scan resumes where the previous allocation
+ * found room, so handing out a whole subnet costs O(1) per address; a
+ * fresh pool hands its addresses out in ascending order.
+ *
+ * @param pool The pool
+ * @param addr Pointer to store the address in
+ * @return 0 on success, -1 when the pool is exhausted
+ */
+int ipam_alloc(ipam_pool_t *pool, struct in_addr *addr);
+
+#endif /* _IPAM_H */
@@ -0,0 +1,86 @@
+/*
+ * lpm.h
+ *
+ * Longest-prefix-match table for IPv4 routes, in DIR-24-8 layout
+ */
+#ifndef _LPM_H
+#define _LPM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LPM_TBL24_ENTRIES (1u << 24) // One per /24, 64 MB mapped lazily
+#define LPM_TBL8_ENTRIES 256         // One per address of an extended /24
+#define LPM_EXTENDED (1u << 31)      // tbl24 entry points at a tbl8 chunk
+#define LPM_BATCH 32                 // Lookups lpm_lookup_batch() overlaps
+
+/* A route; the hop is whatever the caller wants back, 0 is no route */
+typedef struct {
+    uint32_t network; /* Any address of the prefix, host byte order */
+    uint8_t mask;     /* Prefix length, 0 to 32 */
+    uint32_t hop;     /* Next hop, 1 to LPM_EXTENDED - 1 */
+} lpm_prefix_t;
+
+/*
+ * tbl24 holds the hop of every /24 directly, so a lookup is one memory
+ * access unless a prefix longer than /24 splits that /24. Then its entry
+ * is LPM_EXTENDED | chunk and the hop is in tbl8 at chunk * 256 + the
+ * last byte of the address. tbl24 is anonymous memory: pages no route
+ * covers are never touched and read as 0, no route.
+ */
+typedef struct {
+    uint32_t *tbl24;     /* LPM_TBL24_ENTRIES entries */
+    uint32_t *tbl8;      /* tbl8_count chunks of LPM_TBL8_ENTRIES */
+    uint32_t tbl8_count; /* Chunks in use */
+    uint32_t tbl8_cap;   /* Chunks allocated */
+} lpm_table_t;
+
+/**
+ * Build a table from a set of routes. Where two routes have the same
+ * prefix, the later one in the array wins.
+ *
+ * @param table Table to initialize
+ * @param prefixes The routes
+ * @param count Number of routes
+ * @return 0 on success, -1 on a bad route or when out of memory
+ */
+int lpm_build(lpm_table_t *table, const lpm_prefix_t *prefixes, size_t count);
+
+/**
+ * Free a table
+ *
+ * @param table The table
+ */
+void lpm_free(lpm_table_t *table);
+
+/**
+ * Look up the route of an address
+ *
+ * @param table The table
+ * @param addr The address, host byte order
+ * @return Hop of the longest prefix holding addr, or 0 if there is none
+ */
+static inline uint32_t lpm_lookup(const lpm_table_t *table, uint32_t addr) {
+    uint32_t entry = table->tbl24[addr >> 8];
+    if (entry & LPM_EXTENDED) {
+        entry = table->tbl8[(entry & ~LPM_EXTENDED) * LPM_TBL8_ENTRIES +
+                            (addr & 0xff)];
+    }
+    return entry;
+}
+
+/**
+ * Look up many addresses at once. Each group of LPM_BATCH reads all its
+ * tbl24 entries, prefetching the tbl8 entries they point to, before it
+ * reads any of those, so the cache misses of a group overlap instead of
+ * adding up.
+ *
+ * @param table The table
+ * @param addrs Addresses, host byte order
+ * @param hops Where to store the hop of each address
+ * @param count Number of addresses
+ */
+void lpm_lookup_batch(const lpm_table_t *table, const uint32_t *addrs,
+                      uint32_t *hops, size_t count);
+
+#endif /* _LPM_H */
@@ -6,9 +6,9 @@
 
 /* Bridge configuration */
 typedef struct {
-    char name[MAX_NAME_LEN]; /* Name of the bridge */
-    struct in_addr ip_addr;  /* IP address for the bridge interface */
-    u_int8_t mask;           /* CIDR notation subnet mask */
+    const char *name;       /* Name of the bridge, interned by the config */
+    struct in_addr ip_addr; /* IP address for the bridge interface */
+    u_int8_t mask;          /* CIDR notation subnet mask */
 } bridge_t;
 
 #endif // !_NET_DEV_H
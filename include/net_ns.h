@@ -4,6 +4,7 @@
 #include "constants.h"
 
 #include <netdb.h>
+#include <stdbool.h>
 
 /* Connection type for network namespaces */
 typedef enum {
@@ -13,13 +14,16 @@ typedef enum {
 
 /* Network namespace configuration */
 typedef struct {
-    char name[MAX_NAME_LEN]; /* Name of the namespace */
-    struct in_addr ip_addr;  /* IP address of the namespace interface */
-    u_int8_t mask;           /* CIDR notation subnet mask (e.g., 24 for /24) */
-    struct in_addr gateway;  /* Default gateway IP for the namespace */
-    connect_t connect_type;  /* How this namespace connects to the host (bridge
-                                or veth) */
-    char connect_name[MAX_NAME_LEN]; /* Name of bridge or veth pair to use */
+    const char *name;       /* Name of the namespace, interned by the config */
+    struct in_addr ip_addr; /* IP address of the namespace interface */
+    u_int8_t mask;          /* CIDR notation subnet mask (e.g., 24 for /24) */
+    bool auto_ip;           /* ip_addr is handed out from a pool, see
+                               config_assign_addresses() */
+    struct in_addr gateway; /* Default gateway IP for the namespace */
+    connect_t connect_type; /* How this namespace connects to the host (bridge
+                               or veth) */
+    const char *connect_name; /* Name of bridge or veth pair to use, interned
+                                 by the config */
 } namespace_t;
 
 #endif // !_NET_NS_H
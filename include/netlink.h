@@ -0,0 +1,126 @@
+/*
+ * netlink.h
+ *
+ * Pipelined rtnetlink transport shared by the network setup code
+ */
+#ifndef _NETLINK_H
+#define _NETLINK_H
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define NL_MSG_MAX 512         // Upper bound on a single request
+#define NL_WINDOW_DEFAULT 1024 // Requests in flight on a host socket
+
+/* An in-flight request, kept until the kernel ACKs it */
+typedef struct {
+    const char *label; /* Object name used in error messages */
+    int ignore_errno;  /* Error treated as success (0 = none) */
+    int *result;       /* Where to store the errno on failure, may be NULL */
+    int close_fd;      /* Descriptor to close once ACKed (-1 = none) */
+    uint32_t seq;      /* Sequence number occupying this slot */
+    int pending;       /* Queued or sent, ACK not yet received */
+    int resent;        /* Sent again after the kernel dropped ACKs */
+    uint64_t begin;    /* trace_begin() when it was started, 0 untraced */
+    _Alignas(NLMSG_ALIGNTO) char msg[NL_MSG_MAX]; /* Encoded request */
+} nl_req_t;
+
+/*
+ * A NETLINK_ROUTE socket with a window of in-flight requests.
+ *
+ * Requests are keyed by nlmsg_seq: the slot of a request is its sequence
+ * number modulo the window size. Requests in [acked, sent) are waiting for
+ * their ACK, requests in [sent, next) are built but not yet transmitted.
+ */
+typedef struct {
+    int fd;            /* NETLINK_ROUTE socket */
+    uint32_t window;   /* Number of request slots */
+    nl_req_t *reqs;    /* Request slots */
+    uint32_t acked;    /* Oldest request without an ACK */
+    uint32_t sent;     /* Oldest request not yet transmitted */
+    uint32_t next;     /* Sequence number of the next request */
+    int rcvbuf;        /* Current receive buffer size */
+    int failed;        /* Requests that failed since the last nl_sync() */
+} nl_sock_t;
+
+/**
+ * Open a NETLINK_ROUTE socket in the caller's network namespace
+ *
+ * @param nl Socket to initialize
+ * @param window Maximum number of requests in flight
+ * @return 0 on success, -1 on failure
+ */
+int nl_open(nl_sock_t *nl, uint32_t window);
+
+/**
+ * Wait for all outstanding requests and close the socket
+ *
+ * @param nl Socket to close
+ */
+void nl_close(nl_sock_t *nl);
+
+/**
+ * Start a new request. Blocks on ACKs if the window is full.
+ *
+ * @param nl Socket the request goes out on
+ * @param type Message type (RTM_NEWLINK, ...)
+ * @param flags Extra NLM_F_* flags, NLM_F_REQUEST | NLM_F_ACK are implied
+ * @param label Object name for error messages, must outlive the request
+ * @return The message header to fill in, or NULL on failure
+ */
+struct nlmsghdr *nl_msg_begin(nl_sock_t *nl, uint16_t type, uint16_t flags,
+                              const char *label);
+
+/**
+ * Get the bookkeeping of the request being built, to set its options
+ *
+ * @param nl Socket the request was started on
+ * @return The request slot
+ */
+nl_req_t *nl_msg_req(nl_sock_t *nl);
+
+/**
+ * Queue the request started with nl_msg_begin() for transmission
+ *
+ * @param nl Socket the request was started on
+ */
+void nl_msg_end(nl_sock_t *nl);
+
+/**
+ * Transmit all queued requests and wait for every ACK
+ *
+ * @param nl Socket to synchronize
+ * @return 0 if all requests since the last sync succeeded, -1 otherwise
+ */
+int nl_sync(nl_sock_t *nl);
+
+/* Called for every object of a dump; non-zero marks the dump as failed */
+typedef int (*nl_dump_cb)(const struct nlmsghdr *nlh, void *arg);
+
+/**
+ * Dump a table of kernel objects. No requests may be outstanding.
+ *
+ * @param nl Socket to dump on
+ * @param type Dump request type (RTM_GETLINK, RTM_GETADDR, RTM_GETROUTE)
+ * @param family Address family to dump, AF_UNSPEC for all
+ * @param cb Callback invoked for every object
+ * @param arg Passed to the callback
+ * @return 0 on success, -1 on failure
+ */
+int nl_dump(nl_sock_t *nl, uint16_t type, uint8_t family, nl_dump_cb cb,
+            void *arg);
+
+/* Message building helpers */
+void *nl_put(struct nlmsghdr *nlh, size_t len);
+void nl_attr(struct nlmsghdr *nlh, uint16_t type, const void *data,
+             size_t len);
+void nl_attr_str(struct nlmsghdr *nlh, uint16_t type, const char *str);
+void nl_attr_u32(struct nlmsghdr *nlh, uint16_t type, uint32_t value);
+struct rtattr *nl_nest_begin(struct nlmsghdr *nlh, uint16_t type);
+void nl_nest_end(struct nlmsghdr *nlh, struct rtattr *nest);
+struct ifinfomsg *nl_put_ifinfo(struct nlmsghdr *nlh, int index,
+                                unsigned flags, unsigned change);
+
+#endif /* _NETLINK_H */
@@ -7,6 +7,11 @@
 #define _NETWORK_H
 
 #include "config.h"
+#include "netlink.h"
+
+#include <sys/types.h>
+
+#define VETH_NS_IF_NAME "eth0" // Name of the veth end inside a namespace
 
 /**
  * Initialize the network environment based on configuration
@@ -16,6 +21,91 @@
  */
 int network_up(config_t *config);
 
+/**
+ * Apply a configuration to a running system, changing only what differs
+ *
+ * The live namespaces, links, addresses, routes and nftables table are
+ * compared with the configuration. Missing or wrong objects are created or
+ * fixed, and objects a previous --up or --apply created that are no longer
+ * configured are removed.
+ *
+ * @param config Pointer to a parsed config_t structure
+ * @return 0 on success, -1 on failure
+ */
+int network_apply(config_t *config);
+
+/* A socket bound to a namespace, kept open between applies */
+typedef struct {
+    char name[MAX_NAME_LEN]; /* Namespace the socket is bound to */
+    ino_t ino;               /* Inode of that namespace */
+    nl_sock_t nl;            /* The socket */
+} ns_sock_t;
+
+/*
+ * Sockets a resident router keeps open between applies, so an apply only
+ * pays for dumps and changes, not for entering every namespace again.
+ */
+typedef struct {
+    nl_sock_t host;     /* Socket in the host namespace */
+    ns_sock_t *ns;      /* Namespace sockets, sorted by name */
+    int ns_count;       /* Number of namespace sockets */
+} apply_session_t;
+
+/**
+ * Open the sockets of an apply session
+ *
+ * @param session Session to initialize
+ * @return 0 on success, -1 on failure
+ */
+int apply_session_open(apply_session_t *session);
+
+/**
+ * Apply a configuration like network_apply(), reusing the session's sockets
+ *
+ * @param session An open session
+ * @param config Pointer to a parsed config_t structure
+ * @return 0 on success, -1 on failure
+ */
+int apply_session_run(apply_session_t *session, config_t *config);
+
+/**
+ * Close all sockets of an apply session
+ *
+ * @param session Session to close
+ */
+void apply_session_close(apply_session_t *session);
+
+/**
+ * Record the namespaces, bridges and ruleset a configuration installed,
+ * so a later network_apply() knows what it may remove
+ *
+ * @param config Pointer to the config_t structure that was applied
+ * @return 0 on success, -1 on failure
+ */
+int save_manifest(const config_t *config);
+
+/**
+ * Forget the objects recorded by save_manifest()
+ */
+void remove_manifest(void);
+
+/**
+ * Load the addresses save_manifest() recorded for ip = auto namespaces, to
+ * pass as the previous configuration to config_assign_addresses()
+ *
+ * @param previous Pointer to an initialized config_t structure that gets a
+ *        namespace for each recorded address
+ * @return 0 on success, also when nothing was recorded, -1 on failure
+ */
+int load_manifest(config_t *previous);
+
+/**
+ * Read the current IPv4 forwarding setting
+ *
+ * @return 1 if enabled, 0 if disabled, -1 on failure
+ */
+int ipv4_forwarding_enabled(void);
+
 /**
  * Setup IPv4 forwarding based on configuration
  *
@@ -25,64 +115,212 @@ int network_up(config_t *config);
 int setup_ipv4_forwarding(bool enable);
 
 /**
- * Create all namespaces defined in configuration
+ * Get the name of the host end of a namespace's veth pair
  *
- * @param namespaces Array of namespace_t structures
- * @param count Number of namespaces to create
- * @return 0 on success, -1 on failure
+ * @param ns The namespace
+ * @param ifname Buffer of at least IFNAMSIZ bytes to store the name
  */
-int create_namespaces(namespace_t *namespaces, int count);
+void veth_host_ifname(const namespace_t *ns, char *ifname);
 
 /**
- * Remove all namespaces created
+ * Get the name of the bridge a namespace connects through
  *
- * @param namespaces Array of namespace_t structures
- * @param count Number of namespaces to remove
- * @return 0 on success, -1 on failure
+ * @param ns The namespace
+ * @return Bridge name, or NULL if the namespace is connected via veth
+ */
+const char *ns_bridge_name(const namespace_t *ns);
+
+/*
+ * Per-object operations. Each queues its requests on a netlink socket and
+ * stores the errno of a failed request in *result (which may be NULL), so a
+ * caller can batch many objects and sync once.
+ */
+
+/**
+ * Create one namespace on the calling thread and return to home_fd
+ *
+ * @param ns The namespace to create
+ * @param home_fd Descriptor of the network namespace to return to
+ * @return 0 on success, an errno value on failure (EEXIST if it exists)
  */
-int remove_namespaces(namespace_t *namespaces, int count);
+int create_namespace(const namespace_t *ns, int home_fd);
 
 /**
- * Create all bridges defined in configuration
+ * Check whether a namespace exists and is pinned
  *
- * @param bridges Array of bridge_t structures
- * @param count Number of bridges to create
+ * @param ns_name Name of the namespace
+ * @param ino Where to store the namespace's inode, may be NULL
+ * @return true if it exists
+ */
+bool namespace_exists(const char *ns_name, ino_t *ino);
+
+/**
+ * Remove one namespace
+ *
+ * @param ns_name Name of the namespace
  * @return 0 on success, -1 on failure
  */
-int create_bridges(bridge_t *bridges, int count);
+int remove_namespace(const char *ns_name);
 
 /**
- * Connect namespaces to bridges or directly to host
+ * Queue removal of an IPv4 address; a missing address is not an error
  *
- * @param namespaces Array of namespace_t structures
- * @param count Number of namespaces to connect
- * @param bridges Array of bridge_t structures
- * @param bridge_count Number of bridges available
+ * @param index Interface index the address is on
+ * @return 0 if queued, -1 on failure
+ */
+int queue_address_delete(nl_sock_t *nl, int index, struct in_addr addr,
+                         u_int8_t mask, const char *label, int *result);
+
+/**
+ * Queue bringing a link up
+ *
+ * @param index Interface index of the link
+ * @return 0 if queued, -1 on failure
+ */
+int queue_link_up(nl_sock_t *nl, int index, const char *label, int *result);
+
+/**
+ * Queue creation of a bridge link
+ *
+ * @return 0 if queued, -1 on failure
+ */
+int queue_bridge(nl_sock_t *nl, const bridge_t *br, int *result);
+
+/**
+ * Queue the address of a bridge once its link exists
+ *
+ * @param index Interface index of the bridge
+ * @return 0 if queued (or nothing to do), -1 on failure
+ */
+int queue_bridge_address(nl_sock_t *nl, const bridge_t *br, int index,
+                         int *result);
+
+/**
+ * Queue creation of a namespace's veth pair, peer inside the namespace
+ *
+ * @param master Interface index of the bridge to enslave to, 0 for none
+ * @param queues Receive and transmit queues of each end, fixed for the
+ *               life of the pair
+ * @return 0 if queued, -1 on failure
+ */
+int queue_veth(nl_sock_t *nl, const namespace_t *ns, int master,
+               uint32_t queues, int *result);
+
+/**
+ * Queue enslaving the host end of a namespace's veth pair to a bridge
+ *
+ * @param master Interface index of the bridge
+ * @return 0 if queued, -1 on failure
+ */
+int queue_enslave(nl_sock_t *nl, const namespace_t *ns, int master,
+                  int *result);
+
+/**
+ * Queue deletion of a host link; a missing link is not an error
+ *
+ * @return 0 if queued, -1 on failure
+ */
+int queue_link_delete(nl_sock_t *nl, const char *ifname, const char *label,
+                      int *result);
+
+/**
+ * Open a netlink socket bound to a namespace
+ *
+ * @param ns The namespace
+ * @param nl Socket to initialize
+ * @param eth_index Where to store the index of the namespace's veth end
  * @return 0 on success, -1 on failure
  */
-int connect_namespaces(namespace_t *namespaces, int count, bridge_t *bridges,
-                       int bridge_count);
+int open_ns_socket(const namespace_t *ns, nl_sock_t *nl, int *eth_index);
 
 /**
- * Setup network interfaces inside namespaces
+ * Turn transmit checksum offload of a namespace's veth end on or off. With
+ * it on, frames leave with the L4 checksum left for the receiver to fill
+ * in, which only the kernel's own forwarding path knows about.
  *
- * @param namespaces Array of namespace_t structures
- * @param count Number of namespaces to configure
+ * @param ns The namespace
+ * @param on Whether to offload
  * @return 0 on success, -1 on failure
  */
-int setup_namespace_networking(namespace_t *namespaces, int count);
+int set_ns_tx_checksum(const namespace_t *ns, bool on);
+
+/**
+ * Queue bringing up the links of a namespace and assigning its address
+ *
+ * @param nl Socket bound to the namespace
+ * @return 0 if queued, -1 on failure
+ */
+int queue_ns_address(nl_sock_t *nl, const namespace_t *ns, int eth_index,
+                     int *result);
+
+/**
+ * Queue the default route of a namespace
+ *
+ * @param nl Socket bound to the namespace
+ * @return 0 if queued (or nothing to do), -1 on failure
+ */
+int queue_ns_route(nl_sock_t *nl, const namespace_t *ns, int eth_index,
+                   int *result);
+
+/**
+ * Queue removal of the default route of a namespace
+ *
+ * @param nl Socket bound to the namespace
+ * @return 0 if queued, -1 on failure
+ */
+int queue_ns_route_delete(nl_sock_t *nl, const namespace_t *ns,
+                          int *result);
+
+/**
+ * Queue the gateway address on the host end of a veth namespace
+ *
+ * @param nl Socket in the host namespace
+ * @return 0 if queued (or nothing to do), -1 on failure
+ */
+int queue_host_gateway(nl_sock_t *nl, const namespace_t *ns, int *result);
 
 /**
  * Setup firewall rules based on configuration
  *
+ * Loads the complete ruleset, firewall and NAT, in one transaction.
+ *
  * @param config Pointer to a parsed config_t structure
  * @return 0 on success, -1 on failure
  */
 int setup_firewall(config_t *config);
 
+/**
+ * Compile the nftables ruleset for a configuration
+ *
+ * The result replaces the router's table as a whole when loaded, so it can
+ * be applied to a running system in one atomic transaction.
+ *
+ * @param config Pointer to a parsed config_t structure
+ * @return Ruleset text to free() by the caller, or NULL on failure
+ */
+char *compile_ruleset(const config_t *config);
+
+/**
+ * Check whether the router's nftables table is loaded
+ *
+ * @return true if the table exists
+ */
+bool firewall_present(void);
+
+/**
+ * Remove the router's nftables table
+ *
+ * @param config Pointer to the config_t structure used to set up the network
+ * @return 0 on success, -1 on failure
+ */
+int remove_firewall(config_t *config);
+
 /**
  * Setup NAT based on configuration
  *
+ * NAT lives in the same nftables table as the firewall, so this loads the
+ * complete ruleset in one transaction, exactly like setup_firewall().
+ *
  * @param config Pointer to a parsed config_t structure
  * @return 0 on success, -1 on failure
  */
@@ -0,0 +1,106 @@
+/*
+ * pktpool.h
+ *
+ * Fixed-size packet buffers carved out of one huge-page region, handed out
+ * through per-thread caches that trade with a shared ring in bulk
+ */
+#ifndef _PKTPOOL_H
+#define _PKTPOOL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PKTPOOL_HUGE_PAGE (2u << 20) // Size of the huge pages asked for
+#define PKTPOOL_CACHE_SIZE 512       // Frames a cache holds at most
+#define PKTPOOL_BULK 128             // Frames a cache moves at once
+
+/*
+ * The region and the frames no cache holds. The ring is a bounded
+ * multi-producer multi-consumer queue of frame addresses: a thread claims
+ * slots by moving a head forward with a compare-and-swap, fills or empties
+ * them, then publishes them by moving the matching tail once the threads
+ * that claimed earlier slots have published theirs.
+ */
+typedef struct {
+    _Alignas(64) atomic_uint prod_head; /* Next slot a producer claims */
+    atomic_uint prod_tail;              /* Slots before it hold frames */
+    _Alignas(64) atomic_uint cons_head; /* Next slot a consumer claims */
+    atomic_uint cons_tail;              /* Slots before it are free */
+    _Alignas(64) uint64_t *slots;       /* mask + 1 frame addresses */
+    uint32_t mask;                      /* Number of slots - 1 */
+    void *area;                         /* The frames */
+    size_t size;                        /* Bytes mapped for them */
+    uint32_t frames;                    /* Number of frames */
+    uint32_t frame_size;                /* Bytes per frame */
+    bool huge;                          /* area is on reserved huge pages,
+                                           not transparent ones */
+} pktpool_t;
+
+/*
+ * Frames one thread keeps at hand. Only its thread touches it, so taking
+ * and returning frames costs no atomic operation until it runs empty or
+ * full.
+ */
+typedef struct {
+    pktpool_t *pool;                    /* Pool the frames are from */
+    uint32_t count;                     /* Frames held */
+    uint64_t addrs[PKTPOOL_CACHE_SIZE]; /* Their addresses */
+} pktpool_cache_t;
+
+/**
+ * Map the region, on reserved huge pages if there are enough, otherwise
+ * on anonymous memory advised to use transparent ones, and put every frame
+ * in the shared ring
+ *
+ * @param pool Pool to initialize
+ * @param frames Number of frames
+ * @param frame_size Bytes per frame, a power of two
+ * @return 0 on success, -1 on failure
+ */
+int pktpool_open(pktpool_t *pool, uint32_t frames, uint32_t frame_size);
+
+/**
+ * Unmap the region, once no cache or device uses it any more
+ *
+ * @param pool The pool
+ */
+void pktpool_close(pktpool_t *pool);
+
+/**
+ * Start an empty cache
+ *
+ * @param cache Cache to initialize
+ * @param pool Pool it takes frames from
+ */
+void pktpool_cache_init(pktpool_cache_t *cache, pktpool_t *pool);
+
+/**
+ * Give every frame of a cache back to the shared ring
+ *
+ * @param cache The cache
+ */
+void pktpool_cache_flush(pktpool_cache_t *cache);
+
+/**
+ * Take frames, from the cache first, then in bulk from the shared ring
+ *
+ * @param cache Cache of the calling thread
+ * @param addrs Where to store the frames' offsets in the region
+ * @param n Frames wanted
+ * @return Frames taken, fewer than n once every frame is in use
+ */
+uint32_t pktpool_alloc(pktpool_cache_t *cache, uint64_t *addrs, uint32_t n);
+
+/**
+ * Return frames to the cache, moving a bulk of them to the shared ring
+ * whenever it fills up. Any thread may return any frame.
+ *
+ * @param cache Cache of the calling thread
+ * @param addrs Offsets anywhere within the frames
+ * @param n Number of frames
+ */
+void pktpool_free(pktpool_cache_t *cache, const uint64_t *addrs, uint32_t n);
+
+#endif /* _PKTPOOL_H */
@@ -0,0 +1,112 @@
+/*
+ * plan.h
+ *
+ * Dependency graph of the operations that bring a topology up or down
+ */
+#ifndef _PLAN_H
+#define _PLAN_H
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Kinds of operations, in an order compatible with their dependencies */
+typedef enum {
+    OP_FORWARDING, /* Toggle IPv4 forwarding */
+    OP_BRIDGE,     /* Create a bridge and assign its address */
+    OP_NAMESPACE,  /* Create a network namespace */
+    OP_VETH,       /* Create a namespace's veth pair */
+    OP_ENSLAVE,    /* Attach the host veth end to its bridge */
+    OP_ADDRESS,    /* Bring up links and assign addresses */
+    OP_ROUTE,      /* Install a namespace's default route */
+    OP_FIREWALL,   /* Load the nftables ruleset */
+    OP_KIND_COUNT
+} op_kind_t;
+
+/* A single operation in the graph */
+typedef struct {
+    op_kind_t kind;  /* What the operation does */
+    int index;       /* Namespace or bridge index the operation is about */
+    int pred_start;  /* Offset of the predecessors in plan_t.preds */
+    int pred_count;  /* Number of predecessors */
+    int succ_start;  /* Offset of the successors in plan_t.succs */
+    int succ_count;  /* Number of successors */
+    int depth;       /* Longest chain of operations ending here */
+    int pending;     /* Unfinished dependencies while running */
+    int status;      /* errno of the operation, 0 on success */
+    bool done;       /* Already in place, skipped by a bring-up */
+} plan_node_t;
+
+/* The operation graph of a configuration */
+typedef struct {
+    config_t *config;    /* Configuration the plan was built from */
+    plan_node_t *nodes;  /* Operations, in topological order */
+    int node_count;      /* Number of operations */
+    int *preds;          /* Predecessor lists of all nodes */
+    int *succs;          /* Successor lists of all nodes */
+    int edge_count;      /* Number of dependencies */
+    int *ns_bridge;      /* Bridge index per namespace, -1 for veth */
+    int *bridge_ifindex; /* Interface index per bridge once created */
+    uint64_t busy_ns[OP_KIND_COUNT]; /* Time workers spent on each kind
+                                        during the last plan_run() */
+} plan_t;
+
+/**
+ * Build the operation graph for a configuration, expanding its namespace
+ * ranges and assigning addresses first
+ *
+ * @param config Pointer to a parsed config_t structure
+ * @param plan Plan to fill
+ * @return 0 on success, -1 on failure (e.g. a bridge that does not exist)
+ */
+int plan_build(config_t *config, plan_t *plan);
+
+/**
+ * Execute a plan on a pool of worker threads
+ *
+ * Operations run as soon as all of their dependencies are done. For a
+ * teardown the graph is walked in reverse, so an object is only removed
+ * once everything depending on it is gone. A bring-up skips operations
+ * marked done; their dependents must then be either done or not depend
+ * on them.
+ *
+ * @param plan The plan to execute
+ * @param teardown Walk the graph in reverse and undo each operation
+ * @return 0 on success, -1 on failure
+ */
+int plan_run(plan_t *plan, bool teardown);
+
+/**
+ * Get the number of operations on the longest dependency chain
+ *
+ * @param plan The plan
+ * @return Critical path length in operations
+ */
+int plan_critical_path(const plan_t *plan);
+
+/**
+ * Print the operations, their dependencies and the critical path
+ *
+ * @param plan The plan to print
+ * @param fp File pointer to print to
+ */
+void print_plan(const plan_t *plan, FILE *fp);
+
+/**
+ * Get the name of a kind of operation, as print_plan() shows it
+ *
+ * @param kind The kind
+ * @return Static name, e.g. "namespace"
+ */
+const char *plan_kind_name(op_kind_t kind);
+
+/**
+ * Free all memory held by a plan
+ *
+ * @param plan The plan to free
+ */
+void plan_free(plan_t *plan);
+
+#endif /* _PLAN_H */
@@ -0,0 +1,75 @@
+/*
+ * rcu.h
+ *
+ * Quiescent-state based reclamation, for tables that forwarding threads
+ * read without locks while a writer replaces them
+ */
+#ifndef _RCU_H
+#define _RCU_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define RCU_MAX_READERS 64       // Threads that can read at once
+#define RCU_OFFLINE UINT64_MAX   // Reader holds no reference at all
+
+/*
+ * A writer publishes a new table with an atomic pointer store, then waits
+ * in rcu_synchronize() until every reader has passed a quiescent state,
+ * a point where it holds no reference into any table. After that nobody
+ * can still see the old table and it can be freed. Readers pay one store
+ * per quiescent state and nothing per lookup.
+ */
+typedef struct {
+    atomic_uint_fast64_t epoch;                 /* Bumped per synchronize */
+    atomic_uint_fast64_t seen[RCU_MAX_READERS]; /* Epoch each reader last
+                                                   passed, or RCU_OFFLINE */
+    atomic_int readers;                         /* Slots handed out */
+} rcu_t;
+
+/**
+ * Initialize a domain with no readers
+ *
+ * @param rcu Domain to initialize
+ */
+void rcu_init(rcu_t *rcu);
+
+/**
+ * Add a reader. It starts offline.
+ *
+ * @param rcu The domain
+ * @return Slot of the reader, or -1 if there are RCU_MAX_READERS already
+ */
+int rcu_register(rcu_t *rcu);
+
+/**
+ * Tell writers a reader holds no reference right now. Call it between
+ * batches of lookups.
+ *
+ * @param rcu The domain
+ * @param reader Slot from rcu_register()
+ */
+static inline void rcu_quiescent(rcu_t *rcu, int reader) {
+    atomic_store(&rcu->seen[reader], atomic_load(&rcu->epoch));
+}
+
+/**
+ * Tell writers a reader holds no reference until rcu_quiescent() is called
+ * again, e.g. before it sleeps
+ *
+ * @param rcu The domain
+ * @param reader Slot from rcu_register()
+ */
+static inline void rcu_offline(rcu_t *rcu, int reader) {
+    atomic_store(&rcu->seen[reader], RCU_OFFLINE);
+}
+
+/**
+ * Wait until every reader has passed a quiescent state or gone offline,
+ * so none can hold a reference to a table unpublished before the call
+ *
+ * @param rcu The domain
+ */
+void rcu_synchronize(rcu_t *rcu);
+
+#endif /* _RCU_H */
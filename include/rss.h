@@ -0,0 +1,50 @@
+/*
+ * rss.h
+ *
+ * Toeplitz hashing of flows, as NICs do for receive-side scaling
+ */
+#ifndef _RSS_H
+#define _RSS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RSS_KEY_SIZE 40 // Bytes of a key, as NICs take it
+#define RSS_INPUT_MAX 12 // IPv4 addresses and ports
+
+/*
+ * The hash xors one 32-bit window of the key per set input bit. The table
+ * holds that xor for every value of every input byte, so a hash is one
+ * lookup per byte.
+ */
+typedef struct {
+    uint32_t table[RSS_INPUT_MAX][256]; /* Per input byte and value */
+} rss_t;
+
+/*
+ * Key whose 16-bit halves repeat, so swapping source and destination,
+ * which are 32 and 16 bits apart in the input, keeps the hash: both
+ * directions of a flow hash alike.
+ */
+extern const uint8_t rss_symmetric_key[RSS_KEY_SIZE];
+
+/**
+ * Prepare the table of a key
+ *
+ * @param rss Table to fill
+ * @param key The key
+ */
+void rss_init(rss_t *rss, const uint8_t key[RSS_KEY_SIZE]);
+
+/**
+ * Hash an input: source and destination address, then source and
+ * destination port, all in network byte order
+ *
+ * @param rss Table of the key
+ * @param input The input
+ * @param len Bytes of input, at most RSS_INPUT_MAX
+ * @return The Toeplitz hash
+ */
+uint32_t rss_hash(const rss_t *rss, const uint8_t *input, size_t len);
+
+#endif /* _RSS_H */
@@ -0,0 +1,83 @@
+/*
+ * spsc.h
+ *
+ * Bounded lock-free ring between one producer and one consumer thread,
+ * carrying frames of the userspace data plane
+ */
+#ifndef _SPSC_H
+#define _SPSC_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A frame on its way from one thread to another */
+typedef struct {
+    uint64_t addr; /* Frame in the UMEM */
+    uint32_t len;  /* Bytes of the frame */
+    uint32_t port; /* Port it arrived on */
+} spsc_frame_t;
+
+/*
+ * Each side owns one index and keeps a copy of the other's, which it only
+ * reloads when the copy says the ring is full or empty, so the indexes'
+ * cache lines move between the threads once per batch at most.
+ */
+typedef struct {
+    _Alignas(64) atomic_uint head;    /* Next slot the producer fills */
+    uint32_t cached_tail;             /* Producer's copy of tail */
+    _Alignas(64) atomic_uint tail;    /* Next slot the consumer empties */
+    uint32_t cached_head;             /* Consumer's copy of head */
+    _Alignas(64) spsc_frame_t *slots; /* mask + 1 slots */
+    uint32_t mask;                    /* Number of slots - 1 */
+} spsc_ring_t;
+
+/**
+ * Create an empty ring
+ *
+ * @param ring Ring to initialize
+ * @param size Number of slots, a power of two
+ * @return 0 on success, -1 on failure
+ */
+int spsc_init(spsc_ring_t *ring, uint32_t size);
+
+/**
+ * Free a ring
+ *
+ * @param ring The ring
+ */
+void spsc_free(spsc_ring_t *ring);
+
+/**
+ * Append frames, as many as fit. Only the producer may call it.
+ *
+ * @param ring The ring
+ * @param frames Frames to append
+ * @param n Number of frames
+ * @return Number of frames appended, from the start of frames
+ */
+uint32_t spsc_push(spsc_ring_t *ring, const spsc_frame_t *frames, uint32_t n);
+
+/**
+ * Take the oldest frames. Only the consumer may call it.
+ *
+ * @param ring The ring
+ * @param frames Where to store them
+ * @param max Most frames wanted
+ * @return Number of frames taken
+ */
+uint32_t spsc_pop(spsc_ring_t *ring, spsc_frame_t *frames, uint32_t max);
+
+/**
+ * Check for frames without taking them. Any thread may call it; the answer
+ * can be stale by the time it returns.
+ *
+ * @param ring The ring
+ * @return true if the ring holds no frame
+ */
+static inline bool spsc_empty(const spsc_ring_t *ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) ==
+           atomic_load_explicit(&ring->tail, memory_order_relaxed);
+}
+
+#endif /* _SPSC_H */
@@ -0,0 +1,90 @@
+/*
+ * tokenizer.h
+ *
+ * Single-pass tokenizer for topology files that never copies the input
+ */
+#ifndef _TOKENIZER_H
+#define _TOKENIZER_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TOKEN_MAX_KEY_PARTS 3 // e.g. namespace.private1.ip
+
+/* A run of bytes inside the buffer being parsed, not NUL-terminated */
+typedef struct {
+    const char *data; /* First byte */
+    size_t len;       /* Number of bytes */
+} strview_t;
+
+/* One "key = value" line, every view points into the tokenized buffer */
+typedef struct {
+    strview_t key[TOKEN_MAX_KEY_PARTS]; /* Dot-separated parts of the key */
+    int num_parts;                      /* Number of key parts */
+    strview_t value; /* Value without blanks around it or its comment */
+} config_token_t;
+
+/* Position in a buffer being tokenized */
+typedef struct {
+    const char *pos; /* Start of the next line */
+    const char *end; /* End of the buffer */
+    int line;        /* Number of the line last returned, from 1 */
+} tokenizer_t;
+
+/**
+ * Start tokenizing a buffer, which must outlive the tokens
+ *
+ * @param tok Tokenizer to initialize
+ * @param data Buffer holding the lines, need not be NUL-terminated
+ * @param len Size of the buffer
+ */
+void tokenizer_init(tokenizer_t *tok, const char *data, size_t len);
+
+/**
+ * Get the next "key = value" line, skipping blank lines and comments
+ *
+ * @param tok Tokenizer
+ * @param token Filled with views of the key parts and value
+ * @return 1 for a token, 0 at the end of the buffer, -1 for a malformed
+ *         line, whose number is in tok->line
+ */
+int tokenizer_next(tokenizer_t *tok, config_token_t *token);
+
+/**
+ * View a NUL-terminated string
+ *
+ * @param s The string
+ * @return View of s without its terminator
+ */
+strview_t view_of(const char *s);
+
+/**
+ * Compare a view with a NUL-terminated string
+ *
+ * @param view The view
+ * @param s The string
+ * @return true if both hold the same bytes
+ */
+bool view_equals(strview_t view, const char *s);
+
+/**
+ * Parse a dotted-quad IPv4 address, accepting what inet_pton() accepts
+ *
+ * @param view The address text
+ * @param addr Pointer to store the address in network byte order
+ * @return 0 on success, -1 on failure
+ */
+int view_to_ipv4(strview_t view, struct in_addr *addr);
+
+/**
+ * Parse a decimal number without sign or leading zeros
+ *
+ * @param view The number text
+ * @param value Pointer to store the number in
+ * @return 0 on success, -1 on failure or if it does not fit 32 bits
+ */
+int view_to_u32(strview_t view, uint32_t *value);
+
+#endif /* _TOKENIZER_H */
@@ -0,0 +1,85 @@
+/*
+ * trace.h
+ *
+ * Timestamps of kernel operations, dumped in Chrome trace-event format
+ */
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRACE_RING_EVENTS (1u << 14) // Per thread, the oldest are overwritten
+#define TRACE_OBJECT_MAX 32          // Object names are truncated to this
+
+/* Set by trace_start(); everything else is a no-op while it is false */
+extern bool trace_enabled;
+
+/**
+ * Read the clock events are timed with
+ *
+ * @return CLOCK_MONOTONIC in nanoseconds
+ */
+uint64_t trace_now(void);
+
+/**
+ * Record a finished operation in the calling thread's ring. The thread
+ * gets its ring on its first event; only that thread ever writes to it.
+ *
+ * @param cat Category, e.g. "netlink"; must be a string literal
+ * @param name Operation, e.g. "RTM_NEWLINK"; must be a string literal
+ * @param object Object operated on, copied, may be NULL
+ * @param begin trace_now() when the operation started
+ * @param end trace_now() when it finished
+ */
+void trace_record(const char *cat, const char *name, const char *object,
+                  uint64_t begin, uint64_t end);
+
+/**
+ * Start timing an operation
+ *
+ * @return The start time, or 0 when tracing is disabled
+ */
+static inline uint64_t trace_begin(void) {
+    return trace_enabled ? trace_now() : 0;
+}
+
+/**
+ * Finish timing an operation started with trace_begin()
+ *
+ * @param begin Value returned by trace_begin(), nothing is recorded for 0
+ * @param cat Category, e.g. "netns"; must be a string literal
+ * @param name Operation, e.g. "create_namespace"; must be a string literal
+ * @param object Object operated on, copied, may be NULL
+ */
+static inline void trace_end(uint64_t begin, const char *cat,
+                             const char *name, const char *object) {
+    if (begin != 0) {
+        trace_record(cat, name, object, begin, trace_now());
+    }
+}
+
+/**
+ * Enable tracing and drop the events of an earlier trace. Must be called
+ * before the threads being traced are started.
+ *
+ * @return 0 on success, -1 if tracing is already enabled
+ */
+int trace_start(void);
+
+/**
+ * Write the recorded events as a Chrome trace-event JSON file, which
+ * chrome://tracing and Perfetto open. Threads may not record meanwhile.
+ *
+ * @param path File to write
+ * @return 0 on success, -1 on failure
+ */
+int trace_write(const char *path);
+
+/**
+ * Disable tracing and free the recorded events. Threads may not record
+ * meanwhile.
+ */
+void trace_stop(void);
+
+#endif /* _TRACE_H */
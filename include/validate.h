@@ -0,0 +1,24 @@
+/*
+ * validate.h
+ *
+ * Consistency checks run on a configuration before it touches the system
+ */
+#ifndef _VALIDATE_H
+#define _VALIDATE_H
+
+#include "config.h"
+
+#define VALIDATE_MAX_REPORTS 20 // Problems printed before only counting
+
+/**
+ * Check a configuration for mistakes that would fail or misroute halfway
+ * through a bring-up: overlapping link subnets or NAT prefixes, addresses
+ * used twice, gateways outside their subnet and bridges that do not exist.
+ * The prefixes are sorted and swept once, so this is O(n log n).
+ *
+ * @param config Configuration with its addresses assigned
+ * @return 0 if it is consistent, -1 after printing the problems to stderr
+ */
+int validate_config(const config_t *config);
+
+#endif /* _VALIDATE_H */
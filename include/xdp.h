@@ -0,0 +1,269 @@
+/*
+ * xdp.h
+ *
+ * AF_XDP sockets and the XDP program that steers frames to them, set up
+ * with raw bpf(2) and rtnetlink calls
+ */
+#ifndef _XDP_H
+#define _XDP_H
+
+#include "netlink.h"
+
+#include <linux/if_xdp.h>
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define XDP_RING_SIZE 512           // Descriptors in every ring of a socket
+#define XDP_FRAME_SIZE 2048         // UMEM chunk, holds one frame
+#define XDP_MAX_PREFIXES (1u << 20) // Entries of the steering trie
+
+#define XDP_STEER_PASS 0     // Trie value: leave the frame to the kernel
+#define XDP_STEER_REDIRECT 1 // Trie value: hand it to the socket
+#define XDP_STEER_NAT 2      // Trie value: hand it over from NAT ports
+
+/*
+ * A ring shared with the kernel. Either side owns one index; the other is
+ * only read when the cached copy says the ring is full or empty.
+ */
+typedef struct {
+    uint32_t *producer;   /* Index of the next slot to produce */
+    uint32_t *consumer;   /* Index of the next slot to consume */
+    uint32_t *flags;      /* XDP_RING_NEED_WAKEUP */
+    void *descs;          /* struct xdp_desc or uint64_t slots */
+    uint32_t mask;        /* Number of slots - 1 */
+    uint32_t cached_prod; /* Producer index last seen or advanced to */
+    uint32_t cached_cons; /* Consumer index last seen or advanced to */
+    void *map;            /* Mapping of the ring */
+    size_t map_size;      /* Size of the mapping */
+} xdp_ring_t;
+
+/* Memory frames are received into and transmitted from */
+typedef struct {
+    void *area;      /* XDP_FRAME_SIZE chunks */
+    size_t size;     /* Size of the area */
+    uint32_t frames; /* Number of chunks */
+    int owner_fd;    /* Socket the area is registered with, -1 before */
+    bool zerocopy;   /* Sockets bound in zero-copy mode */
+} xdp_umem_t;
+
+/* An AF_XDP socket on one queue of a device, sharing the UMEM */
+typedef struct {
+    int fd;          /* The socket, -1 when closed */
+    xdp_ring_t rx;   /* Received frames */
+    xdp_ring_t tx;   /* Frames to transmit */
+    xdp_ring_t fill; /* Free frames the kernel receives into */
+    xdp_ring_t comp; /* Transmitted frames the kernel is done with */
+} xsk_t;
+
+/*
+ * BPF maps the programs consult: an LPM trie of IPv4 destinations to
+ * XDP_STEER_* values, the sockets by slot and, for the uplink, how many
+ * flows use each NAT port
+ */
+typedef struct {
+    int trie_fd;              /* Destination prefixes, -1 when closed */
+    int xsks_fd;              /* XSKMAP, one slot per receive queue of each
+                                 device */
+    int refs_fd;              /* Array of NAT port counters, or -1 */
+    _Atomic(uint64_t) *refs;  /* The counters, mapped */
+    uint32_t ref_count;       /* Number of counters */
+} xdp_filter_t;
+
+/**
+ * Create the maps of a filter
+ *
+ * @param filter Filter to initialize
+ * @param slots Number of sockets the program can redirect to
+ * @return 0 on success, -1 on failure
+ */
+int xdp_filter_open(xdp_filter_t *filter, uint32_t slots);
+
+/**
+ * Create the NAT port counters xdp_uplink_load() consults, mapped into
+ * filter->refs and all 0
+ *
+ * @param filter The filter
+ * @param count Number of counters
+ * @return 0 on success, -1 on failure
+ */
+int xdp_filter_refs(xdp_filter_t *filter, uint32_t count);
+
+/**
+ * Steer a prefix. The longest matching prefix decides.
+ *
+ * @param filter The filter
+ * @param network Any address of the prefix
+ * @param mask Prefix length
+ * @param steer XDP_STEER_* for frames to the prefix
+ * @return 0 on success, -1 on failure
+ */
+int xdp_filter_add(xdp_filter_t *filter, struct in_addr network, uint8_t mask,
+                   uint32_t steer);
+
+/**
+ * Put a socket into a slot of the filter
+ *
+ * @param filter The filter
+ * @param slot Slot the program of the socket's device redirects its
+ *             queue to
+ * @param xsk The socket
+ * @return 0 on success, -1 on failure
+ */
+int xdp_filter_bind(xdp_filter_t *filter, uint32_t slot, const xsk_t *xsk);
+
+/**
+ * Load the program for one device: IPv4 frames whose destination the trie
+ * steers to userspace are redirected to the socket of their receive queue,
+ * in slot first_slot + queue, everything else goes on to the kernel.
+ *
+ * @param filter Maps the program uses
+ * @param first_slot Slot of the socket of the device's queue 0
+ * @param queues Queues with a socket; frames on later queues are passed
+ * @param nat Whether TCP, UDP and ICMP to XDP_STEER_NAT prefixes are
+ *            redirected too
+ * @return Program descriptor, or -1 on failure
+ */
+int xdp_filter_load(const xdp_filter_t *filter, uint32_t first_slot,
+                    uint32_t queues, bool nat);
+
+/**
+ * Load the program for the uplink: replies to translated flows, TCP and
+ * UDP to a port of the range and ICMP echo replies with an identifier in
+ * it, all addressed to the NAT address, are redirected to the socket of
+ * their receive queue as with xdp_filter_load(). Only ports whose counter
+ * (port - lo) * 4 + n, with n = 0, 1 and 2 for TCP, UDP and ICMP, is not 0
+ * are: the kernel keeps the rest, such as replies to its own masquerade.
+ *
+ * @param filter Maps the program uses
+ * @param first_slot Slot of the socket of the uplink's queue 0
+ * @param queues Queues with a socket; frames on later queues are passed
+ * @param addr NAT address
+ * @param lo First NAT port, host byte order
+ * @param hi Last NAT port, host byte order
+ * @return Program descriptor, or -1 on failure
+ */
+int xdp_uplink_load(const xdp_filter_t *filter, uint32_t first_slot,
+                    uint32_t queues, struct in_addr addr, uint16_t lo,
+                    uint16_t hi);
+
+/**
+ * Close the maps of a filter
+ *
+ * @param filter The filter
+ */
+void xdp_filter_close(xdp_filter_t *filter);
+
+/**
+ * Queue attaching a program to a device, or detaching it
+ *
+ * @param nl Host netlink socket
+ * @param ifindex The device
+ * @param prog_fd Program descriptor, -1 to detach
+ * @param flags XDP_FLAGS_DRV_MODE or XDP_FLAGS_SKB_MODE
+ * @param label Device name for error messages, must outlive the request
+ * @param result Where to store the errno on failure, may be NULL
+ * @return 0 on success, -1 on failure
+ */
+int queue_xdp_attach(nl_sock_t *nl, int ifindex, int prog_fd, uint32_t flags,
+                     const char *label, int *result);
+
+/**
+ * Describe the frame area sockets share. The caller owns the memory and
+ * keeps it mapped until every socket using it is closed.
+ *
+ * @param umem UMEM to initialize
+ * @param area Page-aligned memory of frames * XDP_FRAME_SIZE bytes
+ * @param frames Number of frames
+ */
+void xdp_umem_init(xdp_umem_t *umem, void *area, uint32_t frames);
+
+/**
+ * Open a socket on a queue of a device. The first socket registers the
+ * UMEM, in zero-copy mode when umem->zerocopy is set; later ones share it
+ * in the same mode.
+ *
+ * @param xsk Socket to initialize
+ * @param umem Frame area
+ * @param ifindex The device
+ * @param queue Receive and transmit queue of the device
+ * @return 0 on success, an errno value on failure; EINVAL when the device
+ *         has no such queue
+ */
+int xsk_open(xsk_t *xsk, xdp_umem_t *umem, int ifindex, uint32_t queue);
+
+/**
+ * Close a socket and unmap its rings
+ *
+ * @param xsk The socket
+ */
+void xsk_close(xsk_t *xsk);
+
+/**
+ * Get descriptors the other side produced
+ *
+ * @param ring The ring
+ * @param max Most descriptors wanted
+ * @param idx Pointer to store the index of the first one in
+ * @return Number of descriptors available, up to max
+ */
+uint32_t xdp_ring_peek(xdp_ring_t *ring, uint32_t max, uint32_t *idx);
+
+/**
+ * Hand consumed descriptors back to the other side
+ *
+ * @param ring The ring
+ * @param n Number of descriptors obtained with xdp_ring_peek()
+ */
+void xdp_ring_release(xdp_ring_t *ring, uint32_t n);
+
+/**
+ * Reserve free slots to produce into
+ *
+ * @param ring The ring
+ * @param max Most slots wanted
+ * @param idx Pointer to store the index of the first one in
+ * @return Number of slots reserved, up to max
+ */
+uint32_t xdp_ring_reserve(xdp_ring_t *ring, uint32_t max, uint32_t *idx);
+
+/**
+ * Publish every slot reserved so far to the other side
+ *
+ * @param ring The ring
+ */
+void xdp_ring_submit(xdp_ring_t *ring);
+
+/**
+ * Check whether the kernel waits for a syscall to process a ring
+ *
+ * @param ring The ring
+ * @return true if it needs a wakeup
+ */
+bool xdp_ring_needs_wakeup(const xdp_ring_t *ring);
+
+/**
+ * Frame descriptor of an rx or tx ring slot
+ *
+ * @param ring The ring
+ * @param idx Slot index from xdp_ring_peek() or xdp_ring_reserve()
+ * @return The descriptor
+ */
+static inline struct xdp_desc *xdp_ring_desc(const xdp_ring_t *ring,
+                                             uint32_t idx) {
+    return &((struct xdp_desc *)ring->descs)[idx & ring->mask];
+}
+
+/**
+ * Frame address of a fill or completion ring slot
+ *
+ * @param ring The ring
+ * @param idx Slot index from xdp_ring_peek() or xdp_ring_reserve()
+ * @return The address slot
+ */
+static inline uint64_t *xdp_ring_addr(const xdp_ring_t *ring, uint32_t idx) {
+    return &((uint64_t *)ring->descs)[idx & ring->mask];
+}
+
+#endif /* _XDP_H */
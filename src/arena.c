@@ -0,0 +1,98 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_MIN (64 * 1024) // Size of the first block
+
+struct arena_block {
+    arena_block_t *next; /* Older block */
+    size_t size;         /* Usable bytes in data */
+    size_t used;         /* Bytes handed out */
+    size_t last;         /* Offset of the most recent allocation */
+    alignas(max_align_t) unsigned char data[];
+};
+
+static size_t align_up(size_t n) {
+    return (n + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+}
+
+/* Blocks double so a large config needs only a few of them */
+static arena_block_t *arena_new_block(arena_t *arena, size_t need) {
+    size_t size = arena->head ? arena->head->size * 2 : ARENA_BLOCK_MIN;
+    while (size < need) {
+        size *= 2;
+    }
+
+    // calloc'd memory is zero and the arena never reuses it, so every
+    // allocation starts out zeroed without a memset
+    arena_block_t *block = calloc(1, sizeof *block + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->size = size;
+    block->next = arena->head;
+    arena->head = block;
+    return block;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = align_up(size ? size : 1);
+    arena_block_t *block = arena->head;
+    if (block == NULL || block->size - block->used < size) {
+        if ((block = arena_new_block(arena, size)) == NULL) {
+            return NULL;
+        }
+    }
+    block->last = block->used;
+    block->used += size;
+    return block->data + block->last;
+}
+
+void *arena_realloc(arena_t *arena, void *ptr, size_t old_size,
+                    size_t new_size) {
+    if (ptr == NULL) {
+        return arena_alloc(arena, new_size);
+    }
+
+    arena_block_t *block = arena->head;
+    if (block != NULL && ptr == block->data + block->last &&
+        block->last + align_up(new_size) <= block->size) {
+        block->used = block->last + align_up(new_size);
+        return ptr;
+    }
+
+    void *moved = arena_alloc(arena, new_size);
+    if (moved != NULL) {
+        memcpy(moved, ptr, old_size);
+    }
+    return moved;
+}
+
+void *arena_push(arena_t *arena, void *data, int count, int *cap,
+                 size_t size) {
+    void **array = data;
+    if (count == *cap) {
+        int new_cap = *cap ? *cap * 2 : 16;
+        void *grown =
+            arena_realloc(arena, *array, *cap * size, new_cap * size);
+        if (grown == NULL) {
+            return NULL;
+        }
+        *array = grown;
+        *cap = new_cap;
+    }
+    return (char *)*array + count * size;
+}
+
+void arena_release(arena_t *arena) {
+    arena_block_t *block = arena->head;
+    while (block != NULL) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
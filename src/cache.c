@@ -0,0 +1,428 @@
+#define _GNU_SOURCE
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_ALIGN 8 // Alignment of every section
+
+char *cache_path(const char *filename) {
+    size_t len = strlen(filename) + sizeof CACHE_SUFFIX;
+    char *path = malloc(len);
+    if (path != NULL) {
+        snprintf(path, len, "%s%s", filename, CACHE_SUFFIX);
+    }
+    return path;
+}
+
+/* FNV-1a over the bytes of a file, read through a mapping */
+static int hash_file(const char *filename, uint64_t *hash) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    *hash = 14695981039346656037ull;
+    if (st.st_size == 0) {
+        close(fd);
+        return 0; // nothing to map
+    }
+    const unsigned char *data =
+        mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+    for (off_t i = 0; i < st.st_size; i++) {
+        *hash = (*hash ^ data[i]) * 1099511628211ull;
+    }
+    munmap((void *)data, st.st_size);
+    return 0;
+}
+
+/* String table under construction, deduplicated by the interned pointer */
+typedef struct {
+    char *data;
+    uint32_t len;
+    uint32_t cap;
+    const char **keys; /* Open-addressing table of names already added */
+    uint32_t *offsets; /* Offset of each name in keys */
+    uint32_t slots;    /* Size of keys, a power of two */
+} string_table_t;
+
+static int table_init(string_table_t *t, int names) {
+    memset(t, 0, sizeof *t);
+    t->slots = 64;
+    while (t->slots < 2u * names) {
+        t->slots *= 2;
+    }
+    t->keys = calloc(t->slots, sizeof *t->keys);
+    t->offsets = calloc(t->slots, sizeof *t->offsets);
+    return t->keys != NULL && t->offsets != NULL ? 0 : -1;
+}
+
+static void table_free(string_table_t *t) {
+    free(t->data);
+    free(t->keys);
+    free(t->offsets);
+}
+
+static int table_add(string_table_t *t, const char *name, uint32_t *offset) {
+    uint32_t mask = t->slots - 1;
+    uint32_t slot = (uint32_t)(((uintptr_t)name >> 3) * 2654435761u) & mask;
+    for (; t->keys[slot] != NULL; slot = (slot + 1) & mask) {
+        if (t->keys[slot] == name) {
+            *offset = t->offsets[slot];
+            return 0;
+        }
+    }
+
+    size_t len = strlen(name) + 1;
+    if (t->len + len > t->cap) {
+        uint32_t cap = t->cap ? t->cap * 2 : 4096;
+        while (cap < t->len + len) {
+            cap *= 2;
+        }
+        char *data = realloc(t->data, cap);
+        if (data == NULL) {
+            return -1;
+        }
+        t->data = data;
+        t->cap = cap;
+    }
+    memcpy(t->data + t->len, name, len);
+    t->keys[slot] = name;
+    t->offsets[slot] = *offset = t->len;
+    t->len += len;
+    return 0;
+}
+
+/* Append a section, padded so the next one stays aligned */
+static int write_section(FILE *fp, cache_section_t *section, uint64_t *end,
+                         const void *data, uint32_t count, uint32_t size) {
+    static const char zero[CACHE_ALIGN];
+    section->offset = *end;
+    section->count = count;
+    section->size = size;
+
+    size_t bytes = (size_t)count * size;
+    size_t pad = (CACHE_ALIGN - bytes % CACHE_ALIGN) % CACHE_ALIGN;
+    if ((bytes > 0 && fwrite(data, 1, bytes, fp) != bytes) ||
+        fwrite(zero, 1, pad, fp) != pad) {
+        return -1;
+    }
+    *end += bytes + pad;
+    return 0;
+}
+
+int compile_config(const char *filename, const config_t *config) {
+    if (config->addresses_assigned ||
+        config->ns_templates_expanded < config->ns_template_count) {
+        fprintf(stderr, "Only an expanded configuration without assigned "
+                        "addresses can be compiled\n");
+        return -1;
+    }
+    cache_header_t header = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .ipv4_forwrd = config->ipv4_forwrd,
+        .flow_offload = config->flow_offload,
+        .fw_default = config->fw_default_action,
+        .dataplane = config->dataplane,
+        .ct_flows = config->conntrack_flows,
+        .workers = config->dataplane_workers,
+    };
+    memcpy(header.nat_outgoing_interface, config->nat_outgoing_interface,
+           sizeof header.nat_outgoing_interface);
+    if (hash_file(filename, &header.source_hash) != 0) {
+        fprintf(stderr, "Cannot read %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    int ns_count = config->namespace_count;
+    int br_count = config->bridge_count;
+    cache_namespace_t *ns_records = calloc(ns_count + 1, sizeof *ns_records);
+    cache_bridge_t *br_records = calloc(br_count + 1, sizeof *br_records);
+    string_table_t strings;
+    char *path = cache_path(filename);
+    int status = -1;
+    if (table_init(&strings, 2 * ns_count + br_count) != 0 ||
+        ns_records == NULL || br_records == NULL || path == NULL) {
+        goto out;
+    }
+
+    for (int i = 0; i < ns_count; i++) {
+        const namespace_t *ns = &config->namespaces[i];
+        cache_namespace_t *rec = &ns_records[i];
+        if (table_add(&strings, ns->name, &rec->name) != 0 ||
+            table_add(&strings, ns->connect_name, &rec->connect_name) != 0) {
+            goto out;
+        }
+        rec->ip_addr = ns->ip_addr;
+        rec->gateway = ns->gateway;
+        rec->mask = ns->mask;
+        rec->connect_type = ns->connect_type;
+        rec->auto_ip = ns->auto_ip;
+    }
+    for (int j = 0; j < br_count; j++) {
+        const bridge_t *br = &config->bridges[j];
+        if (table_add(&strings, br->name, &br_records[j].name) != 0) {
+            goto out;
+        }
+        br_records[j].ip_addr = br->ip_addr;
+        br_records[j].mask = br->mask;
+    }
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof tmp, "%s.tmp", path);
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+        goto out;
+    }
+
+    // the header goes in last, once the offsets are known
+    uint64_t end = sizeof header;
+    int failed = fseek(fp, end, SEEK_SET);
+    failed |= write_section(fp, &header.namespaces, &end, ns_records,
+                            ns_count, sizeof *ns_records);
+    failed |= write_section(fp, &header.bridges, &end, br_records, br_count,
+                            sizeof *br_records);
+    failed |= write_section(fp, &header.fw_rules, &end, config->fw_rules,
+                            config->fw_rule_count, sizeof(fw_rule_t));
+    failed |= write_section(fp, &header.nat_rules, &end, config->nat_rules,
+                            config->nat_rule_count, sizeof(nat_rule_t));
+    failed |= write_section(fp, &header.ns_index, &end,
+                            config->ns_index.slots, config->ns_index.capacity,
+                            sizeof(int));
+    failed |= write_section(fp, &header.br_index, &end,
+                            config->br_index.slots, config->br_index.capacity,
+                            sizeof(int));
+    failed |= write_section(fp, &header.strings, &end, strings.data,
+                            strings.len, 1);
+    header.size = end;
+    failed |= fseek(fp, 0, SEEK_SET);
+    failed |= fwrite(&header, sizeof header, 1, fp) != 1;
+
+    // replaced atomically, a running load never sees half a file
+    if (fclose(fp) != 0 || failed || rename(tmp, path) != 0) {
+        fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+        unlink(tmp);
+        goto out;
+    }
+    status = 0;
+
+out:
+    table_free(&strings);
+    free(ns_records);
+    free(br_records);
+    free(path);
+    return status;
+}
+
+/* A section must lie inside the file and hold elements of the given size */
+static bool section_valid(const cache_header_t *h, const cache_section_t *s,
+                          size_t size) {
+    return s->size == size && s->offset % CACHE_ALIGN == 0 &&
+           s->offset >= sizeof *h && s->offset <= h->size &&
+           (uint64_t)s->count * size <= h->size - s->offset;
+}
+
+/* Slots must be in range and leave empty ones for lookups to stop at */
+static bool index_valid(const cache_section_t *s, const int *slots,
+                        uint32_t entries) {
+    if (s->count & (s->count - 1)) {
+        return false; // not a power of two
+    }
+    if (s->count == 0) {
+        return entries == 0;
+    }
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < s->count; i++) {
+        if (slots[i] < 0 || (uint32_t)slots[i] > entries) {
+            return false;
+        }
+        used += slots[i] != 0;
+    }
+    return used < s->count;
+}
+
+static bool cache_valid(const cache_header_t *h, const char *base) {
+    if (!section_valid(h, &h->namespaces, sizeof(cache_namespace_t)) ||
+        !section_valid(h, &h->bridges, sizeof(cache_bridge_t)) ||
+        !section_valid(h, &h->fw_rules, sizeof(fw_rule_t)) ||
+        !section_valid(h, &h->nat_rules, sizeof(nat_rule_t)) ||
+        !section_valid(h, &h->ns_index, sizeof(int)) ||
+        !section_valid(h, &h->br_index, sizeof(int)) ||
+        !section_valid(h, &h->strings, 1) || h->fw_default > FW_DROP ||
+        h->dataplane > DATAPLANE_AFXDP ||
+        h->ct_flows < CONNTRACK_FLOWS_MIN ||
+        h->ct_flows > CONNTRACK_FLOWS_MAX || h->workers < 1 ||
+        h->workers > DATAPLANE_WORKERS_MAX ||
+        h->nat_outgoing_interface[MAX_IF_NAME_LEN - 1] != '\0') {
+        return false;
+    }
+
+    // every name offset then points at a terminated string
+    uint32_t str_len = h->strings.count;
+    if (str_len > 0 && base[h->strings.offset + str_len - 1] != '\0') {
+        return false;
+    }
+    const cache_namespace_t *ns = (const void *)(base + h->namespaces.offset);
+    for (uint32_t i = 0; i < h->namespaces.count; i++) {
+        if (ns[i].name >= str_len || ns[i].connect_name >= str_len ||
+            ns[i].connect_type > CONNECT_VETH || ns[i].auto_ip > 1) {
+            return false;
+        }
+    }
+    const cache_bridge_t *br = (const void *)(base + h->bridges.offset);
+    for (uint32_t j = 0; j < h->bridges.count; j++) {
+        if (br[j].name >= str_len) {
+            return false;
+        }
+    }
+    const fw_rule_t *rules = (const void *)(base + h->fw_rules.offset);
+    for (uint32_t i = 0; i < h->fw_rules.count; i++) {
+        if ((rules[i].src_type == ENDPOINT_NS &&
+             (uint32_t)rules[i].src_ns >= h->namespaces.count) ||
+            (rules[i].dst_type == ENDPOINT_NS &&
+             (uint32_t)rules[i].dst_ns >= h->namespaces.count)) {
+            return false;
+        }
+    }
+    return index_valid(&h->ns_index, (const int *)(base + h->ns_index.offset),
+                       h->namespaces.count) &&
+           index_valid(&h->br_index, (const int *)(base + h->br_index.offset),
+                       h->bridges.count);
+}
+
+/*
+ * Rules, NAT prefixes and the name indexes are used straight from the
+ * mapping; only namespaces and bridges are rebuilt, to turn name offsets
+ * into pointers. The mapping is private and writable, so parsing further
+ * lines into the configuration copies pages rather than touching the file.
+ */
+static int cache_fill(config_t *config, char *base, size_t size) {
+    const cache_header_t *h = (const cache_header_t *)base;
+    const char *strings = base + h->strings.offset;
+
+    int ns_count = h->namespaces.count;
+    int br_count = h->bridges.count;
+    config->namespaces =
+        arena_alloc(&config->arena, (ns_count + 1) * sizeof(namespace_t));
+    config->bridges =
+        arena_alloc(&config->arena, (br_count + 1) * sizeof(bridge_t));
+    if (config->namespaces == NULL || config->bridges == NULL) {
+        return -1;
+    }
+
+    const cache_namespace_t *ns = (const void *)(base + h->namespaces.offset);
+    for (int i = 0; i < ns_count; i++) {
+        config->namespaces[i] = (namespace_t){
+            .name = strings + ns[i].name,
+            .ip_addr = ns[i].ip_addr,
+            .mask = ns[i].mask,
+            .auto_ip = ns[i].auto_ip,
+            .gateway = ns[i].gateway,
+            .connect_type = ns[i].connect_type,
+            .connect_name = strings + ns[i].connect_name,
+        };
+    }
+    const cache_bridge_t *br = (const void *)(base + h->bridges.offset);
+    for (int j = 0; j < br_count; j++) {
+        config->bridges[j] = (bridge_t){
+            .name = strings + br[j].name,
+            .ip_addr = br[j].ip_addr,
+            .mask = br[j].mask,
+        };
+    }
+    config->namespace_count = config->namespace_cap = ns_count;
+    config->bridge_count = config->bridge_cap = br_count;
+
+    config->fw_rules = (fw_rule_t *)(base + h->fw_rules.offset);
+    config->fw_rule_count = config->fw_rule_cap = h->fw_rules.count;
+    config->nat_rules = (nat_rule_t *)(base + h->nat_rules.offset);
+    config->nat_rule_count = config->nat_rule_cap = h->nat_rules.count;
+    config->ns_index = (name_index_t){
+        .slots = (int *)(base + h->ns_index.offset),
+        .capacity = h->ns_index.count,
+    };
+    config->br_index = (name_index_t){
+        .slots = (int *)(base + h->br_index.offset),
+        .capacity = h->br_index.count,
+    };
+
+    config->ipv4_forwrd = h->ipv4_forwrd;
+    config->flow_offload = h->flow_offload;
+    config->fw_default_action = h->fw_default;
+    config->dataplane = h->dataplane;
+    config->conntrack_flows = h->ct_flows;
+    config->dataplane_workers = h->workers;
+    memcpy(config->nat_outgoing_interface, h->nat_outgoing_interface,
+           sizeof config->nat_outgoing_interface);
+    // ranges were expanded before compiling; the addresses are handed out
+    // after loading, against the previous configuration
+    config->cache = base;
+    config->cache_size = size;
+    return 0;
+}
+
+int load_config_cache(const char *filename, config_t *config) {
+    char *path = cache_path(filename);
+    if (path == NULL) {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        free(path);
+        return -1; // not compiled
+    }
+
+    struct stat st;
+    uint64_t hash;
+    char *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(cache_header_t) &&
+        hash_file(filename, &hash) == 0) {
+        base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                    0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+        free(path);
+        return -1;
+    }
+
+    const cache_header_t *h = (const cache_header_t *)base;
+    int status = -1;
+    if (h->magic != CACHE_MAGIC || h->version != CACHE_VERSION ||
+        h->size != (uint64_t)st.st_size) {
+        fprintf(stderr, "Ignoring %s, it was not compiled by this build\n",
+                path);
+    } else if (h->source_hash != hash) {
+        // edited since it was compiled, quietly parse instead
+    } else if (!cache_valid(h, base)) {
+        fprintf(stderr, "Ignoring damaged cache %s\n", path);
+    } else {
+        status = cache_fill(config, base, st.st_size);
+    }
+
+    if (status != 0) {
+        free_config(config);
+        munmap(base, st.st_size);
+    }
+    free(path);
+    return status;
+}
@@ -1,17 +1,22 @@
-#include <stddef.h>
 #define _GNU_SOURCE
 #include "config.h"
 
+#include "tokenizer.h"
+
 #include <arpa/inet.h>
-#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
-
-#define MAX_KEY_PARTS 3
+#include <unistd.h>
 
 typedef enum {
     CONFIG_KEY_UNKNOWN,
@@ -21,305 +26,718 @@ typedef enum {
     CONFIG_KEY_BRIDGE,
     CONFIG_KEY_FIREWALL_FORWARD_DEFAULT,
     CONFIG_KEY_FIREWALL_ALLOW_FORWARD,
-    CONFIG_KEY_ENABLE_NAT
+    CONFIG_KEY_ENABLE_NAT,
+    CONFIG_KEY_FLOW_OFFLOAD,
+    CONFIG_KEY_DATAPLANE,
+    CONFIG_KEY_CONNTRACK_FLOWS,
+    CONFIG_KEY_DATAPLANE_WORKERS
 } config_key_t;
 
-config_key_t map_config_key(char *key, char *key_parts[], int *num_parts) {
-    *num_parts = 0;
-    char *token;
-    char *rest = key;
-
-    // Simple on dot
-    while ((token = strtok_r(rest, ".", &rest)) != NULL &&
-           *num_parts < MAX_KEY_PARTS) {
-        key_parts[*num_parts] = token;
-        (*num_parts)++;
-    }
-
-    if (*num_parts == 0)
-        return CONFIG_KEY_UNKNOWN; // empty key
-
-    const char *base_key = key_parts[0];
-
-    if (strcmp(base_key, "enable_ipv4_forwarding") == 0)
-        return CONFIG_KEY_ENABLE_IPV4_FORWARDING;
-    if (strcmp(base_key, "nat_outgoing_interface") == 0)
-        return CONFIG_KEY_NAT_OUTGOING_INTERFACE;
-    if (strcmp(base_key, "namespace") == 0)
-        return CONFIG_KEY_NAMESPACE;
-    if (strcmp(base_key, "bridge") == 0)
-        return CONFIG_KEY_BRIDGE;
-    if (strcmp(base_key, "firewall_forward_default") == 0)
-        return CONFIG_KEY_FIREWALL_FORWARD_DEFAULT;
-    if (strcmp(base_key, "firewall_allow_forward") == 0)
-        return CONFIG_KEY_FIREWALL_ALLOW_FORWARD;
-    if (strcmp(base_key, "enable_nat") == 0)
-        return CONFIG_KEY_ENABLE_NAT;
-
+#define KEY_IS(key, literal)                                                   \
+    ((key).len == sizeof literal - 1 &&                                        \
+     memcmp((key).data, literal, sizeof literal - 1) == 0)
+
+/*
+ * The key set is fixed, so the length and one distinguishing byte pick the
+ * only candidate and a single memcmp confirms it.
+ */
+static config_key_t map_config_key(strview_t key) {
+    switch (key.len) {
+    case 6:
+        return KEY_IS(key, "bridge") ? CONFIG_KEY_BRIDGE : CONFIG_KEY_UNKNOWN;
+    case 9:
+        if (key.data[0] == 'd') {
+            return KEY_IS(key, "dataplane") ? CONFIG_KEY_DATAPLANE
+                                            : CONFIG_KEY_UNKNOWN;
+        }
+        return KEY_IS(key, "namespace") ? CONFIG_KEY_NAMESPACE
+                                        : CONFIG_KEY_UNKNOWN;
+    case 10:
+        return KEY_IS(key, "enable_nat") ? CONFIG_KEY_ENABLE_NAT
+                                         : CONFIG_KEY_UNKNOWN;
+    case 12:
+        return KEY_IS(key, "flow_offload") ? CONFIG_KEY_FLOW_OFFLOAD
+                                           : CONFIG_KEY_UNKNOWN;
+    case 15:
+        return KEY_IS(key, "conntrack_flows") ? CONFIG_KEY_CONNTRACK_FLOWS
+                                              : CONFIG_KEY_UNKNOWN;
+    case 17:
+        return KEY_IS(key, "dataplane_workers") ? CONFIG_KEY_DATAPLANE_WORKERS
+                                                : CONFIG_KEY_UNKNOWN;
+    case 22:
+        switch (key.data[0]) {
+        case 'e':
+            return KEY_IS(key, "enable_ipv4_forwarding")
+                       ? CONFIG_KEY_ENABLE_IPV4_FORWARDING
+                       : CONFIG_KEY_UNKNOWN;
+        case 'n':
+            return KEY_IS(key, "nat_outgoing_interface")
+                       ? CONFIG_KEY_NAT_OUTGOING_INTERFACE
+                       : CONFIG_KEY_UNKNOWN;
+        case 'f':
+            return KEY_IS(key, "firewall_allow_forward")
+                       ? CONFIG_KEY_FIREWALL_ALLOW_FORWARD
+                       : CONFIG_KEY_UNKNOWN;
+        }
+        return CONFIG_KEY_UNKNOWN;
+    case 24:
+        return KEY_IS(key, "firewall_forward_default")
+                   ? CONFIG_KEY_FIREWALL_FORWARD_DEFAULT
+                   : CONFIG_KEY_UNKNOWN;
+    }
     return CONFIG_KEY_UNKNOWN;
 }
 
+static int parse_cidr_view(strview_t cidr, struct in_addr *addr,
+                           u_int8_t *mask) {
+    const char *slash = memchr(cidr.data, '/', cidr.len);
+    if (slash == NULL) {
+        return -1; /* Invalid cidr_str */
+    }
+
+    /* Convert IP address string to binary */
+    strview_t ip = {cidr.data, slash - cidr.data};
+    if (view_to_ipv4(ip, addr) != 0) {
+        return -1; /* Invalid IP */
+    }
+
+    const char *digit = slash + 1;
+    const char *end = cidr.data + cidr.len;
+    unsigned mask_val = 0;
+    if (digit == end || end - digit > 2) {
+        return -1; /* Invalid mask */
+    }
+    for (; digit < end; digit++) {
+        if (*digit < '0' || *digit > '9') {
+            return -1; /* Invalid mask */
+        }
+        mask_val = mask_val * 10 + (*digit - '0');
+    }
+    if (mask_val > 32) {
+        return -1; /* Invalid mask */
+    }
+    *mask = (u_int8_t)mask_val;
+
+    return 0;
+}
+
 int parse_cidr(const char *cidr_str, struct in_addr *addr, u_int8_t *mask) {
-    char cidr_copy[32];
-    char *ip_str, *mask_str;
+    return parse_cidr_view(view_of(cidr_str), addr, mask);
+}
 
-    if (strlen(cidr_str) >= sizeof cidr_copy) {
-        return -1; /* Input too long */
+/* Name field of the first entry, the base the name index strides from */
+#define NAMESPACE_NAMES(config)                                                \
+    ((const char *)(config)->namespaces + offsetof(namespace_t, name))
+#define BRIDGE_NAMES(config)                                                   \
+    ((const char *)(config)->bridges + offsetof(bridge_t, name))
+#define ENTRY_NAME(names, stride, entry)                                       \
+    (*(const char *const *)((names) + (size_t)(entry) * (stride)))
+
+static uint32_t hash_name(strview_t name) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < name.len; i++) {
+        hash = (hash ^ (unsigned char)name.data[i]) * 16777619u;
     }
+    return hash;
+}
 
-    strncpy(cidr_copy, cidr_str, sizeof(cidr_copy) - 1);
+static int strtab_probe(const strtab_t *tab, strview_t s) {
+    uint32_t mask = tab->capacity - 1;
+    for (uint32_t slot = hash_name(s) & mask;; slot = (slot + 1) & mask) {
+        if (tab->slots[slot] == NULL || view_equals(s, tab->slots[slot])) {
+            return slot;
+        }
+    }
+}
 
-    ip_str = strtok(cidr_copy, "/");
-    if (!ip_str) {
-        return -1; /* Invalid cidr_str */
+/*
+ * Return the single copy of a name, truncated to MAX_NAME_LEN - 1 bytes as
+ * the fixed-size fields it replaces were. Thousands of namespaces behind one
+ * bridge then share one "bridge:br0" string.
+ */
+static const char *intern_name(config_t *config, strview_t name) {
+    if (name.len > MAX_NAME_LEN - 1) {
+        name.len = MAX_NAME_LEN - 1;
     }
 
-    mask_str = strtok(NULL, "/");
-    if (!mask_str) {
-        return -1; /* Invalid cidr_str */
+    strtab_t *tab = &config->names;
+    if (2 * (tab->count + 1) > tab->capacity) {
+        strtab_t grown = {.capacity = tab->capacity ? tab->capacity * 2 : 64,
+                          .count = tab->count};
+        grown.slots =
+            arena_alloc(&config->arena, grown.capacity * sizeof *grown.slots);
+        if (grown.slots == NULL) {
+            return NULL;
+        }
+        for (int i = 0; i < tab->capacity; i++) {
+            if (tab->slots[i] != NULL) {
+                grown.slots[strtab_probe(&grown, view_of(tab->slots[i]))] =
+                    tab->slots[i];
+            }
+        }
+        *tab = grown;
     }
 
-    /* Convert IP address string to binary */
-    if (inet_pton(AF_INET, ip_str, addr) != 1) {
-        return -1; /* Invalid IP */
+    int slot = strtab_probe(tab, name);
+    if (tab->slots[slot] == NULL) {
+        // the arena hands out zeroed memory, the terminator is already there
+        char *copy = arena_alloc(&config->arena, name.len + 1);
+        if (copy == NULL) {
+            return NULL;
+        }
+        tab->slots[slot] = memcpy(copy, name.data, name.len);
+        tab->count++;
     }
+    return tab->slots[slot];
+}
 
-    char *end_ptr;
-    long mask_val = strtol(mask_str, &end_ptr, 10);
-    if (*end_ptr != '\0' || mask_val < 0 || mask_val > 32) {
-        return -1; /* Invalid mask */
+/*
+ * Entries point at their interned name; the pointer of an entry is found at
+ * names + index * stride. Returns the slot holding name, or the empty slot
+ * where it would go.
+ */
+static int index_probe(const name_index_t *index, const char *names,
+                       size_t stride, strview_t name) {
+    uint32_t mask = index->capacity - 1;
+    for (uint32_t slot = hash_name(name) & mask;; slot = (slot + 1) & mask) {
+        int entry = index->slots[slot];
+        if (entry == 0 ||
+            view_equals(name, ENTRY_NAME(names, stride, entry - 1))) {
+            return slot;
+        }
     }
-    *mask = (u_int8_t)mask_val;
+}
+
+static int index_lookup(const name_index_t *index, const char *names,
+                        size_t stride, strview_t name) {
+    if (index->capacity == 0) {
+        return -1;
+    }
+    return index->slots[index_probe(index, names, stride, name)] - 1;
+}
 
+/* Index entry `entry`; a later entry with the same name replaces it */
+static int index_insert(arena_t *arena, name_index_t *index, const char *names,
+                        size_t stride, int entry) {
+    // keep the load factor at or below one half
+    if (2 * (entry + 1) > index->capacity) {
+        name_index_t grown = {.capacity = index->capacity ? index->capacity * 2
+                                                           : 64};
+        while (2 * (entry + 1) > grown.capacity) {
+            grown.capacity *= 2;
+        }
+        grown.slots = arena_alloc(arena, grown.capacity * sizeof *grown.slots);
+        if (grown.slots == NULL) {
+            return -1;
+        }
+        for (int i = 0; i < entry; i++) {
+            grown.slots[index_probe(&grown, names, stride,
+                                    view_of(ENTRY_NAME(names, stride, i)))] =
+                i + 1;
+        }
+        *index = grown;
+    }
+
+    index->slots[index_probe(index, names, stride,
+                             view_of(ENTRY_NAME(names, stride, entry)))] =
+        entry + 1;
     return 0;
 }
 
-int parse_config_file(const char *filename, config_t *config) {
-    FILE *fd = fopen(filename, "r");
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t read;
+static bridge_t *find_bridge(const config_t *config, strview_t br_name) {
+    int i = index_lookup(&config->br_index, BRIDGE_NAMES(config),
+                         sizeof *config->bridges, br_name);
+    return i < 0 ? NULL : &config->bridges[i];
+}
 
-    if (fd == NULL) {
-        perror("Failed to open config file");
-        return -1;
+static namespace_t *find_namespace(const config_t *config, strview_t ns_name) {
+    int i = index_lookup(&config->ns_index, NAMESPACE_NAMES(config),
+                         sizeof *config->namespaces, ns_name);
+    return i < 0 ? NULL : &config->namespaces[i];
+}
+
+bridge_t *find_bridge_by_name(const config_t *config, const char *br_name) {
+    return find_bridge(config, view_of(br_name));
+}
+
+namespace_t *find_namespace_by_name(const config_t *config,
+                                    const char *ns_name) {
+    return find_namespace(config, view_of(ns_name));
+}
+
+/* Append a namespace with only its name set; a name may be taken once */
+static namespace_t *add_namespace(config_t *config, strview_t name) {
+    if (find_namespace(config, name) != NULL) {
+        fprintf(stderr, "Namespace %.*s is declared twice\n", (int)name.len,
+                name.data);
+        return NULL;
     }
+    namespace_t *ns = arena_push(&config->arena, &config->namespaces,
+                                 config->namespace_count,
+                                 &config->namespace_cap, sizeof(namespace_t));
+    if (ns == NULL) {
+        return NULL; // Memory allocation failed
+    }
+    ns->name = intern_name(config, name);
+    ns->connect_name = "";
+    if (ns->name == NULL) {
+        return NULL; // Memory allocation failed
+    }
+    config->namespace_count++;
+    if (index_insert(&config->arena, &config->ns_index,
+                     NAMESPACE_NAMES(config), sizeof *config->namespaces,
+                     config->namespace_count - 1) != 0) {
+        return NULL; // Memory allocation failed
+    }
+    return ns;
+}
 
-    int status = 0;
-    while ((read = getline(&line, &len, fd)) != -1) {
-        status = parse_config_line(line, config);
-        if (status != 0) {
-            break; // parse failed
+/* Append the instances of a range unless they are there already */
+static int expand_template(config_t *config, ns_template_t *tpl) {
+    if (tpl->first_ns >= 0) {
+        return 0;
+    }
+    tpl->first_ns = config->namespace_count;
+    config->ns_templates_expanded++;
+    for (uint32_t k = 0; k <= tpl->last - tpl->first; k++) {
+        char name[MAX_NAME_LEN];
+        int len =
+            snprintf(name, sizeof name, "%s%u", tpl->base, tpl->first + k);
+        namespace_t *ns = add_namespace(config, (strview_t){name, len});
+        if (ns == NULL) {
+            return -1;
         }
+        const char *interned = ns->name;
+        *ns = tpl->proto;
+        ns->name = interned;
     }
+    return 0;
+}
 
-    fclose(fd);
-    if (line) {
-        free(line);
+int config_expand(config_t *config) {
+    for (int i = 0; config->ns_templates_expanded < config->ns_template_count;
+         i++) {
+        if (expand_template(config, &config->ns_templates[i]) != 0) {
+            return -1;
+        }
     }
+    return 0;
+}
 
-    return status;
+/* Parse an unsigned decimal number of at most nine digits */
+static int parse_number(strview_t view, uint32_t *number) {
+    if (view.len == 0 || view.len > 9) {
+        return -1;
+    }
+    *number = 0;
+    for (size_t i = 0; i < view.len; i++) {
+        if (view.data[i] < '0' || view.data[i] > '9') {
+            return -1;
+        }
+        *number = *number * 10 + (view.data[i] - '0');
+    }
+    return 0;
 }
 
-char *ltrim(char *s) {
-    while (isspace(*s))
-        s++;
-    return s;
+/*
+ * Whether name is the base followed by a number of the range, written the
+ * way expand_template() prints it
+ */
+static bool in_template(const ns_template_t *tpl, strview_t name) {
+    size_t base_len = strlen(tpl->base);
+    strview_t digits = {name.data + base_len, name.len - base_len};
+    uint32_t number;
+    return name.len > base_len && memcmp(name.data, tpl->base, base_len) == 0 &&
+           (digits.data[0] != '0' || digits.len == 1) &&
+           parse_number(digits, &number) == 0 && number >= tpl->first &&
+           number <= tpl->last;
 }
 
-char *rtrim(char *s) {
-    char *back = s + strlen(s);
-    while (back > s && isspace(*--back))
-        ;
-    *(back + 1) = '\0';
-    return s;
+/*
+ * Look a namespace up, expanding only the range it is an instance of; a
+ * misspelled name expands nothing
+ */
+static namespace_t *resolve_namespace(config_t *config, strview_t name) {
+    namespace_t *ns = find_namespace(config, name);
+    for (int i = 0; ns == NULL && i < config->ns_template_count; i++) {
+        ns_template_t *tpl = &config->ns_templates[i];
+        if (tpl->first_ns < 0 && in_template(tpl, name)) {
+            if (expand_template(config, tpl) != 0) {
+                return NULL;
+            }
+            ns = find_namespace(config, name);
+        }
+    }
+    return ns;
 }
 
-char *trim(char *s) { return rtrim(ltrim(s)); }
+/* namespace = base[first..last] */
+static int parse_template(strview_t value, config_t *config) {
+    const char *open = memchr(value.data, '[', value.len);
+    const char *close = value.data + value.len - 1;
+    const char *dots = open ? memchr(open, '.', close - open) : NULL;
+    strview_t base = {value.data, open ? open - value.data : 0};
+    uint32_t first, last;
+    if (base.len == 0 || dots == NULL || dots[1] != '.' ||
+        parse_number((strview_t){open + 1, dots - open - 1}, &first) != 0 ||
+        parse_number((strview_t){dots + 2, close - dots - 2}, &last) != 0 ||
+        first > last || last - first >= TEMPLATE_MAX_INSTANCES) {
+        fprintf(stderr, "Invalid namespace range %.*s\n", (int)value.len,
+                value.data);
+        return -1;
+    }
+    char digits[16];
+    if (base.len + snprintf(digits, sizeof digits, "%u", last) >=
+        MAX_NAME_LEN) {
+        fprintf(stderr, "Names in namespace range %.*s are too long\n",
+                (int)value.len, value.data);
+        return -1;
+    }
 
-bridge_t *find_bridge_by_name(config_t *config, const char *br_name) {
-    bridge_t *br = NULL;
+    ns_template_t *tpl = arena_push(&config->arena, &config->ns_templates,
+                                    config->ns_template_count,
+                                    &config->ns_template_cap,
+                                    sizeof(ns_template_t));
+    if (tpl == NULL) {
+        return -1; // Memory allocation failed
+    }
+    tpl->base = intern_name(config, base);
+    if (tpl->base == NULL) {
+        return -1; // Memory allocation failed
+    }
+    tpl->first = first;
+    tpl->last = last;
+    tpl->first_ns = -1;
+    tpl->proto.connect_name = "";
+    config->ns_template_count++;
+    return 0;
+}
 
-    for (int i = 0; i < config->bridge_count; i++) {
-        if (strcmp(config->bridges[i].name, br_name) == 0) {
-            br = &config->bridges[i];
+/* Range named by a "base[*]" key part; a later range wins like names do */
+static ns_template_t *find_template(const config_t *config, strview_t key) {
+    strview_t base = {key.data, key.len - 3};
+    for (int i = config->ns_template_count - 1; i >= 0; i--) {
+        if (view_equals(base, config->ns_templates[i].base)) {
+            return &config->ns_templates[i];
         }
     }
+    return NULL;
+}
 
-    return br;
+static bool is_template_key(strview_t key) {
+    return key.len > 3 && memcmp(key.data + key.len - 3, "[*]", 3) == 0;
 }
 
-namespace_t *find_namespace_by_name(config_t *config, const char *ns_name) {
-    namespace_t *ns = NULL;
+static bool is_template_value(strview_t value) {
+    return value.data[value.len - 1] == ']' &&
+           memchr(value.data, '[', value.len) != NULL;
+}
 
-    for (int i = 0; i < config->namespace_count; i++) {
-        if (strcmp(config->namespaces[i].name, ns_name) == 0) {
-            ns = &config->namespaces[i];
+/*
+ * ip = auto takes an address from the subnet of the bridge, ip = <cidr> auto
+ * one from that subnet; either is handed out by config_assign_addresses()
+ */
+static int parse_namespace_ip(strview_t value, namespace_t *ns) {
+    ns->auto_ip = false;
+    if (view_equals(value, "auto")) {
+        ns->auto_ip = true;
+        ns->ip_addr.s_addr = 0;
+        ns->mask = 0;
+        return 0;
+    }
+    const char *blank = memchr(value.data, ' ', value.len);
+    if (blank == NULL) {
+        blank = memchr(value.data, '\t', value.len);
+    }
+    if (blank != NULL) {
+        strview_t word = {blank, value.data + value.len - blank};
+        while (word.len > 0 && (*word.data == ' ' || *word.data == '\t')) {
+            word.data++;
+            word.len--;
+        }
+        if (!view_equals(word, "auto")) {
+            return -1;
         }
+        ns->auto_ip = true;
+        value.len = blank - value.data;
+    }
+    if (parse_cidr_view(value, &ns->ip_addr, &ns->mask) != 0) {
+        return -1;
+    }
+    if (ns->auto_ip) {
+        uint32_t netmask = ns->mask == 0 ? 0 : ~0u << (32 - ns->mask);
+        ns->ip_addr.s_addr &= htonl(netmask);
     }
+    return 0;
+}
 
-    return ns;
+static int set_namespace_prop(config_t *config, namespace_t *ns,
+                              strview_t ns_prop, strview_t value) {
+    if (view_equals(ns_prop, "ip")) {
+        return parse_namespace_ip(value, ns);
+    } else if (view_equals(ns_prop, "gateway")) {
+        return view_to_ipv4(value, &ns->gateway);
+    } else if (view_equals(ns_prop, "connect_via")) {
+        ns->connect_type =
+            view_equals(value, "veth") ? CONNECT_VETH : CONNECT_BRIDGE;
+        ns->connect_name = intern_name(config, value);
+        return ns->connect_name != NULL ? 0 : -1;
+    }
+    fprintf(stderr, "Unknown namespace property %.*s\n", (int)ns_prop.len,
+            ns_prop.data);
+    return -1; // Invalid prop
 }
 
-int parse_config_line(char *line, config_t *config) {
-    if (line == NULL || config == NULL) {
+/* namespace.base[*].prop = value sets a property of every instance */
+static int set_template_prop(config_t *config, ns_template_t *tpl,
+                             strview_t ns_prop, strview_t value) {
+    namespace_t *proto = &tpl->proto;
+    if (set_namespace_prop(config, proto, ns_prop, value) != 0) {
+        return -1;
+    }
+
+    // instances take the addresses after the gateway, before broadcast
+    uint64_t size = 1ull << (32 - proto->mask);
+    if (view_equals(ns_prop, "ip") && proto->auto_ip && proto->mask > 0 &&
+        tpl->last - tpl->first + 3ull > size) {
+        fprintf(stderr, "%u namespaces do not fit in %.*s\n",
+                tpl->last - tpl->first + 1, (int)value.len, value.data);
         return -1;
     }
 
-    char *trimmed = trim(line);
+    // instances that already exist follow the range for this property only
+    for (uint32_t k = 0; tpl->first_ns >= 0 && k <= tpl->last - tpl->first;
+         k++) {
+        namespace_t *ns = &config->namespaces[tpl->first_ns + k];
+        if (view_equals(ns_prop, "ip")) {
+            ns->ip_addr = proto->ip_addr;
+            ns->mask = proto->mask;
+            ns->auto_ip = proto->auto_ip;
+        } else if (view_equals(ns_prop, "gateway")) {
+            ns->gateway = proto->gateway;
+        } else {
+            ns->connect_type = proto->connect_type;
+            ns->connect_name = proto->connect_name;
+        }
+    }
+    return 0;
+}
+
+static int parse_namespace(const config_token_t *token, config_t *config) {
+    strview_t value = token->value;
+    if (token->num_parts == 1) {
+        if (is_template_value(value)) {
+            return parse_template(value, config);
+        }
+        return add_namespace(config, value) != NULL ? 0 : -1;
+    }
+    if (token->num_parts != 3) {
+        return -1; // Invalid key
+    }
+
+    strview_t ns_prop = token->key[2];
+    if (is_template_key(token->key[1])) {
+        ns_template_t *tpl = find_template(config, token->key[1]);
+        if (tpl == NULL) {
+            return -1; // Range not defined
+        }
+        return set_template_prop(config, tpl, ns_prop, value);
+    }
+
+    namespace_t *ns = resolve_namespace(config, token->key[1]);
+    if (ns == NULL) {
+        return -1; // Namespace not defined
+    }
+    return set_namespace_prop(config, ns, ns_prop, value);
+}
 
-    // ignore comments and empty lines
-    if (*trimmed == '#' || *trimmed == '\0') {
+/* Resolve one side of a rule to INTERNET or the index of a namespace */
+static int parse_endpoint(config_t *config, strview_t name, endpoint_t *type,
+                          int *ns_index) {
+    *ns_index = -1;
+    if (view_equals(name, "INTERNET")) {
+        *type = ENDPOINT_INTERNET;
         return 0;
     }
 
-    // get key and value trimmed
-    char *key = strtok(trimmed, "=");
-    if (key == NULL) {
-        return -1; /* Invalid line */
+    *type = ENDPOINT_NS;
+    const namespace_t *ns = resolve_namespace(config, name);
+    if (ns == NULL) {
+        fprintf(stderr, "Firewall rule references unknown namespace %.*s\n",
+                (int)name.len, name.data);
+        return -1;
     }
-    key = trim(key);
-    char *value = strtok(NULL, "=");
-    if (value == NULL) {
-        return -1; /* Invalid line */
+    *ns_index = ns - config->namespaces;
+    return 0;
+}
+
+/* Next blank-separated word of a view, consumed from its front */
+static strview_t next_word(strview_t *rest) {
+    while (rest->len > 0 && (*rest->data == ' ' || *rest->data == '\t')) {
+        rest->data++;
+        rest->len--;
+    }
+    strview_t word = {rest->data, 0};
+    while (word.len < rest->len && word.data[word.len] != ' ' &&
+           word.data[word.len] != '\t') {
+        word.len++;
     }
-    value = trim(value);
+    rest->data += word.len;
+    rest->len -= word.len;
+    return word;
+}
+
+static int parse_fw_rule_view(strview_t rule_str, config_t *config,
+                              fw_rule_t *rule) {
+    rule->action = FW_ALLOW;
 
-    // remove end of line comments
-    char *comment = strchr(value, '#');
-    if (comment) {
-        *comment = '\0';
+    /* Parse string */
+    strview_t src_name = next_word(&rule_str);
+    strview_t arrow = next_word(&rule_str);
+    strview_t dst_name = next_word(&rule_str);
+    if (src_name.len == 0 || !view_equals(arrow, "->") || dst_name.len == 0 ||
+        next_word(&rule_str).len != 0) {
+        return -1; /* Invalid rule_str */
     }
-    value = trim(value);
 
-    char *key_parts[MAX_KEY_PARTS];
-    int num_parts = 0;
-    config_key_t key_t = map_config_key(key, key_parts, &num_parts);
+    /* Assign to rule struct */
+    if (parse_endpoint(config, src_name, &rule->src_type, &rule->src_ns) != 0) {
+        return -1; /* Undefined namespace */
+    }
+    if (parse_endpoint(config, dst_name, &rule->dst_type, &rule->dst_ns) != 0) {
+        return -1; /* Undefined namespace */
+    }
 
-    switch (key_t) {
-    case CONFIG_KEY_ENABLE_IPV4_FORWARDING:
-        if (num_parts != 1) {
-            return -1; // only top level
+    return 0;
+}
+
+int parse_fw_rule(const char *rule_str, config_t *config, fw_rule_t *rule) {
+    if (rule_str == NULL || config == NULL || rule == NULL) {
+        return -1;
+    }
+    return parse_fw_rule_view(view_of(rule_str), config, rule);
+}
+
+static int parse_bridge(const config_token_t *token, config_t *config) {
+    if (token->num_parts == 1) {
+        bridge_t *br = arena_push(&config->arena, &config->bridges,
+                                  config->bridge_count, &config->bridge_cap,
+                                  sizeof(bridge_t));
+        if (br == NULL) {
+            return -1; // Memory allocation failed
+        }
+        br->name = intern_name(config, token->value);
+        if (br->name == NULL) {
+            return -1; // Memory allocation failed
         }
-        config->ipv4_forwrd = strcmp(value, "true") == 0;
+        config->bridge_count++;
+        return index_insert(&config->arena, &config->br_index,
+                            BRIDGE_NAMES(config), sizeof *config->bridges,
+                            config->bridge_count - 1);
+    }
+    if (token->num_parts != 3) {
+        return -1; // Invalid key
+    }
+
+    bridge_t *br = find_bridge(config, token->key[1]);
+    if (br == NULL) {
+        return -1; // Bridge not defined
+    }
+    if (view_equals(token->key[2], "ip")) {
+        return parse_cidr_view(token->value, &br->ip_addr, &br->mask);
+    }
+    return -1; // Invalid prop
+}
+
+static int parse_config_token(const config_token_t *token, config_t *config) {
+    strview_t value = token->value;
+    config_key_t key = map_config_key(token->key[0]);
+
+    // only namespaces and bridges have properties
+    if (token->num_parts != 1 && key != CONFIG_KEY_NAMESPACE &&
+        key != CONFIG_KEY_BRIDGE) {
+        return -1;
+    }
+
+    switch (key) {
+    case CONFIG_KEY_ENABLE_IPV4_FORWARDING:
+        config->ipv4_forwrd = view_equals(value, "true");
         break;
     case CONFIG_KEY_NAT_OUTGOING_INTERFACE:
-        if (num_parts != 1) {
-            return -1; // only top level
-        }
-        strncpy(config->nat_outgoing_interface, value,
-                sizeof(config->nat_outgoing_interface) - 1);
+        memset(config->nat_outgoing_interface, 0,
+               sizeof config->nat_outgoing_interface);
+        memcpy(config->nat_outgoing_interface, value.data,
+               value.len < sizeof config->nat_outgoing_interface
+                   ? value.len
+                   : sizeof config->nat_outgoing_interface - 1);
         break;
     case CONFIG_KEY_NAMESPACE:
-        if (num_parts == 1) {
-            config->namespace_count++;
-            config->namespaces =
-                realloc(config->namespaces,
-                        config->namespace_count * sizeof(namespace_t));
-            if (config->namespaces == NULL) {
-                return -1; // Memory allocation failed
-            }
-            namespace_t *ns = &config->namespaces[config->namespace_count - 1];
-            strncpy(ns->name, value, sizeof(ns->name) - 1);
-        } else if (num_parts == 3) {
-            const char *ns_name = key_parts[1];
-            const char *ns_prop = key_parts[2];
-            namespace_t *ns = find_namespace_by_name(config, ns_name);
-            if (ns == NULL) {
-                return -1; // Namespace not defined
-            }
-
-            if (strcmp(ns_prop, "ip") == 0) {
-                if (parse_cidr(value, &ns->ip_addr, &ns->mask) != 0) {
-                    printf("HERE1");
-                    return -1; // Invalid IP address
-                }
-            } else if (strcmp(ns_prop, "gateway") == 0) {
-                if (inet_pton(AF_INET, value, &ns->gateway) != 1) {
-                    printf("HERE2");
-                    return -1; // Invalid IP
-                }
-            } else if (strcmp(ns_prop, "connect_via") == 0) {
-                if (strcmp(value, "veth") == 0) {
-                    ns->connect_type = CONNECT_VETH;
-                } else {
-                    ns->connect_type = CONNECT_BRIDGE;
-                }
-                strncpy(ns->connect_name, value, sizeof(ns->connect_name) - 1);
-            } else {
-                printf("prop: %s\n", ns_prop);
-                return -1; // Invalid prop
-            }
-        }
-        break;
+        return parse_namespace(token, config);
     case CONFIG_KEY_BRIDGE:
-        if (num_parts == 1) {
-            config->bridge_count++;
-            config->bridges = realloc(config->bridges,
-                                      config->bridge_count * sizeof(bridge_t));
-            if (config->bridges == NULL) {
-                return -1; // Memory allocation failed
-            }
-            bridge_t *br = &config->bridges[config->bridge_count - 1];
-            strncpy(br->name, value, sizeof(br->name) - 1);
-        } else if (num_parts == 3) {
-            const char *br_name = key_parts[1];
-            const char *br_prop = key_parts[2];
-            bridge_t *br = find_bridge_by_name(config, br_name);
-            if (br == NULL) {
-                return -1; // Bridge not defined
-            }
-
-            if (strcmp(br_prop, "ip") == 0) {
-                if (parse_cidr(value, &br->ip_addr, &br->mask) != 0) {
-                    return -1; // Invalid IP address
-                }
-            } else {
-                return -1; // Invalid prop
-            }
-        }
-        break;
+        return parse_bridge(token, config);
     case CONFIG_KEY_FIREWALL_FORWARD_DEFAULT:
-        if (num_parts != 1) {
-            return -1; // only top level
-        }
-        if (strcmp(value, "ALLOW") == 0) {
+        if (view_equals(value, "ALLOW")) {
             config->fw_default_action = FW_ALLOW;
-        } else if (strcmp(value, "DROP") == 0) {
+        } else if (view_equals(value, "DROP")) {
             config->fw_default_action = FW_DROP;
         } else {
             return -1; // invalid firewall rule
         }
         break;
-    case CONFIG_KEY_FIREWALL_ALLOW_FORWARD:
-        if (num_parts != 1) {
-            return -1; // only top level
-        }
-        config->fw_rule_count++;
-        config->fw_rules = realloc(config->fw_rules,
-                                   config->fw_rule_count * sizeof(fw_rule_t));
-        if (config->fw_rules == NULL) {
+    case CONFIG_KEY_FIREWALL_ALLOW_FORWARD: {
+        fw_rule_t *fw_rule = arena_push(&config->arena, &config->fw_rules,
+                                        config->fw_rule_count,
+                                        &config->fw_rule_cap,
+                                        sizeof(fw_rule_t));
+        if (fw_rule == NULL) {
             return -1; // Memory allocation failed
         }
-        fw_rule_t *fw_rule = &config->fw_rules[config->fw_rule_count - 1];
-        if (parse_fw_rule(value, fw_rule) != 0) {
+        if (parse_fw_rule_view(value, config, fw_rule) != 0) {
             return -1; // Invalid FW rule
         }
+        config->fw_rule_count++;
         break;
-    case CONFIG_KEY_ENABLE_NAT:
-        if (num_parts != 1) {
-            return -1; // only top level
-        }
-        config->nat_rule_count++;
-        config->nat_rules = realloc(
-            config->nat_rules, (config->nat_rule_count * sizeof(nat_rule_t)));
-        if (config->nat_rules == NULL) {
+    }
+    case CONFIG_KEY_ENABLE_NAT: {
+        nat_rule_t *nat_rule = arena_push(&config->arena, &config->nat_rules,
+                                          config->nat_rule_count,
+                                          &config->nat_rule_cap,
+                                          sizeof(nat_rule_t));
+        if (nat_rule == NULL) {
             return -1; // Memory allocation failed
         }
-        nat_rule_t *nat_rule = &config->nat_rules[config->nat_rule_count - 1];
-        if (parse_cidr(value, &nat_rule->network, &nat_rule->mask) != 0) {
+        if (parse_cidr_view(value, &nat_rule->network, &nat_rule->mask) !=
+            0) {
             return -1; // Invalid CIDR
         }
+        config->nat_rule_count++;
+        break;
+    }
+    case CONFIG_KEY_FLOW_OFFLOAD:
+        config->flow_offload = view_equals(value, "true");
+        break;
+    case CONFIG_KEY_DATAPLANE:
+        if (view_equals(value, "kernel")) {
+            config->dataplane = DATAPLANE_KERNEL;
+        } else if (view_equals(value, "afxdp")) {
+            config->dataplane = DATAPLANE_AFXDP;
+        } else {
+            return -1; // Unknown data plane
+        }
+        break;
+    case CONFIG_KEY_CONNTRACK_FLOWS:
+        if (view_to_u32(value, &config->conntrack_flows) != 0 ||
+            config->conntrack_flows < CONNTRACK_FLOWS_MIN ||
+            config->conntrack_flows > CONNTRACK_FLOWS_MAX) {
+            return -1; // Not a number, or a table too small or too large
+        }
+        break;
+    case CONFIG_KEY_DATAPLANE_WORKERS:
+        if (view_to_u32(value, &config->dataplane_workers) != 0 ||
+            config->dataplane_workers < 1 ||
+            config->dataplane_workers > DATAPLANE_WORKERS_MAX) {
+            return -1; // Not a number, or no or too many threads
+        }
         break;
     case CONFIG_KEY_UNKNOWN:
         return -1;
@@ -328,42 +746,276 @@ int parse_config_line(char *line, config_t *config) {
     return 0;
 }
 
-int parse_fw_rule(const char *rule_str, fw_rule_t *rule) {
-    if (rule_str == NULL || rule == NULL) {
+/* Parse every line of a buffer, reporting the number of a bad one */
+static int parse_config_buffer(const char *data, size_t len, config_t *config,
+                               int *line) {
+    tokenizer_t tok;
+    tokenizer_init(&tok, data, len);
+
+    config_token_t token;
+    int status;
+    while ((status = tokenizer_next(&tok, &token)) > 0) {
+        if (parse_config_token(&token, config) != 0) {
+            status = -1;
+            break;
+        }
+    }
+    *line = tok.line;
+    return status;
+}
+
+int parse_config_line(char *line, config_t *config) {
+    if (line == NULL || config == NULL) {
         return -1;
     }
+    int line_number;
+    return parse_config_buffer(line, strlen(line), config, &line_number);
+}
 
-    rule->action = FW_ALLOW;
+/*
+ * The file is mapped and tokenized in place: no line is read into a buffer
+ * and no token is copied before it is stored in the configuration.
+ */
+int parse_config_file(const char *filename, config_t *config) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("Failed to open config file");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("Failed to open config file");
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0; // nothing to map
+    }
 
-    char rule_str_cpy[64];
-    if (strlen(rule_str) >= sizeof rule_str_cpy) {
-        return -1; /* Input too long */
+    const char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", filename, strerror(errno));
+        return -1;
     }
-    strncpy(rule_str_cpy, rule_str, sizeof(rule_str_cpy) - 1);
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
 
-    /* Parse string */
-    char *src_name = strtok(rule_str_cpy, " ");
-    if (!src_name) {
-        return -1; /* Invalid rule_str */
+    int line;
+    int status = parse_config_buffer(data, st.st_size, config, &line);
+    if (status != 0) {
+        fprintf(stderr, "%s:%d: Invalid configuration line\n", filename,
+                line);
     }
-    /* Drop -> */
-    strtok(NULL, " ");
-    char *dst_name = strtok(NULL, " ");
-    if (!dst_name) {
-        return -1; /* Invalid rule_str */
+
+    munmap((void *)data, st.st_size);
+    return status;
+}
+
+/* Pools of a configuration, sorted by subnet with wider subnets first */
+typedef struct {
+    ipam_pool_t *pools;
+    uint64_t *keys;  /* Network << 8 | mask of each pool */
+    uint32_t *reach; /* Highest address of the pools up to each */
+    int count;
+} pool_set_t;
+
+static uint64_t subnet_key(struct in_addr addr, uint8_t mask) {
+    uint32_t netmask = mask == 0 ? 0 : ~0u << (32 - mask);
+    return (uint64_t)(ntohl(addr.s_addr) & netmask) << 8 | mask;
+}
+
+static int cmp_key(const void *a, const void *b) {
+    uint64_t ka = *(const uint64_t *)a, kb = *(const uint64_t *)b;
+    return (ka > kb) - (ka < kb);
+}
+
+static int find_pool(const pool_set_t *set, struct in_addr addr,
+                     uint8_t mask) {
+    uint64_t key = subnet_key(addr, mask);
+    const uint64_t *found =
+        bsearch(&key, set->keys, set->count, sizeof key, cmp_key);
+    return found ? (int)(found - set->keys) : -1;
+}
+
+/* Take an address in every pool that has it, so nested pools agree */
+static void take_address(pool_set_t *set, struct in_addr addr) {
+    uint32_t host = ntohl(addr.s_addr);
+    int lo = 0, hi = set->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (set->keys[mid] >> 8 <= host) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (int i = lo - 1; i >= 0 && set->reach[i] >= host; i--) {
+        ipam_reserve(&set->pools[i], addr); // taken already is fine
     }
+}
 
-    /* Assign to rule struct */
-    rule->src_type =
-        strcmp(src_name, "INTERNET") == 0 ? ENDPOINT_INTERNET : ENDPOINT_NS;
-    strncpy(rule->src_name, src_name, sizeof(rule->src_name) - 1);
-    rule->dst_type =
-        strcmp(dst_name, "INTERNET") == 0 ? ENDPOINT_INTERNET : ENDPOINT_NS;
-    strncpy(rule->dst_name, dst_name, sizeof(rule->dst_name) - 1);
+/* One pool per bridge subnet and per subnet named by an ip = <cidr> auto */
+static int build_pools(config_t *config, pool_set_t *set) {
+    int max = config->bridge_count + config->namespace_count;
+    set->keys = malloc((max + 1) * sizeof *set->keys);
+    set->count = 0;
+    if (set->keys == NULL) {
+        return -1;
+    }
+    for (int j = 0; j < config->bridge_count; j++) {
+        const bridge_t *br = &config->bridges[j];
+        if (br->mask >= IPAM_MIN_MASK) {
+            set->keys[set->count++] = subnet_key(br->ip_addr, br->mask);
+        }
+    }
+    for (int i = 0; i < config->namespace_count; i++) {
+        const namespace_t *ns = &config->namespaces[i];
+        uint64_t key = subnet_key(ns->ip_addr, ns->mask);
+        // instances of a range come in runs of the same subnet
+        if (ns->auto_ip && ns->mask > 0 &&
+            (set->count == 0 || set->keys[set->count - 1] != key)) {
+            set->keys[set->count++] = key;
+        }
+    }
+    qsort(set->keys, set->count, sizeof *set->keys, cmp_key);
+    int unique = 0;
+    for (int p = 0; p < set->count; p++) {
+        if (unique == 0 || set->keys[unique - 1] != set->keys[p]) {
+            set->keys[unique++] = set->keys[p];
+        }
+    }
+    set->count = unique;
 
+    set->pools = arena_alloc(&config->arena,
+                             (set->count + 1) * sizeof *set->pools);
+    set->reach = malloc((set->count + 1) * sizeof *set->reach);
+    if (set->pools == NULL || set->reach == NULL) {
+        return -1;
+    }
+    for (int p = 0; p < set->count; p++) {
+        ipam_pool_t *pool = &set->pools[p];
+        struct in_addr network = {htonl(set->keys[p] >> 8)};
+        if (ipam_init(pool, &config->arena, network, set->keys[p] & 0xff) !=
+            0) {
+            return -1;
+        }
+        uint32_t last = pool->network + (pool->size - 1);
+        set->reach[p] = p > 0 && set->reach[p - 1] > last ? set->reach[p - 1]
+                                                          : last;
+    }
     return 0;
 }
 
+/* Pool an ip = auto namespace takes its address from, filling its gateway */
+static int namespace_pool(config_t *config, pool_set_t *set,
+                          namespace_t *ns) {
+    if (ns->mask > 0) {
+        // the first host address of the subnet is left for the gateway
+        struct in_addr gateway = {
+            htonl(ntohl(ns->ip_addr.s_addr) + (ns->mask < 31))};
+        take_address(set, gateway);
+        if (ns->gateway.s_addr == 0) {
+            ns->gateway = gateway;
+        }
+        return find_pool(set, ns->ip_addr, ns->mask);
+    }
+
+    const char *sep = strchr(ns->connect_name, ':');
+    const bridge_t *br =
+        ns->connect_type == CONNECT_BRIDGE
+            ? find_bridge(config, view_of(sep ? sep + 1 : ns->connect_name))
+            : NULL;
+    if (br == NULL || br->mask < IPAM_MIN_MASK) {
+        fprintf(stderr,
+                "Namespace %s has ip = auto but no bridge subnet to take it "
+                "from\n",
+                ns->name);
+        return -1;
+    }
+    ns->mask = br->mask;
+    if (ns->gateway.s_addr == 0) {
+        ns->gateway = br->ip_addr;
+    }
+    return find_pool(set, br->ip_addr, br->mask);
+}
+
+int config_assign_addresses(config_t *config, const config_t *previous) {
+    if (config->addresses_assigned) {
+        return 0;
+    }
+    if (config_expand(config) != 0) {
+        return -1;
+    }
+
+    pool_set_t set = {0};
+    int *pool_of = malloc((config->namespace_count + 1) * sizeof *pool_of);
+    int status = pool_of != NULL ? build_pools(config, &set) : -1;
+
+    // written addresses and gateways are never handed out
+    for (int j = 0; status == 0 && j < config->bridge_count; j++) {
+        take_address(&set, config->bridges[j].ip_addr);
+    }
+    for (int i = 0; status == 0 && i < config->namespace_count; i++) {
+        const namespace_t *ns = &config->namespaces[i];
+        if (!ns->auto_ip) {
+            take_address(&set, ns->ip_addr);
+        }
+        if (ns->gateway.s_addr != 0) {
+            take_address(&set, ns->gateway);
+        }
+    }
+    for (int i = 0; status == 0 && i < config->namespace_count; i++) {
+        namespace_t *ns = &config->namespaces[i];
+        pool_of[i] = ns->auto_ip ? namespace_pool(config, &set, ns) : -1;
+        if (ns->auto_ip && pool_of[i] < 0) {
+            status = -1;
+        }
+    }
+
+    // a running namespace keeps its address, so a reload moves nothing
+    for (int i = 0; status == 0 && previous != NULL &&
+                    i < config->namespace_count;
+         i++) {
+        namespace_t *ns = &config->namespaces[i];
+        const namespace_t *prev =
+            pool_of[i] >= 0 ? find_namespace_by_name(previous, ns->name)
+                            : NULL;
+        if (prev != NULL && prev->auto_ip && prev->mask == ns->mask &&
+            ipam_reserve(&set.pools[pool_of[i]], prev->ip_addr) == 0) {
+            take_address(&set, prev->ip_addr);
+            ns->ip_addr = prev->ip_addr;
+            pool_of[i] = -1;
+        }
+    }
+
+    for (int i = 0; status == 0 && i < config->namespace_count; i++) {
+        namespace_t *ns = &config->namespaces[i];
+        if (pool_of[i] < 0) {
+            continue;
+        }
+        ipam_pool_t *pool = &set.pools[pool_of[i]];
+        struct in_addr addr;
+        if (ipam_alloc(pool, &addr) != 0) {
+            struct in_addr network = {htonl(pool->network)};
+            char net_str[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &network, net_str, sizeof net_str);
+            fprintf(stderr, "No address left in %s/%u for namespace %s\n",
+                    net_str, pool->mask, ns->name);
+            status = -1;
+            break;
+        }
+        take_address(&set, addr);
+        ns->ip_addr = addr;
+    }
+
+    free(pool_of);
+    free(set.keys);
+    free(set.reach);
+    config->addresses_assigned = status == 0;
+    return status;
+}
+
 void init_config(config_t *config) {
     if (config == NULL) {
         return;
@@ -373,17 +1025,39 @@ void init_config(config_t *config) {
            sizeof config->nat_outgoing_interface);
 
     config->namespace_count = 0;
+    config->namespace_cap = 0;
     config->namespaces = NULL;
 
     config->bridge_count = 0;
+    config->bridge_cap = 0;
     config->bridges = NULL;
 
     config->fw_default_action = FW_DROP; /* Default to DROP for security */
     config->fw_rule_count = 0;
+    config->fw_rule_cap = 0;
     config->fw_rules = NULL;
 
     config->nat_rule_count = 0;
+    config->nat_rule_cap = 0;
     config->nat_rules = NULL;
+
+    config->flow_offload = false;
+    config->dataplane = DATAPLANE_KERNEL;
+    config->conntrack_flows = CONNTRACK_FLOWS_DEFAULT;
+    config->dataplane_workers = 1;
+
+    memset(&config->ns_index, 0, sizeof config->ns_index);
+    memset(&config->br_index, 0, sizeof config->br_index);
+    memset(&config->names, 0, sizeof config->names);
+    config->ns_templates = NULL;
+    config->ns_template_count = 0;
+    config->ns_template_cap = 0;
+    config->ns_templates_expanded = 0;
+    config->addresses_assigned = false;
+    memset(&config->arena, 0, sizeof config->arena);
+
+    config->cache = NULL;
+    config->cache_size = 0;
 }
 
 void free_config(config_t *config) {
@@ -391,23 +1065,41 @@ void free_config(config_t *config) {
         return;
     }
 
-    free(config->namespaces);
-    free(config->bridges);
-    free(config->fw_rules);
-    free(config->nat_rules);
+    // every array and index lives in the arena or the cache mapping
+    arena_release(&config->arena);
+    if (config->cache != NULL) {
+        munmap(config->cache, config->cache_size);
+    }
+    config->cache = NULL;
+    config->cache_size = 0;
 
     // Reset pointers and counts to prevent use after free
     config->namespace_count = 0;
+    config->namespace_cap = 0;
     config->namespaces = NULL;
 
     config->bridge_count = 0;
+    config->bridge_cap = 0;
     config->bridges = NULL;
 
     config->fw_rule_count = 0;
+    config->fw_rule_cap = 0;
     config->fw_rules = NULL;
 
     config->nat_rule_count = 0;
+    config->nat_rule_cap = 0;
     config->nat_rules = NULL;
+
+    memset(&config->ns_index, 0, sizeof config->ns_index);
+    memset(&config->br_index, 0, sizeof config->br_index);
+    memset(&config->names, 0, sizeof config->names);
+
+    config->ns_templates = NULL;
+    config->ns_template_count = 0;
+    config->ns_template_cap = 0;
+    config->ns_templates_expanded = 0;
+
+    config->addresses_assigned = false;
 }
 
 void print_config(const config_t *config, FILE *fp) {
@@ -423,6 +1115,12 @@ void print_config(const config_t *config, FILE *fp) {
     fprintf(fp, "NAT Outgoing Interface: %s\n", config->nat_outgoing_interface);
     fprintf(fp, "Default Firewall Action: %s\n",
             config->fw_default_action == FW_ALLOW ? "ALLOW" : "DROP");
+    fprintf(fp, "Flow Offload: %s\n",
+            config->flow_offload ? "Enabled" : "Disabled");
+    fprintf(fp, "Data Plane: %s\n",
+            config->dataplane == DATAPLANE_AFXDP ? "AF_XDP" : "Kernel");
+    fprintf(fp, "Conntrack Flows: %u per thread\n", config->conntrack_flows);
+    fprintf(fp, "Data Plane Workers: %u\n", config->dataplane_workers);
 
     // Print namespaces
     fprintf(fp, "\n--- Namespaces (%d) ---\n", config->namespace_count);
@@ -442,6 +1140,21 @@ void print_config(const config_t *config, FILE *fp) {
         fprintf(fp, "\n");
     }
 
+    // Print namespace ranges not expanded yet
+    for (int i = 0; i < config->ns_template_count; i++) {
+        ns_template_t *tpl = &config->ns_templates[i];
+        if (tpl->first_ns >= 0) {
+            continue;
+        }
+
+        inet_ntop(AF_INET, &tpl->proto.ip_addr, ip_str, INET_ADDRSTRLEN);
+        fprintf(fp, "Namespace range %s[%u..%u]:\n", tpl->base, tpl->first,
+                tpl->last);
+        fprintf(fp, "  IP Address: %s/%u%s\n", ip_str, tpl->proto.mask,
+                tpl->proto.auto_ip ? " auto" : "");
+        fprintf(fp, "\n");
+    }
+
     // Print bridges
     fprintf(fp, "\n--- Bridges (%d) ---\n", config->bridge_count);
     for (int i = 0; i < config->bridge_count; i++) {
@@ -462,7 +1175,7 @@ void print_config(const config_t *config, FILE *fp) {
 
         // Source
         if (rule->src_type == ENDPOINT_NS) {
-            fprintf(fp, "%s ", rule->src_name);
+            fprintf(fp, "%s ", config->namespaces[rule->src_ns].name);
         } else {
             fprintf(fp, "INTERNET ");
         }
@@ -471,7 +1184,7 @@ void print_config(const config_t *config, FILE *fp) {
 
         // Destination
         if (rule->dst_type == ENDPOINT_NS) {
-            fprintf(fp, "%s", rule->dst_name);
+            fprintf(fp, "%s", config->namespaces[rule->dst_ns].name);
         } else {
             fprintf(fp, "INTERNET");
         }
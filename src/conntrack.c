@@ -0,0 +1,486 @@
+#define _GNU_SOURCE
+#include "conntrack.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define MAX_LOAD_PERCENT 90 // Entries per bucket slot the hash is sized for
+
+static size_t buckets_size(const ct_table_t *ct) {
+    return ((size_t)ct->bucket_mask + 1) * sizeof(ct_bucket_t);
+}
+
+static size_t flows_size(const ct_table_t *ct) {
+    return (size_t)ct->capacity * sizeof(ct_flow_t);
+}
+
+static void *map_zeroed(size_t size) {
+    void *area = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return area == MAP_FAILED ? NULL : area;
+}
+
+int ct_init(ct_table_t *ct, uint32_t capacity, uint32_t now) {
+    memset(ct, 0, sizeof *ct);
+    atomic_init(&ct->moving, 0);
+    // two entries per flow, one for each direction
+    uint64_t need = ((uint64_t)capacity * 2 * 100 +
+                     CT_BUCKET_SLOTS * MAX_LOAD_PERCENT - 1) /
+                    (CT_BUCKET_SLOTS * MAX_LOAD_PERCENT);
+    uint64_t buckets = 2;
+    while (buckets < need) {
+        buckets *= 2;
+    }
+    ct->bucket_mask = buckets - 1;
+    ct->capacity = capacity;
+    ct->free_list = CT_NONE;
+    ct->tick = now;
+
+    ct->buckets = map_zeroed(buckets_size(ct));
+    ct->flows = map_zeroed(flows_size(ct));
+    ct->wheel = malloc(CT_WHEEL_SLOTS * sizeof *ct->wheel);
+    if (ct->buckets == NULL || ct->flows == NULL || ct->wheel == NULL) {
+        fprintf(stderr, "Cannot allocate a connection table of %u flows: "
+                        "%s\n",
+                capacity, strerror(errno));
+        ct_free(ct);
+        return -1;
+    }
+    for (int i = 0; i < CT_WHEEL_SLOTS; i++) {
+        ct->wheel[i] = CT_NONE;
+    }
+    return 0;
+}
+
+void ct_free(ct_table_t *ct) {
+    if (ct->buckets != NULL) {
+        munmap(ct->buckets, buckets_size(ct));
+    }
+    if (ct->flows != NULL) {
+        munmap(ct->flows, flows_size(ct));
+    }
+    free(ct->wheel);
+    memset(ct, 0, sizeof *ct);
+}
+
+void ct_nat_range(ct_table_t *ct, uint32_t addr, uint16_t lo, uint16_t hi) {
+    ct->nat_addr = addr;
+    ct->port_lo = lo;
+    ct->port_hi = hi;
+    ct->port_next = lo;
+}
+
+/* Counter of a flow's NAT port, or NULL if it has none */
+static _Atomic(uint64_t) *nat_ref(const ct_table_t *ct, const ct_flow_t *flow) {
+    const ct_tuple_t *reply = &flow->tuple[CT_DIR_REPLY];
+    uint16_t port = ntohs(reply->dport);
+    if (ct->nat_refs == NULL || !(flow->state & CT_NAT) ||
+        port < CT_NAT_PORT_MIN) {
+        return NULL;
+    }
+    int n = reply->proto == IPPROTO_TCP   ? 0
+            : reply->proto == IPPROTO_UDP ? 1
+                                          : 2;
+    return &ct->nat_refs[(port - CT_NAT_PORT_MIN) * 4 + n];
+}
+
+void ct_nat_refs(ct_table_t *ct, _Atomic(uint64_t) *refs) {
+    ct->nat_refs = refs;
+    // every flow in the table is on the wheel
+    for (uint32_t slot = 0; refs != NULL && slot < CT_WHEEL_SLOTS; slot++) {
+        for (uint32_t f = ct->wheel[slot]; f != CT_NONE;
+             f = ct->flows[f].next) {
+            _Atomic(uint64_t) *ref = nat_ref(ct, &ct->flows[f]);
+            if (ref != NULL) {
+                atomic_fetch_add_explicit(ref, 1, memory_order_relaxed);
+            }
+        }
+    }
+}
+
+uint32_t ct_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint32_t)ts.tv_sec;
+}
+
+/* Multiply-xorshift over both halves, finished as MurmurHash3's fmix64 */
+static uint64_t tuple_hash(const ct_tuple_t *tuple) {
+    uint64_t a, b;
+    memcpy(&a, tuple, sizeof a);
+    memcpy(&b, (const char *)tuple + sizeof a, sizeof b);
+    uint64_t h = a * 0x9e3779b97f4a7c15ull ^ b;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Never 0, so an entry is never 0 either */
+static uint32_t signature(uint64_t hash) {
+    uint32_t sig = hash >> 48;
+    return sig != 0 ? sig : 1;
+}
+
+/* Applied twice it gives the first bucket back */
+static uint32_t other_bucket(const ct_table_t *ct, uint32_t bucket,
+                             uint32_t sig) {
+    return (bucket ^ sig * 0x5bd1e995u) & ct->bucket_mask;
+}
+
+static uint64_t make_entry(uint32_t sig, uint32_t ref) {
+    return (uint64_t)sig << 32 | ref;
+}
+
+/* Search one bucket, again until no change overlapped the search */
+static uint32_t bucket_find(const ct_table_t *ct, uint32_t b, uint32_t sig,
+                            const ct_tuple_t *tuple) {
+    ct_bucket_t *bucket = &ct->buckets[b];
+    for (;;) {
+        uint64_t seq = atomic_load_explicit(&bucket->seq,
+                                            memory_order_acquire);
+        uint32_t ref = CT_NONE;
+        for (int s = 0; s < CT_BUCKET_SLOTS && !(seq & 1); s++) {
+            uint64_t entry = atomic_load_explicit(&bucket->slots[s],
+                                                  memory_order_relaxed);
+            if (entry >> 32 != sig) {
+                continue;
+            }
+            const ct_flow_t *flow = ct_flow(ct, (uint32_t)entry);
+            if (memcmp(&flow->tuple[entry & 1], tuple, sizeof *tuple) == 0) {
+                ref = (uint32_t)entry;
+                break;
+            }
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (!(seq & 1) &&
+            atomic_load_explicit(&bucket->seq, memory_order_relaxed) == seq) {
+            return ref;
+        }
+    }
+}
+
+uint32_t ct_lookup(const ct_table_t *ct, const ct_tuple_t *tuple) {
+    uint64_t hash = tuple_hash(tuple);
+    uint32_t sig = signature(hash);
+    uint32_t first = hash & ct->bucket_mask;
+    uint32_t second = other_bucket(ct, first, sig);
+    for (;;) {
+        unsigned moving = atomic_load_explicit(&ct->moving,
+                                               memory_order_acquire);
+        uint32_t ref = bucket_find(ct, first, sig, tuple);
+        if (ref == CT_NONE) {
+            ref = bucket_find(ct, second, sig, tuple);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (ref != CT_NONE ||
+            (!(moving & 1) &&
+             atomic_load_explicit(&ct->moving, memory_order_relaxed) ==
+                 moving)) {
+            return ref;
+        }
+    }
+}
+
+/* Change one slot the way readers expect, see bucket_find() */
+static void bucket_store(ct_bucket_t *bucket, int s, uint64_t entry) {
+    uint64_t seq = atomic_load_explicit(&bucket->seq, memory_order_relaxed);
+    atomic_store_explicit(&bucket->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&bucket->slots[s], entry, memory_order_relaxed);
+    atomic_store_explicit(&bucket->seq, seq + 2, memory_order_release);
+}
+
+static int free_slot(const ct_bucket_t *bucket) {
+    for (int s = 0; s < CT_BUCKET_SLOTS; s++) {
+        if (atomic_load_explicit(&bucket->slots[s], memory_order_relaxed) ==
+            0) {
+            return s;
+        }
+    }
+    return -1;
+}
+
+/* A bucket the path search reached by moving one entry of its parent */
+typedef struct {
+    uint32_t bucket; /* The bucket */
+    int16_t parent;  /* Node whose entry would move here, -1 at the root */
+    int8_t slot;     /* Slot of that entry in the parent's bucket */
+} path_node_t;
+
+static bool on_path(const path_node_t *nodes, int node, uint32_t bucket) {
+    for (; node >= 0; node = nodes[node].parent) {
+        if (nodes[node].bucket == bucket) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Each entry is written to its new slot before it leaves the old one, so
+ * a reader can always find it in one of its buckets, unless it checked
+ * the new bucket before and the old one after the move; moving tells it
+ * to look again then.
+ */
+static void move_entry(ct_table_t *ct, uint32_t from, int from_slot,
+                       uint32_t to, int to_slot) {
+    ct_bucket_t *src = &ct->buckets[from];
+    uint64_t entry = atomic_load_explicit(&src->slots[from_slot],
+                                          memory_order_relaxed);
+    bucket_store(&ct->buckets[to], to_slot, entry);
+    bucket_store(src, from_slot, 0);
+}
+
+/*
+ * Breadth-first search from both buckets of the new entry for an entry
+ * whose other bucket has room, then moves along that path from its far
+ * end: every move fills the slot the one before freed, and the last frees
+ * a slot in a bucket of the new entry. Buckets never repeat on a path, so
+ * each move still finds the entry the search saw.
+ */
+static int hash_add(ct_table_t *ct, const ct_tuple_t *tuple, uint32_t ref) {
+    uint64_t hash = tuple_hash(tuple);
+    uint32_t sig = signature(hash);
+    path_node_t nodes[CT_SEARCH_NODES];
+    nodes[0] = (path_node_t){hash & ct->bucket_mask, -1, -1};
+    nodes[1] = (path_node_t){other_bucket(ct, nodes[0].bucket, sig), -1, -1};
+    for (int i = 0; i < 2; i++) {
+        int s = free_slot(&ct->buckets[nodes[i].bucket]);
+        if (s >= 0) {
+            bucket_store(&ct->buckets[nodes[i].bucket], s,
+                         make_entry(sig, ref));
+            return 0;
+        }
+    }
+
+    int count = 2;
+    for (int node = 0; node < count; node++) {
+        uint32_t b = nodes[node].bucket;
+        for (int s = 0; s < CT_BUCKET_SLOTS; s++) {
+            uint64_t entry = atomic_load_explicit(
+                &ct->buckets[b].slots[s], memory_order_relaxed);
+            uint32_t next = other_bucket(ct, b, entry >> 32);
+            int free = free_slot(&ct->buckets[next]);
+            if (free < 0) {
+                if (count < CT_SEARCH_NODES && !on_path(nodes, node, next)) {
+                    nodes[count++] = (path_node_t){next, node, s};
+                }
+                continue;
+            }
+
+            atomic_fetch_add_explicit(&ct->moving, 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+            move_entry(ct, b, s, next, free);
+            int vacant = s;
+            for (int n = node; nodes[n].parent >= 0; n = nodes[n].parent) {
+                move_entry(ct, nodes[nodes[n].parent].bucket, nodes[n].slot,
+                           nodes[n].bucket, vacant);
+                vacant = nodes[n].slot;
+                b = nodes[nodes[n].parent].bucket;
+            }
+            atomic_fetch_add_explicit(&ct->moving, 1, memory_order_release);
+            bucket_store(&ct->buckets[b], vacant, make_entry(sig, ref));
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void hash_remove(ct_table_t *ct, const ct_tuple_t *tuple,
+                        uint32_t ref) {
+    uint64_t hash = tuple_hash(tuple);
+    uint32_t sig = signature(hash);
+    uint32_t b = hash & ct->bucket_mask;
+    uint64_t entry = make_entry(sig, ref);
+    for (int i = 0; i < 2; i++, b = other_bucket(ct, b, sig)) {
+        for (int s = 0; s < CT_BUCKET_SLOTS; s++) {
+            if (atomic_load_explicit(&ct->buckets[b].slots[s],
+                                     memory_order_relaxed) == entry) {
+                bucket_store(&ct->buckets[b], s, 0);
+                return;
+            }
+        }
+    }
+}
+
+static void wheel_link(ct_table_t *ct, uint32_t f) {
+    ct_flow_t *flow = &ct->flows[f];
+    flow->slot = flow->expires % CT_WHEEL_SLOTS;
+    flow->prev = CT_NONE;
+    flow->next = ct->wheel[flow->slot];
+    if (flow->next != CT_NONE) {
+        ct->flows[flow->next].prev = f;
+    }
+    ct->wheel[flow->slot] = f;
+}
+
+static void wheel_unlink(ct_table_t *ct, uint32_t f) {
+    ct_flow_t *flow = &ct->flows[f];
+    if (flow->prev != CT_NONE) {
+        ct->flows[flow->prev].next = flow->next;
+    } else {
+        ct->wheel[flow->slot] = flow->next;
+    }
+    if (flow->next != CT_NONE) {
+        ct->flows[flow->next].prev = flow->prev;
+    }
+}
+
+/* Take a flow off the hash and onto the free list, already off the wheel */
+static void release(ct_table_t *ct, uint32_t f) {
+    ct_flow_t *flow = &ct->flows[f];
+    hash_remove(ct, &flow->tuple[CT_DIR_ORIGINAL], f << 1 | CT_DIR_ORIGINAL);
+    hash_remove(ct, &flow->tuple[CT_DIR_REPLY], f << 1 | CT_DIR_REPLY);
+    _Atomic(uint64_t) *ref = nat_ref(ct, flow);
+    if (ref != NULL) {
+        atomic_fetch_sub_explicit(ref, 1, memory_order_relaxed);
+    }
+    flow->next = ct->free_list;
+    ct->free_list = f;
+    ct->count--;
+}
+
+int ct_nat_port(ct_table_t *ct, ct_tuple_t *reply) {
+    if (ct->port_lo == 0) {
+        return -1;
+    }
+    uint32_t span = ct->port_hi - ct->port_lo + 1u;
+    uint32_t tries = span < CT_NAT_TRIES ? span : CT_NAT_TRIES;
+    // the original port first, as Linux does, so most flows keep theirs
+    uint16_t port = ntohs(reply->dport);
+    bool from_cursor = port < ct->port_lo || port > ct->port_hi;
+    for (uint32_t i = 0; i < tries + !from_cursor; i++) {
+        if (from_cursor) {
+            port = ct->port_next;
+            ct->port_next = port == ct->port_hi ? ct->port_lo : port + 1;
+        }
+        from_cursor = true;
+        reply->dport = htons(port);
+        if (reply->proto == IPPROTO_ICMP) {
+            reply->sport = reply->dport;
+        }
+        if (ct_lookup(ct, reply) == CT_NONE) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static uint32_t timeout(const ct_flow_t *flow) {
+    bool replied = flow->state & CT_REPLIED;
+    switch (flow->tuple[CT_DIR_ORIGINAL].proto) {
+    case IPPROTO_TCP:
+        if (flow->state & CT_RESET) {
+            return CT_TIMEOUT_TCP_RESET;
+        }
+        if (flow->state & CT_CLOSING) {
+            return CT_TIMEOUT_TCP_CLOSING;
+        }
+        return replied ? CT_TIMEOUT_TCP_ESTABLISHED : CT_TIMEOUT_TCP_NEW;
+    case IPPROTO_UDP:
+        return replied ? CT_TIMEOUT_UDP_REPLIED : CT_TIMEOUT_UDP_NEW;
+    default:
+        return CT_TIMEOUT_ICMP;
+    }
+}
+
+uint32_t ct_insert(ct_table_t *ct, const ct_tuple_t *original,
+                   const ct_tuple_t *reply, uint16_t state, uint32_t now) {
+    uint32_t f = ct->free_list;
+    if (f != CT_NONE) {
+        ct->free_list = ct->flows[f].next;
+    } else if (ct->used < ct->capacity) {
+        f = ct->used++;
+    } else {
+        return CT_NONE;
+    }
+
+    ct_flow_t *flow = &ct->flows[f];
+    flow->tuple[CT_DIR_ORIGINAL] = *original;
+    flow->tuple[CT_DIR_REPLY] = *reply;
+    flow->state = state;
+    if (hash_add(ct, original, f << 1 | CT_DIR_ORIGINAL) != 0) {
+        flow->next = ct->free_list;
+        ct->free_list = f;
+        return CT_NONE;
+    }
+    if (hash_add(ct, reply, f << 1 | CT_DIR_REPLY) != 0) {
+        hash_remove(ct, original, f << 1 | CT_DIR_ORIGINAL);
+        flow->next = ct->free_list;
+        ct->free_list = f;
+        return CT_NONE;
+    }
+    ct->count++;
+    flow->expires = now + timeout(flow);
+    wheel_link(ct, f);
+    _Atomic(uint64_t) *ref = nat_ref(ct, flow);
+    if (ref != NULL) {
+        // before the first packet goes out, so its reply finds the port
+        atomic_fetch_add_explicit(ref, 1, memory_order_release);
+    }
+    return f;
+}
+
+void ct_update(ct_table_t *ct, uint32_t f, int dir, uint8_t tcp_flags,
+               uint32_t now) {
+    ct_flow_t *flow = &ct->flows[f];
+    if (dir == CT_DIR_REPLY) {
+        flow->state |= CT_REPLIED;
+    } else if ((tcp_flags & (TH_SYN | TH_ACK)) == TH_SYN &&
+               (flow->state & (CT_CLOSING | CT_RESET))) {
+        // the tuple is reused for a new connection
+        flow->state &= ~(CT_REPLIED | CT_CLOSING | CT_RESET);
+    }
+    if (tcp_flags & TH_RST) {
+        flow->state |= CT_RESET;
+    } else if (tcp_flags & TH_FIN) {
+        flow->state |= CT_CLOSING;
+    }
+
+    // a later expiry is found when the wheel reaches the earlier slot,
+    // an earlier one needs the flow in its own slot
+    uint32_t expires = now + timeout(flow);
+    if (expires < flow->expires) {
+        wheel_unlink(ct, f);
+        flow->expires = expires;
+        wheel_link(ct, f);
+    } else {
+        flow->expires = expires;
+    }
+}
+
+uint32_t ct_expire(ct_table_t *ct, uint32_t now) {
+    // after a long stall one turn of the wheel visits every flow
+    if ((int32_t)(now - ct->tick) > CT_WHEEL_SLOTS) {
+        ct->tick = now - CT_WHEEL_SLOTS;
+    }
+    uint32_t removed = 0;
+    for (int t = 0; t < CT_EXPIRE_TICKS && ct->tick <= now; t++) {
+        uint32_t *head = &ct->wheel[ct->tick % CT_WHEEL_SLOTS];
+        uint32_t f = *head;
+        *head = CT_NONE;
+        while (f != CT_NONE) {
+            uint32_t next = ct->flows[f].next;
+            if (ct->flows[f].expires <= now) {
+                release(ct, f);
+                removed++;
+            } else {
+                wheel_link(ct, f);
+            }
+            f = next;
+        }
+        ct->tick++;
+    }
+    return removed;
+}
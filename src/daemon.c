@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+#include "daemon.h"
+
+#include "dataplane.h"
+#include "network.h"
+#include "validate.h"
+
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+/* Every namespace keeps a socket open, so lift the descriptor limit */
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+/*
+ * Watch the directory rather than the file: editors often save by writing
+ * a new file and renaming it over the old one, which a watch on the file
+ * itself would not follow.
+ */
+static int watch_config(const char *filename, char *name, size_t size) {
+    char dir[PATH_MAX], base[PATH_MAX];
+    snprintf(dir, sizeof dir, "%s", filename);
+    snprintf(base, sizeof base, "%s", filename);
+    snprintf(name, size, "%s", basename(base));
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot create inotify instance: %s\n",
+                strerror(errno));
+        return -1;
+    }
+    if (inotify_add_watch(fd, dirname(dir),
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        fprintf(stderr, "Cannot watch %s: %s\n", filename, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Drain the queued events and tell whether any concerns the file */
+static bool config_changed(int fd, const char *name) {
+    _Alignas(struct inotify_event) char buf[4096];
+    bool changed = false;
+
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof buf)) > 0) {
+        for (char *p = buf; p < buf + n;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (ev->len > 0 && strcmp(ev->name, name) == 0) {
+                changed = true;
+            }
+            p += sizeof *ev + ev->len;
+        }
+    }
+    return changed;
+}
+
+/*
+ * Forward between the namespaces of a freshly applied configuration in
+ * userspace, if it asks for that. The kernel keeps forwarding whatever the
+ * userspace data plane does not take, so a failure costs only speed.
+ */
+static void restart_dataplane(dataplane_t *dp, const config_t *config) {
+    dataplane_free(dp);
+    if (config->dataplane != DATAPLANE_AFXDP) {
+        return;
+    }
+    if (dataplane_build(dp, config) != 0 || dataplane_start(dp) != 0) {
+        fprintf(stderr,
+                "Userspace data plane failed, the kernel forwards instead\n");
+        dataplane_free(dp);
+    }
+}
+
+/* Parse the file again and apply it; a broken file changes nothing */
+static int reload(const char *filename, config_t *config,
+                  apply_session_t *session, dataplane_t *dp) {
+    config_t next;
+    init_config(&next);
+    // running namespaces keep the addresses they were handed
+    if (parse_config_file(filename, &next) != 0 ||
+        config_assign_addresses(&next, config) != 0 ||
+        validate_config(&next) != 0) {
+        fprintf(stderr, "Cannot use %s, keeping the running topology\n",
+                filename);
+        free_config(&next);
+        return -1;
+    }
+    free_config(config);
+    *config = next;
+
+    // same ports: new routes and policy go in under the running workers;
+    // otherwise the apply may replace the links the sockets are bound to
+    if (!dp->running || config->dataplane != DATAPLANE_AFXDP ||
+        dataplane_update(dp, config) != 0) {
+        dataplane_stop(dp);
+    }
+    printf("Applying %s\n", filename);
+    int status = apply_session_run(session, config);
+    if (status != 0) {
+        fprintf(stderr, "Failed to apply %s\n", filename);
+    }
+    if (!dp->running) {
+        restart_dataplane(dp, config);
+    }
+    return status;
+}
+
+int run_daemon(const char *filename, config_t *config) {
+    raise_fd_limit();
+    setvbuf(stdout, NULL, _IOLBF, 0); // usually ends up in a log file
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+        return -1;
+    }
+    int sig_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sig_fd < 0) {
+        fprintf(stderr, "Cannot create signalfd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    char name[NAME_MAX + 1];
+    int watch_fd = watch_config(filename, name, sizeof name);
+    apply_session_t session;
+    if (watch_fd < 0 || apply_session_open(&session) != 0) {
+        if (watch_fd >= 0) {
+            close(watch_fd);
+        }
+        close(sig_fd);
+        return -1;
+    }
+
+    printf("Applying %s\n", filename);
+    if (apply_session_run(&session, config) != 0) {
+        fprintf(stderr, "Failed to apply %s, waiting for a change\n",
+                filename);
+    }
+    dataplane_t dp;
+    dataplane_init(&dp);
+    restart_dataplane(&dp, config);
+
+    int status = 0;
+    bool pending = false; // a change is waiting for the file to go quiet
+    for (;;) {
+        struct pollfd fds[2] = {
+            {.fd = sig_fd, .events = POLLIN},
+            {.fd = watch_fd, .events = POLLIN},
+        };
+        int n = poll(fds, 2, pending ? DAEMON_DEBOUNCE_MS : -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "poll failed: %s\n", strerror(errno));
+            status = -1;
+            break;
+        }
+        if (n == 0) {
+            pending = false;
+            reload(filename, config, &session, &dp);
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            if (read(sig_fd, &si, sizeof si) == sizeof si) {
+                if (si.ssi_signo != SIGHUP) {
+                    printf("Stopping, the topology stays up\n");
+                    break;
+                }
+                pending = false;
+                reload(filename, config, &session, &dp);
+            }
+        }
+        // every further event restarts the quiet period
+        if ((fds[1].revents & POLLIN) && config_changed(watch_fd, name)) {
+            pending = true;
+        }
+    }
+
+    dataplane_free(&dp);
+    apply_session_close(&session);
+    close(watch_fd);
+    close(sig_fd);
+    return status;
+}
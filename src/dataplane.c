@@ -0,0 +1,1680 @@
+#define _GNU_SOURCE
+#include "dataplane.h"
+
+#include "netlink.h"
+#include "network.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_link.h>
+#include <linux/neighbour.h>
+#include <linux/rtnetlink.h>
+#include <netinet/in.h>
+#include <netinet/ip_icmp.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define IP_HLEN 20 // IPv4 header without options
+// neighbour states with a usable address, as the kernel's NUD_VALID
+#define NUD_USABLE                                                             \
+    (NUD_PERMANENT | NUD_NOARP | NUD_REACHABLE | NUD_PROBE | NUD_STALE |       \
+     NUD_DELAY)
+
+void dataplane_init(dataplane_t *dp) {
+    memset(dp, 0, sizeof *dp);
+    dp->uplink = -1;
+    atomic_init(&dp->fib, NULL);
+    rcu_init(&dp->rcu);
+    dp->filter.trie_fd = dp->filter.xsks_fd = dp->filter.refs_fd = -1;
+    dp->umem.owner_fd = -1;
+    atomic_init(&dp->stop, false);
+}
+
+static int cmp_pair(const void *a, const void *b) {
+    uint64_t pa = *(const uint64_t *)a, pb = *(const uint64_t *)b;
+    return (pa > pb) - (pa < pb);
+}
+
+static void free_fib(dp_fib_t *fib) {
+    if (fib != NULL) {
+        lpm_free(&fib->routes);
+        free(fib->allowed);
+        free(fib);
+    }
+}
+
+/*
+ * Routes go in from least to most specific owner, so a port wins over a
+ * NAT prefix with the same subnet. A /0 would fill all of tbl24, so the
+ * uplink is the default hop instead, and without one a missing route
+ * means "the kernel's" anyway.
+ */
+static int collect_prefixes(dataplane_t *dp, const config_t *config,
+                            const int *port_of) {
+    size_t max = config->nat_rule_count + config->bridge_count +
+                 2 * (size_t)config->namespace_count;
+    lpm_prefix_t *prefixes = arena_alloc(&dp->arena,
+                                         (max + 1) * sizeof *prefixes);
+    if (prefixes == NULL) {
+        return -1;
+    }
+
+    size_t count = 0;
+    for (int i = 0; i < config->nat_rule_count; i++) {
+        const nat_rule_t *nat = &config->nat_rules[i];
+        prefixes[count] = (lpm_prefix_t){ntohl(nat->network.s_addr),
+                                         nat->mask, DP_HOP_KERNEL};
+        count += nat->mask > 0;
+    }
+    for (int i = 0; i < config->bridge_count; i++) {
+        const bridge_t *br = &config->bridges[i];
+        prefixes[count] = (lpm_prefix_t){ntohl(br->ip_addr.s_addr), br->mask,
+                                         DP_HOP_KERNEL};
+        count += br->mask > 0 && br->ip_addr.s_addr != 0;
+    }
+    for (int i = 0; i < config->namespace_count; i++) {
+        const namespace_t *ns = &config->namespaces[i];
+        if (port_of[i] >= 0) {
+            prefixes[count++] = (lpm_prefix_t){
+                ntohl(ns->ip_addr.s_addr), ns->mask, DP_HOP_PORT(port_of[i])};
+        }
+    }
+    // the host end of each link belongs to the host
+    for (int i = 0; i < config->namespace_count; i++) {
+        const namespace_t *ns = &config->namespaces[i];
+        if (port_of[i] >= 0 && ns->gateway.s_addr != 0) {
+            prefixes[count++] = (lpm_prefix_t){ntohl(ns->gateway.s_addr), 32,
+                                               DP_HOP_KERNEL};
+        }
+    }
+    dp->prefixes = prefixes;
+    dp->prefix_count = count;
+    return 0;
+}
+
+static dp_fib_t *build_fib(const dataplane_t *dp, const config_t *config,
+                           const int *port_of) {
+    dp_fib_t *fib = calloc(1, sizeof *fib);
+    if (fib == NULL ||
+        lpm_build(&fib->routes, dp->prefixes, dp->prefix_count) != 0) {
+        free(fib);
+        return NULL;
+    }
+    fib->default_hop = dp->uplink >= 0 ? DP_HOP_PORT(dp->uplink) : 0;
+
+    // same permitted pairs as the forward chain, by port
+    fib->allowed = malloc((config->fw_rule_count + 1) * sizeof *fib->allowed);
+    if (fib->allowed == NULL) {
+        free_fib(fib);
+        return NULL;
+    }
+    fib->allow_all = config->fw_default_action == FW_ALLOW;
+    fib->track = !fib->allow_all || dp->uplink >= 0;
+    for (int r = 0; r < config->fw_rule_count; r++) {
+        const fw_rule_t *rule = &config->fw_rules[r];
+        int src = rule->src_type == ENDPOINT_NS ? port_of[rule->src_ns] : -1;
+        int dst = rule->dst_type == ENDPOINT_NS ? port_of[rule->dst_ns]
+                                                : dp->uplink;
+        if (src >= 0 && dst >= 0) {
+            fib->allowed[fib->allowed_count++] = (uint64_t)src << 32 | dst;
+        }
+    }
+    qsort(fib->allowed, fib->allowed_count, sizeof *fib->allowed, cmp_pair);
+    return fib;
+}
+
+/* Whether the whole subnet of a port is in a NAT prefix */
+static bool port_nats(const config_t *config, const dp_port_t *port) {
+    int mask = 32 - __builtin_popcount(port->hostmask);
+    for (int i = 0; i < config->nat_rule_count; i++) {
+        const nat_rule_t *nat = &config->nat_rules[i];
+        uint32_t bits = nat->mask ? ~0u << (32 - nat->mask) : 0;
+        if (nat->mask <= mask &&
+            (port->network & bits) == (ntohl(nat->network.s_addr) & bits)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Split the NAT ports between the workers, the last one taking what does
+ * not divide evenly. A reply's destination port then names its flow's
+ * owner.
+ */
+static void share_nat_ports(dataplane_t *dp, uint32_t addr, int workers) {
+    uint32_t ports = CT_NAT_PORT_MAX - CT_NAT_PORT_MIN + 1;
+    dp->nat_span = ports / workers;
+    for (int w = 0; w < workers; w++) {
+        uint32_t lo = CT_NAT_PORT_MIN + w * dp->nat_span;
+        uint32_t hi =
+            w == workers - 1 ? CT_NAT_PORT_MAX : lo + dp->nat_span - 1;
+        ct_nat_range(&dp->workers[w].ct, addr, lo, hi);
+    }
+}
+
+static int init_workers(dataplane_t *dp, const config_t *config) {
+    int count = config->dataplane_workers;
+    // whole cache lines, so no two workers share one
+    dp->workers = aligned_alloc(64, count * sizeof *dp->workers);
+    if (dp->workers == NULL) {
+        return -1;
+    }
+    memset(dp->workers, 0, count * sizeof *dp->workers);
+    for (int w = 0; w < count; w++) {
+        dp_worker_t *worker = &dp->workers[w];
+        worker->index = w;
+        worker->dp = dp;
+        worker->reader = -1;
+        worker->wake_fd = -1;
+        atomic_init(&worker->idle, false);
+        if (ct_init(&worker->ct, config->conntrack_flows, ct_now()) != 0) {
+            return -1;
+        }
+        dp->worker_count++;
+    }
+    dp->active = count;
+    share_nat_ports(dp, 0, count);
+    rss_init(&dp->rss, rss_symmetric_key);
+    return 0;
+}
+
+int dataplane_build(dataplane_t *dp, const config_t *config) {
+    int *port_of = malloc((config->namespace_count + 1) * sizeof *port_of);
+    if (port_of == NULL) {
+        return -1;
+    }
+
+    int count = 0;
+    for (int i = 0; i < config->namespace_count; i++) {
+        const namespace_t *ns = &config->namespaces[i];
+        bool port = ns->connect_type == CONNECT_VETH && ns->mask > 0 &&
+                    ns->ip_addr.s_addr != 0;
+        port_of[i] = port ? count++ : -1;
+    }
+
+    dp->ports = arena_alloc(&dp->arena, (count + 2) * sizeof *dp->ports);
+    if (dp->ports == NULL) {
+        free(port_of);
+        return -1;
+    }
+    bool nat = false;
+    for (int i = 0; i < config->namespace_count; i++) {
+        if (port_of[i] < 0) {
+            continue;
+        }
+        const namespace_t *ns = &config->namespaces[i];
+        dp_port_t *port = &dp->ports[port_of[i]];
+        size_t len = strlen(ns->name) + 1;
+        char *name = arena_alloc(&dp->arena, len);
+        if (name == NULL) {
+            free(port_of);
+            return -1;
+        }
+        memcpy(name, ns->name, len);
+        port->ns_name = name;
+        veth_host_ifname(ns, port->ifname);
+        port->hostmask = ns->mask >= 32 ? 0 : ~0u >> ns->mask;
+        port->network = ntohl(ns->ip_addr.s_addr) & ~port->hostmask;
+        port->gateway = ntohl(ns->gateway.s_addr);
+        port->nat = config->nat_outgoing_interface[0] != '\0' &&
+                    port_nats(config, port);
+        nat |= port->nat;
+        port->prog_fd = -1;
+    }
+    if (nat) {
+        // every address is somewhere behind the uplink
+        dp_port_t *port = &dp->ports[count];
+        snprintf(port->ifname, sizeof port->ifname, "%s",
+                 config->nat_outgoing_interface);
+        port->hostmask = ~0u;
+        port->prog_fd = -1;
+        dp->uplink = count++;
+    }
+    dp->port_count = count;
+
+    dp_fib_t *fib = NULL;
+    if (collect_prefixes(dp, config, port_of) == 0 &&
+        init_workers(dp, config) == 0) {
+        fib = build_fib(dp, config, port_of);
+    }
+    free(port_of);
+    if (fib == NULL) {
+        return -1;
+    }
+    free_fib(atomic_exchange(&dp->fib, fib));
+    return 0;
+}
+
+/*
+ * Ports stay bound to their links, and the programs keep steering, as
+ * long as these are unchanged
+ */
+static bool same_ports(const dataplane_t *a, const dataplane_t *b) {
+    if (a->port_count != b->port_count || a->uplink != b->uplink ||
+        a->prefix_count != b->prefix_count ||
+        a->worker_count != b->worker_count ||
+        a->workers[0].ct.capacity != b->workers[0].ct.capacity) {
+        return false;
+    }
+    for (int i = 0; i < a->prefix_count; i++) {
+        const lpm_prefix_t *pa = &a->prefixes[i], *pb = &b->prefixes[i];
+        if (pa->network != pb->network || pa->mask != pb->mask ||
+            pa->hop != pb->hop) {
+            return false;
+        }
+    }
+    for (int i = 0; i < a->port_count; i++) {
+        const dp_port_t *pa = &a->ports[i], *pb = &b->ports[i];
+        if (strcmp(pa->ifname, pb->ifname) != 0 ||
+            (pa->ns_name != NULL && strcmp(pa->ns_name, pb->ns_name) != 0) ||
+            pa->network != pb->network || pa->hostmask != pb->hostmask ||
+            pa->gateway != pb->gateway || pa->nat != pb->nat) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int dataplane_update(dataplane_t *dp, const config_t *config) {
+    dataplane_t next;
+    dataplane_init(&next);
+    if (dataplane_build(&next, config) != 0 || !same_ports(dp, &next)) {
+        dataplane_free(&next);
+        return -1;
+    }
+    dp_fib_t *old = atomic_exchange(&dp->fib, atomic_exchange(&next.fib, NULL));
+    // the workers may still be routing a batch with the old one
+    rcu_synchronize(&dp->rcu);
+    free_fib(old);
+    dataplane_free(&next);
+    return 0;
+}
+
+/* A received frame as far as routing it needs */
+typedef struct {
+    uint32_t dst;      /* Destination, host byte order, 0 to drop */
+    uint32_t ref;      /* Flow and direction, CT_NONE if there is none */
+    bool tracked;      /* tuple is set */
+    bool echo_reply;   /* An ICMP echo reply, which starts no flow */
+    uint8_t tcp_flags; /* Flags of a TCP segment, else 0 */
+    ct_tuple_t tuple;  /* The packet's identity */
+} dp_packet_t;
+
+/*
+ * Destination of a frame worth routing, or 0 for frames that are not
+ * IPv4 or that must not be forwarded
+ */
+static uint32_t frame_dst(const uint8_t *frame, uint32_t len) {
+    if (len < ETH_HLEN + IP_HLEN) {
+        return 0;
+    }
+    uint16_t proto;
+    memcpy(&proto, frame + 2 * ETH_ALEN, sizeof proto);
+    const uint8_t *ip = frame + ETH_HLEN;
+    if (proto != htons(ETH_P_IP) || ip[0] >> 4 != 4 || (ip[0] & 0xf) < 5 ||
+        len < ETH_HLEN + (ip[0] & 0xfu) * 4) {
+        return 0;
+    }
+    if (ip[8] <= 1) {
+        return 0; // TTL would expire, the kernel sends no ICMP for us
+    }
+    uint32_t daddr;
+    memcpy(&daddr, ip + 16, sizeof daddr);
+    return ntohl(daddr);
+}
+
+/*
+ * The tuple of TCP, UDP and ICMP echo, whose headers follow the IP header
+ * within the frame. Fragments only carry the ports in the first one, so
+ * none of them has a tuple.
+ */
+static bool parse_tuple(const uint8_t *ip, uint32_t len, dp_packet_t *pkt) {
+    uint32_t ihl = (ip[0] & 0xfu) * 4;
+    if (((ip[6] & 0x3f) | ip[7]) != 0) {
+        return false;
+    }
+    const uint8_t *l4 = ip + ihl;
+    ct_tuple_t *t = &pkt->tuple;
+    memset(t, 0, sizeof *t);
+    t->proto = ip[9];
+    switch (t->proto) {
+    case IPPROTO_TCP:
+        if (len < ihl + 20) {
+            return false;
+        }
+        memcpy(&t->sport, l4, sizeof t->sport);
+        memcpy(&t->dport, l4 + 2, sizeof t->dport);
+        pkt->tcp_flags = l4[13];
+        break;
+    case IPPROTO_UDP:
+        if (len < ihl + 8) {
+            return false;
+        }
+        memcpy(&t->sport, l4, sizeof t->sport);
+        memcpy(&t->dport, l4 + 2, sizeof t->dport);
+        break;
+    case IPPROTO_ICMP:
+        if (len < ihl + 8 || (l4[0] != ICMP_ECHO && l4[0] != ICMP_ECHOREPLY)) {
+            return false;
+        }
+        memcpy(&t->sport, l4 + 4, sizeof t->sport);
+        t->dport = t->sport;
+        pkt->echo_reply = l4[0] == ICMP_ECHOREPLY;
+        break;
+    default:
+        return false;
+    }
+    memcpy(&t->src, ip + 12, sizeof t->src);
+    memcpy(&t->dst, ip + 16, sizeof t->dst);
+    return true;
+}
+
+/* Fix a checksum for one 16-bit word that changed, RFC 1624 eqn. 3 */
+static uint16_t csum_update16(uint16_t check, uint16_t from, uint16_t to) {
+    uint32_t sum = (uint16_t)~check + (uint32_t)(uint16_t)~from + to;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+static uint16_t csum_update32(uint16_t check, uint32_t from, uint32_t to) {
+    check = csum_update16(check, from >> 16, to >> 16);
+    return csum_update16(check, from & 0xffff, to & 0xffff);
+}
+
+/*
+ * Translate the source or the destination of a packet parse_tuple()
+ * accepted: address and port, or echo identifier, in network byte order.
+ * The checksums are updated rather than recomputed, a UDP one only if the
+ * sender computed it.
+ */
+static void translate(uint8_t *ip, bool source, uint32_t addr, uint16_t port) {
+    uint8_t *l4 = ip + (ip[0] & 0xfu) * 4;
+    uint8_t *addr_at = ip + (source ? 12 : 16);
+    uint8_t *port_at, *check_at;
+    bool pseudo = true;
+    switch (ip[9]) {
+    case IPPROTO_TCP:
+        port_at = l4 + (source ? 0 : 2);
+        check_at = l4 + 16;
+        break;
+    case IPPROTO_UDP:
+        port_at = l4 + (source ? 0 : 2);
+        check_at = l4 + 6;
+        break;
+    default:
+        port_at = l4 + 4;
+        check_at = l4 + 2;
+        pseudo = false; // ICMP covers no pseudo header
+        break;
+    }
+
+    uint32_t old_addr;
+    uint16_t old_port, check;
+    memcpy(&old_addr, addr_at, sizeof old_addr);
+    memcpy(&old_port, port_at, sizeof old_port);
+    memcpy(&check, ip + 10, sizeof check);
+    check = csum_update32(check, old_addr, addr);
+    memcpy(ip + 10, &check, sizeof check);
+
+    memcpy(&check, check_at, sizeof check);
+    if (ip[9] != IPPROTO_UDP || check != 0) {
+        if (pseudo) {
+            check = csum_update32(check, old_addr, addr);
+        }
+        check = csum_update16(check, old_port, port);
+        if (ip[9] == IPPROTO_UDP && check == 0) {
+            check = 0xffff; // 0 would say there is none
+        }
+        memcpy(check_at, &check, sizeof check);
+    }
+    memcpy(addr_at, &addr, sizeof addr);
+    memcpy(port_at, &port, sizeof port);
+}
+
+/*
+ * Everything about a frame that comes before routing it, and before
+ * picking its worker: whether it is worth routing and its flow
+ */
+static void inspect(const dp_fib_t *fib, const uint8_t *frame, uint32_t len,
+                    dp_packet_t *pkt) {
+    pkt->ref = CT_NONE;
+    pkt->tracked = pkt->echo_reply = false;
+    pkt->tcp_flags = 0;
+    pkt->dst = frame_dst(frame, len);
+    if (pkt->dst != 0 && fib->track) {
+        pkt->tracked = parse_tuple(frame + ETH_HLEN, len - ETH_HLEN, pkt);
+    }
+}
+
+/* An Ethernet address as dp_port_t.peer holds it */
+static uint64_t mac_word(const uint8_t *mac) {
+    uint64_t word = 0;
+    memcpy(&word, mac, ETH_ALEN);
+    return word;
+}
+
+/* The namespace is the only host behind its veth pair */
+static void learn(dataplane_t *dp, int in_port, const uint8_t *frame,
+                  const dp_packet_t *pkt) {
+    if (in_port == dp->uplink || pkt->dst == 0) {
+        return;
+    }
+    uint64_t peer = mac_word(frame + ETH_ALEN);
+    _Atomic(uint64_t) *known = &dp->ports[in_port].peer;
+    if (atomic_load_explicit(known, memory_order_relaxed) != peer) {
+        atomic_store_explicit(known, peer, memory_order_relaxed);
+    }
+}
+
+/*
+ * Worker of an inspected packet, or -1 for one without a flow. Replies on
+ * the uplink come to the worker that picked their NAT port; anything else
+ * hashes both directions of a flow alike.
+ */
+static int owner(const dataplane_t *dp, int in_port, const dp_packet_t *pkt) {
+    if (!pkt->tracked || dp->active == 1) {
+        return -1;
+    }
+    const ct_tuple_t *t = &pkt->tuple;
+    if (in_port == dp->uplink) {
+        uint32_t port = ntohs(t->dport);
+        if (port < CT_NAT_PORT_MIN || port > CT_NAT_PORT_MAX) {
+            return -1;
+        }
+        uint32_t w = (port - CT_NAT_PORT_MIN) / dp->nat_span;
+        return w < (uint32_t)dp->active ? (int)w : dp->active - 1;
+    }
+    uint8_t input[RSS_INPUT_MAX];
+    memcpy(input, &t->src, 4);
+    memcpy(input + 4, &t->dst, 4);
+    memcpy(input + 8, &t->sport, 2);
+    memcpy(input + 10, &t->dport, 2);
+    uint32_t hash = rss_hash(&dp->rss, input, sizeof input);
+    return (int)((uint64_t)hash * dp->active >> 32);
+}
+
+int dataplane_owner(const dataplane_t *dp, int in_port, const uint8_t *frame,
+                    uint32_t len) {
+    dp_packet_t pkt;
+    inspect(atomic_load(&dp->fib), frame, len, &pkt);
+    return owner(dp, in_port, &pkt);
+}
+
+/*
+ * Look an inspected packet up in the worker's flows. For replies to
+ * translated flows the original destination is what gets routed.
+ */
+static void classify(dp_worker_t *w, int in_port, uint8_t *frame,
+                     dp_packet_t *pkt) {
+    if (pkt->dst == 0) {
+        return;
+    }
+    if (pkt->tracked) {
+        pkt->ref = ct_lookup(&w->ct, &pkt->tuple);
+    }
+    const ct_flow_t *flow = ct_flow(&w->ct, pkt->ref);
+    if (pkt->ref != CT_NONE && (pkt->ref & 1) == CT_DIR_REPLY &&
+        (flow->state & CT_NAT)) {
+        const ct_tuple_t *orig = &flow->tuple[CT_DIR_ORIGINAL];
+        translate(frame + ETH_HLEN, false, orig->src, orig->sport);
+        pkt->dst = ntohl(orig->src);
+    } else if (in_port == w->dp->uplink) {
+        // the program only hands over ports of flows, so this one expired
+        // in the meantime
+        pkt->dst = 0;
+    }
+}
+
+/* Start tracking a packet's flow, translated if it leaves via the uplink */
+static uint32_t new_flow(dp_worker_t *w, const dp_fib_t *fib, int in_port,
+                         int out, dp_packet_t *pkt) {
+    dataplane_t *dp = w->dp;
+    const ct_tuple_t *t = &pkt->tuple;
+    ct_tuple_t reply = *t;
+    reply.src = t->dst;
+    reply.dst = t->src;
+    reply.sport = t->dport;
+    reply.dport = t->sport;
+    if (out != dp->uplink) {
+        return fib->allow_all ? CT_NONE
+                              : ct_insert(&w->ct, t, &reply, 0, w->now);
+    }
+
+    // an echo reply answers nothing the uplink could reach
+    if (!dp->ports[in_port].nat || w->ct.nat_addr == 0 || pkt->echo_reply) {
+        return CT_NONE;
+    }
+    reply.dst = w->ct.nat_addr;
+    if (ct_nat_port(&w->ct, &reply) != 0) {
+        return CT_NONE;
+    }
+    return ct_insert(&w->ct, t, &reply, CT_NAT, w->now);
+}
+
+/*
+ * Check a routed frame against the flows and the policy, translate it if
+ * its flow says so, and rewrite it for its port
+ */
+static int forward(dp_worker_t *w, const dp_fib_t *fib, int in_port,
+                   uint8_t *frame, dp_packet_t *pkt, uint32_t hop) {
+    dataplane_t *dp = w->dp;
+    if (hop == 0) {
+        hop = fib->default_hop;
+    }
+    if (pkt->dst == 0 || hop < DP_HOP_PORT(0)) {
+        return -1; // no route, or one to the host or a bridge
+    }
+    int out = hop - DP_HOP_PORT(0);
+    if (out == in_port) {
+        return -1;
+    }
+    dp_port_t *port = &dp->ports[out];
+    uint32_t host = pkt->dst & port->hostmask;
+    uint64_t peer = atomic_load_explicit(&port->peer, memory_order_relaxed);
+    if (peer == 0 ||
+        (port->hostmask > 1 && (host == 0 || host == port->hostmask))) {
+        return -1; // unresolved, or a subnet broadcast
+    }
+
+    if (pkt->tracked && pkt->ref == CT_NONE) {
+        // an earlier frame of the batch may have started the flow
+        pkt->ref = ct_lookup(&w->ct, &pkt->tuple);
+    }
+    if (pkt->ref == CT_NONE) {
+        uint64_t pair = (uint64_t)in_port << 32 | out;
+        if (!fib->allow_all && bsearch(&pair, fib->allowed, fib->allowed_count,
+                                       sizeof pair, cmp_pair) == NULL) {
+            return -1;
+        }
+        uint32_t flow =
+            pkt->tracked ? new_flow(w, fib, in_port, out, pkt) : CT_NONE;
+        if (flow != CT_NONE) {
+            pkt->ref = flow << 1 | CT_DIR_ORIGINAL;
+        } else if (out == dp->uplink) {
+            return -1; // not translatable, or out of flows or ports
+        }
+    }
+
+    uint8_t *ip = frame + ETH_HLEN;
+    if (pkt->ref != CT_NONE) {
+        int dir = pkt->ref & 1;
+        ct_flow_t *flow = ct_flow(&w->ct, pkt->ref);
+        ct_update(&w->ct, pkt->ref >> 1, dir, pkt->tcp_flags, w->now);
+        if (dir == CT_DIR_ORIGINAL && (flow->state & CT_NAT)) {
+            const ct_tuple_t *reply = &flow->tuple[CT_DIR_REPLY];
+            translate(ip, true, reply->dst, reply->dport);
+        }
+    }
+
+    // TTL is the high byte of its checksummed word, as ip_decrease_ttl()
+    uint16_t check;
+    memcpy(&check, ip + 10, sizeof check);
+    uint32_t sum = check + (uint32_t)htons(0x0100);
+    check = (uint16_t)(sum + (sum >= 0xffff));
+    memcpy(ip + 10, &check, sizeof check);
+    ip[8]--;
+
+    memcpy(frame, &peer, ETH_ALEN);
+    memcpy(frame + ETH_ALEN, port->host_mac, ETH_ALEN);
+    return out;
+}
+
+int dataplane_route(dataplane_t *dp, int worker, int in_port, uint8_t *frame,
+                    uint32_t len) {
+    dp_worker_t *w = &dp->workers[worker];
+    const dp_fib_t *fib = atomic_load(&dp->fib);
+    dp_packet_t pkt;
+    w->now = ct_now();
+    inspect(fib, frame, len, &pkt);
+    learn(dp, in_port, frame, &pkt);
+    classify(w, in_port, frame, &pkt);
+    uint32_t hop = pkt.dst != 0 ? lpm_lookup(&fib->routes, pkt.dst) : 0;
+    return forward(w, fib, in_port, frame, &pkt, hop);
+}
+
+/* The queue a worker transmits on to a port */
+static dp_queue_t *tx_queue(const dp_worker_t *w, int port) {
+    return &w->dp->queues[w->dp->ports[port].first_queue + w->index];
+}
+
+/*
+ * Move the frames staged for a worker onto the ring to it, and wake it if
+ * it sleeps. What does not fit is dropped.
+ */
+static void flush_outbox(dp_worker_t *w, int to) {
+    dataplane_t *dp = w->dp;
+    spsc_frame_t *box = &w->outbox[to * DATAPLANE_BATCH];
+    uint32_t n = w->outbox_count[to];
+    uint32_t sent = spsc_push(&dp->rings[w->index * dp->active + to], box, n);
+    w->outbox_count[to] = 0;
+    w->handed_off += sent;
+    for (uint32_t i = sent; i < n; i++) {
+        w->dropped++;
+        pktpool_free(&w->cache, &box[i].addr, 1);
+    }
+    if (sent == 0) {
+        return;
+    }
+    // pairs with the fence of the other worker going idle: either it sees
+    // the frames, or this sees it idle
+    atomic_thread_fence(memory_order_seq_cst);
+    dp_worker_t *peer = &dp->workers[to];
+    if (atomic_load_explicit(&peer->idle, memory_order_relaxed)) {
+        uint64_t one = 1;
+        if (write(peer->wake_fd, &one, sizeof one) < 0) {
+            // it still looks again within DATAPLANE_IDLE_MS
+        }
+    }
+}
+
+static void hand_off(dp_worker_t *w, int to, spsc_frame_t frame) {
+    if (w->outbox_count[to] == DATAPLANE_BATCH) {
+        flush_outbox(w, to);
+    }
+    w->outbox[to * DATAPLANE_BATCH + w->outbox_count[to]++] = frame;
+}
+
+/* Take back the frames the kernel transmitted */
+static uint32_t reclaim(dp_worker_t *w, dp_queue_t *queue) {
+    uint32_t idx;
+    uint32_t n = xdp_ring_peek(&queue->xsk.comp, DATAPLANE_BATCH, &idx);
+    if (n == 0) {
+        return 0;
+    }
+    uint64_t addrs[DATAPLANE_BATCH];
+    for (uint32_t i = 0; i < n; i++) {
+        addrs[i] = *xdp_ring_addr(&queue->xsk.comp, idx + i);
+    }
+    xdp_ring_release(&queue->xsk.comp, n);
+    pktpool_free(&w->cache, addrs, n);
+    return n;
+}
+
+/* Top the fill ring up to the queue's target with frames of the pool */
+static void refill(dp_worker_t *w, dp_queue_t *queue) {
+    xdp_ring_t *fill = &queue->xsk.fill;
+    uint32_t queued = fill->cached_prod - fill->cached_cons;
+    if (queued * 2 > queue->fill_target) {
+        fill->cached_cons = __atomic_load_n(fill->consumer, __ATOMIC_ACQUIRE);
+        queued = fill->cached_prod - fill->cached_cons;
+    }
+    uint64_t addrs[XDP_RING_SIZE];
+    uint32_t want = pktpool_alloc(&w->cache, addrs,
+                                  queue->fill_target - queued);
+    if (want == 0) {
+        return;
+    }
+    uint32_t idx;
+    uint32_t n = xdp_ring_reserve(fill, want, &idx);
+    for (uint32_t i = 0; i < n; i++) {
+        *xdp_ring_addr(fill, idx + i) = addrs[i];
+    }
+    xdp_ring_submit(fill);
+    pktpool_free(&w->cache, addrs + n, want - n);
+}
+
+/* Route inspected frames of flows the worker owns onto its tx rings */
+static void route_batch(dp_worker_t *w, const dp_fib_t *fib,
+                        const spsc_frame_t *frames, dp_packet_t *pkts,
+                        uint32_t n) {
+    dataplane_t *dp = w->dp;
+    if (n == 0) {
+        return;
+    }
+
+    // all lookups of the batch first, so their cache misses overlap
+    uint32_t dsts[DATAPLANE_BATCH], hops[DATAPLANE_BATCH];
+    for (uint32_t i = 0; i < n; i++) {
+        classify(w, frames[i].port, (uint8_t *)dp->umem.area + frames[i].addr,
+                 &pkts[i]);
+        dsts[i] = pkts[i].dst;
+    }
+    lpm_lookup_batch(&fib->routes, dsts, hops, n);
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint8_t *frame = (uint8_t *)dp->umem.area + frames[i].addr;
+        int out = forward(w, fib, frames[i].port, frame, &pkts[i], hops[i]);
+        dp_queue_t *queue = out >= 0 ? tx_queue(w, out) : NULL;
+
+        uint32_t slot;
+        if (out < 0 || xdp_ring_reserve(&queue->xsk.tx, 1, &slot) == 0) {
+            w->dropped++;
+            pktpool_free(&w->cache, &frames[i].addr, 1);
+            continue;
+        }
+        // the frame moves to the other socket without a copy
+        *xdp_ring_desc(&queue->xsk.tx, slot) =
+            (struct xdp_desc){.addr = frames[i].addr, .len = frames[i].len};
+        queue->tx_pending = true;
+    }
+}
+
+/*
+ * Take one batch received on a queue: frames of flows another worker owns
+ * are handed to it, the rest are routed here
+ */
+static uint32_t receive(dp_worker_t *w, const dp_fib_t *fib,
+                        dp_queue_t *queue) {
+    dataplane_t *dp = w->dp;
+    uint32_t idx;
+    uint32_t n = xdp_ring_peek(&queue->xsk.rx, DATAPLANE_BATCH, &idx);
+    if (n == 0) {
+        return 0;
+    }
+
+    spsc_frame_t frames[DATAPLANE_BATCH];
+    dp_packet_t pkts[DATAPLANE_BATCH];
+    uint32_t mine = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        const struct xdp_desc *desc = xdp_ring_desc(&queue->xsk.rx, idx + i);
+        spsc_frame_t f = {desc->addr, desc->len, queue->port};
+        const uint8_t *frame = (uint8_t *)dp->umem.area + desc->addr;
+        inspect(fib, frame, desc->len, &pkts[mine]);
+        learn(dp, queue->port, frame, &pkts[mine]);
+        int to = owner(dp, queue->port, &pkts[mine]);
+        if (to >= 0 && to != w->index) {
+            hand_off(w, to, f);
+        } else {
+            frames[mine++] = f;
+        }
+    }
+    xdp_ring_release(&queue->xsk.rx, n);
+    route_batch(w, fib, frames, pkts, mine);
+    return n;
+}
+
+/* Route what other workers handed over */
+static uint32_t drain_inboxes(dp_worker_t *w, const dp_fib_t *fib) {
+    dataplane_t *dp = w->dp;
+    uint32_t moved = 0;
+    for (int from = 0; from < dp->active; from++) {
+        if (from == w->index) {
+            continue;
+        }
+        spsc_frame_t frames[DATAPLANE_BATCH];
+        dp_packet_t pkts[DATAPLANE_BATCH];
+        spsc_ring_t *ring = &dp->rings[from * dp->active + w->index];
+        uint32_t n = spsc_pop(ring, frames, DATAPLANE_BATCH);
+        for (uint32_t i = 0; i < n; i++) {
+            inspect(fib, (uint8_t *)dp->umem.area + frames[i].addr,
+                    frames[i].len, &pkts[i]);
+        }
+        route_batch(w, fib, frames, pkts, n);
+        moved += n;
+    }
+    return moved;
+}
+
+static bool inboxes_empty(const dp_worker_t *w) {
+    const dataplane_t *dp = w->dp;
+    for (int from = 0; from < dp->active; from++) {
+        if (from != w->index &&
+            !spsc_empty(&dp->rings[from * dp->active + w->index])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void transmit(dp_worker_t *w, dp_queue_t *queue) {
+    xdp_ring_t *tx = &queue->xsk.tx;
+    w->forwarded += tx->cached_prod - *tx->producer;
+    xdp_ring_submit(tx);
+    queue->tx_pending = false;
+    // copy mode only sends from the syscall
+    if (!w->dp->umem.zerocopy || xdp_ring_needs_wakeup(tx)) {
+        sendto(queue->xsk.fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+    }
+}
+
+static void *dataplane_worker(void *arg) {
+    dp_worker_t *w = arg;
+    dataplane_t *dp = w->dp;
+    int nfds = w->rx_count + 1;
+    struct pollfd *fds = calloc(nfds, sizeof *fds);
+    if (fds == NULL) {
+        fprintf(stderr, "Userspace data plane is out of memory\n");
+        return NULL;
+    }
+    for (int i = 0; i < w->rx_count; i++) {
+        fds[i] = (struct pollfd){.fd = dp->queues[w->rx[i]].xsk.fd,
+                                 .events = POLLIN};
+    }
+    fds[w->rx_count] = (struct pollfd){.fd = w->wake_fd, .events = POLLIN};
+
+    while (!atomic_load_explicit(&dp->stop, memory_order_relaxed)) {
+        // nothing from the previous round is referenced any more
+        rcu_quiescent(&dp->rcu, w->reader);
+        const dp_fib_t *fib = atomic_load(&dp->fib);
+        w->now = ct_now();
+        ct_expire(&w->ct, w->now);
+        uint32_t moved = drain_inboxes(w, fib);
+        for (int p = 0; p < dp->port_count; p++) {
+            moved += reclaim(w, tx_queue(w, p));
+        }
+        for (int i = 0; i < w->rx_count; i++) {
+            dp_queue_t *queue = &dp->queues[w->rx[i]];
+            refill(w, queue);
+            moved += receive(w, fib, queue);
+        }
+        for (int to = 0; to < dp->active; to++) {
+            if (w->outbox_count[to] > 0) {
+                flush_outbox(w, to);
+            }
+        }
+        for (int p = 0; p < dp->port_count; p++) {
+            if (tx_queue(w, p)->tx_pending) {
+                transmit(w, tx_queue(w, p));
+            }
+        }
+        if (moved > 0) {
+            continue;
+        }
+        // nothing to do, sleep until a frame, a handover or the stop
+        // request arrives
+        rcu_offline(&dp->rcu, w->reader);
+        atomic_store(&w->idle, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!inboxes_empty(w)) {
+            atomic_store(&w->idle, false);
+            continue;
+        }
+        if (poll(fds, nfds, DATAPLANE_IDLE_MS) < 0 && errno != EINTR) {
+            fprintf(stderr, "Userspace data plane poll failed: %s\n",
+                    strerror(errno));
+            break;
+        }
+        uint64_t wakeups;
+        if ((fds[w->rx_count].revents & POLLIN) &&
+            read(w->wake_fd, &wakeups, sizeof wakeups) < 0) {
+            // reset by an earlier read, nothing is lost
+        }
+        atomic_store(&w->idle, false);
+    }
+    rcu_offline(&dp->rcu, w->reader);
+    free(fds);
+    return NULL;
+}
+
+/* Ports by host end name, filled in from a link dump */
+typedef struct {
+    dp_port_t **sorted; /* Ports sorted by ifname */
+    int count;          /* Number of ports */
+} link_scan_t;
+
+static int cmp_port_ptr(const void *a, const void *b) {
+    return strcmp((*(dp_port_t *const *)a)->ifname,
+                  (*(dp_port_t *const *)b)->ifname);
+}
+
+static int cmp_port_name(const void *key, const void *entry) {
+    return strcmp(key, (*(dp_port_t *const *)entry)->ifname);
+}
+
+/*
+ * Read the name, hardware address and queues of a link: the fewer of its
+ * receive and transmit queues, 1 if the kernel does not say
+ */
+static int link_attrs(const struct nlmsghdr *nlh, const char **name,
+                      const uint8_t **mac, uint32_t *queues) {
+    const struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    *name = NULL;
+    *mac = NULL;
+    uint32_t rx = 1, tx = 1;
+    int len = IFLA_PAYLOAD(nlh);
+    for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len);
+         rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFLA_IFNAME) {
+            *name = RTA_DATA(rta);
+        } else if (rta->rta_type == IFLA_ADDRESS &&
+                   RTA_PAYLOAD(rta) == ETH_ALEN) {
+            *mac = RTA_DATA(rta);
+        } else if (rta->rta_type == IFLA_NUM_RX_QUEUES &&
+                   RTA_PAYLOAD(rta) == 4) {
+            memcpy(&rx, RTA_DATA(rta), 4);
+        } else if (rta->rta_type == IFLA_NUM_TX_QUEUES &&
+                   RTA_PAYLOAD(rta) == 4) {
+            memcpy(&tx, RTA_DATA(rta), 4);
+        }
+    }
+    *queues = rx < tx ? rx : tx;
+    if (*queues == 0) {
+        *queues = 1;
+    }
+    return ifi->ifi_index;
+}
+
+static int scan_host_link(const struct nlmsghdr *nlh, void *arg) {
+    link_scan_t *scan = arg;
+    const char *name;
+    const uint8_t *mac;
+    uint32_t queues;
+    int ifindex = link_attrs(nlh, &name, &mac, &queues);
+    if (name == NULL || mac == NULL) {
+        return 0;
+    }
+    dp_port_t **port = bsearch(name, scan->sorted, scan->count,
+                               sizeof *scan->sorted, cmp_port_name);
+    if (port != NULL) {
+        (*port)->ifindex = ifindex;
+        memcpy((*port)->host_mac, mac, ETH_ALEN);
+        (*port)->max_queues = queues;
+    }
+    return 0;
+}
+
+/* Index, address and queues of every port's host end, from one dump */
+static int find_links(dataplane_t *dp, nl_sock_t *nl) {
+    link_scan_t scan = {malloc(dp->port_count * sizeof *scan.sorted),
+                        dp->port_count};
+    if (scan.sorted == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < dp->port_count; i++) {
+        scan.sorted[i] = &dp->ports[i];
+    }
+    qsort(scan.sorted, scan.count, sizeof *scan.sorted, cmp_port_ptr);
+    int status = nl_dump(nl, RTM_GETLINK, AF_UNSPEC, scan_host_link, &scan);
+    free(scan.sorted);
+    if (status != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < dp->port_count; i++) {
+        const dp_port_t *port = &dp->ports[i];
+        if (port->ifindex == 0 && i == dp->uplink) {
+            fprintf(stderr, "NAT outgoing interface %s does not exist\n",
+                    port->ifname);
+            return -1;
+        } else if (port->ifindex == 0) {
+            fprintf(stderr, "Host end %s of namespace %s does not exist\n",
+                    port->ifname, port->ns_name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* What the host's tables say about the uplink, from dumps at start */
+typedef struct {
+    int ifindex;          /* Index of the uplink */
+    uint32_t addr;        /* Its primary address, network byte order */
+    uint32_t gateway;     /* Gateway of its default route, network order */
+    uint32_t priority;    /* Metric of that route */
+    uint8_t *mac;         /* Where the gateway's address goes */
+    bool mac_found;       /* mac was stored */
+    lpm_prefix_t *routes; /* Every other route of the host */
+    int route_count;      /* Number of routes */
+    int route_cap;        /* Routes allocated */
+} uplink_scan_t;
+
+static int scan_uplink_addr(const struct nlmsghdr *nlh, void *arg) {
+    uplink_scan_t *scan = arg;
+    const struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+    if ((int)ifa->ifa_index != scan->ifindex || scan->addr != 0 ||
+        (ifa->ifa_flags & IFA_F_SECONDARY)) {
+        return 0;
+    }
+    int len = IFA_PAYLOAD(nlh);
+    for (struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, len);
+         rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFA_LOCAL && RTA_PAYLOAD(rta) == 4) {
+            memcpy(&scan->addr, RTA_DATA(rta), 4);
+        }
+    }
+    return 0;
+}
+
+/*
+ * The default route of the uplink with the lowest metric, and the other
+ * routes of the main and local tables, which must stay with the kernel
+ */
+static int scan_uplink_route(const struct nlmsghdr *nlh, void *arg) {
+    uplink_scan_t *scan = arg;
+    const struct rtmsg *rtm = NLMSG_DATA(nlh);
+    uint32_t table = rtm->rtm_table, dst = 0, gateway = 0, priority = 0;
+    int oif = 0;
+    int len = RTM_PAYLOAD(nlh);
+    for (struct rtattr *rta = RTM_RTA(rtm); RTA_OK(rta, len);
+         rta = RTA_NEXT(rta, len)) {
+        if (RTA_PAYLOAD(rta) != 4) {
+            continue;
+        }
+        uint32_t value;
+        memcpy(&value, RTA_DATA(rta), 4);
+        switch (rta->rta_type) {
+        case RTA_TABLE:
+            table = value;
+            break;
+        case RTA_DST:
+            dst = value;
+            break;
+        case RTA_GATEWAY:
+            gateway = value;
+            break;
+        case RTA_PRIORITY:
+            priority = value;
+            break;
+        case RTA_OIF:
+            oif = value;
+            break;
+        }
+    }
+    if (rtm->rtm_family != AF_INET ||
+        (table != RT_TABLE_MAIN && table != RT_TABLE_LOCAL)) {
+        return 0;
+    }
+    if (rtm->rtm_dst_len == 0) {
+        if (table == RT_TABLE_MAIN && oif == scan->ifindex && gateway != 0 &&
+            (scan->gateway == 0 || priority < scan->priority)) {
+            scan->gateway = gateway;
+            scan->priority = priority;
+        }
+        return 0;
+    }
+    if (scan->route_count == scan->route_cap) {
+        int cap = scan->route_cap ? scan->route_cap * 2 : 64;
+        lpm_prefix_t *routes = realloc(scan->routes, cap * sizeof *routes);
+        if (routes == NULL) {
+            return -1;
+        }
+        scan->routes = routes;
+        scan->route_cap = cap;
+    }
+    scan->routes[scan->route_count++] =
+        (lpm_prefix_t){ntohl(dst), rtm->rtm_dst_len, DP_HOP_KERNEL};
+    return 0;
+}
+
+static int scan_uplink_neigh(const struct nlmsghdr *nlh, void *arg) {
+    uplink_scan_t *scan = arg;
+    const struct ndmsg *ndm = NLMSG_DATA(nlh);
+    if (ndm->ndm_ifindex != scan->ifindex || !(ndm->ndm_state & NUD_USABLE)) {
+        return 0;
+    }
+    const uint8_t *mac = NULL;
+    uint32_t dst = 0;
+    // linux/neighbour.h has no NDA_RTA() for userspace
+    int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof *ndm);
+    struct rtattr *rta =
+        (struct rtattr *)((char *)ndm + NLMSG_ALIGN(sizeof *ndm));
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == NDA_DST && RTA_PAYLOAD(rta) == 4) {
+            memcpy(&dst, RTA_DATA(rta), 4);
+        } else if (rta->rta_type == NDA_LLADDR &&
+                   RTA_PAYLOAD(rta) == ETH_ALEN) {
+            mac = RTA_DATA(rta);
+        }
+    }
+    if (dst == scan->gateway && mac != NULL) {
+        memcpy(scan->mac, mac, ETH_ALEN);
+        scan->mac_found = true;
+    }
+    return 0;
+}
+
+/* Make the kernel resolve the gateway, by sending it something harmless */
+static void poke_gateway(uint32_t gateway) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return;
+    }
+    struct sockaddr_in addr = {.sin_family = AF_INET,
+                               .sin_port = htons(9), // discard
+                               .sin_addr = {gateway}};
+    if (sendto(fd, "", 0, MSG_DONTWAIT, (struct sockaddr *)&addr,
+               sizeof addr) < 0) {
+        // the neighbour lookup below reports the failure
+    }
+    close(fd);
+}
+
+/*
+ * Address, gateway and host routes of the uplink, read once: the data plane
+ * does not follow them when they change later. Fails when the uplink
+ * cannot masquerade, so that the kernel keeps doing it.
+ */
+static int resolve_uplink(dataplane_t *dp, nl_sock_t *nl,
+                          uplink_scan_t *scan) {
+    dp_port_t *port = &dp->ports[dp->uplink];
+    uint8_t mac[ETH_ALEN];
+    scan->ifindex = port->ifindex;
+    scan->mac = mac;
+    if (nl_dump(nl, RTM_GETADDR, AF_INET, scan_uplink_addr, scan) != 0 ||
+        nl_dump(nl, RTM_GETROUTE, AF_INET, scan_uplink_route, scan) != 0) {
+        return -1;
+    }
+    if (scan->addr == 0 || scan->gateway == 0) {
+        fprintf(stderr, "NAT outgoing interface %s has no %s\n", port->ifname,
+                scan->addr == 0 ? "IPv4 address" : "default gateway");
+        return -1;
+    }
+    for (int i = 0; i < DATAPLANE_RESOLVE_TRIES && !scan->mac_found; i++) {
+        if (i > 0) {
+            poke_gateway(scan->gateway);
+            usleep(DATAPLANE_RESOLVE_MS * 1000);
+        }
+        if (nl_dump(nl, RTM_GETNEIGH, AF_INET, scan_uplink_neigh, scan) != 0) {
+            return -1;
+        }
+    }
+    if (!scan->mac_found) {
+        char text[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &scan->gateway, text, sizeof text);
+        fprintf(stderr, "Gateway %s of %s does not answer ARP\n", text,
+                port->ifname);
+        return -1;
+    }
+    atomic_store(&port->peer, mac_word(mac));
+    share_nat_ports(dp, scan->addr, dp->worker_count);
+    return 0;
+}
+
+/* The namespace end of a port, looked up inside the namespace */
+typedef struct {
+    int ifindex;  /* Index of the namespace end */
+    uint8_t *mac; /* Where to store its address */
+    bool found;   /* mac was stored */
+} peer_scan_t;
+
+static int scan_peer_link(const struct nlmsghdr *nlh, void *arg) {
+    peer_scan_t *scan = arg;
+    const char *name;
+    const uint8_t *mac;
+    uint32_t queues;
+    if (link_attrs(nlh, &name, &mac, &queues) == scan->ifindex &&
+        mac != NULL) {
+        memcpy(scan->mac, mac, ETH_ALEN);
+        scan->found = true;
+    }
+    return 0;
+}
+
+/*
+ * A veth end normally leaves the L4 checksum to whoever receives the
+ * frame, which a socket forwarding raw frames cannot do, so the namespaces
+ * compute it themselves while the data plane runs. Frames a namespace sends
+ * teach its address too, so one that cannot be looked up now is only
+ * unreachable until it sends something.
+ */
+static int prepare_peers(dataplane_t *dp) {
+    for (int i = 0; i < dp->port_count; i++) {
+        dp_port_t *port = &dp->ports[i];
+        if (i == dp->uplink) {
+            continue;
+        }
+        namespace_t ns = {.name = port->ns_name};
+        if (set_ns_tx_checksum(&ns, false) != 0) {
+            return -1;
+        }
+        port->csum_off = true;
+
+        nl_sock_t nl;
+        int eth_index;
+        if (open_ns_socket(&ns, &nl, &eth_index) != 0) {
+            continue;
+        }
+        uint8_t mac[ETH_ALEN];
+        peer_scan_t scan = {eth_index, mac, false};
+        if (nl_dump(&nl, RTM_GETLINK, AF_UNSPEC, scan_peer_link, &scan) ==
+                0 &&
+            scan.found) {
+            atomic_store(&port->peer, mac_word(mac));
+        }
+        nl_close(&nl);
+    }
+    return 0;
+}
+
+static int add_steering(dataplane_t *dp, const lpm_prefix_t *p,
+                        uint32_t steer) {
+    struct in_addr network = {htonl(p->network)};
+    return xdp_filter_add(&dp->filter, network, p->mask, steer);
+}
+
+/*
+ * What the programs hand to userspace: port subnets, and with an uplink
+ * whatever the host has no specific route for, and replies to the NAT
+ * ports the workers' flows use. The host's own routes go in first, so the
+ * same prefix from the configuration overrides them.
+ */
+static int open_filter(dataplane_t *dp, const uplink_scan_t *scan) {
+    if (xdp_filter_open(&dp->filter, dp->queue_count) != 0) {
+        return -1;
+    }
+    if (dp->uplink >= 0) {
+        if (xdp_filter_refs(&dp->filter, CT_NAT_REFS) != 0) {
+            return -1;
+        }
+        for (int i = 0; i < dp->active; i++) {
+            ct_nat_refs(&dp->workers[i].ct, dp->filter.refs);
+        }
+    }
+    for (int i = 0; i < scan->route_count; i++) {
+        if (add_steering(dp, &scan->routes[i], XDP_STEER_PASS) != 0) {
+            return -1;
+        }
+    }
+    lpm_prefix_t any = {0, 0, 0};
+    if (dp->uplink >= 0 && add_steering(dp, &any, XDP_STEER_NAT) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < dp->prefix_count; i++) {
+        const lpm_prefix_t *p = &dp->prefixes[i];
+        if (add_steering(dp, p, p->hop == DP_HOP_KERNEL ? XDP_STEER_PASS
+                                                        : XDP_STEER_REDIRECT)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void close_sockets(dataplane_t *dp) {
+    for (int q = 0; q < dp->queue_count; q++) {
+        xsk_close(&dp->queues[q].xsk);
+    }
+    dp->queue_count = 0;
+    for (int i = 0; i < dp->port_count; i++) {
+        dp->ports[i].queues = 0;
+    }
+    dp->umem.owner_fd = -1;
+}
+
+/*
+ * A socket on every queue of a port, as many as the device uses: binding
+ * past the last one fails with EINVAL
+ */
+static int open_queues(dataplane_t *dp, int index) {
+    dp_port_t *port = &dp->ports[index];
+    port->first_queue = dp->queue_count;
+    for (uint32_t q = 0; q < port->max_queues; q++) {
+        if (dp->queue_count == dp->queue_cap) {
+            int cap = dp->queue_cap ? dp->queue_cap * 2 : 16;
+            dp_queue_t *queues = realloc(dp->queues, cap * sizeof *queues);
+            if (queues == NULL) {
+                return ENOMEM;
+            }
+            dp->queues = queues;
+            dp->queue_cap = cap;
+        }
+        dp_queue_t *queue = &dp->queues[dp->queue_count];
+        memset(queue, 0, sizeof *queue);
+        queue->port = index;
+        queue->id = q;
+        int error = xsk_open(&queue->xsk, &dp->umem, port->ifindex, q);
+        if (error == EINVAL && q > 0) {
+            break;
+        }
+        if (error != 0) {
+            return error;
+        }
+        dp->queue_count++;
+        port->queues++;
+    }
+    return 0;
+}
+
+/*
+ * One UMEM backs every socket, so a frame is forwarded by moving its
+ * descriptor from one socket's rx ring to another's tx ring. It is the
+ * region of the packet pool, so that a few huge pages rather than many
+ * small ones map it. Zero-copy is tried first; veth only has copy mode,
+ * where the kernel copies each frame into the UMEM on receive and out of
+ * it on transmit.
+ */
+static int open_sockets(dataplane_t *dp) {
+    uint64_t want = 0;
+    for (int i = 0; i < dp->port_count; i++) {
+        want += (uint64_t)dp->ports[i].max_queues * XDP_RING_SIZE * 2;
+    }
+    uint32_t frames = want < DATAPLANE_MAX_FRAMES ? want : DATAPLANE_MAX_FRAMES;
+    if (pktpool_open(&dp->pool, frames, XDP_FRAME_SIZE) != 0) {
+        return -1;
+    }
+    xdp_umem_init(&dp->umem, dp->pool.area, frames);
+
+    dp->umem.zerocopy = true;
+    for (int i = 0; i < dp->port_count; i++) {
+        dp_port_t *port = &dp->ports[i];
+        int error = open_queues(dp, i);
+        if (error != 0 && dp->umem.zerocopy) {
+            close_sockets(dp);
+            dp->umem.zerocopy = false;
+            i = -1;
+            continue;
+        }
+        if (error != 0) {
+            fprintf(stderr, "Cannot open AF_XDP socket on %s: %s\n",
+                    port->ifname, strerror(error));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * As many workers as the port with the fewest queues allows, so that each
+ * has a queue of every port to transmit on. Each gets a cache of the
+ * packet pool, the receive queues whose number it is modulo the workers,
+ * and a ring to each of the others. Half the frames start out on the fill
+ * rings, the rest are for frames in flight.
+ */
+static int prepare_workers(dataplane_t *dp) {
+    const dp_port_t *fewest = &dp->ports[0];
+    for (int i = 1; i < dp->port_count; i++) {
+        if (dp->ports[i].queues < fewest->queues) {
+            fewest = &dp->ports[i];
+        }
+    }
+    int active = dp->worker_count;
+    if (fewest->queues < (uint32_t)active) {
+        printf("%s has %u queues, running %u of %d data plane workers\n",
+               fewest->ifname, fewest->queues, fewest->queues, active);
+        active = fewest->queues;
+    }
+    dp->active = active;
+    share_nat_ports(dp, dp->workers[0].ct.nat_addr, active);
+
+    dp->rings = calloc((size_t)active * active, sizeof *dp->rings);
+    if (dp->rings == NULL) {
+        return -1;
+    }
+    for (int from = 0; from < active; from++) {
+        for (int to = 0; to < active; to++) {
+            if (from != to && spsc_init(&dp->rings[from * active + to],
+                                        DATAPLANE_RING_SIZE) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    for (int i = 0; i < active; i++) {
+        dp_worker_t *w = &dp->workers[i];
+        w->outbox = malloc(active * DATAPLANE_BATCH * sizeof *w->outbox);
+        w->outbox_count = calloc(active, sizeof *w->outbox_count);
+        w->rx = malloc(dp->queue_count * sizeof *w->rx);
+        if (w->outbox == NULL || w->outbox_count == NULL || w->rx == NULL) {
+            return -1;
+        }
+        w->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (w->wake_fd < 0) {
+            fprintf(stderr, "Cannot create eventfd: %s\n", strerror(errno));
+            return -1;
+        }
+        pktpool_cache_init(&w->cache, &dp->pool);
+
+        for (int q = 0; q < dp->queue_count; q++) {
+            if (dp->queues[q].id % active == (uint32_t)i) {
+                w->rx[w->rx_count++] = q;
+            }
+        }
+        uint32_t fill = dp->pool.frames / (2 * dp->queue_count);
+        if (fill > XDP_RING_SIZE) {
+            fill = XDP_RING_SIZE;
+        }
+        if (fill == 0) {
+            fprintf(stderr, "Too many queues for the userspace data plane: "
+                            "%d\n",
+                    dp->queue_count);
+            return -1;
+        }
+        for (int r = 0; r < w->rx_count; r++) {
+            dp->queues[w->rx[r]].fill_target = fill;
+            refill(w, &dp->queues[w->rx[r]]);
+        }
+    }
+    return 0;
+}
+
+/* Native XDP where the driver has it, generic XDP otherwise */
+static int attach_programs(dataplane_t *dp, nl_sock_t *nl) {
+    for (int q = 0; q < dp->queue_count; q++) {
+        if (xdp_filter_bind(&dp->filter, q, &dp->queues[q].xsk) != 0) {
+            return -1;
+        }
+    }
+    struct in_addr addr = {dp->workers[0].ct.nat_addr};
+    for (int i = 0; i < dp->port_count; i++) {
+        dp_port_t *port = &dp->ports[i];
+        port->prog_fd =
+            i == dp->uplink
+                ? xdp_uplink_load(&dp->filter, port->first_queue, port->queues,
+                                  addr, CT_NAT_PORT_MIN, CT_NAT_PORT_MAX)
+                : xdp_filter_load(&dp->filter, port->first_queue, port->queues,
+                                  port->nat);
+        if (port->prog_fd < 0) {
+            return -1;
+        }
+    }
+
+    int *results = calloc(dp->port_count, sizeof *results);
+    if (results == NULL) {
+        return -1;
+    }
+    const uint32_t modes[] = {XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE};
+    int missing = dp->port_count;
+    for (size_t m = 0; m < sizeof modes / sizeof *modes && missing > 0; m++) {
+        for (int i = 0; i < dp->port_count; i++) {
+            dp_port_t *port = &dp->ports[i];
+            results[i] = 0;
+            if (port->xdp_flags == 0 &&
+                queue_xdp_attach(nl, port->ifindex, port->prog_fd, modes[m],
+                                 port->ifname, &results[i]) != 0) {
+                results[i] = EIO;
+            }
+        }
+        nl_sync(nl);
+        for (int i = 0; i < dp->port_count; i++) {
+            if (dp->ports[i].xdp_flags == 0 && results[i] == 0) {
+                dp->ports[i].xdp_flags = modes[m];
+                missing--;
+            }
+        }
+    }
+    free(results);
+    return missing == 0 ? 0 : -1;
+}
+
+static void detach_programs(dataplane_t *dp) {
+    nl_sock_t nl;
+    bool attached = false;
+    for (int i = 0; i < dp->port_count; i++) {
+        attached |= dp->ports[i].xdp_flags != 0;
+    }
+    if (attached && nl_open(&nl, NL_WINDOW_DEFAULT) == 0) {
+        for (int i = 0; i < dp->port_count; i++) {
+            dp_port_t *port = &dp->ports[i];
+            if (port->xdp_flags != 0) {
+                queue_xdp_attach(&nl, port->ifindex, -1, port->xdp_flags,
+                                 port->ifname, NULL);
+            }
+        }
+        nl_sync(&nl);
+        nl_close(&nl);
+    }
+    for (int i = 0; i < dp->port_count; i++) {
+        dp_port_t *port = &dp->ports[i];
+        port->xdp_flags = 0;
+        if (port->prog_fd >= 0) {
+            close(port->prog_fd);
+        }
+        port->prog_fd = -1;
+    }
+}
+
+/* Undo dataplane_start() up to wherever it got */
+static void teardown(dataplane_t *dp) {
+    detach_programs(dp);
+    close_sockets(dp);
+    xdp_umem_init(&dp->umem, NULL, 0);
+    pktpool_close(&dp->pool);
+    for (int i = 0; i < dp->worker_count; i++) {
+        ct_nat_refs(&dp->workers[i].ct, NULL);
+    }
+    xdp_filter_close(&dp->filter);
+    for (int i = 0; i < dp->worker_count; i++) {
+        dp_worker_t *w = &dp->workers[i];
+        free(w->outbox);
+        free(w->outbox_count);
+        free(w->rx);
+        w->outbox = NULL;
+        w->outbox_count = NULL;
+        w->rx = NULL;
+        w->cache.count = 0;
+        w->rx_count = 0;
+        if (w->wake_fd >= 0) {
+            close(w->wake_fd);
+        }
+        w->wake_fd = -1;
+    }
+    if (dp->rings != NULL) {
+        for (int r = 0; r < dp->active * dp->active; r++) {
+            spsc_free(&dp->rings[r]);
+        }
+    }
+    free(dp->rings);
+    dp->rings = NULL;
+    free(dp->queues);
+    dp->queues = NULL;
+    dp->queue_cap = 0;
+    for (int i = 0; i < dp->port_count; i++) {
+        dp_port_t *port = &dp->ports[i];
+        namespace_t ns = {.name = port->ns_name};
+        if (port->csum_off && set_ns_tx_checksum(&ns, true) == 0) {
+            port->csum_off = false;
+        }
+    }
+}
+
+/* The worker's CPU: the next of those the daemon may run on, in turn */
+static void pin_worker(const dp_worker_t *w, const cpu_set_t *allowed) {
+    int nth = w->index % CPU_COUNT(allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, allowed) && nth-- == 0) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            // an unpinned worker forwards all the same
+            pthread_setaffinity_np(w->thread, sizeof one, &one);
+            return;
+        }
+    }
+}
+
+static int start_workers(dataplane_t *dp) {
+    cpu_set_t allowed;
+    bool pin = sched_getaffinity(0, sizeof allowed, &allowed) == 0 &&
+               CPU_COUNT(&allowed) > 0;
+    atomic_store(&dp->stop, false);
+    for (int i = 0; i < dp->active; i++) {
+        dp_worker_t *w = &dp->workers[i];
+        if (w->reader < 0) {
+            w->reader = rcu_register(&dp->rcu);
+        }
+        if (w->reader < 0 ||
+            pthread_create(&w->thread, NULL, dataplane_worker, w) != 0) {
+            fprintf(stderr, "Cannot start userspace data plane worker %d\n",
+                    i);
+            return -1;
+        }
+        w->running = true;
+        if (pin) {
+            pin_worker(w, &allowed);
+        }
+    }
+    return 0;
+}
+
+/* End the workers, whether all of them started or not */
+static void stop_workers(dataplane_t *dp) {
+    atomic_store(&dp->stop, true);
+    for (int i = 0; i < dp->worker_count; i++) {
+        uint64_t one = 1;
+        if (dp->workers[i].running &&
+            write(dp->workers[i].wake_fd, &one, sizeof one) < 0) {
+            // the worker still notices within DATAPLANE_IDLE_MS
+        }
+    }
+    for (int i = 0; i < dp->worker_count; i++) {
+        if (dp->workers[i].running) {
+            pthread_join(dp->workers[i].thread, NULL);
+            dp->workers[i].running = false;
+        }
+    }
+}
+
+int dataplane_start(dataplane_t *dp) {
+    if (dp->port_count == 0) {
+        return 0; // no veth-connected namespace, nothing to forward
+    }
+
+    nl_sock_t nl;
+    if (nl_open(&nl, NL_WINDOW_DEFAULT) != 0) {
+        return -1;
+    }
+    int status = -1;
+    uplink_scan_t scan = {0};
+    if (find_links(dp, &nl) != 0 ||
+        (dp->uplink >= 0 && resolve_uplink(dp, &nl, &scan) != 0) ||
+        prepare_peers(dp) != 0 || open_sockets(dp) != 0 ||
+        prepare_workers(dp) != 0 || open_filter(dp, &scan) != 0 ||
+        attach_programs(dp, &nl) != 0 || start_workers(dp) != 0) {
+        goto out;
+    }
+    printf("Userspace data plane forwarding between %d ports on %d "
+           "worker%s in %s mode%s\n",
+           dp->port_count, dp->active, dp->active == 1 ? "" : "s",
+           dp->umem.zerocopy ? "zero-copy" : "copy",
+           dp->uplink >= 0 ? ", masquerading" : "");
+    dp->running = true;
+    status = 0;
+
+out:
+    free(scan.routes);
+    nl_close(&nl);
+    if (status != 0) {
+        stop_workers(dp);
+        teardown(dp);
+    }
+    return status;
+}
+
+void dataplane_stop(dataplane_t *dp) {
+    if (!dp->running) {
+        return;
+    }
+    stop_workers(dp);
+    dp->running = false;
+    teardown(dp);
+
+    uint64_t forwarded = 0, dropped = 0, handed_off = 0;
+    for (int i = 0; i < dp->worker_count; i++) {
+        forwarded += dp->workers[i].forwarded;
+        dropped += dp->workers[i].dropped;
+        handed_off += dp->workers[i].handed_off;
+    }
+    printf("Userspace data plane stopped: %llu frames forwarded, %llu "
+           "dropped, %llu handed to another worker\n",
+           (unsigned long long)forwarded, (unsigned long long)dropped,
+           (unsigned long long)handed_off);
+}
+
+void dataplane_free(dataplane_t *dp) {
+    dataplane_stop(dp);
+    teardown(dp);
+    free_fib(atomic_exchange(&dp->fib, NULL));
+    for (int i = 0; i < dp->worker_count; i++) {
+        ct_free(&dp->workers[i].ct);
+    }
+    free(dp->workers);
+    arena_release(&dp->arena);
+    dataplane_init(dp);
+}
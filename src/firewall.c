@@ -0,0 +1,472 @@
+#define _GNU_SOURCE
+#include "conntrack.h"
+#include "network.h"
+
+#include "trace.h"
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <nftables/libnftables.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NFT_FAMILY "inet"
+#define NFT_TABLE "lvr" // Table holding everything the router installs
+
+/* Growable text buffer the ruleset is compiled into */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} strbuf_t;
+
+static int sb_printf(strbuf_t *sb, const char *fmt, ...) {
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(sb->data + sb->len, sb->cap - sb->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            return -1;
+        }
+        if (sb->len + n < sb->cap) {
+            sb->len += n;
+            return 0;
+        }
+
+        size_t cap = sb->cap ? sb->cap * 2 : 4096;
+        while (cap <= sb->len + n) {
+            cap *= 2;
+        }
+        char *data = realloc(sb->data, cap);
+        if (data == NULL) {
+            return -1;
+        }
+        sb->data = data;
+        sb->cap = cap;
+    }
+}
+
+/*
+ * Host interfaces are numbered so rules compare as integers: 0 is the uplink,
+ * then one per bridge, then the host veth end of each namespace.
+ */
+#define IF_UPLINK 0u
+#define IF_BRIDGE(j) (1u + (uint32_t)(j))
+#define IF_VETH(config, i) (1u + (uint32_t)(config)->bridge_count + (i))
+
+static void key_ifname(const config_t *config, uint32_t key, char *ifname) {
+    if (key == IF_UPLINK) {
+        snprintf(ifname, IFNAMSIZ, "%s", config->nat_outgoing_interface);
+    } else if (key < IF_VETH(config, 0)) {
+        snprintf(ifname, IFNAMSIZ, "%s", config->bridges[key - 1].name);
+    } else {
+        veth_host_ifname(&config->namespaces[key - IF_VETH(config, 0)],
+                         ifname);
+    }
+}
+
+/*
+ * One end of a permitted pair: the host interface its traffic passes, and
+ * for a namespace behind a bridge its address, since every namespace on
+ * the bridge shares the interface.
+ */
+typedef struct {
+    uint32_t key;  /* Host interface, see IF_UPLINK */
+    uint32_t addr; /* Namespace address in network order, 0 if the
+                      interface alone identifies the end */
+} fw_end_t;
+
+/* A permitted pair, with the ends in the order of their map key */
+typedef struct {
+    uint32_t iif;   /* Interface traffic enters through */
+    uint32_t saddr; /* Source address, 0 if not matched */
+    uint32_t oif;   /* Interface traffic leaves through */
+    uint32_t daddr; /* Destination address, 0 if not matched */
+} fw_pair_t;
+
+/* Which map a pair goes to: whether it matches on saddr, on daddr */
+static int pair_map(const fw_pair_t *pair) {
+    return (pair->saddr != 0) << 1 | (pair->daddr != 0);
+}
+
+static int cmp_pair(const void *a, const void *b) {
+    const fw_pair_t *pa = a, *pb = b;
+    uint32_t ka[5] = {pair_map(pa), pa->iif, pa->saddr, pa->oif, pa->daddr};
+    uint32_t kb[5] = {pair_map(pb), pb->iif, pb->saddr, pb->oif, pb->daddr};
+    for (int i = 0; i < 5; i++) {
+        if (ka[i] != kb[i]) {
+            return ka[i] < kb[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * End each namespace's traffic enters and leaves through: its host veth
+ * end, or its bridge and its address.
+ */
+static fw_end_t *namespace_ends(const config_t *config) {
+    fw_end_t *ends = malloc((config->namespace_count + 1) * sizeof *ends);
+    if (ends == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < config->namespace_count; i++) {
+        const namespace_t *ns = &config->namespaces[i];
+        const char *br_name = ns_bridge_name(ns);
+        if (br_name == NULL) {
+            ends[i] = (fw_end_t){IF_VETH(config, i), 0};
+            continue;
+        }
+        const bridge_t *br = find_bridge_by_name(config, br_name);
+        if (br == NULL) {
+            fprintf(stderr, "Bridge %s for namespace %s does not exist\n",
+                    br_name, ns->name);
+            free(ends);
+            return NULL;
+        }
+        // 0 stands for an address that is unknown until assigned
+        uint32_t addr = ns->auto_ip && !config->addresses_assigned
+                            ? 0
+                            : ns->ip_addr.s_addr;
+        ends[i] = (fw_end_t){IF_BRIDGE(br - config->bridges), addr};
+    }
+    return ends;
+}
+
+/* The end of a rule, or -1 for a namespace that cannot be told apart */
+static int rule_end(const config_t *config, const fw_end_t *ns_ends,
+                    endpoint_t type, int ns, fw_end_t *end) {
+    if (type == ENDPOINT_INTERNET) {
+        *end = (fw_end_t){IF_UPLINK, 0};
+        return 0;
+    }
+    *end = ns_ends[ns];
+    if (end->key < IF_VETH(config, 0) && end->addr == 0) {
+        fprintf(stderr,
+                "Namespace %s shares its bridge, a firewall rule about it "
+                "needs its address\n",
+                config->namespaces[ns].name);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Permitted pairs, sorted by map and without duplicates: a rule may be
+ * given twice.
+ */
+static int compile_pairs(const config_t *config, fw_pair_t **out,
+                         int *count) {
+    *out = NULL;
+    *count = 0;
+
+    fw_end_t *ns_ends = namespace_ends(config);
+    fw_pair_t *pairs = malloc((config->fw_rule_count + 1) * sizeof *pairs);
+    if (ns_ends == NULL || pairs == NULL) {
+        free(ns_ends);
+        free(pairs);
+        return -1;
+    }
+
+    int n = 0;
+    for (int i = 0; i < config->fw_rule_count; i++) {
+        const fw_rule_t *rule = &config->fw_rules[i];
+        if ((rule->src_type == ENDPOINT_INTERNET ||
+             rule->dst_type == ENDPOINT_INTERNET) &&
+            config->nat_outgoing_interface[0] == '\0') {
+            fprintf(stderr, "Firewall rule uses INTERNET but "
+                            "nat_outgoing_interface is not set\n");
+            free(ns_ends);
+            free(pairs);
+            return -1;
+        }
+        fw_end_t src, dst;
+        if (rule_end(config, ns_ends, rule->src_type, rule->src_ns, &src) !=
+                0 ||
+            rule_end(config, ns_ends, rule->dst_type, rule->dst_ns, &dst) !=
+                0) {
+            free(ns_ends);
+            free(pairs);
+            return -1;
+        }
+        pairs[n++] = (fw_pair_t){src.key, src.addr, dst.key, dst.addr};
+    }
+    free(ns_ends);
+
+    qsort(pairs, n, sizeof *pairs, cmp_pair);
+    int unique = 0;
+    for (int i = 0; i < n; i++) {
+        if (unique == 0 || cmp_pair(&pairs[unique - 1], &pairs[i]) != 0) {
+            pairs[unique++] = pairs[i];
+        }
+    }
+
+    *out = pairs;
+    *count = unique;
+    return 0;
+}
+
+/*
+ * Flowtable over every host interface forwarded traffic can enter through.
+ * Packets of offloaded flows are forwarded straight from the ingress hook.
+ * nft rejects the whole ruleset over a device that does not exist, so an
+ * uplink that is missing is left out rather than taking NAT down with it.
+ */
+static int compile_flowtable(const config_t *config, strbuf_t *sb) {
+    int status = 0;
+    int devices = 0;
+    status |= sb_printf(sb, "\tflowtable ft {\n"
+                            "\t\thook ingress priority 0\n"
+                            "\t\tdevices = {");
+    for (int i = 0; i < config->namespace_count; i++) {
+        char ifname[IFNAMSIZ];
+        veth_host_ifname(&config->namespaces[i], ifname);
+        status |= sb_printf(sb, "%s \"%s\"", devices++ > 0 ? "," : "", ifname);
+    }
+    for (int i = 0; i < config->bridge_count; i++) {
+        status |= sb_printf(sb, "%s \"%s\"", devices++ > 0 ? "," : "",
+                            config->bridges[i].name);
+    }
+    const char *uplink = config->nat_outgoing_interface;
+    if (uplink[0] != '\0' && if_nametoindex(uplink) == 0) {
+        fprintf(stderr, "Uplink %s not found, its flows are not offloaded\n",
+                uplink);
+    } else if (uplink[0] != '\0') {
+        status |= sb_printf(sb, "%s \"%s\"", devices++ > 0 ? "," : "",
+                            uplink);
+    }
+    status |= sb_printf(sb, " }\n\t}\n");
+    return status == 0 ? 0 : -1;
+}
+
+/* Verdict maps by pair_map(), keyed in the order of fw_pair_t */
+static const struct {
+    const char *name;  /* Name of the map */
+    const char *type;  /* Its key type */
+    const char *match; /* The packet fields looked up */
+} fw_maps[4] = {
+    {"forward_allow", "ifname . ifname", "iifname . oifname"},
+    {"forward_allow_daddr", "ifname . ifname . ipv4_addr",
+     "iifname . oifname . ip daddr"},
+    {"forward_allow_saddr", "ifname . ipv4_addr . ifname",
+     "iifname . ip saddr . oifname"},
+    {"forward_allow_addrs", "ifname . ipv4_addr . ifname . ipv4_addr",
+     "iifname . ip saddr . oifname . ip daddr"},
+};
+
+/* One map element: the interfaces and whichever addresses the map keys */
+static int compile_element(const config_t *config, const fw_pair_t *pair,
+                           strbuf_t *sb) {
+    char iif[IFNAMSIZ], oif[IFNAMSIZ];
+    char saddr[INET_ADDRSTRLEN], daddr[INET_ADDRSTRLEN];
+    key_ifname(config, pair->iif, iif);
+    key_ifname(config, pair->oif, oif);
+    inet_ntop(AF_INET, &pair->saddr, saddr, sizeof saddr);
+    inet_ntop(AF_INET, &pair->daddr, daddr, sizeof daddr);
+    int status = sb_printf(sb, "\n\t\t\t\"%s\"", iif);
+    if (pair->saddr != 0) {
+        status |= sb_printf(sb, " . %s", saddr);
+    }
+    status |= sb_printf(sb, " . \"%s\"", oif);
+    if (pair->daddr != 0) {
+        status |= sb_printf(sb, " . %s", daddr);
+    }
+    return status | sb_printf(sb, " : accept");
+}
+
+static int compile_filter(const config_t *config, strbuf_t *sb) {
+    fw_pair_t *pairs;
+    int count;
+    if (compile_pairs(config, &pairs, &count) != 0) {
+        return -1;
+    }
+
+    // nft rejects a flowtable without devices
+    bool offload = config->flow_offload &&
+                   (config->namespace_count > 0 || config->bridge_count > 0);
+    int status = 0;
+    if (offload) {
+        status |= compile_flowtable(config, sb);
+    }
+
+    /*
+     * One hash lookup per map however many pairs are allowed. Namespaces
+     * behind a bridge are told apart by address; the interface map is
+     * there even when empty, the others only when they have pairs.
+     */
+    bool used[4] = {true, false, false, false};
+    for (int m = 0, i = 0; m < 4; m++) {
+        int first = i;
+        while (i < count && pair_map(&pairs[i]) == m) {
+            i++;
+        }
+        used[m] = used[m] || i > first;
+        if (!used[m]) {
+            continue;
+        }
+        status |= sb_printf(sb, "\tmap %s {\n\t\ttype %s : verdict\n",
+                            fw_maps[m].name, fw_maps[m].type);
+        if (i > first) {
+            status |= sb_printf(sb, "\t\telements = {");
+            for (int e = first; e < i; e++) {
+                if (e > first) {
+                    status |= sb_printf(sb, ",");
+                }
+                status |= compile_element(config, &pairs[e], sb);
+            }
+            status |= sb_printf(sb, "\n\t\t}\n");
+        }
+        status |= sb_printf(sb, "\t}\n");
+    }
+
+    status |= sb_printf(
+        sb,
+        "\tchain forward {\n"
+        "\t\ttype filter hook forward priority filter; policy %s;\n",
+        config->fw_default_action == FW_ALLOW ? "accept" : "drop");
+    if (offload) {
+        // only connections the map let through ever become established
+        status |= sb_printf(sb, "\t\tmeta l4proto { tcp, udp } "
+                                "ct state established flow add @ft\n");
+    }
+    status |= sb_printf(sb, "\t\tct state established,related accept\n");
+    for (int m = 0; m < 4; m++) {
+        if (used[m]) {
+            status |= sb_printf(sb, "\t\t%s vmap @%s\n", fw_maps[m].match,
+                                fw_maps[m].name);
+        }
+    }
+    status |= sb_printf(sb, "\t}\n");
+
+    free(pairs);
+    return status == 0 ? 0 : -1;
+}
+
+/*
+ * All NAT prefixes go into one interval set matched by a single masquerade
+ * rule, so the cost of a new connection does not grow with the prefixes.
+ * With the userspace data plane the kernel keeps below the ports that
+ * conntrack.h hands out, so the uplink program can tell their replies apart.
+ */
+static int compile_nat(const config_t *config, strbuf_t *sb) {
+    if (config->nat_rule_count == 0) {
+        return 0;
+    }
+    if (config->nat_outgoing_interface[0] == '\0') {
+        fprintf(stderr, "enable_nat requires nat_outgoing_interface\n");
+        return -1;
+    }
+
+    int status = 0;
+    status |= sb_printf(sb, "\tset nat_sources {\n"
+                            "\t\ttype ipv4_addr\n"
+                            "\t\tflags interval\n"
+                            "\t\tauto-merge\n"
+                            "\t\telements = {");
+    for (int i = 0; i < config->nat_rule_count; i++) {
+        const nat_rule_t *rule = &config->nat_rules[i];
+
+        // nft rejects prefixes with host bits set
+        uint32_t mask = rule->mask ? htonl(~0u << (32 - rule->mask)) : 0;
+        struct in_addr network = {.s_addr = rule->network.s_addr & mask};
+        char ip_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &network, ip_str, sizeof ip_str);
+        status |= sb_printf(sb, "%s\n\t\t\t%s/%u", i > 0 ? "," : "", ip_str,
+                            rule->mask);
+    }
+    status |= sb_printf(sb, "\n\t\t}\n\t}\n");
+
+    status |= sb_printf(sb,
+                        "\tchain postrouting {\n"
+                        "\t\ttype nat hook postrouting priority srcnat; "
+                        "policy accept;\n"
+                        "\t\toifname \"%s\" ip saddr @nat_sources masquerade",
+                        config->nat_outgoing_interface);
+    if (config->dataplane == DATAPLANE_AFXDP) {
+        status |= sb_printf(sb, " to :1024-%d", CT_NAT_PORT_MIN - 1);
+    }
+    status |= sb_printf(sb, "\n\t}\n");
+
+    return status == 0 ? 0 : -1;
+}
+
+/*
+ * The whole table is replaced in one transaction: adding the table first
+ * makes the delete succeed when it does not exist yet.
+ */
+char *compile_ruleset(const config_t *config) {
+    strbuf_t sb = {0};
+    int status = 0;
+    status |= sb_printf(&sb, "add table %s %s\n", NFT_FAMILY, NFT_TABLE);
+    status |= sb_printf(&sb, "delete table %s %s\n", NFT_FAMILY, NFT_TABLE);
+    status |= sb_printf(&sb, "table %s %s {\n", NFT_FAMILY, NFT_TABLE);
+    status |= compile_filter(config, &sb);
+    status |= compile_nat(config, &sb);
+    status |= sb_printf(&sb, "}\n");
+
+    if (status != 0) {
+        free(sb.data);
+        return NULL;
+    }
+    return sb.data;
+}
+
+/* Load a ruleset through libnftables as a single transaction */
+static int nft_load(const char *ruleset) {
+    uint64_t begin = trace_begin();
+    struct nft_ctx *ctx = nft_ctx_new(NFT_CTX_DEFAULT);
+    if (ctx == NULL) {
+        fprintf(stderr, "Cannot create nftables context\n");
+        return -1;
+    }
+    nft_ctx_buffer_error(ctx);
+
+    int status = 0;
+    if (nft_run_cmd_from_buffer(ctx, ruleset) != 0) {
+        fprintf(stderr, "Failed to load nftables ruleset:\n%s",
+                nft_ctx_get_error_buffer(ctx));
+        status = -1;
+    }
+
+    nft_ctx_free(ctx);
+    trace_end(begin, "nft", "nft_load", NFT_TABLE);
+    return status;
+}
+
+int setup_firewall(config_t *config) {
+    char *ruleset = compile_ruleset(config);
+    if (ruleset == NULL) {
+        return -1;
+    }
+    int status = nft_load(ruleset);
+    free(ruleset);
+    return status;
+}
+
+int setup_nat(config_t *config) { return setup_firewall(config); }
+
+bool firewall_present(void) {
+    uint64_t begin = trace_begin();
+    struct nft_ctx *ctx = nft_ctx_new(NFT_CTX_DEFAULT);
+    if (ctx == NULL) {
+        return false;
+    }
+    // only the status matters, keep the listing off the terminal
+    nft_ctx_buffer_output(ctx);
+    nft_ctx_buffer_error(ctx);
+    bool present = nft_run_cmd_from_buffer(
+                       ctx, "list table " NFT_FAMILY " " NFT_TABLE "\n") == 0;
+    nft_ctx_free(ctx);
+    trace_end(begin, "nft", "nft_list", NFT_TABLE);
+    return present;
+}
+
+int remove_firewall(config_t *config) {
+    (void)config;
+    return nft_load("add table " NFT_FAMILY " " NFT_TABLE "\n"
+                    "delete table " NFT_FAMILY " " NFT_TABLE "\n");
+}
@@ -0,0 +1,91 @@
+#include "ipam.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+
+#define WORD_BITS 64
+
+/* Mark an address taken, and its word full once nothing is left in it */
+static void take(ipam_pool_t *pool, uint32_t offset) {
+    uint32_t word = offset / WORD_BITS;
+    pool->bits[word] |= 1ull << (offset % WORD_BITS);
+    if (pool->bits[word] == ~0ull) {
+        pool->full[word / WORD_BITS] |= 1ull << (word % WORD_BITS);
+    }
+    pool->used++;
+}
+
+static bool taken(const ipam_pool_t *pool, uint32_t offset) {
+    return pool->bits[offset / WORD_BITS] >> (offset % WORD_BITS) & 1;
+}
+
+int ipam_init(ipam_pool_t *pool, arena_t *arena, struct in_addr network,
+              uint8_t mask) {
+    if (mask < IPAM_MIN_MASK || mask > 32) {
+        fprintf(stderr, "Cannot manage addresses of a /%u subnet\n", mask);
+        return -1;
+    }
+    uint32_t netmask = mask == 32 ? ~0u : ~(~0u >> mask);
+    pool->network = ntohl(network.s_addr) & netmask;
+    pool->mask = mask;
+    pool->size = ~netmask + 1;
+    pool->used = 0;
+    pool->cursor = 0;
+
+    uint32_t words = (pool->size + WORD_BITS - 1) / WORD_BITS;
+    uint32_t summary = (words + WORD_BITS - 1) / WORD_BITS;
+    pool->bits = arena_alloc(arena, words * sizeof *pool->bits);
+    pool->full = arena_alloc(arena, summary * sizeof *pool->full);
+    if (pool->bits == NULL || pool->full == NULL) {
+        return -1;
+    }
+
+    // bits past the end of the subnet read as taken so no scan returns them
+    if (pool->size % WORD_BITS != 0) {
+        pool->bits[words - 1] |= ~0ull << (pool->size % WORD_BITS);
+    }
+    if (words % WORD_BITS != 0) {
+        pool->full[summary - 1] |= ~0ull << (words % WORD_BITS);
+    }
+    if (mask < 31) {
+        take(pool, 0);
+        take(pool, pool->size - 1);
+    }
+    return 0;
+}
+
+bool ipam_contains(const ipam_pool_t *pool, struct in_addr addr) {
+    return ntohl(addr.s_addr) - pool->network < pool->size;
+}
+
+int ipam_reserve(ipam_pool_t *pool, struct in_addr addr) {
+    uint32_t offset = ntohl(addr.s_addr) - pool->network;
+    if (offset >= pool->size || taken(pool, offset)) {
+        return -1;
+    }
+    take(pool, offset);
+    return 0;
+}
+
+int ipam_alloc(ipam_pool_t *pool, struct in_addr *addr) {
+    uint32_t summary = (pool->size + WORD_BITS * WORD_BITS - 1) /
+                       (WORD_BITS * WORD_BITS);
+    for (uint32_t i = 0; i < summary; i++) {
+        uint32_t s = pool->cursor + i;
+        if (s >= summary) {
+            s -= summary;
+        }
+        uint64_t room = ~pool->full[s];
+        if (room == 0) {
+            continue;
+        }
+        uint32_t word = s * WORD_BITS + __builtin_ctzll(room);
+        uint32_t offset =
+            word * WORD_BITS + __builtin_ctzll(~pool->bits[word]);
+        take(pool, offset);
+        pool->cursor = s;
+        addr->s_addr = htonl(pool->network + offset);
+        return 0;
+    }
+    return -1;
+}
@@ -0,0 +1,139 @@
+#define _GNU_SOURCE
+#include "lpm.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define TBL24_SIZE (LPM_TBL24_ENTRIES * sizeof(uint32_t))
+
+/* Shorter prefixes first, so longer ones overwrite them; then by position */
+static int cmp_prefix(const void *a, const void *b) {
+    const lpm_prefix_t *pa = *(const lpm_prefix_t *const *)a;
+    const lpm_prefix_t *pb = *(const lpm_prefix_t *const *)b;
+    if (pa->mask != pb->mask) {
+        return pa->mask - pb->mask;
+    }
+    return (pa > pb) - (pa < pb);
+}
+
+/*
+ * A new chunk for one /24, every address routed like the whole /24 was.
+ * There is at most one chunk per /24, so chunk indexes stay below 2^24
+ * and tbl8 offsets fit 32 bits.
+ */
+static int64_t add_tbl8(lpm_table_t *table, uint32_t hop) {
+    if (table->tbl8_count == table->tbl8_cap) {
+        uint32_t cap = table->tbl8_cap ? table->tbl8_cap * 2 : 64;
+        uint32_t *tbl8 = realloc(table->tbl8, (size_t)cap * LPM_TBL8_ENTRIES *
+                                                  sizeof *tbl8);
+        if (tbl8 == NULL) {
+            return -1;
+        }
+        table->tbl8 = tbl8;
+        table->tbl8_cap = cap;
+    }
+    uint32_t *chunk = &table->tbl8[(size_t)table->tbl8_count *
+                                   LPM_TBL8_ENTRIES];
+    for (uint32_t i = 0; i < LPM_TBL8_ENTRIES; i++) {
+        chunk[i] = hop;
+    }
+    return table->tbl8_count++;
+}
+
+static void fill(uint32_t *entries, uint32_t first, uint32_t count,
+                 uint32_t hop) {
+    for (uint32_t i = first; i < first + count; i++) {
+        entries[i] = hop;
+    }
+}
+
+int lpm_build(lpm_table_t *table, const lpm_prefix_t *prefixes, size_t count) {
+    memset(table, 0, sizeof *table);
+    table->tbl24 = mmap(NULL, TBL24_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (table->tbl24 == MAP_FAILED) {
+        fprintf(stderr, "Cannot map route table: %s\n", strerror(errno));
+        table->tbl24 = NULL;
+        return -1;
+    }
+
+    const lpm_prefix_t **order = malloc((count + 1) * sizeof *order);
+    if (order == NULL) {
+        lpm_free(table);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        order[i] = &prefixes[i];
+    }
+    qsort(order, count, sizeof *order, cmp_prefix);
+
+    for (size_t i = 0; i < count; i++) {
+        const lpm_prefix_t *p = order[i];
+        if (p->mask > 32 || p->hop == 0 || p->hop >= LPM_EXTENDED) {
+            fprintf(stderr, "Route with prefix length %u and hop %u cannot "
+                            "go into the route table\n",
+                    p->mask, p->hop);
+            goto fail;
+        }
+        uint32_t network = p->mask ? p->network & ~0u << (32 - p->mask) : 0;
+        if (p->mask <= 24) {
+            // no tbl8 exists yet, every longer prefix comes later
+            fill(table->tbl24, network >> 8, 1u << (24 - p->mask), p->hop);
+            continue;
+        }
+        uint32_t *entry = &table->tbl24[network >> 8];
+        if (!(*entry & LPM_EXTENDED)) {
+            int64_t chunk = add_tbl8(table, *entry);
+            if (chunk < 0) {
+                fprintf(stderr, "Out of memory for the route table\n");
+                goto fail;
+            }
+            *entry = LPM_EXTENDED | (uint32_t)chunk;
+        }
+        size_t base = (size_t)(*entry & ~LPM_EXTENDED) * LPM_TBL8_ENTRIES;
+        fill(table->tbl8 + base, network & 0xff, 1u << (32 - p->mask),
+             p->hop);
+    }
+    free(order);
+    return 0;
+
+fail:
+    free(order);
+    lpm_free(table);
+    return -1;
+}
+
+void lpm_free(lpm_table_t *table) {
+    if (table->tbl24 != NULL) {
+        munmap(table->tbl24, TBL24_SIZE);
+    }
+    free(table->tbl8);
+    memset(table, 0, sizeof *table);
+}
+
+void lpm_lookup_batch(const lpm_table_t *table, const uint32_t *addrs,
+                      uint32_t *hops, size_t count) {
+    for (size_t base = 0; base < count; base += LPM_BATCH) {
+        size_t n = count - base < LPM_BATCH ? count - base : LPM_BATCH;
+        const uint32_t *a = addrs + base;
+        uint32_t *h = hops + base;
+
+        for (size_t i = 0; i < n; i++) {
+            h[i] = table->tbl24[a[i] >> 8];
+            if (h[i] & LPM_EXTENDED) {
+                __builtin_prefetch(
+                    &table->tbl8[(h[i] & ~LPM_EXTENDED) * LPM_TBL8_ENTRIES +
+                                 (a[i] & 0xff)]);
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (h[i] & LPM_EXTENDED) {
+                h[i] = table->tbl8[(h[i] & ~LPM_EXTENDED) * LPM_TBL8_ENTRIES +
+                                   (a[i] & 0xff)];
+            }
+        }
+    }
+}
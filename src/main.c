@@ -1,17 +1,38 @@
+#include "cache.h"
 #include "config.h"
+#include "daemon.h"
 #include "network.h"
+#include "plan.h"
+#include "trace.h"
+#include "validate.h"
 
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/* Write the trace requested with --trace, if any */
+static int finish_trace(const char *path) {
+    if (path == NULL) {
+        return 0;
+    }
+    int status = trace_write(path);
+    trace_stop();
+    return status;
+}
+
 int main(int argc, char *argv[]) {
     char *config_filename;
+    const char *trace_path = NULL;
     config_t config;
 
-    if (argc != 3) {
-        printf("Usage: %s <config_file> <--up|--down>\n", argv[0]);
+    if (argc == 5 && strcmp(argv[3], "--trace") == 0) {
+        trace_path = argv[4];
+    } else if (argc != 3) {
+        printf("Usage: %s <config_file> "
+               "<--up|--down|--apply|--daemon|--plan|--compile> "
+               "[--trace <out.json>]\n",
+               argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -19,8 +40,10 @@ int main(int argc, char *argv[]) {
 
     init_config(&config);
     int result = 0;
-    ;
-    if ((result = parse_config_file(config_filename, &config)) != 0) {
+    // a compiled cache that still matches the file skips parsing
+    bool compile = strcmp(argv[2], "--compile") == 0;
+    if ((compile || load_config_cache(config_filename, &config) != 0) &&
+        (result = parse_config_file(config_filename, &config)) != 0) {
         fprintf(stderr,
                 "ERROR: Failed to parse network topology configuration with "
                 "code %d\n",
@@ -28,6 +51,38 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
+    if (trace_path != NULL && trace_start() != 0) {
+        goto out_delete;
+    }
+
+    // namespaces that are up keep the addresses the last apply handed out
+    config_t previous;
+    init_config(&previous);
+    if ((strcmp(argv[2], "--apply") == 0 ||
+         strcmp(argv[2], "--daemon") == 0) &&
+        load_manifest(&previous) != 0) {
+        fprintf(stderr, "ERROR: Cannot read the addresses in use\n");
+        free_config(&previous);
+        goto out_delete;
+    }
+
+    // a broken topology is rejected before anything is touched; tearing
+    // one down still has to work
+    int invalid = strcmp(argv[2], "--down") != 0 &&
+                  (config_assign_addresses(&config, &previous) != 0 ||
+                   validate_config(&config) != 0);
+    free_config(&previous);
+    if (invalid) {
+        fprintf(stderr, "ERROR: Invalid network topology in %s\n",
+                config_filename);
+        goto out_delete;
+    }
+
+    if (config.dataplane == DATAPLANE_AFXDP &&
+        (strcmp(argv[2], "--up") == 0 || strcmp(argv[2], "--apply") == 0)) {
+        printf("Note: dataplane = afxdp only forwards while --daemon runs\n");
+    }
+
     int status = 0;
     if (strcmp(argv[2], "--up") == 0) {
         status = network_up(&config);
@@ -44,6 +99,48 @@ int main(int argc, char *argv[]) {
                     status);
             goto out_delete;
         }
+    } else if (strcmp(argv[2], "--apply") == 0) {
+        status = network_apply(&config);
+        if (status != 0) {
+            fprintf(stderr,
+                    "ERROR: Failed to apply configuration with code %d\n",
+                    status);
+            goto out_delete;
+        }
+    } else if (strcmp(argv[2], "--daemon") == 0) {
+        status = run_daemon(config_filename, &config);
+        if (status != 0) {
+            fprintf(stderr, "ERROR: Daemon failed with code %d\n", status);
+            goto out_delete;
+        }
+    } else if (compile) {
+        plan_t plan;
+        // only a topology that could be brought up is worth caching
+        if (plan_build(&config, &plan) != 0) {
+            fprintf(stderr, "ERROR: Failed to build the operation graph\n");
+            goto out_delete;
+        }
+        plan_free(&plan);
+        // the cache holds the addresses as written, so whoever loads it
+        // hands them out against the namespaces that are running then
+        config_t written;
+        init_config(&written);
+        status = parse_config_file(config_filename, &written) != 0 ||
+                 config_expand(&written) != 0 ||
+                 compile_config(config_filename, &written) != 0;
+        free_config(&written);
+        if (status != 0) {
+            fprintf(stderr, "ERROR: Failed to compile %s\n", config_filename);
+            goto out_delete;
+        }
+    } else if (strcmp(argv[2], "--plan") == 0) {
+        plan_t plan;
+        if (plan_build(&config, &plan) != 0) {
+            fprintf(stderr, "ERROR: Failed to build the operation graph\n");
+            goto out_delete;
+        }
+        print_plan(&plan, stdout);
+        plan_free(&plan);
     } else {
         fprintf(stderr, "Invalid argument: %s\n", argv[2]);
         goto out_delete;
@@ -51,9 +148,10 @@ int main(int argc, char *argv[]) {
 
     free_config(&config);
 
-    return 0;
+    return finish_trace(trace_path) == 0 ? 0 : EXIT_FAILURE;
 
 out_delete:
     free_config(&config);
+    finish_trace(trace_path);
     return EXIT_FAILURE;
 }
@@ -0,0 +1,507 @@
+#define _GNU_SOURCE
+#include "netlink.h"
+
+#include "trace.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define NL_SEND_BYTES (64 * 1024) // Request bytes per sendmsg
+#define NL_SEND_IOV 256           // Requests per sendmsg
+#define NL_RECV_BYTES (64 * 1024) // Receive buffer for ACKs and dumps
+#define NL_ACK_TRUESIZE 1024 // Kernel memory charged per queued ACK
+#define NL_RCVBUF_MAX (64 * 1024 * 1024) // Cap when growing after ENOBUFS
+
+static nl_req_t *nl_slot(nl_sock_t *nl, uint32_t seq) {
+    return &nl->reqs[seq % nl->window];
+}
+
+/* Name of a message type in traces */
+static const char *nl_type_name(uint16_t type) {
+    switch (type) {
+    case RTM_NEWLINK:
+        return "RTM_NEWLINK";
+    case RTM_DELLINK:
+        return "RTM_DELLINK";
+    case RTM_GETLINK:
+        return "RTM_GETLINK";
+    case RTM_NEWADDR:
+        return "RTM_NEWADDR";
+    case RTM_DELADDR:
+        return "RTM_DELADDR";
+    case RTM_GETADDR:
+        return "RTM_GETADDR";
+    case RTM_NEWROUTE:
+        return "RTM_NEWROUTE";
+    case RTM_DELROUTE:
+        return "RTM_DELROUTE";
+    case RTM_GETROUTE:
+        return "RTM_GETROUTE";
+    case RTM_GETNEIGH:
+        return "RTM_GETNEIGH";
+    default:
+        return "netlink";
+    }
+}
+
+static int nl_set_rcvbuf(nl_sock_t *nl, int size) {
+    // SO_RCVBUFFORCE bypasses rmem_max when we have CAP_NET_ADMIN
+    if (setsockopt(nl->fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof size) <
+            0 &&
+        setsockopt(nl->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size) < 0) {
+        return -1;
+    }
+    nl->rcvbuf = size;
+    return 0;
+}
+
+int nl_open(nl_sock_t *nl, uint32_t window) {
+    nl->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nl->fd < 0) {
+        fprintf(stderr, "Cannot open netlink socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    struct sockaddr_nl sa = {.nl_family = AF_NETLINK};
+    if (bind(nl->fd, (struct sockaddr *)&sa, sizeof sa) < 0) {
+        fprintf(stderr, "Cannot bind netlink socket: %s\n", strerror(errno));
+        close(nl->fd);
+        return -1;
+    }
+
+    // ACKs only echo the request header, keeping the ACK burst small
+    int one = 1;
+    setsockopt(nl->fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof one);
+
+    nl->reqs = calloc(window, sizeof *nl->reqs);
+    if (nl->reqs == NULL) {
+        close(nl->fd);
+        return -1;
+    }
+
+    nl->window = window;
+    nl->acked = 1;
+    nl->sent = 1;
+    nl->next = 1;
+    nl->failed = 0;
+    nl->rcvbuf = 0;
+    socklen_t optlen = sizeof nl->rcvbuf;
+    getsockopt(nl->fd, SOL_SOCKET, SO_RCVBUF, &nl->rcvbuf, &optlen);
+
+    // size the buffer so a full window of ACKs fits; ENOBUFS covers the rest
+    if ((int)(window * NL_ACK_TRUESIZE) > nl->rcvbuf) {
+        nl_set_rcvbuf(nl, window * NL_ACK_TRUESIZE);
+    }
+    return 0;
+}
+
+/*
+ * Send the requests in [from, to) that are still waiting for an ACK. On
+ * failure, errno is set and unsent is the first request the kernel did
+ * not take.
+ */
+static int nl_transmit(nl_sock_t *nl, uint32_t from, uint32_t to,
+                       uint32_t *unsent) {
+    struct sockaddr_nl kernel = {.nl_family = AF_NETLINK};
+    struct iovec iov[NL_SEND_IOV];
+
+    uint32_t seq = from;
+    while (seq != to) {
+        uint32_t first = seq;
+        int iovlen = 0;
+        size_t bytes = 0;
+        for (; seq != to && iovlen < NL_SEND_IOV; seq++) {
+            nl_req_t *req = nl_slot(nl, seq);
+            if (!req->pending) {
+                continue; // already acked, only happens on resend
+            }
+            struct nlmsghdr *nlh = (struct nlmsghdr *)req->msg;
+            if (bytes + nlh->nlmsg_len > NL_SEND_BYTES) {
+                break;
+            }
+            iov[iovlen].iov_base = nlh;
+            iov[iovlen].iov_len = NLMSG_ALIGN(nlh->nlmsg_len);
+            bytes += iov[iovlen].iov_len;
+            iovlen++;
+        }
+        if (iovlen == 0) {
+            continue;
+        }
+
+        struct msghdr msg = {
+            .msg_name = &kernel,
+            .msg_namelen = sizeof kernel,
+            .msg_iov = iov,
+            .msg_iovlen = iovlen,
+        };
+        while (sendmsg(nl->fd, &msg, 0) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ENOBUFS) {
+                // transient memory pressure in the kernel, back off
+                usleep(1000);
+                continue;
+            }
+            int error = errno;
+            fprintf(stderr, "Netlink sendmsg failed: %s\n", strerror(error));
+            *unsent = first;
+            errno = error;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void nl_complete(nl_sock_t *nl, nl_req_t *req, int error) {
+    if (req->resent && (error == EEXIST || error == ENODEV ||
+                        error == ENOENT || error == ESRCH ||
+                        error == EADDRNOTAVAIL)) {
+        error = 0; // the original request got through, only its ACK was lost
+    }
+    if (error == req->ignore_errno) {
+        error = 0;
+    }
+    if (error != 0) {
+        fprintf(stderr, "Netlink request for %s failed: %s\n",
+                req->label ? req->label : "(unknown)", strerror(error));
+        nl->failed++;
+    }
+    if (req->result && error != 0) {
+        *req->result = error;
+    }
+    if (req->close_fd >= 0) {
+        close(req->close_fd);
+        req->close_fd = -1;
+    }
+    trace_end(req->begin, "netlink",
+              nl_type_name(((struct nlmsghdr *)req->msg)->nlmsg_type),
+              req->label);
+    req->pending = 0;
+}
+
+/* Attach the ACKs in a received datagram to their requests */
+static void nl_process(nl_sock_t *nl, const char *buf, ssize_t n) {
+    for (const struct nlmsghdr *nlh = (const struct nlmsghdr *)buf;
+         NLMSG_OK(nlh, (size_t)n); nlh = NLMSG_NEXT(nlh, n)) {
+        if (nlh->nlmsg_type != NLMSG_ERROR) {
+            continue;
+        }
+        if (nlh->nlmsg_seq - nl->acked >= nl->sent - nl->acked) {
+            continue; // not in flight, e.g. a duplicate ACK after a resend
+        }
+        nl_req_t *req = nl_slot(nl, nlh->nlmsg_seq);
+        if (!req->pending || req->seq != nlh->nlmsg_seq) {
+            continue;
+        }
+        const struct nlmsgerr *err = NLMSG_DATA(nlh);
+        nl_complete(nl, req, -err->error);
+    }
+
+    while (nl->acked != nl->sent && !nl_slot(nl, nl->acked)->pending) {
+        nl->acked++;
+    }
+}
+
+/*
+ * The receive queue overflowed and ACKs were dropped. The kernel only
+ * reports the next overflow once the queue has been drained, so consume
+ * what is queued first, then grow the buffer so the next burst fits and
+ * resend everything that is still unacknowledged.
+ */
+static int nl_recover(nl_sock_t *nl, char *buf, size_t size) {
+    for (;;) {
+        ssize_t n = recv(nl->fd, buf, size, MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR || errno == ENOBUFS) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            fprintf(stderr, "Netlink recv failed: %s\n", strerror(errno));
+            return -1;
+        }
+        nl_process(nl, buf, n);
+    }
+
+    if (nl->rcvbuf < NL_RCVBUF_MAX) {
+        nl_set_rcvbuf(nl, nl->rcvbuf * 2);
+    }
+
+    for (uint32_t seq = nl->acked; seq != nl->sent; seq++) {
+        nl_req_t *req = nl_slot(nl, seq);
+        if (req->pending) {
+            req->resent = 1;
+        }
+    }
+    uint32_t unsent;
+    return nl_transmit(nl, nl->acked, nl->sent, &unsent);
+}
+
+/* Replies are consumed before the next recv, one buffer per thread */
+static _Thread_local _Alignas(NLMSG_ALIGNTO) char nl_rxbuf[NL_RECV_BYTES];
+
+/* Receive one batch of replies and attach them to their requests */
+static int nl_receive(nl_sock_t *nl) {
+    ssize_t n = recv(nl->fd, nl_rxbuf, sizeof nl_rxbuf, 0);
+    if (n < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        if (errno == ENOBUFS) {
+            return nl_recover(nl, nl_rxbuf, sizeof nl_rxbuf);
+        }
+        fprintf(stderr, "Netlink recv failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    nl_process(nl, nl_rxbuf, n);
+    return 0;
+}
+
+/*
+ * Transmit the queued requests. Those the kernel did not take fail right
+ * away: sending them again with a later batch could apply them twice.
+ */
+static int nl_flush(nl_sock_t *nl) {
+    uint32_t unsent;
+    int status = nl_transmit(nl, nl->sent, nl->next, &unsent);
+    if (status != 0) {
+        int error = errno;
+        for (uint32_t seq = unsent; seq != nl->next; seq++) {
+            nl_req_t *req = nl_slot(nl, seq);
+            if (req->pending) {
+                nl_complete(nl, req, error);
+            }
+        }
+    }
+    nl->sent = nl->next;
+    while (nl->acked != nl->sent && !nl_slot(nl, nl->acked)->pending) {
+        nl->acked++;
+    }
+    return status;
+}
+
+struct nlmsghdr *nl_msg_begin(nl_sock_t *nl, uint16_t type, uint16_t flags,
+                              const char *label) {
+    // window full: push out what is queued and wait for the oldest ACKs
+    if (nl->next - nl->acked == nl->window) {
+        if (nl_flush(nl) != 0) {
+            return NULL;
+        }
+        while (nl->next - nl->acked == nl->window) {
+            if (nl_receive(nl) != 0) {
+                return NULL;
+            }
+        }
+    }
+
+    nl_req_t *req = nl_slot(nl, nl->next);
+    memset(req->msg, 0, sizeof req->msg);
+    req->label = label;
+    req->ignore_errno = 0;
+    req->result = NULL;
+    req->close_fd = -1;
+    req->seq = nl->next;
+    req->pending = 0;
+    req->resent = 0;
+    req->begin = trace_begin();
+
+    struct nlmsghdr *nlh = (struct nlmsghdr *)req->msg;
+    nlh->nlmsg_len = NLMSG_LENGTH(0);
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    nlh->nlmsg_seq = nl->next;
+    return nlh;
+}
+
+nl_req_t *nl_msg_req(nl_sock_t *nl) { return nl_slot(nl, nl->next); }
+
+void nl_msg_end(nl_sock_t *nl) {
+    nl_slot(nl, nl->next)->pending = 1;
+    nl->next++;
+
+    // keep the pipe full without waiting for ACKs
+    if (nl->next - nl->sent >= NL_SEND_IOV) {
+        nl_flush(nl); // a failure shows in the requests and nl_sync()
+    }
+}
+
+int nl_sync(nl_sock_t *nl) {
+    // requests that could not be sent count in nl->failed
+    nl_flush(nl);
+
+    int status = 0;
+    while (status == 0 && nl->acked != nl->sent) {
+        if (nl_receive(nl) != 0) {
+            status = -1;
+        }
+    }
+
+    if (status != 0) {
+        // the socket is unusable, fail whatever is still outstanding
+        for (uint32_t seq = nl->acked; seq != nl->next; seq++) {
+            nl_req_t *req = nl_slot(nl, seq);
+            if (req->pending) {
+                nl_complete(nl, req, EIO);
+            }
+        }
+        nl->acked = nl->sent = nl->next;
+    }
+
+    if (nl->failed > 0) {
+        status = -1;
+    }
+    nl->failed = 0;
+    return status;
+}
+
+void nl_close(nl_sock_t *nl) {
+    if (nl->reqs == NULL) {
+        return;
+    }
+    nl_sync(nl);
+    close(nl->fd);
+    free(nl->reqs);
+    nl->reqs = NULL;
+}
+
+/* Size of the family header a dump request carries */
+static size_t nl_dump_hdrlen(uint16_t type) {
+    switch (type) {
+    case RTM_GETLINK:
+        return sizeof(struct ifinfomsg);
+    case RTM_GETADDR:
+        return sizeof(struct ifaddrmsg);
+    case RTM_GETNEIGH:
+        return sizeof(struct ndmsg);
+    default:
+        return sizeof(struct rtmsg);
+    }
+}
+
+static int nl_dump_run(nl_sock_t *nl, uint16_t type, uint8_t family,
+                       nl_dump_cb cb, void *arg) {
+    if (nl->acked != nl->next) {
+        fprintf(stderr, "Netlink dump with requests outstanding\n");
+        return -1;
+    }
+
+    // the dump takes a sequence number outside of the request window
+    uint32_t seq = nl->next++;
+    nl->acked = nl->sent = nl->next;
+
+    _Alignas(NLMSG_ALIGNTO) char msg[NLMSG_SPACE(sizeof(struct ifinfomsg))];
+    memset(msg, 0, sizeof msg);
+    struct nlmsghdr *req = (struct nlmsghdr *)msg;
+    req->nlmsg_len = NLMSG_LENGTH(0);
+    req->nlmsg_type = type;
+    req->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req->nlmsg_seq = seq;
+    // every family header starts with its address family
+    *(uint8_t *)nl_put(req, nl_dump_hdrlen(type)) = family;
+
+    while (send(nl->fd, req, req->nlmsg_len, 0) < 0) {
+        if (errno != EINTR) {
+            fprintf(stderr, "Netlink dump request failed: %s\n",
+                    strerror(errno));
+            return -1;
+        }
+    }
+
+    // read to the end even after a failure so the socket stays usable
+    int status = 0;
+    for (;;) {
+        ssize_t n = recv(nl->fd, nl_rxbuf, sizeof nl_rxbuf, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Netlink dump failed: %s\n", strerror(errno));
+            return -1;
+        }
+
+        for (const struct nlmsghdr *nlh = (const struct nlmsghdr *)nl_rxbuf;
+             NLMSG_OK(nlh, (size_t)n); nlh = NLMSG_NEXT(nlh, n)) {
+            if (nlh->nlmsg_seq != seq) {
+                continue;
+            }
+            if (nlh->nlmsg_type == NLMSG_DONE) {
+                return status;
+            }
+            if (nlh->nlmsg_type == NLMSG_ERROR) {
+                const struct nlmsgerr *err = NLMSG_DATA(nlh);
+                fprintf(stderr, "Netlink dump failed: %s\n",
+                        strerror(-err->error));
+                return -1;
+            }
+            if (nlh->nlmsg_flags & NLM_F_DUMP_INTR) {
+                fprintf(stderr, "Netlink dump interrupted by a change\n");
+                status = -1;
+            }
+            if (cb(nlh, arg) != 0) {
+                status = -1;
+            }
+        }
+    }
+}
+
+int nl_dump(nl_sock_t *nl, uint16_t type, uint8_t family, nl_dump_cb cb,
+            void *arg) {
+    uint64_t begin = trace_begin();
+    int status = nl_dump_run(nl, type, family, cb, arg);
+    trace_end(begin, "netlink", nl_type_name(type), NULL);
+    return status;
+}
+
+void *nl_put(struct nlmsghdr *nlh, size_t len) {
+    void *data = (char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len);
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + len;
+    return data;
+}
+
+void nl_attr(struct nlmsghdr *nlh, uint16_t type, const void *data,
+             size_t len) {
+    struct rtattr *rta = nl_put(nlh, RTA_LENGTH(len));
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    if (len > 0) {
+        memcpy(RTA_DATA(rta), data, len);
+    }
+}
+
+void nl_attr_str(struct nlmsghdr *nlh, uint16_t type, const char *str) {
+    nl_attr(nlh, type, str, strlen(str) + 1);
+}
+
+void nl_attr_u32(struct nlmsghdr *nlh, uint16_t type, uint32_t value) {
+    nl_attr(nlh, type, &value, sizeof value);
+}
+
+struct rtattr *nl_nest_begin(struct nlmsghdr *nlh, uint16_t type) {
+    struct rtattr *nest =
+        (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+    nl_attr(nlh, type, NULL, 0);
+    return nest;
+}
+
+void nl_nest_end(struct nlmsghdr *nlh, struct rtattr *nest) {
+    nest->rta_len = (char *)nlh + nlh->nlmsg_len - (char *)nest;
+}
+
+struct ifinfomsg *nl_put_ifinfo(struct nlmsghdr *nlh, int index,
+                                unsigned flags, unsigned change) {
+    struct ifinfomsg *ifi = nl_put(nlh, sizeof *ifi);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = index;
+    ifi->ifi_flags = flags;
+    ifi->ifi_change = change;
+    return ifi;
+}
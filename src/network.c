@@ -1,116 +1,181 @@
 #define _GNU_SOURCE
 #include "network.h"
 
+#include "plan.h"
+#include "trace.h"
+
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/ethtool.h>
+#include <linux/if_link.h>
+#include <linux/sockios.h>
+#include <linux/veth.h>
+#include <net/if.h>
 #include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
-#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
 #include <unistd.h>
 
-#define STACK_SIZE 65536 // Stack size for namespace child processes
 #define NETNS_RUN_DIR "/var/run/netns"
-#define PROC_PATH "/proc/self/ns/net"
+#define PROC_PATH "/proc/thread-self/ns/net"
 
-int network_up(config_t *config) {
-    int status = 0;
-    if ((status = create_namespaces(config->namespaces,
-                                    config->namespace_count)) != 0) {
-        return status;
+#define NS_NL_WINDOW 8 // Requests in flight on a per-namespace socket
+#define IP_FORWARD_PATH "/proc/sys/net/ipv4/ip_forward"
+#define NSFS_MAGIC 0x6e736673 // f_type of a pinned namespace
+
+void veth_host_ifname(const namespace_t *ns, char *ifname) {
+    if (strlen(ns->name) + 3 < IFNAMSIZ) {
+        snprintf(ifname, IFNAMSIZ, "vh-%.12s", ns->name);
+        return;
     }
 
-    return 0;
+    // name too long for an interface, fall back to a stable hash; its own
+    // prefix keeps it apart from the name of a namespace called like a hash
+    uint32_t hash = 2166136261u;
+    for (const char *c = ns->name; *c; c++) {
+        hash = (hash ^ (unsigned char)*c) * 16777619u;
+    }
+    snprintf(ifname, IFNAMSIZ, "vx-%08x", hash);
 }
 
-int network_down(config_t *config) {
-    int status = 0;
-    if ((status = remove_namespaces(config->namespaces,
-                                    config->namespace_count)) != 0) {
-        return status;
+const char *ns_bridge_name(const namespace_t *ns) {
+    if (ns->connect_type != CONNECT_BRIDGE) {
+        return NULL;
     }
-    return 0;
+    const char *sep = strchr(ns->connect_name, ':');
+    return sep ? sep + 1 : ns->connect_name;
 }
 
-int create_namespace(void *arg) {
-    const namespace_t ns = *(namespace_t *)arg;
+int network_up(config_t *config) {
+    plan_t plan;
+    if (plan_build(config, &plan) != 0) {
+        return -1;
+    }
+    int status = plan_run(&plan, false);
+    plan_free(&plan);
+    if (status == 0) {
+        status = save_manifest(config);
+    }
+    return status;
+}
 
-    char ns_path[100];
-    snprintf(ns_path, 100, "%s/%s", NETNS_RUN_DIR, ns.name);
+int network_down(config_t *config) {
+    plan_t plan;
+    if (plan_build(config, &plan) != 0) {
+        return -1;
+    }
+    int status = plan_run(&plan, true);
+    plan_free(&plan);
+    remove_manifest();
+    return status;
+}
 
-    // create filesystem state
-    int fd = open(ns_path, O_RDONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0);
+int ipv4_forwarding_enabled(void) {
+    int fd = open(IP_FORWARD_PATH, O_RDONLY | O_CLOEXEC);
     if (fd < 0) {
-        if (errno == EEXIST) {
-            fprintf(stderr, "Network namespace %s already exists\n", ns.name);
-            return 0;
-        } else {
-            fprintf(stderr, "Cannot create network namespace %s: %s\n", ns.name,
-                    strerror(errno));
-            return -1;
-        }
+        return -1;
     }
+    char value = 0;
+    ssize_t n = read(fd, &value, 1);
     close(fd);
+    return n == 1 ? value == '1' : -1;
+}
 
-    // bind netns
-    if (mount(PROC_PATH, ns_path, "none", MS_BIND, NULL) < 0) {
-        fprintf(stderr, "Bind %s -> %s failed: %s\n", PROC_PATH, ns_path,
+int setup_ipv4_forwarding(bool enable) {
+    int fd = open(IP_FORWARD_PATH, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", IP_FORWARD_PATH,
                 strerror(errno));
-        unlink(ns_path);
         return -1;
     }
 
-    return 0;
+    int status = 0;
+    if (write(fd, enable ? "1\n" : "0\n", 2) != 2) {
+        fprintf(stderr, "Cannot write %s: %s\n", IP_FORWARD_PATH,
+                strerror(errno));
+        status = -1;
+    }
+    close(fd);
+    return status;
 }
 
-int create_namespaces(namespace_t *namespaces, int count) {
-    pid_t ns_pids[count];
-    char *stacks[count];
-
-    for (int i = 0; i < count; i++) {
-        const namespace_t ns = namespaces[i];
-        char *stack_top;
-        int flags = CLONE_NEWNET;
+/*
+ * Create a namespace from a pool worker: unshare a fresh network namespace
+ * on the calling thread, pin it with a bind mount and switch back to the
+ * namespace referenced by home_fd. Returns 0 or an errno value.
+ */
+static int pin_namespace(const namespace_t *ns, int home_fd) {
+    char ns_path[100];
+    snprintf(ns_path, 100, "%s/%s", NETNS_RUN_DIR, ns->name);
 
-        stacks[i] = malloc(STACK_SIZE);
-        if (stacks[i] == NULL) {
-            return -1; // malloc failed
+    // create filesystem state
+    int fd = open(ns_path, O_RDONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0);
+    if (fd < 0 && errno == ENOENT) {
+        if (mkdir(NETNS_RUN_DIR, 0755) < 0 && errno != EEXIST) {
+            return errno;
         }
-        stack_top = stacks[i] + STACK_SIZE;
+        fd = open(ns_path, O_RDONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0);
+    }
+    if (fd < 0) {
+        return errno;
+    }
+    close(fd);
 
-        if ((ns_pids[i] = clone(create_namespace, stack_top, flags | SIGCHLD,
-                                (void *)&ns)) == -1) {
-            fprintf(stderr, "clone failed: %s\n", strerror(errno));
-            free(stacks[i]);
-            return -1; // clone failed
-        }
+    if (unshare(CLONE_NEWNET) < 0) {
+        int error = errno;
+        unlink(ns_path);
+        return error;
     }
 
-    int overall_status = 0;
-    for (int i = 0; i < count; i++) {
-        int status;
-        if (waitpid(ns_pids[i], &status, 0) == -1) {
-            fprintf(stderr, "waitpid failed for pid %d: %s\n", ns_pids[i],
-                    strerror(errno));
-            overall_status = -1;
-        } else {
-            // check if the child process exited with an error
-            if (!(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
-                fprintf(stderr, "Namespace creation failed for pid %d\n",
-                        ns_pids[i]);
-                overall_status = -1;
-            }
-        }
+    // bind netns; thread-self since only this thread has moved
+    int error = 0;
+    if (mount(PROC_PATH, ns_path, "none", MS_BIND, NULL) < 0) {
+        error = errno;
+        unlink(ns_path);
+    }
 
-        free(stacks[i]);
+    if (setns(home_fd, CLONE_NEWNET) < 0) {
+        // the thread is stranded in the new namespace and cannot go on
+        fprintf(stderr, "Cannot return from namespace %s: %s\n", ns->name,
+                strerror(errno));
+        abort();
     }
 
-    return overall_status;
+    return error;
+}
+
+int create_namespace(const namespace_t *ns, int home_fd) {
+    uint64_t begin = trace_begin();
+    int error = pin_namespace(ns, home_fd);
+    trace_end(begin, "netns", "create_namespace", ns->name);
+    return error;
+}
+
+bool namespace_exists(const char *ns_name, ino_t *ino) {
+    char ns_path[100];
+    snprintf(ns_path, 100, "%s/%s", NETNS_RUN_DIR, ns_name);
+
+    // a leftover file that is no longer bind mounted does not count
+    struct statfs fs;
+    struct stat st;
+    if (statfs(ns_path, &fs) != 0 || fs.f_type != NSFS_MAGIC ||
+        stat(ns_path, &st) != 0) {
+        return false;
+    }
+    if (ino != NULL) {
+        *ino = st.st_ino;
+    }
+    return true;
 }
 
-int remove_namespace(char *ns_name) {
+static int unpin_namespace(const char *ns_name) {
     char ns_path[100];
     snprintf(ns_path, 100, "%s/%s", NETNS_RUN_DIR, ns_name);
 
@@ -132,13 +197,315 @@ int remove_namespace(char *ns_name) {
     return 0;
 }
 
-int remove_namespaces(namespace_t *namespaces, int count) {
-    int cleanup_status = 0;
-    for (int i = 0; i < count; i++) {
-        if ((cleanup_status = remove_namespace(namespaces[i].name)) != 0) {
-            fprintf(stderr, "Failed to remove namespace %s\n",
-                    namespaces[i].name);
-        }
+int remove_namespace(const char *ns_name) {
+    uint64_t begin = trace_begin();
+    int status = unpin_namespace(ns_name);
+    trace_end(begin, "netns", "remove_namespace", ns_name);
+    return status;
+}
+
+/* Queue an IPv4 address assignment on the socket of the owning namespace */
+static int add_address(nl_sock_t *nl, int index, struct in_addr addr,
+                       u_int8_t mask, const char *label, int *result) {
+    struct nlmsghdr *nlh =
+        nl_msg_begin(nl, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE, label);
+    if (nlh == NULL) {
+        return -1;
+    }
+    nl_msg_req(nl)->result = result;
+    struct ifaddrmsg *ifa = nl_put(nlh, sizeof *ifa);
+    ifa->ifa_family = AF_INET;
+    ifa->ifa_prefixlen = mask;
+    ifa->ifa_index = index;
+    nl_attr(nlh, IFA_LOCAL, &addr, sizeof addr);
+    nl_attr(nlh, IFA_ADDRESS, &addr, sizeof addr);
+    nl_msg_end(nl);
+    return 0;
+}
+
+int queue_address_delete(nl_sock_t *nl, int index, struct in_addr addr,
+                         u_int8_t mask, const char *label, int *result) {
+    struct nlmsghdr *nlh = nl_msg_begin(nl, RTM_DELADDR, 0, label);
+    if (nlh == NULL) {
+        return -1;
+    }
+    nl_msg_req(nl)->result = result;
+    nl_msg_req(nl)->ignore_errno = EADDRNOTAVAIL; // already gone
+    struct ifaddrmsg *ifa = nl_put(nlh, sizeof *ifa);
+    ifa->ifa_family = AF_INET;
+    ifa->ifa_prefixlen = mask;
+    ifa->ifa_index = index;
+    nl_attr(nlh, IFA_LOCAL, &addr, sizeof addr);
+    nl_msg_end(nl);
+    return 0;
+}
+
+int queue_link_up(nl_sock_t *nl, int index, const char *label, int *result) {
+    struct nlmsghdr *nlh = nl_msg_begin(nl, RTM_NEWLINK, 0, label);
+    if (nlh == NULL) {
+        return -1;
+    }
+    nl_msg_req(nl)->result = result;
+    nl_put_ifinfo(nlh, index, IFF_UP, IFF_UP);
+    nl_msg_end(nl);
+    return 0;
+}
+
+int queue_bridge(nl_sock_t *nl, const bridge_t *br, int *result) {
+    if (strlen(br->name) >= IFNAMSIZ) {
+        fprintf(stderr, "Bridge name %s is too long for an interface\n",
+                br->name);
+        return -1;
+    }
+
+    struct nlmsghdr *nlh =
+        nl_msg_begin(nl, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, br->name);
+    if (nlh == NULL) {
+        return -1;
+    }
+    nl_msg_req(nl)->result = result;
+    nl_put_ifinfo(nlh, 0, IFF_UP, IFF_UP);
+    nl_attr_str(nlh, IFLA_IFNAME, br->name);
+    struct rtattr *linkinfo = nl_nest_begin(nlh, IFLA_LINKINFO);
+    nl_attr_str(nlh, IFLA_INFO_KIND, "bridge");
+    nl_nest_end(nlh, linkinfo);
+    nl_msg_end(nl);
+    return 0;
+}
+
+int queue_bridge_address(nl_sock_t *nl, const bridge_t *br, int index,
+                         int *result) {
+    if (br->mask == 0) {
+        return 0; // no address configured
+    }
+    return add_address(nl, index, br->ip_addr, br->mask, br->name, result);
+}
+
+int queue_veth(nl_sock_t *nl, const namespace_t *ns, int master,
+               uint32_t queues, int *result) {
+    char ns_path[100];
+    snprintf(ns_path, sizeof ns_path, "%s/%s", NETNS_RUN_DIR, ns->name);
+    int ns_fd = open(ns_path, O_RDONLY | O_CLOEXEC);
+    if (ns_fd < 0) {
+        fprintf(stderr, "Cannot open network namespace %s: %s\n", ns->name,
+                strerror(errno));
+        return -1;
+    }
+
+    struct nlmsghdr *nlh =
+        nl_msg_begin(nl, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, ns->name);
+    if (nlh == NULL) {
+        close(ns_fd);
+        return -1;
+    }
+    nl_msg_req(nl)->result = result;
+    nl_msg_req(nl)->close_fd = ns_fd; // must stay open until the ACK
+
+    char host_ifname[IFNAMSIZ];
+    veth_host_ifname(ns, host_ifname);
+
+    nl_put_ifinfo(nlh, 0, IFF_UP, IFF_UP);
+    nl_attr_str(nlh, IFLA_IFNAME, host_ifname);
+    if (master != 0) {
+        nl_attr_u32(nlh, IFLA_MASTER, master);
+    }
+    nl_attr_u32(nlh, IFLA_NUM_TX_QUEUES, queues);
+    nl_attr_u32(nlh, IFLA_NUM_RX_QUEUES, queues);
+    struct rtattr *linkinfo = nl_nest_begin(nlh, IFLA_LINKINFO);
+    nl_attr_str(nlh, IFLA_INFO_KIND, "veth");
+    struct rtattr *data = nl_nest_begin(nlh, IFLA_INFO_DATA);
+    struct rtattr *peer = nl_nest_begin(nlh, VETH_INFO_PEER);
+    // the peer can only go up once the pair is linked, so it is left
+    // down here and brought up from inside the namespace
+    nl_put_ifinfo(nlh, 0, 0, 0);
+    nl_attr_str(nlh, IFLA_IFNAME, VETH_NS_IF_NAME);
+    nl_attr_u32(nlh, IFLA_NET_NS_FD, ns_fd);
+    nl_attr_u32(nlh, IFLA_NUM_TX_QUEUES, queues);
+    nl_attr_u32(nlh, IFLA_NUM_RX_QUEUES, queues);
+    nl_nest_end(nlh, peer);
+    nl_nest_end(nlh, data);
+    nl_nest_end(nlh, linkinfo);
+    nl_msg_end(nl);
+    return 0;
+}
+
+int queue_enslave(nl_sock_t *nl, const namespace_t *ns, int master,
+                  int *result) {
+    struct nlmsghdr *nlh = nl_msg_begin(nl, RTM_NEWLINK, 0, ns->name);
+    if (nlh == NULL) {
+        return -1;
+    }
+    nl_msg_req(nl)->result = result;
+
+    char host_ifname[IFNAMSIZ];
+    veth_host_ifname(ns, host_ifname);
+    nl_put_ifinfo(nlh, 0, 0, 0);
+    nl_attr_str(nlh, IFLA_IFNAME, host_ifname);
+    nl_attr_u32(nlh, IFLA_MASTER, master);
+    nl_msg_end(nl);
+    return 0;
+}
+
+int queue_link_delete(nl_sock_t *nl, const char *ifname, const char *label,
+                      int *result) {
+    struct nlmsghdr *nlh = nl_msg_begin(nl, RTM_DELLINK, 0, label);
+    if (nlh == NULL) {
+        return -1;
+    }
+    nl_put_ifinfo(nlh, 0, 0, 0);
+    nl_attr_str(nlh, IFLA_IFNAME, ifname);
+    nl_msg_req(nl)->ignore_errno = ENODEV; // already gone
+    nl_msg_req(nl)->result = result;
+    nl_msg_end(nl);
+    return 0;
+}
+
+/* Switch the calling thread into a namespace; returns its own, or -1 */
+static int enter_namespace(const namespace_t *ns) {
+    char ns_path[100];
+    snprintf(ns_path, sizeof ns_path, "%s/%s", NETNS_RUN_DIR, ns->name);
+
+    int self_fd = open(PROC_PATH, O_RDONLY | O_CLOEXEC);
+    if (self_fd < 0) {
+        fprintf(stderr, "Cannot open own network namespace: %s\n",
+                strerror(errno));
+        return -1;
+    }
+    int ns_fd = open(ns_path, O_RDONLY | O_CLOEXEC);
+    if (ns_fd < 0) {
+        fprintf(stderr, "Cannot open network namespace %s: %s\n", ns->name,
+                strerror(errno));
+        close(self_fd);
+        return -1;
+    }
+    if (setns(ns_fd, CLONE_NEWNET) < 0) {
+        fprintf(stderr, "Cannot enter network namespace %s: %s\n", ns->name,
+                strerror(errno));
+        close(self_fd);
+        self_fd = -1;
+    }
+    close(ns_fd);
+    return self_fd;
+}
+
+static void leave_namespace(int self_fd) {
+    if (setns(self_fd, CLONE_NEWNET) < 0) {
+        fprintf(stderr, "Cannot return to own network namespace: %s\n",
+                strerror(errno));
+        abort(); // continuing would configure the wrong namespace
+    }
+    close(self_fd);
+}
+
+/*
+ * The socket stays bound to the namespace it was created in, so the thread
+ * only visits the namespace briefly.
+ */
+int open_ns_socket(const namespace_t *ns, nl_sock_t *nl, int *eth_index) {
+    int self_fd = enter_namespace(ns);
+    if (self_fd < 0) {
+        return -1;
+    }
+    int status = nl_open(nl, NS_NL_WINDOW);
+    *eth_index = if_nametoindex(VETH_NS_IF_NAME);
+    if (status == 0 && *eth_index == 0) {
+        fprintf(stderr, "No %s in namespace %s\n", VETH_NS_IF_NAME, ns->name);
+        nl_close(nl);
+        status = -1;
+    }
+    leave_namespace(self_fd);
+    return status;
+}
+
+int set_ns_tx_checksum(const namespace_t *ns, bool on) {
+    int self_fd = enter_namespace(ns);
+    if (self_fd < 0) {
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    int status = -1;
+    if (fd >= 0) {
+        struct ethtool_value value = {ETHTOOL_STXCSUM, on};
+        struct ifreq ifr = {.ifr_data = (void *)&value};
+        snprintf(ifr.ifr_name, sizeof ifr.ifr_name, "%s", VETH_NS_IF_NAME);
+        status = ioctl(fd, SIOCETHTOOL, &ifr);
+        close(fd);
+    }
+    if (status < 0) {
+        fprintf(stderr, "Cannot set checksum offload in namespace %s: %s\n",
+                ns->name, strerror(errno));
+    }
+    leave_namespace(self_fd);
+    return status < 0 ? -1 : 0;
+}
+
+int queue_ns_address(nl_sock_t *nl, const namespace_t *ns, int eth_index,
+                     int *result) {
+    // loopback is always index 1
+    if (queue_link_up(nl, 1, ns->name, result) != 0 ||
+        queue_link_up(nl, eth_index, ns->name, result) != 0) {
+        return -1;
+    }
+
+    if (ns->mask == 0) {
+        return 0; // no address configured
+    }
+    return add_address(nl, eth_index, ns->ip_addr, ns->mask, ns->name, result);
+}
+
+int queue_ns_route(nl_sock_t *nl, const namespace_t *ns, int eth_index,
+                   int *result) {
+    if (ns->gateway.s_addr == 0) {
+        return 0; // no gateway configured
+    }
+
+    struct nlmsghdr *nlh =
+        nl_msg_begin(nl, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE, ns->name);
+    if (nlh == NULL) {
+        return -1;
+    }
+    nl_msg_req(nl)->result = result;
+    struct rtmsg *rtm = nl_put(nlh, sizeof *rtm);
+    rtm->rtm_family = AF_INET;
+    rtm->rtm_table = RT_TABLE_MAIN;
+    rtm->rtm_protocol = RTPROT_BOOT;
+    rtm->rtm_scope = RT_SCOPE_UNIVERSE;
+    rtm->rtm_type = RTN_UNICAST;
+    nl_attr(nlh, RTA_GATEWAY, &ns->gateway, sizeof ns->gateway);
+    nl_attr_u32(nlh, RTA_OIF, eth_index);
+    nl_msg_end(nl);
+    return 0;
+}
+
+int queue_ns_route_delete(nl_sock_t *nl, const namespace_t *ns,
+                          int *result) {
+    struct nlmsghdr *nlh = nl_msg_begin(nl, RTM_DELROUTE, 0, ns->name);
+    if (nlh == NULL) {
+        return -1;
+    }
+    nl_msg_req(nl)->result = result;
+    nl_msg_req(nl)->ignore_errno = ESRCH; // already gone
+    struct rtmsg *rtm = nl_put(nlh, sizeof *rtm);
+    rtm->rtm_family = AF_INET;
+    rtm->rtm_table = RT_TABLE_MAIN;
+    rtm->rtm_scope = RT_SCOPE_NOWHERE;
+    nl_msg_end(nl);
+    return 0;
+}
+
+int queue_host_gateway(nl_sock_t *nl, const namespace_t *ns, int *result) {
+    // only a veth namespace routes through the host end of its pair
+    if (ns->connect_type != CONNECT_VETH || ns->gateway.s_addr == 0) {
+        return 0;
+    }
+
+    char host_ifname[IFNAMSIZ];
+    veth_host_ifname(ns, host_ifname);
+    int index = if_nametoindex(host_ifname);
+    if (index == 0) {
+        fprintf(stderr, "Host veth %s not found: %s\n", host_ifname,
+                strerror(errno));
+        return -1;
     }
-    return cleanup_status;
+    return add_address(nl, index, ns->gateway, ns->mask, ns->name, result);
 }
@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+#include "pktpool.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/*
+ * Reserved huge pages when the administrator set some aside, otherwise
+ * ordinary memory aligned to a huge page so that transparent ones can
+ * back it
+ */
+static void *map_region(size_t size, bool *huge) {
+    void *area = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (area != MAP_FAILED) {
+        *huge = true;
+        return area;
+    }
+    *huge = false;
+    char *raw = mmap(NULL, size + PKTPOOL_HUGE_PAGE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+    // trim to an aligned start and the exact size
+    size_t head = -(uintptr_t)raw & (PKTPOOL_HUGE_PAGE - 1);
+    if (head > 0) {
+        munmap(raw, head);
+    }
+    munmap(raw + head + size, PKTPOOL_HUGE_PAGE - head);
+    area = raw + head;
+    if (madvise(area, size, MADV_HUGEPAGE) != 0) {
+        // no THP in this kernel, small pages work all the same
+    }
+    return area;
+}
+
+int pktpool_open(pktpool_t *pool, uint32_t frames, uint32_t frame_size) {
+    memset(pool, 0, sizeof *pool);
+    if (frames == 0 || frame_size == 0 || (frame_size & (frame_size - 1))) {
+        fprintf(stderr, "Invalid packet pool of %u frames of %u bytes\n",
+                frames, frame_size);
+        return -1;
+    }
+    uint32_t slots = 1;
+    while (slots < frames) {
+        slots <<= 1;
+    }
+    pool->slots = malloc(slots * sizeof *pool->slots);
+    if (pool->slots == NULL) {
+        return -1;
+    }
+    size_t bytes = (size_t)frames * frame_size;
+    pool->size = (bytes + PKTPOOL_HUGE_PAGE - 1) &
+                 ~(size_t)(PKTPOOL_HUGE_PAGE - 1);
+    pool->area = map_region(pool->size, &pool->huge);
+    if (pool->area == NULL) {
+        fprintf(stderr, "Cannot allocate %zu bytes of frames: %s\n",
+                pool->size, strerror(errno));
+        pktpool_close(pool);
+        return -1;
+    }
+    pool->mask = slots - 1;
+    pool->frames = frames;
+    pool->frame_size = frame_size;
+    // every frame starts out in the ring, the lowest handed out first
+    for (uint32_t f = 0; f < frames; f++) {
+        pool->slots[f] = (uint64_t)f * frame_size;
+    }
+    atomic_init(&pool->prod_head, frames);
+    atomic_init(&pool->prod_tail, frames);
+    atomic_init(&pool->cons_head, 0);
+    atomic_init(&pool->cons_tail, 0);
+    return 0;
+}
+
+void pktpool_close(pktpool_t *pool) {
+    if (pool->area != NULL) {
+        munmap(pool->area, pool->size);
+    }
+    free(pool->slots);
+    memset(pool, 0, sizeof *pool);
+}
+
+/* Wait for the threads that claimed slots before ours to publish them */
+static void publish(atomic_uint *tail, uint32_t from, uint32_t to) {
+    while (atomic_load_explicit(tail, memory_order_relaxed) != from) {
+        sched_yield(); // the other thread may have lost its CPU
+    }
+    atomic_store_explicit(tail, to, memory_order_release);
+}
+
+/* Put up to n frames into the ring; it has room for all of them */
+static uint32_t ring_put(pktpool_t *pool, const uint64_t *addrs, uint32_t n) {
+    uint32_t size = pool->mask + 1;
+    uint32_t head =
+        atomic_load_explicit(&pool->prod_head, memory_order_relaxed);
+    do {
+        uint32_t tail =
+            atomic_load_explicit(&pool->cons_tail, memory_order_acquire);
+        uint32_t room = size - (head - tail);
+        if (n > room) {
+            n = room;
+        }
+        if (n == 0) {
+            return 0;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(
+        &pool->prod_head, &head, head + n, memory_order_relaxed,
+        memory_order_relaxed));
+    for (uint32_t i = 0; i < n; i++) {
+        pool->slots[(head + i) & pool->mask] = addrs[i];
+    }
+    publish(&pool->prod_tail, head, head + n);
+    return n;
+}
+
+/* Take up to n frames out of the ring */
+static uint32_t ring_get(pktpool_t *pool, uint64_t *addrs, uint32_t n) {
+    uint32_t head =
+        atomic_load_explicit(&pool->cons_head, memory_order_relaxed);
+    do {
+        uint32_t tail =
+            atomic_load_explicit(&pool->prod_tail, memory_order_acquire);
+        uint32_t ready = tail - head;
+        if (n > ready) {
+            n = ready;
+        }
+        if (n == 0) {
+            return 0;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(
+        &pool->cons_head, &head, head + n, memory_order_relaxed,
+        memory_order_relaxed));
+    for (uint32_t i = 0; i < n; i++) {
+        addrs[i] = pool->slots[(head + i) & pool->mask];
+    }
+    publish(&pool->cons_tail, head, head + n);
+    return n;
+}
+
+void pktpool_cache_init(pktpool_cache_t *cache, pktpool_t *pool) {
+    cache->pool = pool;
+    cache->count = 0;
+}
+
+/* Move the oldest frames of a cache to the ring */
+static void spill(pktpool_cache_t *cache, uint32_t n) {
+    uint32_t put = ring_put(cache->pool, cache->addrs, n);
+    cache->count -= put;
+    memmove(cache->addrs, cache->addrs + put,
+            cache->count * sizeof *cache->addrs);
+}
+
+void pktpool_cache_flush(pktpool_cache_t *cache) {
+    spill(cache, cache->count);
+}
+
+uint32_t pktpool_alloc(pktpool_cache_t *cache, uint64_t *addrs, uint32_t n) {
+    uint32_t got = 0;
+    while (got < n) {
+        if (cache->count == 0) {
+            cache->count = ring_get(cache->pool, cache->addrs, PKTPOOL_BULK);
+            if (cache->count == 0) {
+                break;
+            }
+        }
+        uint32_t take = n - got < cache->count ? n - got : cache->count;
+        cache->count -= take;
+        memcpy(addrs + got, cache->addrs + cache->count, take * sizeof *addrs);
+        got += take;
+    }
+    return got;
+}
+
+void pktpool_free(pktpool_cache_t *cache, const uint64_t *addrs, uint32_t n) {
+    uint64_t mask = ~(uint64_t)(cache->pool->frame_size - 1);
+    for (uint32_t i = 0; i < n; i++) {
+        if (cache->count == PKTPOOL_CACHE_SIZE) {
+            // the recently used frames stay, still warm in the cache
+            spill(cache, PKTPOOL_BULK);
+        }
+        cache->addrs[cache->count++] = addrs[i] & mask;
+    }
+}
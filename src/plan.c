@@ -0,0 +1,648 @@
+#define _GNU_SOURCE
+#include "plan.h"
+
+#include "netlink.h"
+#include "network.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PLAN_BATCH 64       // Operations of one kind a worker runs at once
+#define PLAN_MIN_WORKERS 4  // Operations mostly wait on the kernel, not CPU
+
+static const char *op_names[OP_KIND_COUNT] = {
+    [OP_FORWARDING] = "forwarding", [OP_BRIDGE] = "bridge",
+    [OP_NAMESPACE] = "namespace",   [OP_VETH] = "veth",
+    [OP_ENSLAVE] = "enslave",       [OP_ADDRESS] = "address",
+    [OP_ROUTE] = "route",           [OP_FIREWALL] = "firewall",
+};
+
+typedef struct {
+    int from; /* Operation that must run first */
+    int to;   /* Operation depending on it */
+} plan_edge_t;
+
+static const char *node_object(const plan_t *plan, const plan_node_t *node) {
+    switch (node->kind) {
+    case OP_FORWARDING:
+        return "ipv4";
+    case OP_FIREWALL:
+        return "nftables";
+    case OP_BRIDGE:
+        return plan->config->bridges[node->index].name;
+    default:
+        return plan->config->namespaces[node->index].name;
+    }
+}
+
+static int add_node(plan_t *plan, op_kind_t kind, int index) {
+    plan_node_t *node = &plan->nodes[plan->node_count];
+    memset(node, 0, sizeof *node);
+    node->kind = kind;
+    node->index = index;
+    return plan->node_count++;
+}
+
+int plan_build(config_t *config, plan_t *plan) {
+    memset(plan, 0, sizeof *plan);
+    plan->config = config;
+    // namespace ranges and ip = auto are only resolved once needed
+    if (config_assign_addresses(config, NULL) != 0) {
+        return -1;
+    }
+
+    int ns_count = config->namespace_count;
+    int br_count = config->bridge_count;
+    int max_nodes = 2 + br_count + 5 * ns_count;
+    int max_edges = 6 * ns_count + br_count;
+
+    plan->nodes = calloc(max_nodes, sizeof *plan->nodes);
+    plan->ns_bridge = calloc(ns_count + 1, sizeof *plan->ns_bridge);
+    plan->bridge_ifindex = calloc(br_count + 1, sizeof *plan->bridge_ifindex);
+    plan_edge_t *edges = calloc(max_edges + 1, sizeof *edges);
+    int *bridge_node = calloc(br_count + 1, sizeof *bridge_node);
+    int *veth_node = calloc(ns_count + 1, sizeof *veth_node);
+    if (plan->nodes == NULL || plan->ns_bridge == NULL ||
+        plan->bridge_ifindex == NULL || edges == NULL || bridge_node == NULL ||
+        veth_node == NULL) {
+        goto fail;
+    }
+
+    add_node(plan, OP_FORWARDING, 0);
+    for (int j = 0; j < br_count; j++) {
+        bridge_node[j] = add_node(plan, OP_BRIDGE, j);
+    }
+
+    // namespace -> veth -> address -> route, bridge -> enslave
+    for (int i = 0; i < ns_count; i++) {
+        const namespace_t *ns = &config->namespaces[i];
+
+        plan->ns_bridge[i] = -1;
+        if (ns->connect_type == CONNECT_BRIDGE) {
+            const char *br_name = ns_bridge_name(ns);
+            const bridge_t *br = find_bridge_by_name(config, br_name);
+            if (br == NULL) {
+                fprintf(stderr, "Bridge %s for namespace %s does not exist\n",
+                        br_name, ns->name);
+                goto fail;
+            }
+            plan->ns_bridge[i] = br - config->bridges;
+        }
+
+        int ns_node = add_node(plan, OP_NAMESPACE, i);
+        veth_node[i] = add_node(plan, OP_VETH, i);
+        edges[plan->edge_count++] = (plan_edge_t){ns_node, veth_node[i]};
+        if (plan->ns_bridge[i] >= 0) {
+            int enslave_node = add_node(plan, OP_ENSLAVE, i);
+            edges[plan->edge_count++] =
+                (plan_edge_t){veth_node[i], enslave_node};
+            edges[plan->edge_count++] =
+                (plan_edge_t){bridge_node[plan->ns_bridge[i]], enslave_node};
+        }
+        int addr_node = add_node(plan, OP_ADDRESS, i);
+        edges[plan->edge_count++] = (plan_edge_t){veth_node[i], addr_node};
+        int route_node = add_node(plan, OP_ROUTE, i);
+        edges[plan->edge_count++] = (plan_edge_t){addr_node, route_node};
+    }
+
+    // the firewall goes in once every link it filters exists
+    int fw_node = add_node(plan, OP_FIREWALL, 0);
+    for (int j = 0; j < br_count; j++) {
+        edges[plan->edge_count++] = (plan_edge_t){bridge_node[j], fw_node};
+    }
+    for (int i = 0; i < ns_count; i++) {
+        edges[plan->edge_count++] = (plan_edge_t){veth_node[i], fw_node};
+    }
+
+    // adjacency lists in both directions, laid out by counting sort
+    plan->preds = calloc(plan->edge_count + 1, sizeof *plan->preds);
+    plan->succs = calloc(plan->edge_count + 1, sizeof *plan->succs);
+    if (plan->preds == NULL || plan->succs == NULL) {
+        goto fail;
+    }
+    for (int e = 0; e < plan->edge_count; e++) {
+        plan->nodes[edges[e].from].succ_count++;
+        plan->nodes[edges[e].to].pred_count++;
+    }
+    int pred_off = 0, succ_off = 0;
+    for (int n = 0; n < plan->node_count; n++) {
+        plan->nodes[n].pred_start = pred_off;
+        plan->nodes[n].succ_start = succ_off;
+        pred_off += plan->nodes[n].pred_count;
+        succ_off += plan->nodes[n].succ_count;
+        plan->nodes[n].pred_count = 0;
+        plan->nodes[n].succ_count = 0;
+    }
+    for (int e = 0; e < plan->edge_count; e++) {
+        plan_node_t *from = &plan->nodes[edges[e].from];
+        plan_node_t *to = &plan->nodes[edges[e].to];
+        plan->succs[from->succ_start + from->succ_count++] = edges[e].to;
+        plan->preds[to->pred_start + to->pred_count++] = edges[e].from;
+    }
+
+    // nodes were added in topological order, so one pass yields the depths
+    for (int n = 0; n < plan->node_count; n++) {
+        plan_node_t *node = &plan->nodes[n];
+        node->depth = 1;
+        for (int p = 0; p < node->pred_count; p++) {
+            int pred = plan->preds[node->pred_start + p];
+            if (plan->nodes[pred].depth + 1 > node->depth) {
+                node->depth = plan->nodes[pred].depth + 1;
+            }
+        }
+    }
+
+    free(edges);
+    free(bridge_node);
+    free(veth_node);
+    return 0;
+
+fail:
+    free(edges);
+    free(bridge_node);
+    free(veth_node);
+    plan_free(plan);
+    return -1;
+}
+
+const char *plan_kind_name(op_kind_t kind) { return op_names[kind]; }
+
+void plan_free(plan_t *plan) {
+    free(plan->nodes);
+    free(plan->preds);
+    free(plan->succs);
+    free(plan->ns_bridge);
+    free(plan->bridge_ifindex);
+    memset(plan, 0, sizeof *plan);
+}
+
+int plan_critical_path(const plan_t *plan) {
+    int longest = 0;
+    for (int n = 0; n < plan->node_count; n++) {
+        if (plan->nodes[n].depth > longest) {
+            longest = plan->nodes[n].depth;
+        }
+    }
+    return longest;
+}
+
+void print_plan(const plan_t *plan, FILE *fp) {
+    fprintf(fp, "=== Plan (%d operations, %d dependencies) ===\n",
+            plan->node_count, plan->edge_count);
+
+    for (int n = 0; n < plan->node_count; n++) {
+        const plan_node_t *node = &plan->nodes[n];
+        fprintf(fp, "%6d  %-10s %-20s", n, op_names[node->kind],
+                node_object(plan, node));
+        if (node->pred_count > 0) {
+            fprintf(fp, " after");
+            for (int p = 0; p < node->pred_count; p++) {
+                fprintf(fp, " %d", plan->preds[node->pred_start + p]);
+            }
+        }
+        fprintf(fp, "\n");
+    }
+
+    int length = plan_critical_path(plan);
+    fprintf(fp, "\nCritical path: %d operations\n", length);
+
+    // walk back from the deepest node along predecessors one level up
+    int *chain = calloc(length + 1, sizeof *chain);
+    if (chain == NULL || length == 0) {
+        free(chain);
+        fprintf(fp, "====================\n");
+        return;
+    }
+    int cur = 0;
+    for (int n = 0; n < plan->node_count; n++) {
+        if (plan->nodes[n].depth == length) {
+            cur = n;
+            break;
+        }
+    }
+    for (int d = length - 1; d >= 0; d--) {
+        chain[d] = cur;
+        const plan_node_t *node = &plan->nodes[cur];
+        for (int p = 0; p < node->pred_count; p++) {
+            int pred = plan->preds[node->pred_start + p];
+            if (plan->nodes[pred].depth == node->depth - 1) {
+                cur = pred;
+                break;
+            }
+        }
+    }
+    fprintf(fp, " ");
+    for (int d = 0; d < length; d++) {
+        const plan_node_t *node = &plan->nodes[chain[d]];
+        fprintf(fp, " %s%s %s", d > 0 ? "-> " : "", op_names[node->kind],
+                node_object(plan, node));
+    }
+    fprintf(fp, "\n====================\n");
+    free(chain);
+}
+
+/* Shared scheduler state while a plan runs */
+typedef struct {
+    plan_t *plan;
+    bool teardown;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int *ready;                         /* Ready stacks, one slice per kind */
+    int ready_base[OP_KIND_COUNT];      /* Start of each kind's slice */
+    int ready_len[OP_KIND_COUNT];       /* Ready operations per kind */
+    int ready_total;                    /* Ready operations of all kinds */
+    int active;                         /* Workers running a batch */
+    int failed;                         /* Operations that failed */
+    bool aborted;                       /* Stop scheduling new operations */
+} plan_exec_t;
+
+/* Per-thread state of a worker */
+typedef struct {
+    plan_exec_t *exec;
+    nl_sock_t host; /* Socket in the host namespace */
+    int home_fd;    /* Network namespace the worker returns to */
+} plan_worker_t;
+
+static void mark_failed(plan_node_t *node) {
+    if (node->status == 0) {
+        node->status = EIO;
+    }
+}
+
+static void run_bridges(plan_worker_t *w, plan_node_t **batch, int n) {
+    plan_t *plan = w->exec->plan;
+    for (int i = 0; i < n; i++) {
+        const bridge_t *br = &plan->config->bridges[batch[i]->index];
+        int queued = w->exec->teardown
+                         ? queue_link_delete(&w->host, br->name, br->name,
+                                             &batch[i]->status)
+                         : queue_bridge(&w->host, br, &batch[i]->status);
+        if (queued != 0) {
+            mark_failed(batch[i]);
+        }
+    }
+    nl_sync(&w->host);
+    if (w->exec->teardown) {
+        return;
+    }
+
+    // addresses and enslaving need the ifindex of the new links
+    for (int i = 0; i < n; i++) {
+        if (batch[i]->status != 0) {
+            continue;
+        }
+        const bridge_t *br = &plan->config->bridges[batch[i]->index];
+        int index = if_nametoindex(br->name);
+        plan->bridge_ifindex[batch[i]->index] = index;
+        if (index == 0) {
+            batch[i]->status = errno;
+        } else if (queue_bridge_address(&w->host, br, index,
+                                        &batch[i]->status) != 0) {
+            mark_failed(batch[i]);
+        }
+    }
+    nl_sync(&w->host);
+}
+
+static void run_namespaces(plan_worker_t *w, plan_node_t **batch, int n) {
+    plan_t *plan = w->exec->plan;
+    for (int i = 0; i < n; i++) {
+        const namespace_t *ns = &plan->config->namespaces[batch[i]->index];
+        if (w->exec->teardown) {
+            if (remove_namespace(ns->name) != 0) {
+                mark_failed(batch[i]);
+            }
+            continue;
+        }
+
+        int error = w->home_fd < 0 ? EBADF : create_namespace(ns, w->home_fd);
+        if (error == EEXIST) {
+            fprintf(stderr, "Network namespace %s already exists\n", ns->name);
+            error = 0;
+        } else if (error != 0) {
+            fprintf(stderr, "Cannot create network namespace %s: %s\n",
+                    ns->name, strerror(error));
+        }
+        batch[i]->status = error;
+    }
+}
+
+/* One queue per userspace forwarding thread, so each can own one */
+static uint32_t veth_queues(const config_t *config) {
+    return config->dataplane == DATAPLANE_AFXDP ? config->dataplane_workers
+                                                : 1;
+}
+
+static void run_veths(plan_worker_t *w, plan_node_t **batch, int n) {
+    plan_t *plan = w->exec->plan;
+    for (int i = 0; i < n; i++) {
+        const namespace_t *ns = &plan->config->namespaces[batch[i]->index];
+        int queued;
+        if (w->exec->teardown) {
+            // deleting the host end of a veth pair removes its peer as well
+            char host_ifname[IFNAMSIZ];
+            veth_host_ifname(ns, host_ifname);
+            queued = queue_link_delete(&w->host, host_ifname, ns->name,
+                                       &batch[i]->status);
+        } else {
+            queued = queue_veth(&w->host, ns, 0, veth_queues(plan->config),
+                                &batch[i]->status);
+        }
+        if (queued != 0) {
+            mark_failed(batch[i]);
+        }
+    }
+    nl_sync(&w->host);
+}
+
+static void run_enslaves(plan_worker_t *w, plan_node_t **batch, int n) {
+    plan_t *plan = w->exec->plan;
+    for (int i = 0; i < n; i++) {
+        int ns_index = batch[i]->index;
+        int master = plan->bridge_ifindex[plan->ns_bridge[ns_index]];
+        if (queue_enslave(&w->host, &plan->config->namespaces[ns_index],
+                          master, &batch[i]->status) != 0) {
+            mark_failed(batch[i]);
+        }
+    }
+    nl_sync(&w->host);
+}
+
+static void run_in_namespaces(plan_worker_t *w, plan_node_t **batch, int n) {
+    plan_t *plan = w->exec->plan;
+    nl_sock_t socks[PLAN_BATCH];
+
+    // queue on every namespace socket first, then collect all the ACKs
+    for (int i = 0; i < n; i++) {
+        const namespace_t *ns = &plan->config->namespaces[batch[i]->index];
+        socks[i].reqs = NULL;
+
+        int eth_index = 0;
+        if (open_ns_socket(ns, &socks[i], &eth_index) != 0) {
+            mark_failed(batch[i]);
+            continue;
+        }
+
+        int queued;
+        if (batch[i]->kind == OP_ADDRESS) {
+            queued = queue_ns_address(&socks[i], ns, eth_index,
+                                      &batch[i]->status) ||
+                     queue_host_gateway(&w->host, ns, &batch[i]->status);
+        } else {
+            queued =
+                queue_ns_route(&socks[i], ns, eth_index, &batch[i]->status);
+        }
+        if (queued != 0) {
+            mark_failed(batch[i]);
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (socks[i].reqs != NULL) {
+            nl_close(&socks[i]);
+        }
+    }
+    nl_sync(&w->host);
+}
+
+static void run_batch(plan_worker_t *w, op_kind_t kind, plan_node_t **batch,
+                      int n) {
+    bool teardown = w->exec->teardown;
+
+    switch (kind) {
+    case OP_FORWARDING:
+        if (!teardown &&
+            setup_ipv4_forwarding(w->exec->plan->config->ipv4_forwrd) != 0) {
+            mark_failed(batch[0]);
+        }
+        break;
+    case OP_BRIDGE:
+        run_bridges(w, batch, n);
+        break;
+    case OP_NAMESPACE:
+        run_namespaces(w, batch, n);
+        break;
+    case OP_VETH:
+        run_veths(w, batch, n);
+        break;
+    case OP_ENSLAVE:
+        if (!teardown) {
+            run_enslaves(w, batch, n);
+        }
+        break;
+    case OP_ADDRESS:
+    case OP_ROUTE:
+        // both disappear with the links they live on
+        if (!teardown) {
+            run_in_namespaces(w, batch, n);
+        }
+        break;
+    case OP_FIREWALL:
+        if ((teardown ? remove_firewall(w->exec->plan->config)
+                      : setup_firewall(w->exec->plan->config)) != 0) {
+            mark_failed(batch[0]);
+        }
+        break;
+    case OP_KIND_COUNT:
+        break;
+    }
+}
+
+/* Push an operation whose dependencies are done; called with the lock held */
+static void push_ready(plan_exec_t *exec, int id) {
+    op_kind_t kind = exec->plan->nodes[id].kind;
+    exec->ready[exec->ready_base[kind] + exec->ready_len[kind]++] = id;
+    exec->ready_total++;
+}
+
+/*
+ * Pick the kind to run next. Bring-up favours later kinds so namespaces are
+ * finished depth first; teardown favours earlier ones for the same reason.
+ */
+static int pick_kind(plan_exec_t *exec) {
+    for (int k = 0; k < OP_KIND_COUNT; k++) {
+        int kind = exec->teardown ? k : OP_KIND_COUNT - 1 - k;
+        if (exec->ready_len[kind] > 0) {
+            return kind;
+        }
+    }
+    return -1;
+}
+
+static void *plan_worker(void *arg) {
+    plan_worker_t *w = arg;
+    plan_exec_t *exec = w->exec;
+    plan_t *plan = exec->plan;
+    plan_node_t *batch[PLAN_BATCH];
+
+    pthread_mutex_lock(&exec->lock);
+    for (;;) {
+        while (exec->ready_total == 0 && exec->active > 0 && !exec->aborted) {
+            pthread_cond_wait(&exec->cond, &exec->lock);
+        }
+        if (exec->ready_total == 0 || exec->aborted) {
+            break; // finished, or nothing more will become ready
+        }
+
+        // take up to a batch of the same kind so requests share a sync
+        op_kind_t kind = pick_kind(exec);
+        int n = 0;
+        while (n < PLAN_BATCH && exec->ready_len[kind] > 0) {
+            int top = exec->ready_base[kind] + --exec->ready_len[kind];
+            int id = exec->ready[top];
+            batch[n++] = &plan->nodes[id];
+        }
+        exec->ready_total -= n;
+        exec->active++;
+        pthread_mutex_unlock(&exec->lock);
+
+        uint64_t start = trace_now();
+        run_batch(w, kind, batch, n);
+        uint64_t end = trace_now();
+        uint64_t busy = end - start;
+        if (trace_enabled) {
+            char ops[TRACE_OBJECT_MAX];
+            snprintf(ops, sizeof ops, "%d ops", n);
+            trace_record("plan", op_names[kind], ops, start, end);
+        }
+
+        pthread_mutex_lock(&exec->lock);
+        plan->busy_ns[kind] += busy;
+        exec->active--;
+        for (int i = 0; i < n; i++) {
+            plan_node_t *node = batch[i];
+            if (node->status != 0) {
+                exec->failed++;
+                // a teardown goes on and removes as much as it can
+                if (!exec->teardown) {
+                    exec->aborted = true;
+                    continue;
+                }
+            }
+
+            int first = exec->teardown ? node->pred_start : node->succ_start;
+            int count = exec->teardown ? node->pred_count : node->succ_count;
+            const int *next = exec->teardown ? plan->preds : plan->succs;
+            for (int e = 0; e < count; e++) {
+                plan_node_t *dep = &plan->nodes[next[first + e]];
+                if (!exec->teardown && dep->done) {
+                    continue;
+                }
+                if (--dep->pending == 0) {
+                    push_ready(exec, next[first + e]);
+                }
+            }
+        }
+        pthread_cond_broadcast(&exec->cond);
+    }
+    pthread_cond_broadcast(&exec->cond);
+    pthread_mutex_unlock(&exec->lock);
+    return NULL;
+}
+
+int plan_run(plan_t *plan, bool teardown) {
+    memset(plan->busy_ns, 0, sizeof plan->busy_ns);
+    if (plan->node_count == 0) {
+        return 0;
+    }
+
+    plan_exec_t exec = {.plan = plan, .teardown = teardown};
+    exec.ready = calloc(plan->node_count, sizeof *exec.ready);
+    if (exec.ready == NULL) {
+        return -1;
+    }
+    pthread_mutex_init(&exec.lock, NULL);
+    pthread_cond_init(&exec.cond, NULL);
+
+    int kind_count[OP_KIND_COUNT] = {0};
+    for (int n = 0; n < plan->node_count; n++) {
+        kind_count[plan->nodes[n].kind]++;
+    }
+    for (int k = 0, base = 0; k < OP_KIND_COUNT; k++) {
+        exec.ready_base[k] = base;
+        base += kind_count[k];
+    }
+
+    for (int n = 0; n < plan->node_count; n++) {
+        plan_node_t *node = &plan->nodes[n];
+        node->status = 0;
+        if (teardown) {
+            node->pending = node->succ_count;
+        } else if (node->done) {
+            continue;
+        } else {
+            // operations already in place never signal their dependents
+            node->pending = 0;
+            for (int p = 0; p < node->pred_count; p++) {
+                node->pending += !plan->nodes[plan->preds[node->pred_start + p]]
+                                      .done;
+            }
+        }
+        if (node->pending == 0) {
+            push_ready(&exec, n);
+        }
+    }
+    if (exec.ready_total == 0) {
+        // everything is in place already
+        free(exec.ready);
+        pthread_mutex_destroy(&exec.lock);
+        pthread_cond_destroy(&exec.cond);
+        return 0;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus > PLAN_MIN_WORKERS ? (int)cpus : PLAN_MIN_WORKERS;
+    if (workers > plan->node_count) {
+        workers = plan->node_count;
+    }
+
+    plan_worker_t *ctx = calloc(workers, sizeof *ctx);
+    pthread_t *threads = calloc(workers, sizeof *threads);
+    int started = 0;
+    for (int i = 0; ctx != NULL && threads != NULL && i < workers; i++) {
+        ctx[i].exec = &exec;
+        if (nl_open(&ctx[i].host, NL_WINDOW_DEFAULT) != 0) {
+            break;
+        }
+        ctx[i].home_fd = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+        if (pthread_create(&threads[started], NULL, plan_worker, &ctx[i]) !=
+            0) {
+            nl_close(&ctx[i].host);
+            if (ctx[i].home_fd >= 0) {
+                close(ctx[i].home_fd);
+            }
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        nl_close(&ctx[i].host);
+        if (ctx[i].home_fd >= 0) {
+            close(ctx[i].home_fd);
+        }
+    }
+
+    int status = 0;
+    if (started == 0) {
+        fprintf(stderr, "Cannot start plan workers\n");
+        status = -1;
+    } else if (exec.failed > 0) {
+        fprintf(stderr, "%d operation(s) failed%s\n", exec.failed,
+                exec.aborted ? ", bring-up aborted" : "");
+        status = -1;
+    }
+
+    free(threads);
+    free(ctx);
+    free(exec.ready);
+    pthread_mutex_destroy(&exec.lock);
+    pthread_cond_destroy(&exec.cond);
+    return status;
+}
@@ -0,0 +1,36 @@
+#define _GNU_SOURCE
+#include "rcu.h"
+
+#include <sched.h>
+
+void rcu_init(rcu_t *rcu) {
+    atomic_init(&rcu->epoch, 0);
+    for (int i = 0; i < RCU_MAX_READERS; i++) {
+        atomic_init(&rcu->seen[i], RCU_OFFLINE);
+    }
+    atomic_init(&rcu->readers, 0);
+}
+
+int rcu_register(rcu_t *rcu) {
+    int reader = atomic_fetch_add(&rcu->readers, 1);
+    if (reader >= RCU_MAX_READERS) {
+        atomic_fetch_sub(&rcu->readers, 1);
+        return -1;
+    }
+    return reader;
+}
+
+void rcu_synchronize(rcu_t *rcu) {
+    uint64_t epoch = atomic_fetch_add(&rcu->epoch, 1) + 1;
+    int readers = atomic_load(&rcu->readers);
+    for (int i = 0; i < readers && i < RCU_MAX_READERS; i++) {
+        // a reader between batches gets there within one batch
+        for (;;) {
+            uint64_t seen = atomic_load(&rcu->seen[i]);
+            if (seen >= epoch) { // RCU_OFFLINE is larger than any epoch
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
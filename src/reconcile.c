@@ -0,0 +1,707 @@
+#define _GNU_SOURCE
+#include "network.h"
+
+#include "plan.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_link.h>
+#include <net/if.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MANIFEST_DIR "/var/run/lvr"
+#define MANIFEST_PATH MANIFEST_DIR "/manifest"
+
+/* Parts of a namespace's setup found in place */
+enum {
+    LIVE_NAMESPACE = 1 << 0, /* Namespace is pinned */
+    LIVE_VETH = 1 << 1,      /* Both ends of the veth pair exist */
+    LIVE_ENSLAVE = 1 << 2,   /* Host end is attached to its bridge */
+    LIVE_ADDRESS = 1 << 3,   /* Links are up and addresses are right */
+    LIVE_ROUTE = 1 << 4,     /* Default route is right */
+};
+
+static const unsigned live_bit[OP_KIND_COUNT] = {
+    [OP_NAMESPACE] = LIVE_NAMESPACE, [OP_VETH] = LIVE_VETH,
+    [OP_ENSLAVE] = LIVE_ENSLAVE,     [OP_ADDRESS] = LIVE_ADDRESS,
+    [OP_ROUTE] = LIVE_ROUTE,
+};
+
+/* A link as reported by the kernel */
+typedef struct {
+    char name[IFNAMSIZ];
+    int index;
+    int master;     /* Bridge the link is attached to, 0 for none */
+    unsigned flags; /* IFF_* flags */
+    bool is_bridge;
+} live_link_t;
+
+/* An IPv4 address as reported by the kernel */
+typedef struct {
+    int index;
+    struct in_addr addr;
+    u_int8_t mask;
+} live_addr_t;
+
+/* Links, addresses and default route of one network namespace */
+typedef struct {
+    live_link_t *links; /* Sorted by name */
+    int link_count;
+    int link_cap;
+    live_addr_t *addrs; /* Sorted by interface index */
+    int addr_count;
+    int addr_cap;
+    bool has_default;       /* A default route exists in the main table */
+    struct in_addr gateway; /* Its gateway */
+    int gateway_oif;        /* Its outgoing interface */
+} live_t;
+
+/* Objects recorded by the last successful bring-up or apply */
+typedef struct {
+    char (*namespaces)[MAX_NAME_LEN];
+    int namespace_count;
+    int namespace_cap;
+    char (*bridges)[MAX_NAME_LEN];
+    int bridge_count;
+    int bridge_cap;
+    uint64_t ruleset_hash; /* Hash of the ruleset that was loaded */
+} manifest_t;
+
+static int grow(void **data, int *cap, int count, size_t size) {
+    if (count < *cap) {
+        return 0;
+    }
+    int new_cap = *cap ? *cap * 2 : 16;
+    void *grown = realloc(*data, new_cap * size);
+    if (grown == NULL) {
+        return -1;
+    }
+    *data = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+static uint64_t hash_ruleset(const char *ruleset) {
+    uint64_t hash = 14695981039346656037ull; // FNV-1a
+    for (const char *c = ruleset; *c; c++) {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static int on_link(const struct nlmsghdr *nlh, void *arg) {
+    live_t *live = arg;
+    if (nlh->nlmsg_type != RTM_NEWLINK) {
+        return 0;
+    }
+    if (grow((void **)&live->links, &live->link_cap, live->link_count,
+             sizeof *live->links) != 0) {
+        return -1;
+    }
+
+    const struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    live_link_t *link = &live->links[live->link_count++];
+    memset(link, 0, sizeof *link);
+    link->index = ifi->ifi_index;
+    link->flags = ifi->ifi_flags;
+
+    int len = IFLA_PAYLOAD(nlh);
+    for (const struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len);
+         rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFLA_IFNAME) {
+            snprintf(link->name, sizeof link->name, "%s",
+                     (const char *)RTA_DATA(rta));
+        } else if (rta->rta_type == IFLA_MASTER) {
+            link->master = *(const uint32_t *)RTA_DATA(rta);
+        } else if (rta->rta_type == IFLA_LINKINFO) {
+            int info_len = RTA_PAYLOAD(rta);
+            for (const struct rtattr *info = RTA_DATA(rta);
+                 RTA_OK(info, info_len); info = RTA_NEXT(info, info_len)) {
+                if (info->rta_type == IFLA_INFO_KIND) {
+                    link->is_bridge =
+                        strcmp((const char *)RTA_DATA(info), "bridge") == 0;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static int on_addr(const struct nlmsghdr *nlh, void *arg) {
+    live_t *live = arg;
+    const struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+    if (nlh->nlmsg_type != RTM_NEWADDR || ifa->ifa_family != AF_INET) {
+        return 0;
+    }
+    if (grow((void **)&live->addrs, &live->addr_cap, live->addr_count,
+             sizeof *live->addrs) != 0) {
+        return -1;
+    }
+
+    live_addr_t *addr = &live->addrs[live->addr_count++];
+    memset(addr, 0, sizeof *addr);
+    addr->index = ifa->ifa_index;
+    addr->mask = ifa->ifa_prefixlen;
+
+    // IFA_LOCAL is the address itself, IFA_ADDRESS the peer on p2p links
+    int len = IFA_PAYLOAD(nlh);
+    for (const struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, len);
+         rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFA_LOCAL ||
+            (rta->rta_type == IFA_ADDRESS && addr->addr.s_addr == 0)) {
+            memcpy(&addr->addr, RTA_DATA(rta), sizeof addr->addr);
+        }
+    }
+    return 0;
+}
+
+static int on_route(const struct nlmsghdr *nlh, void *arg) {
+    live_t *live = arg;
+    const struct rtmsg *rtm = NLMSG_DATA(nlh);
+    if (nlh->nlmsg_type != RTM_NEWROUTE || rtm->rtm_family != AF_INET ||
+        rtm->rtm_table != RT_TABLE_MAIN || rtm->rtm_dst_len != 0 ||
+        rtm->rtm_type != RTN_UNICAST) {
+        return 0;
+    }
+
+    live->has_default = true;
+    int len = RTM_PAYLOAD(nlh);
+    for (const struct rtattr *rta = RTM_RTA(rtm); RTA_OK(rta, len);
+         rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == RTA_GATEWAY) {
+            memcpy(&live->gateway, RTA_DATA(rta), sizeof live->gateway);
+        } else if (rta->rta_type == RTA_OIF) {
+            live->gateway_oif = *(const uint32_t *)RTA_DATA(rta);
+        }
+    }
+    return 0;
+}
+
+static int cmp_link_name(const void *a, const void *b) {
+    return strcmp(((const live_link_t *)a)->name,
+                  ((const live_link_t *)b)->name);
+}
+
+static int cmp_addr_index(const void *a, const void *b) {
+    return ((const live_addr_t *)a)->index - ((const live_addr_t *)b)->index;
+}
+
+/* Dump the links, addresses and default route of the socket's namespace */
+static int live_observe(nl_sock_t *nl, live_t *live) {
+    if (nl_dump(nl, RTM_GETLINK, AF_UNSPEC, on_link, live) != 0 ||
+        nl_dump(nl, RTM_GETADDR, AF_INET, on_addr, live) != 0 ||
+        nl_dump(nl, RTM_GETROUTE, AF_INET, on_route, live) != 0) {
+        return -1;
+    }
+    qsort(live->links, live->link_count, sizeof *live->links, cmp_link_name);
+    qsort(live->addrs, live->addr_count, sizeof *live->addrs, cmp_addr_index);
+    return 0;
+}
+
+static void live_free(live_t *live) {
+    free(live->links);
+    free(live->addrs);
+    memset(live, 0, sizeof *live);
+}
+
+static const live_link_t *find_link(const live_t *live, const char *name) {
+    live_link_t key;
+    snprintf(key.name, sizeof key.name, "%s", name);
+    return bsearch(&key, live->links, live->link_count, sizeof *live->links,
+                   cmp_link_name);
+}
+
+/*
+ * Queue removal of every address on a link except the wanted one (none if
+ * mask is 0), and tell whether the link ends up with the right addresses.
+ */
+static bool sync_addresses(nl_sock_t *nl, const live_t *live, int index,
+                           struct in_addr want, u_int8_t mask,
+                           const char *label) {
+    int lo = 0, hi = live->addr_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (live->addrs[mid].index < index) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    bool present = mask == 0;
+    for (int i = lo; i < live->addr_count && live->addrs[i].index == index;
+         i++) {
+        const live_addr_t *addr = &live->addrs[i];
+        if (mask != 0 && addr->addr.s_addr == want.s_addr &&
+            addr->mask == mask) {
+            present = true;
+        } else {
+            queue_address_delete(nl, index, addr->addr, addr->mask, label,
+                                 NULL);
+        }
+    }
+    return present;
+}
+
+static void manifest_free(manifest_t *manifest) {
+    free(manifest->namespaces);
+    free(manifest->bridges);
+    memset(manifest, 0, sizeof *manifest);
+}
+
+static int read_manifest(manifest_t *manifest) {
+    memset(manifest, 0, sizeof *manifest);
+    FILE *fp = fopen(MANIFEST_PATH, "r");
+    if (fp == NULL) {
+        // nothing was recorded, so nothing will be removed
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    char line[2 * MAX_NAME_LEN];
+    int status = 0;
+    while (status == 0 && fgets(line, sizeof line, fp) != NULL) {
+        char kind[16], name[MAX_NAME_LEN];
+        unsigned long long hash;
+        if (sscanf(line, "ruleset %llx", &hash) == 1) {
+            manifest->ruleset_hash = hash;
+        } else if (sscanf(line, "%15s %63s", kind, name) == 2) {
+            bool is_ns = strcmp(kind, "namespace") == 0;
+            char(**names)[MAX_NAME_LEN] =
+                is_ns ? &manifest->namespaces : &manifest->bridges;
+            int *count = is_ns ? &manifest->namespace_count
+                               : &manifest->bridge_count;
+            int *cap =
+                is_ns ? &manifest->namespace_cap : &manifest->bridge_cap;
+            if (grow((void **)names, cap, *count, sizeof **names) != 0) {
+                status = -1;
+                break;
+            }
+            memcpy((*names)[(*count)++], name, sizeof name);
+        }
+    }
+
+    fclose(fp);
+    if (status != 0) {
+        manifest_free(manifest);
+    }
+    return status;
+}
+
+int save_manifest(const config_t *config) {
+    char *ruleset = compile_ruleset(config);
+    if (ruleset == NULL) {
+        return -1;
+    }
+    uint64_t hash = hash_ruleset(ruleset);
+    free(ruleset);
+
+    if (mkdir(MANIFEST_DIR, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Cannot create %s: %s\n", MANIFEST_DIR,
+                strerror(errno));
+        return -1;
+    }
+    FILE *fp = fopen(MANIFEST_PATH ".tmp", "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot write %s: %s\n", MANIFEST_PATH,
+                strerror(errno));
+        return -1;
+    }
+
+    fprintf(fp, "ruleset %016llx\n", (unsigned long long)hash);
+    for (int i = 0; i < config->bridge_count; i++) {
+        fprintf(fp, "bridge %s\n", config->bridges[i].name);
+    }
+    // handed out addresses go along, so the next apply keeps them
+    for (int i = 0; i < config->namespace_count; i++) {
+        const namespace_t *ns = &config->namespaces[i];
+        if (ns->auto_ip) {
+            char ip_str[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &ns->ip_addr, ip_str, sizeof ip_str);
+            fprintf(fp, "namespace %s %s/%u\n", ns->name, ip_str, ns->mask);
+        } else {
+            fprintf(fp, "namespace %s\n", ns->name);
+        }
+    }
+
+    // replaced atomically, an interrupted write leaves the old one
+    if (fclose(fp) != 0 || rename(MANIFEST_PATH ".tmp", MANIFEST_PATH) != 0) {
+        fprintf(stderr, "Cannot write %s: %s\n", MANIFEST_PATH,
+                strerror(errno));
+        unlink(MANIFEST_PATH ".tmp");
+        return -1;
+    }
+    return 0;
+}
+
+void remove_manifest(void) { unlink(MANIFEST_PATH); }
+
+int load_manifest(config_t *previous) {
+    FILE *fp = fopen(MANIFEST_PATH, "r");
+    if (fp == NULL) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    char line[2 * MAX_NAME_LEN];
+    int status = 0;
+    while (status == 0 && fgets(line, sizeof line, fp) != NULL) {
+        char name[MAX_NAME_LEN], cidr[INET_ADDRSTRLEN + 4];
+        char decl[sizeof "namespace = " + MAX_NAME_LEN];
+        struct in_addr addr;
+        uint8_t mask;
+        if (sscanf(line, "namespace %63s %18s", name, cidr) != 2) {
+            continue; // not a namespace, or one with a written address
+        }
+        snprintf(decl, sizeof decl, "namespace = %s", name);
+        namespace_t *ns = NULL;
+        if (parse_cidr(cidr, &addr, &mask) != 0 ||
+            parse_config_line(decl, previous) != 0 ||
+            (ns = find_namespace_by_name(previous, name)) == NULL) {
+            fprintf(stderr, "Bad namespace %s in %s\n", name, MANIFEST_PATH);
+            status = -1;
+            break;
+        }
+        ns->ip_addr = addr;
+        ns->mask = mask;
+        ns->auto_ip = true;
+    }
+
+    fclose(fp);
+    return status;
+}
+
+/* Remove recorded namespaces and bridges the configuration no longer has */
+static int remove_stale(const config_t *config, const manifest_t *manifest,
+                        nl_sock_t *nl) {
+    bool *stale = calloc(manifest->namespace_count + 1, sizeof *stale);
+    if (stale == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < manifest->namespace_count; i++) {
+        const char *name = manifest->namespaces[i];
+        if (find_namespace_by_name(config, name) != NULL) {
+            continue;
+        }
+        stale[i] = true;
+        namespace_t ns = {.name = name};
+        char host_ifname[IFNAMSIZ];
+        veth_host_ifname(&ns, host_ifname);
+        queue_link_delete(nl, host_ifname, manifest->namespaces[i], NULL);
+    }
+    for (int j = 0; j < manifest->bridge_count; j++) {
+        const char *name = manifest->bridges[j];
+        if (find_bridge_by_name(config, name) == NULL) {
+            queue_link_delete(nl, name, manifest->bridges[j], NULL);
+        }
+    }
+
+    // links go first so nothing is left behind in a dying namespace
+    int status = nl_sync(nl);
+    for (int i = 0; i < manifest->namespace_count; i++) {
+        if (stale[i] && remove_namespace(manifest->namespaces[i]) != 0) {
+            status = -1;
+        }
+    }
+
+    free(stale);
+    return status;
+}
+
+/*
+ * Check the bridges against the host links. A bridge that exists gets its
+ * state and address fixed in place instead of being recreated.
+ */
+static void observe_bridges(plan_t *plan, const live_t *host, nl_sock_t *nl,
+                            bool *br_live) {
+    const config_t *config = plan->config;
+    for (int j = 0; j < config->bridge_count; j++) {
+        const bridge_t *br = &config->bridges[j];
+        const live_link_t *link = find_link(host, br->name);
+        if (link == NULL) {
+            continue;
+        }
+        if (!link->is_bridge) {
+            fprintf(stderr, "Link %s exists but is not a bridge\n", br->name);
+            continue;
+        }
+
+        plan->bridge_ifindex[j] = link->index;
+        if (!(link->flags & IFF_UP)) {
+            queue_link_up(nl, link->index, br->name, NULL);
+        }
+        if (!sync_addresses(nl, host, link->index, br->ip_addr, br->mask,
+                            br->name)) {
+            queue_bridge_address(nl, br, link->index, NULL);
+        }
+        br_live[j] = true;
+    }
+}
+
+static int cmp_ns_sock(const void *a, const void *b) {
+    return strcmp(((const ns_sock_t *)a)->name, ((const ns_sock_t *)b)->name);
+}
+
+/* Namespace sockets carried from one apply to the next */
+typedef struct {
+    apply_session_t *session;
+    bool *reused;   /* Per session socket, taken over by this apply */
+    ns_sock_t *ns;  /* Sockets kept for the next apply */
+    int ns_count;
+} ns_socks_t;
+
+/*
+ * Socket bound to a namespace: the one from the last apply if it is still
+ * the same namespace, else a new one. Either way it is kept for the next.
+ */
+static nl_sock_t *ns_socket(ns_socks_t *socks, const namespace_t *ns,
+                            ino_t ino) {
+    apply_session_t *session = socks->session;
+    ns_sock_t key;
+    snprintf(key.name, sizeof key.name, "%s", ns->name);
+    ns_sock_t *old = bsearch(&key, session->ns, session->ns_count,
+                             sizeof *session->ns, cmp_ns_sock);
+
+    ns_sock_t *sock = &socks->ns[socks->ns_count];
+    if (old != NULL && old->ino == ino && !socks->reused[old - session->ns]) {
+        socks->reused[old - session->ns] = true;
+        *sock = *old;
+    } else {
+        int eth_index;
+        if (open_ns_socket(ns, &sock->nl, &eth_index) != 0) {
+            return NULL;
+        }
+        memcpy(sock->name, key.name, sizeof sock->name);
+        sock->ino = ino;
+    }
+    socks->ns_count++;
+    return &sock->nl;
+}
+
+/* Check the links, address and route inside an existing namespace */
+static unsigned observe_inside(nl_sock_t *nl, const namespace_t *ns) {
+    unsigned found = 0;
+    live_t live = {0};
+    if (live_observe(nl, &live) == 0) {
+        const live_link_t *lo = find_link(&live, "lo");
+        const live_link_t *eth = find_link(&live, VETH_NS_IF_NAME);
+        if (eth == NULL) {
+            live_free(&live);
+            return 0; // the pair has to be recreated
+        }
+        found |= LIVE_VETH;
+
+        bool up = lo != NULL && (lo->flags & IFF_UP) && (eth->flags & IFF_UP);
+        if (sync_addresses(nl, &live, eth->index, ns->ip_addr, ns->mask,
+                           ns->name) &&
+            up) {
+            found |= LIVE_ADDRESS;
+        }
+
+        if (ns->gateway.s_addr == 0) {
+            if (live.has_default) {
+                queue_ns_route_delete(nl, ns, NULL);
+            }
+            found |= LIVE_ROUTE;
+        } else if (live.has_default &&
+                   live.gateway.s_addr == ns->gateway.s_addr &&
+                   live.gateway_oif == eth->index) {
+            found |= LIVE_ROUTE;
+        }
+    }
+
+    // stale addresses must be gone before the address is trusted
+    if (nl_sync(nl) != 0) {
+        found &= ~(LIVE_ADDRESS | LIVE_ROUTE);
+    }
+    live_free(&live);
+    return found;
+}
+
+static void observe_namespaces(plan_t *plan, const live_t *host,
+                               nl_sock_t *nl, ns_socks_t *socks,
+                               unsigned char *ns_live, const bool *br_live) {
+    const config_t *config = plan->config;
+    for (int i = 0; i < config->namespace_count; i++) {
+        const namespace_t *ns = &config->namespaces[i];
+        ino_t ino;
+        if (!namespace_exists(ns->name, &ino)) {
+            remove_namespace(ns->name); // clears a leftover mount point
+            continue;
+        }
+        unsigned found = LIVE_NAMESPACE;
+
+        char host_ifname[IFNAMSIZ];
+        veth_host_ifname(ns, host_ifname);
+        const live_link_t *veth = find_link(host, host_ifname);
+        if (veth == NULL) {
+            ns_live[i] = found;
+            continue;
+        }
+
+        nl_sock_t *ns_nl = ns_socket(socks, ns, ino);
+        if (ns_nl != NULL) {
+            found |= observe_inside(ns_nl, ns);
+        }
+        if (!(found & LIVE_VETH)) {
+            // half a pair, clear it out of the way of the new one
+            queue_link_delete(nl, host_ifname, ns->name, NULL);
+            ns_live[i] = found;
+            continue;
+        }
+
+        int bridge = plan->ns_bridge[i];
+        if (bridge >= 0) {
+            if (br_live[bridge] &&
+                veth->master == plan->bridge_ifindex[bridge]) {
+                found |= LIVE_ENSLAVE;
+            }
+        } else if (veth->master != 0) {
+            queue_enslave(nl, ns, 0, NULL); // used to go through a bridge
+        }
+        if (!(veth->flags & IFF_UP)) {
+            queue_link_up(nl, veth->index, ns->name, NULL);
+        }
+
+        // a veth namespace has its gateway on the host end of the pair
+        bool gateway = ns->connect_type == CONNECT_VETH &&
+                       ns->gateway.s_addr != 0;
+        if (!sync_addresses(nl, host, veth->index, ns->gateway,
+                            gateway ? ns->mask : 0, ns->name)) {
+            found &= ~LIVE_ADDRESS;
+        }
+        ns_live[i] = found;
+    }
+}
+
+/*
+ * Mark the operations whose result is in place. An operation is redone
+ * whenever something it builds on is, e.g. a recreated veth pair needs its
+ * addresses and route again and the firewall needs to see the new link.
+ */
+static int mark_done(plan_t *plan, const unsigned char *ns_live,
+                     const bool *br_live, bool forwarding, bool firewall) {
+    int todo = 0;
+    for (int n = 0; n < plan->node_count; n++) {
+        plan_node_t *node = &plan->nodes[n];
+        switch (node->kind) {
+        case OP_FORWARDING:
+            node->done = forwarding;
+            break;
+        case OP_BRIDGE:
+            node->done = br_live[node->index];
+            break;
+        case OP_FIREWALL:
+            node->done = firewall;
+            break;
+        default:
+            node->done = (ns_live[node->index] & live_bit[node->kind]) != 0;
+            break;
+        }
+        for (int p = 0; p < node->pred_count && node->done; p++) {
+            node->done = plan->nodes[plan->preds[node->pred_start + p]].done;
+        }
+        todo += !node->done;
+    }
+    return todo;
+}
+
+int apply_session_open(apply_session_t *session) {
+    memset(session, 0, sizeof *session);
+    return nl_open(&session->host, NL_WINDOW_DEFAULT);
+}
+
+void apply_session_close(apply_session_t *session) {
+    for (int i = 0; i < session->ns_count; i++) {
+        nl_close(&session->ns[i].nl);
+    }
+    free(session->ns);
+    nl_close(&session->host);
+    memset(session, 0, sizeof *session);
+}
+
+/* Keep the sockets this apply used, close those of vanished namespaces */
+static void keep_ns_sockets(apply_session_t *session, ns_socks_t *socks) {
+    for (int i = 0; i < session->ns_count; i++) {
+        if (!socks->reused[i]) {
+            nl_close(&session->ns[i].nl);
+        }
+    }
+    free(session->ns);
+    qsort(socks->ns, socks->ns_count, sizeof *socks->ns, cmp_ns_sock);
+    session->ns = socks->ns;
+    session->ns_count = socks->ns_count;
+    socks->ns = NULL;
+}
+
+int apply_session_run(apply_session_t *session, config_t *config) {
+    plan_t plan;
+    if (plan_build(config, &plan) != 0) {
+        return -1;
+    }
+
+    int status = -1;
+    nl_sock_t *nl = &session->host;
+    unsigned char *ns_live = calloc(config->namespace_count + 1, 1);
+    bool *br_live = calloc(config->bridge_count + 1, sizeof *br_live);
+    ns_socks_t socks = {
+        .session = session,
+        .reused = calloc(session->ns_count + 1, sizeof *socks.reused),
+        .ns = calloc(config->namespace_count + 1, sizeof *socks.ns),
+    };
+    manifest_t manifest = {0};
+    live_t host = {0};
+    if (ns_live == NULL || br_live == NULL || socks.reused == NULL ||
+        socks.ns == NULL || read_manifest(&manifest) != 0) {
+        goto out;
+    }
+
+    if (remove_stale(config, &manifest, nl) != 0 ||
+        live_observe(nl, &host) != 0) {
+        goto out;
+    }
+    observe_bridges(&plan, &host, nl, br_live);
+    observe_namespaces(&plan, &host, nl, &socks, ns_live, br_live);
+    keep_ns_sockets(session, &socks);
+    if (nl_sync(nl) != 0) {
+        goto out; // fixes in place failed, the observed state is stale
+    }
+
+    bool forwarding = ipv4_forwarding_enabled() == config->ipv4_forwrd;
+    char *ruleset = compile_ruleset(config);
+    bool firewall = ruleset != NULL &&
+                    hash_ruleset(ruleset) == manifest.ruleset_hash &&
+                    firewall_present();
+    free(ruleset);
+
+    int todo = mark_done(&plan, ns_live, br_live, forwarding, firewall);
+    printf("Apply: %d of %d operations to run\n", todo, plan.node_count);
+    status = plan_run(&plan, false);
+    if (status == 0) {
+        status = save_manifest(config);
+    }
+
+out:
+    free(socks.ns); // still empty unless handed over to the session
+    free(socks.reused);
+    live_free(&host);
+    manifest_free(&manifest);
+    free(ns_live);
+    free(br_live);
+    plan_free(&plan);
+    return status;
+}
+
+int network_apply(config_t *config) {
+    apply_session_t session;
+    if (apply_session_open(&session) != 0) {
+        return -1;
+    }
+    int status = apply_session_run(&session, config);
+    apply_session_close(&session);
+    return status;
+}
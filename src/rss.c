@@ -0,0 +1,44 @@
+#include "rss.h"
+
+const uint8_t rss_symmetric_key[RSS_KEY_SIZE] = {
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+};
+
+/* The 32 key bits starting at bit, counted from the top of byte 0 */
+static uint32_t key_window(const uint8_t *key, unsigned bit) {
+    uint64_t bits = 0;
+    for (unsigned i = 0; i < 5; i++) {
+        unsigned byte = bit / 8 + i;
+        bits = bits << 8 | (byte < RSS_KEY_SIZE ? key[byte] : 0);
+    }
+    return (uint32_t)(bits >> (8 - bit % 8));
+}
+
+void rss_init(rss_t *rss, const uint8_t key[RSS_KEY_SIZE]) {
+    for (unsigned pos = 0; pos < RSS_INPUT_MAX; pos++) {
+        uint32_t windows[8];
+        for (unsigned b = 0; b < 8; b++) {
+            windows[b] = key_window(key, pos * 8 + b);
+        }
+        for (unsigned value = 0; value < 256; value++) {
+            uint32_t hash = 0;
+            for (unsigned b = 0; b < 8; b++) {
+                if (value & (0x80u >> b)) {
+                    hash ^= windows[b];
+                }
+            }
+            rss->table[pos][value] = hash;
+        }
+    }
+}
+
+uint32_t rss_hash(const rss_t *rss, const uint8_t *input, size_t len) {
+    uint32_t hash = 0;
+    for (size_t i = 0; i < len && i < RSS_INPUT_MAX; i++) {
+        hash ^= rss->table[i][input[i]];
+    }
+    return hash;
+}
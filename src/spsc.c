@@ -0,0 +1,63 @@
+#include "spsc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int spsc_init(spsc_ring_t *ring, uint32_t size) {
+    memset(ring, 0, sizeof *ring);
+    if (size == 0 || (size & (size - 1)) != 0) {
+        fprintf(stderr, "Ring size %u is not a power of two\n", size);
+        return -1;
+    }
+    ring->slots = malloc(size * sizeof *ring->slots);
+    if (ring->slots == NULL) {
+        return -1;
+    }
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+void spsc_free(spsc_ring_t *ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+uint32_t spsc_push(spsc_ring_t *ring, const spsc_frame_t *frames, uint32_t n) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t size = ring->mask + 1;
+    if (size - (head - ring->cached_tail) < n) {
+        ring->cached_tail =
+            atomic_load_explicit(&ring->tail, memory_order_acquire);
+    }
+    uint32_t free = size - (head - ring->cached_tail);
+    if (n > free) {
+        n = free;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        ring->slots[(head + i) & ring->mask] = frames[i];
+    }
+    // the slots are written before the consumer can see them
+    atomic_store_explicit(&ring->head, head + n, memory_order_release);
+    return n;
+}
+
+uint32_t spsc_pop(spsc_ring_t *ring, spsc_frame_t *frames, uint32_t max) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (ring->cached_head - tail < max) {
+        ring->cached_head =
+            atomic_load_explicit(&ring->head, memory_order_acquire);
+    }
+    uint32_t n = ring->cached_head - tail;
+    if (n > max) {
+        n = max;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        frames[i] = ring->slots[(tail + i) & ring->mask];
+    }
+    // the slots are read before the producer can reuse them
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+    return n;
+}
@@ -0,0 +1,129 @@
+#include "tokenizer.h"
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <string.h>
+
+/* isspace() in the C locale, without the locale table lookup */
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+           c == '\f';
+}
+
+static strview_t view_trim(const char *start, const char *end) {
+    while (start < end && is_blank(*start)) {
+        start++;
+    }
+    while (end > start && is_blank(end[-1])) {
+        end--;
+    }
+    return (strview_t){start, end - start};
+}
+
+void tokenizer_init(tokenizer_t *tok, const char *data, size_t len) {
+    tok->pos = data;
+    tok->end = data + len;
+    tok->line = 0;
+}
+
+/* Split a key on dots; empty parts are skipped as strtok() would */
+static int split_key(strview_t key, config_token_t *token) {
+    const char *pos = key.data;
+    const char *end = key.data + key.len;
+    token->num_parts = 0;
+    while (pos < end) {
+        const char *dot = memchr(pos, '.', end - pos);
+        const char *stop = dot ? dot : end;
+        if (stop > pos) {
+            if (token->num_parts == TOKEN_MAX_KEY_PARTS) {
+                return -1; // too deep
+            }
+            token->key[token->num_parts++] = (strview_t){pos, stop - pos};
+        }
+        pos = stop + 1;
+    }
+    return token->num_parts > 0 ? 0 : -1;
+}
+
+int tokenizer_next(tokenizer_t *tok, config_token_t *token) {
+    while (tok->pos < tok->end) {
+        const char *start = tok->pos;
+        const char *newline = memchr(start, '\n', tok->end - start);
+        const char *stop = newline ? newline : tok->end;
+        tok->pos = newline ? newline + 1 : tok->end;
+        tok->line++;
+
+        // ignore comments and empty lines
+        strview_t line = view_trim(start, stop);
+        if (line.len == 0 || line.data[0] == '#') {
+            continue;
+        }
+
+        const char *line_end = line.data + line.len;
+        const char *eq = memchr(line.data, '=', line.len);
+        if (eq == NULL) {
+            return -1; // no value
+        }
+        // remove end of line comments
+        const char *comment = memchr(eq + 1, '#', line_end - (eq + 1));
+        token->value = view_trim(eq + 1, comment ? comment : line_end);
+        if (token->value.len == 0 ||
+            split_key(view_trim(line.data, eq), token) != 0) {
+            return -1;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+strview_t view_of(const char *s) { return (strview_t){s, strlen(s)}; }
+
+bool view_equals(strview_t view, const char *s) {
+    // the view may hold a NUL from the file, so s is never read past its end
+    return strlen(s) == view.len && memcmp(view.data, s, view.len) == 0;
+}
+
+int view_to_ipv4(strview_t view, struct in_addr *addr) {
+    const char *pos = view.data;
+    const char *end = view.data + view.len;
+    uint32_t ip = 0;
+    for (int octet = 0; octet < 4; octet++) {
+        if (octet > 0 && (pos == end || *pos++ != '.')) {
+            return -1;
+        }
+        const char *digits = pos;
+        unsigned value = 0;
+        while (pos < end && *pos >= '0' && *pos <= '9' && pos - digits < 3) {
+            value = value * 10 + (*pos++ - '0');
+        }
+        // like inet_pton(): one to three digits, no leading zeros
+        if (pos == digits || value > 255 ||
+            (*digits == '0' && pos > digits + 1)) {
+            return -1;
+        }
+        ip = ip << 8 | value;
+    }
+    if (pos != end) {
+        return -1;
+    }
+    addr->s_addr = htonl(ip);
+    return 0;
+}
+
+int view_to_u32(strview_t view, uint32_t *value) {
+    if (view.len == 0 || (view.data[0] == '0' && view.len > 1)) {
+        return -1;
+    }
+    uint64_t n = 0;
+    for (size_t i = 0; i < view.len; i++) {
+        if (view.data[i] < '0' || view.data[i] > '9') {
+            return -1;
+        }
+        n = n * 10 + (view.data[i] - '0');
+        if (n > UINT32_MAX) {
+            return -1;
+        }
+    }
+    *value = (uint32_t)n;
+    return 0;
+}
@@ -0,0 +1,207 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* One operation, a cache line each */
+typedef struct {
+    uint64_t begin;                /* Start, CLOCK_MONOTONIC ns */
+    uint64_t end;                  /* Finish, CLOCK_MONOTONIC ns */
+    const char *cat;               /* Category */
+    const char *name;              /* Operation */
+    char object[TRACE_OBJECT_MAX]; /* Object operated on, may be empty */
+} trace_event_t;
+
+/*
+ * The events of one thread. The owner is the only writer, so recording
+ * takes no lock; rings are linked into a list once and only freed by
+ * trace_stop(), which lets a thread exit before the trace is written.
+ */
+typedef struct trace_ring {
+    struct trace_ring *next;                 /* Ring of another thread */
+    int tid;                                 /* Thread number in the trace */
+    _Atomic uint64_t count;                  /* Events ever recorded */
+    trace_event_t events[TRACE_RING_EVENTS]; /* Most recent events */
+} trace_ring_t;
+
+bool trace_enabled = false;
+
+static _Atomic(trace_ring_t *) trace_rings;
+static atomic_int trace_threads;
+static atomic_uint trace_generation;
+static uint64_t trace_origin;
+
+/* A thread's ring is only valid for the trace it was created in */
+static _Thread_local trace_ring_t *thread_ring;
+static _Thread_local unsigned thread_generation;
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static trace_ring_t *ring_get(void) {
+    unsigned generation = atomic_load(&trace_generation);
+    if (thread_ring != NULL && thread_generation == generation) {
+        return thread_ring;
+    }
+
+    // calloc leaves the pages of a mostly idle ring untouched
+    trace_ring_t *ring = calloc(1, sizeof *ring);
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->tid = atomic_fetch_add(&trace_threads, 1) + 1;
+    ring->next = atomic_load(&trace_rings);
+    while (!atomic_compare_exchange_weak(&trace_rings, &ring->next, ring)) {
+    }
+    thread_ring = ring;
+    thread_generation = generation;
+    return ring;
+}
+
+void trace_record(const char *cat, const char *name, const char *object,
+                  uint64_t begin, uint64_t end) {
+    if (!trace_enabled) {
+        return;
+    }
+    trace_ring_t *ring = ring_get();
+    if (ring == NULL) {
+        return; // out of memory, tracing is best effort
+    }
+
+    uint64_t count = atomic_load_explicit(&ring->count, memory_order_relaxed);
+    trace_event_t *event = &ring->events[count % TRACE_RING_EVENTS];
+    event->begin = begin;
+    event->end = end;
+    event->cat = cat;
+    event->name = name;
+    if (object != NULL) {
+        strncpy(event->object, object, sizeof event->object - 1);
+        event->object[sizeof event->object - 1] = '\0';
+    } else {
+        event->object[0] = '\0';
+    }
+    atomic_store_explicit(&ring->count, count + 1, memory_order_release);
+}
+
+static void free_rings(void) {
+    trace_ring_t *ring = atomic_exchange(&trace_rings, NULL);
+    while (ring != NULL) {
+        trace_ring_t *next = ring->next;
+        free(ring);
+        ring = next;
+    }
+    atomic_store(&trace_threads, 0);
+    // rings still referenced by threads are never touched again
+    atomic_fetch_add(&trace_generation, 1);
+}
+
+int trace_start(void) {
+    if (trace_enabled) {
+        fprintf(stderr, "Tracing is already enabled\n");
+        return -1;
+    }
+    free_rings();
+    trace_origin = trace_now();
+    trace_enabled = true;
+    return 0;
+}
+
+void trace_stop(void) {
+    trace_enabled = false;
+    free_rings();
+}
+
+/* Nanoseconds since the trace started as microseconds, Chrome's unit */
+static void write_us(FILE *fp, uint64_t ns) {
+    fprintf(fp, "%" PRIu64 ".%03u", ns / 1000, (unsigned)(ns % 1000));
+}
+
+static void write_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s != '\0'; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void write_event(FILE *fp, const trace_event_t *event, int pid,
+                        int tid) {
+    uint64_t ts = event->begin > trace_origin ? event->begin - trace_origin
+                                              : 0;
+    uint64_t dur = event->end > event->begin ? event->end - event->begin : 0;
+
+    fprintf(fp, "{\"name\":");
+    write_string(fp, event->name);
+    fprintf(fp, ",\"cat\":");
+    write_string(fp, event->cat);
+    fprintf(fp, ",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":", pid, tid);
+    write_us(fp, ts);
+    fprintf(fp, ",\"dur\":");
+    write_us(fp, dur);
+    if (event->object[0] != '\0') {
+        fprintf(fp, ",\"args\":{\"object\":");
+        write_string(fp, event->object);
+        fputc('}', fp);
+    }
+    fputc('}', fp);
+}
+
+int trace_write(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot write trace %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int pid = getpid();
+    uint64_t dropped = 0;
+    bool first = true;
+    fprintf(fp, "{\"traceEvents\":[");
+    for (trace_ring_t *ring = atomic_load(&trace_rings); ring != NULL;
+         ring = ring->next) {
+        uint64_t count =
+            atomic_load_explicit(&ring->count, memory_order_acquire);
+        uint64_t oldest = 0;
+        if (count > TRACE_RING_EVENTS) {
+            oldest = count - TRACE_RING_EVENTS;
+            dropped += oldest;
+        }
+        for (uint64_t i = oldest; i < count; i++) {
+            fprintf(fp, first ? "\n" : ",\n");
+            write_event(fp, &ring->events[i % TRACE_RING_EVENTS], pid,
+                        ring->tid);
+            first = false;
+        }
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    bool failed = ferror(fp) != 0;
+    int status = 0;
+    if (fclose(fp) != 0 || failed) {
+        fprintf(stderr, "Cannot write trace %s\n", path);
+        status = -1;
+    }
+    if (dropped > 0) {
+        fprintf(stderr,
+                "Trace %s misses the %" PRIu64 " oldest events, rings hold "
+                "%u per thread\n",
+                path, dropped, TRACE_RING_EVENTS);
+    }
+    return status;
+}
@@ -0,0 +1,222 @@
+#include "validate.h"
+#include "network.h"
+
+#include <arpa/inet.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum { OWNER_NAMESPACE, OWNER_BRIDGE, OWNER_NAT } owner_t;
+
+/* An address range and the entry it comes from */
+typedef struct {
+    uint32_t first; /* Lowest address, host byte order */
+    uint32_t last;  /* Highest address, inclusive */
+    owner_t owner;  /* Kind of entry */
+    int index;      /* Position of the entry in its array */
+} span_t;
+
+typedef struct {
+    const config_t *config;
+    int problems;
+} report_t;
+
+static span_t make_span(struct in_addr addr, uint8_t mask, owner_t owner,
+                        int index) {
+    uint32_t host = ntohl(addr.s_addr);
+    uint32_t hostmask = mask >= 32 ? 0 : ~0u >> mask;
+    return (span_t){host & ~hostmask, host | hostmask, owner, index};
+}
+
+/* Ascending start, wider first, so an enclosing range precedes its parts */
+static int cmp_span(const void *a, const void *b) {
+    const span_t *sa = a, *sb = b;
+    if (sa->first != sb->first) {
+        return sa->first < sb->first ? -1 : 1;
+    }
+    return (sa->last < sb->last) - (sa->last > sb->last);
+}
+
+static void describe(const config_t *config, const span_t *span, char *buf,
+                     size_t size) {
+    switch (span->owner) {
+    case OWNER_NAMESPACE:
+        snprintf(buf, size, "namespace %s",
+                 config->namespaces[span->index].name);
+        break;
+    case OWNER_BRIDGE:
+        snprintf(buf, size, "bridge %s", config->bridges[span->index].name);
+        break;
+    case OWNER_NAT:
+        snprintf(buf, size, "NAT rule %d", span->index + 1);
+        break;
+    }
+}
+
+/* Print a problem unless enough have been printed already */
+static void problem(report_t *report, const char *fmt, ...) {
+    if (report->problems++ < VALIDATE_MAX_REPORTS) {
+        va_list ap;
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+    }
+}
+
+static void format_range(const span_t *span, char *buf, size_t size) {
+    struct in_addr first = {htonl(span->first)};
+    inet_ntop(AF_INET, &first, buf, INET_ADDRSTRLEN);
+    int bits = 32;
+    for (uint32_t width = span->last - span->first; width != 0; width >>= 1) {
+        bits--;
+    }
+    size_t len = strlen(buf);
+    snprintf(buf + len, size - len, "/%d", bits);
+}
+
+/*
+ * Sweep ranges sorted by start: a range overlaps an earlier one exactly
+ * when it starts before the furthest end seen so far.
+ */
+static void sweep_overlaps(report_t *report, span_t *spans, int count,
+                           const char *what) {
+    qsort(spans, count, sizeof *spans, cmp_span);
+    const span_t *reach = NULL;
+    for (int i = 0; i < count; i++) {
+        if (reach != NULL && spans[i].first <= reach->last) {
+            char a[MAX_NAME_LEN + 16], b[MAX_NAME_LEN + 16];
+            char ra[INET_ADDRSTRLEN + 4], rb[INET_ADDRSTRLEN + 4];
+            describe(report->config, &spans[i], a, sizeof a);
+            describe(report->config, reach, b, sizeof b);
+            format_range(&spans[i], ra, sizeof ra);
+            format_range(reach, rb, sizeof rb);
+            problem(report, "%s %s of %s overlaps %s of %s\n", what, ra, a, rb,
+                    b);
+        }
+        if (reach == NULL || spans[i].last > reach->last) {
+            reach = &spans[i];
+        }
+    }
+}
+
+/* Addresses are single-address ranges; equal neighbours once sorted clash */
+static void sweep_duplicates(report_t *report, span_t *spans, int count) {
+    qsort(spans, count, sizeof *spans, cmp_span);
+    for (int i = 1; i < count; i++) {
+        if (spans[i].first == spans[i - 1].first) {
+            char a[MAX_NAME_LEN + 16], b[MAX_NAME_LEN + 16];
+            char ip_str[INET_ADDRSTRLEN];
+            struct in_addr addr = {htonl(spans[i].first)};
+            inet_ntop(AF_INET, &addr, ip_str, sizeof ip_str);
+            describe(report->config, &spans[i - 1], a, sizeof a);
+            describe(report->config, &spans[i], b, sizeof b);
+            problem(report, "Address %s is used by both %s and %s\n", ip_str,
+                    a, b);
+        }
+    }
+}
+
+static bool in_span(const span_t *span, struct in_addr addr) {
+    uint32_t host = ntohl(addr.s_addr);
+    return host >= span->first && host <= span->last;
+}
+
+/* Gateways and bridges of each namespace, one at a time */
+static void check_namespaces(report_t *report) {
+    const config_t *config = report->config;
+    for (int i = 0; i < config->namespace_count; i++) {
+        const namespace_t *ns = &config->namespaces[i];
+        span_t subnet = make_span(ns->ip_addr, ns->mask, OWNER_NAMESPACE, i);
+        char ip_str[INET_ADDRSTRLEN];
+
+        if (ns->gateway.s_addr != 0 && ns->mask > 0 &&
+            !in_span(&subnet, ns->gateway)) {
+            inet_ntop(AF_INET, &ns->gateway, ip_str, sizeof ip_str);
+            problem(report,
+                    "Gateway %s of namespace %s is outside its subnet\n",
+                    ip_str, ns->name);
+        }
+
+        const char *br_name = ns_bridge_name(ns);
+        if (br_name == NULL) {
+            continue;
+        }
+        const bridge_t *br = find_bridge_by_name(config, br_name);
+        if (br == NULL) {
+            problem(report, "Namespace %s connects via bridge %s, which is "
+                            "not defined\n",
+                    ns->name, br_name);
+            continue;
+        }
+        span_t segment = make_span(br->ip_addr, br->mask, OWNER_BRIDGE, 0);
+        if (ns->ip_addr.s_addr != 0 && br->mask > 0 &&
+            !in_span(&segment, ns->ip_addr)) {
+            inet_ntop(AF_INET, &ns->ip_addr, ip_str, sizeof ip_str);
+            problem(report,
+                    "Address %s of namespace %s is outside the subnet of "
+                    "bridge %s\n",
+                    ip_str, ns->name, br->name);
+        }
+    }
+}
+
+int validate_config(const config_t *config) {
+    report_t report = {config, 0};
+    int max = config->namespace_count + config->bridge_count +
+              config->nat_rule_count;
+    span_t *spans = malloc((max + 1) * sizeof *spans);
+    if (spans == NULL) {
+        return -1;
+    }
+
+    check_namespaces(&report);
+
+    // every address given to an interface
+    int count = 0;
+    for (int j = 0; j < config->bridge_count; j++) {
+        const bridge_t *br = &config->bridges[j];
+        if (br->ip_addr.s_addr != 0) {
+            spans[count++] = make_span(br->ip_addr, 32, OWNER_BRIDGE, j);
+        }
+    }
+    for (int i = 0; i < config->namespace_count; i++) {
+        const namespace_t *ns = &config->namespaces[i];
+        if (ns->ip_addr.s_addr != 0) {
+            spans[count++] = make_span(ns->ip_addr, 32, OWNER_NAMESPACE, i);
+        }
+    }
+    sweep_duplicates(&report, spans, count);
+
+    // link subnets: each bridge, and each namespace on its own veth pair
+    count = 0;
+    for (int j = 0; j < config->bridge_count; j++) {
+        const bridge_t *br = &config->bridges[j];
+        if (br->mask > 0) {
+            spans[count++] = make_span(br->ip_addr, br->mask, OWNER_BRIDGE, j);
+        }
+    }
+    for (int i = 0; i < config->namespace_count; i++) {
+        const namespace_t *ns = &config->namespaces[i];
+        if (ns->connect_type == CONNECT_VETH && ns->mask > 0) {
+            spans[count++] =
+                make_span(ns->ip_addr, ns->mask, OWNER_NAMESPACE, i);
+        }
+    }
+    sweep_overlaps(&report, spans, count, "Subnet");
+
+    count = 0;
+    for (int r = 0; r < config->nat_rule_count; r++) {
+        const nat_rule_t *rule = &config->nat_rules[r];
+        spans[count++] = make_span(rule->network, rule->mask, OWNER_NAT, r);
+    }
+    sweep_overlaps(&report, spans, count, "NAT prefix");
+
+    free(spans);
+    if (report.problems > VALIDATE_MAX_REPORTS) {
+        fprintf(stderr, "... and %d more problems\n",
+                report.problems - VALIDATE_MAX_REPORTS);
+    }
+    return report.problems == 0 ? 0 : -1;
+}
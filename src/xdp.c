@@ -0,0 +1,522 @@
+#define _GNU_SOURCE
+#include "xdp.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define XDP_LOG_SIZE 65536 // Verifier log printed when a load fails
+#define XDP_MAX_INSNS 96   // Longest program built here
+
+/* Key of the steering trie: a prefix length and an IPv4 address */
+typedef struct {
+    uint32_t prefixlen; /* Bits of addr that must match */
+    uint32_t addr;      /* Network byte order */
+} trie_key_t;
+
+static int bpf(int cmd, union bpf_attr *attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof *attr);
+}
+
+static int map_create(uint32_t type, uint32_t key_size, uint32_t value_size,
+                      uint32_t max_entries, uint32_t flags) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.map_type = type;
+    attr.key_size = key_size;
+    attr.value_size = value_size;
+    attr.max_entries = max_entries;
+    attr.map_flags = flags;
+    return bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int map_update(int fd, const void *key, const void *value) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.map_fd = fd;
+    attr.key = (uintptr_t)key;
+    attr.value = (uintptr_t)value;
+    attr.flags = BPF_ANY;
+    return bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+int xdp_filter_open(xdp_filter_t *filter, uint32_t slots) {
+    filter->refs_fd = -1;
+    filter->refs = NULL;
+    filter->ref_count = 0;
+    filter->trie_fd = map_create(BPF_MAP_TYPE_LPM_TRIE, sizeof(trie_key_t),
+                                 sizeof(uint32_t), XDP_MAX_PREFIXES,
+                                 BPF_F_NO_PREALLOC);
+    if (filter->trie_fd < 0) {
+        fprintf(stderr, "Cannot create XDP prefix map: %s\n",
+                strerror(errno));
+        filter->xsks_fd = -1;
+        return -1;
+    }
+    filter->xsks_fd = map_create(BPF_MAP_TYPE_XSKMAP, sizeof(uint32_t),
+                                 sizeof(uint32_t), slots > 0 ? slots : 1, 0);
+    if (filter->xsks_fd < 0) {
+        fprintf(stderr, "Cannot create XDP socket map: %s\n",
+                strerror(errno));
+        xdp_filter_close(filter);
+        return -1;
+    }
+    return 0;
+}
+
+int xdp_filter_refs(xdp_filter_t *filter, uint32_t count) {
+    filter->refs_fd = map_create(BPF_MAP_TYPE_ARRAY, sizeof(uint32_t),
+                                 sizeof(uint64_t), count, BPF_F_MMAPABLE);
+    if (filter->refs_fd < 0) {
+        fprintf(stderr, "Cannot create XDP port map: %s\n", strerror(errno));
+        return -1;
+    }
+    void *refs = mmap(NULL, (size_t)count * sizeof(uint64_t),
+                      PROT_READ | PROT_WRITE, MAP_SHARED, filter->refs_fd, 0);
+    if (refs == MAP_FAILED) {
+        fprintf(stderr, "Cannot map XDP port map: %s\n", strerror(errno));
+        return -1;
+    }
+    filter->refs = refs;
+    filter->ref_count = count;
+    return 0;
+}
+
+int xdp_filter_add(xdp_filter_t *filter, struct in_addr network, uint8_t mask,
+                   uint32_t steer) {
+    trie_key_t key = {mask, network.s_addr};
+    uint32_t value = steer;
+    if (map_update(filter->trie_fd, &key, &value) != 0) {
+        char ip_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &network, ip_str, sizeof ip_str);
+        fprintf(stderr, "Cannot add %s/%u to the XDP prefix map: %s\n",
+                ip_str, mask, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int xdp_filter_bind(xdp_filter_t *filter, uint32_t slot, const xsk_t *xsk) {
+    uint32_t fd = xsk->fd;
+    if (map_update(filter->xsks_fd, &slot, &fd) != 0) {
+        fprintf(stderr, "Cannot add a socket to the XDP socket map: %s\n",
+                strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void xdp_filter_close(xdp_filter_t *filter) {
+    if (filter->trie_fd >= 0) {
+        close(filter->trie_fd);
+    }
+    if (filter->xsks_fd >= 0) {
+        close(filter->xsks_fd);
+    }
+    if (filter->refs != NULL) {
+        munmap((void *)filter->refs, filter->ref_count * sizeof(uint64_t));
+    }
+    if (filter->refs_fd >= 0) {
+        close(filter->refs_fd);
+    }
+    filter->trie_fd = filter->xsks_fd = filter->refs_fd = -1;
+    filter->refs = NULL;
+    filter->ref_count = 0;
+}
+
+#define INSN(op, dst, src, offset, value)                                      \
+    ((struct bpf_insn){.code = (op),                                           \
+                       .dst_reg = (dst),                                       \
+                       .src_reg = (src),                                       \
+                       .off = (offset),                                        \
+                       .imm = (value)})
+
+/* Places jumps of the programs below can go to */
+enum { LABEL_PASS, LABEL_REDIRECT, LABEL_PORTS, LABEL_RANGE, LABEL_COUNT };
+
+/* A program built front to back; jump offsets are filled in at the end */
+typedef struct {
+    struct bpf_insn insns[XDP_MAX_INSNS];
+    int jumps[XDP_MAX_INSNS]; /* Label each instruction jumps to, or -1 */
+    int labels[LABEL_COUNT];  /* Instruction each label is at */
+    int count;                /* Instructions emitted, may pass the end */
+} asm_t;
+
+static void emit(asm_t *a, struct bpf_insn insn) {
+    if (a->count < XDP_MAX_INSNS) {
+        a->insns[a->count] = insn;
+        a->jumps[a->count] = -1;
+    }
+    a->count++;
+}
+
+static void emit_jump(asm_t *a, struct bpf_insn insn, int label) {
+    emit(a, insn);
+    if (a->count <= XDP_MAX_INSNS) {
+        a->jumps[a->count - 1] = label;
+    }
+}
+
+static void emit_map_fd(asm_t *a, int reg, int fd) {
+    emit(a, INSN(BPF_LD | BPF_DW | BPF_IMM, reg, BPF_PSEUDO_MAP_FD, 0, fd));
+    emit(a, INSN(0, 0, 0, 0, 0));
+}
+
+static void mark(asm_t *a, int label) {
+    a->labels[label] = a->count;
+}
+
+/*
+ * Redirect to the socket of the receive queue, or pass when the queue has
+ * none or its slot is empty; then pass. Expects ctx in r6.
+ */
+static void emit_tail(asm_t *a, const xdp_filter_t *filter,
+                      uint32_t first_slot, uint32_t queues) {
+    mark(a, LABEL_REDIRECT);
+    emit(a, INSN(BPF_LDX | BPF_W | BPF_MEM, 2, 6,
+                 offsetof(struct xdp_md, rx_queue_index), 0));
+    emit_jump(a, INSN(BPF_JMP | BPF_JGE | BPF_K, 2, 0, 0, queues),
+              LABEL_PASS);
+    emit(a, INSN(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, first_slot));
+    emit_map_fd(a, 1, filter->xsks_fd);
+    emit(a, INSN(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS));
+    emit(a, INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+    emit(a, INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+    mark(a, LABEL_PASS);
+    emit(a, INSN(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS));
+    emit(a, INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+}
+
+static int load_program(asm_t *a) {
+    if (a->count > XDP_MAX_INSNS) {
+        fprintf(stderr, "XDP program of %d instructions is too long\n",
+                a->count);
+        return -1;
+    }
+    for (int i = 0; i < a->count; i++) {
+        if (a->jumps[i] >= 0) {
+            a->insns[i].off = a->labels[a->jumps[i]] - i - 1;
+        }
+    }
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uintptr_t)a->insns;
+    attr.insn_cnt = a->count;
+    attr.license = (uintptr_t) "GPL";
+    int fd = bpf(BPF_PROG_LOAD, &attr);
+    if (fd >= 0) {
+        return fd;
+    }
+
+    // load again with the verifier log to show why
+    int error = errno;
+    char *log = malloc(XDP_LOG_SIZE);
+    if (log != NULL) {
+        log[0] = '\0';
+        attr.log_buf = (uintptr_t)log;
+        attr.log_size = XDP_LOG_SIZE;
+        attr.log_level = 1;
+        bpf(BPF_PROG_LOAD, &attr);
+    }
+    fprintf(stderr, "Cannot load XDP program: %s\n%s", strerror(error),
+            log != NULL ? log : "");
+    free(log);
+    return -1;
+}
+
+int xdp_filter_load(const xdp_filter_t *filter, uint32_t first_slot,
+                    uint32_t queues, bool nat) {
+    asm_t a = {.count = 0};
+    // r6 = ctx; r2 = data; r3 = data_end
+    emit(&a, INSN(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0));
+    emit(&a, INSN(BPF_LDX | BPF_W | BPF_MEM, 2, 1, 0, 0));
+    emit(&a, INSN(BPF_LDX | BPF_W | BPF_MEM, 3, 1, 4, 0));
+    // Ethernet and IPv4 headers up to the destination must be there
+    emit(&a, INSN(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0));
+    emit(&a, INSN(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, ETH_HLEN + 20));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 0, 0), LABEL_PASS);
+    emit(&a, INSN(BPF_LDX | BPF_H | BPF_MEM, 5, 2, 12, 0));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 0, htons(ETH_P_IP)),
+              LABEL_PASS);
+    // r7 = protocol, kept across the call
+    emit(&a, INSN(BPF_LDX | BPF_B | BPF_MEM, 7, 2, ETH_HLEN + 9, 0));
+    // key = {32, daddr} on the stack
+    emit(&a, INSN(BPF_LDX | BPF_W | BPF_MEM, 5, 2, ETH_HLEN + 16, 0));
+    emit(&a, INSN(BPF_STX | BPF_W | BPF_MEM, 10, 5, -4, 0));
+    emit(&a, INSN(BPF_ST | BPF_W | BPF_MEM, 10, 0, -8, 32));
+    emit_map_fd(&a, 1, filter->trie_fd);
+    emit(&a, INSN(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0));
+    emit(&a, INSN(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -8));
+    emit(&a, INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 0, 0), LABEL_PASS);
+    emit(&a, INSN(BPF_LDX | BPF_W | BPF_MEM, 0, 0, 0, 0));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 0, XDP_STEER_REDIRECT),
+              LABEL_REDIRECT);
+    if (nat) {
+        // only what the NAT can translate goes to the uplink this way
+        emit_jump(&a, INSN(BPF_JMP | BPF_JNE | BPF_K, 0, 0, 0, XDP_STEER_NAT),
+                  LABEL_PASS);
+        emit_jump(&a, INSN(BPF_JMP | BPF_JEQ | BPF_K, 7, 0, 0, IPPROTO_TCP),
+                  LABEL_REDIRECT);
+        emit_jump(&a, INSN(BPF_JMP | BPF_JEQ | BPF_K, 7, 0, 0, IPPROTO_UDP),
+                  LABEL_REDIRECT);
+        emit_jump(&a, INSN(BPF_JMP | BPF_JEQ | BPF_K, 7, 0, 0, IPPROTO_ICMP),
+                  LABEL_REDIRECT);
+    }
+    emit_jump(&a, INSN(BPF_JMP | BPF_JA, 0, 0, 0, 0), LABEL_PASS);
+    emit_tail(&a, filter, first_slot, queues);
+    return load_program(&a);
+}
+
+int xdp_uplink_load(const xdp_filter_t *filter, uint32_t first_slot,
+                    uint32_t queues, struct in_addr addr, uint16_t lo,
+                    uint16_t hi) {
+    enum { L4 = ETH_HLEN + 20 }; // translated packets have no IP options
+    asm_t a = {.count = 0};
+    // r6 = ctx; r2 = data; r3 = data_end
+    emit(&a, INSN(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0));
+    emit(&a, INSN(BPF_LDX | BPF_W | BPF_MEM, 2, 1, 0, 0));
+    emit(&a, INSN(BPF_LDX | BPF_W | BPF_MEM, 3, 1, 4, 0));
+    // Ethernet, IPv4 and the first 8 bytes of L4 must be there
+    emit(&a, INSN(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0));
+    emit(&a, INSN(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, L4 + 8));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 0, 0), LABEL_PASS);
+    emit(&a, INSN(BPF_LDX | BPF_H | BPF_MEM, 5, 2, 12, 0));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 0, htons(ETH_P_IP)),
+              LABEL_PASS);
+    // IPv4 without options, unfragmented, to the NAT address
+    emit(&a, INSN(BPF_LDX | BPF_B | BPF_MEM, 5, 2, ETH_HLEN, 0));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 0, 0x45), LABEL_PASS);
+    emit(&a, INSN(BPF_LDX | BPF_H | BPF_MEM, 5, 2, ETH_HLEN + 6, 0));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JSET | BPF_K, 5, 0, 0, htons(0x3fff)),
+              LABEL_PASS);
+    emit(&a, INSN(BPF_LDX | BPF_W | BPF_MEM, 5, 2, ETH_HLEN + 16, 0));
+    emit_jump(&a, INSN(BPF_JMP32 | BPF_JNE | BPF_K, 5, 0, 0, addr.s_addr),
+              LABEL_PASS);
+    // r5 = destination port, or identifier of an echo reply; r7 = counter
+    // of the protocol, kept across the call
+    emit(&a, INSN(BPF_LDX | BPF_B | BPF_MEM, 5, 2, ETH_HLEN + 9, 0));
+    emit(&a, INSN(BPF_ALU64 | BPF_MOV | BPF_K, 7, 0, 0, 0));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JEQ | BPF_K, 5, 0, 0, IPPROTO_TCP),
+              LABEL_PORTS);
+    emit(&a, INSN(BPF_ALU64 | BPF_MOV | BPF_K, 7, 0, 0, 1));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JEQ | BPF_K, 5, 0, 0, IPPROTO_UDP),
+              LABEL_PORTS);
+    emit(&a, INSN(BPF_ALU64 | BPF_MOV | BPF_K, 7, 0, 0, 2));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 0, IPPROTO_ICMP),
+              LABEL_PASS);
+    emit(&a, INSN(BPF_LDX | BPF_B | BPF_MEM, 5, 2, L4, 0));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, 0, 0), LABEL_PASS);
+    emit(&a, INSN(BPF_LDX | BPF_H | BPF_MEM, 5, 2, L4 + 4, 0));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JA, 0, 0, 0, 0), LABEL_RANGE);
+    mark(&a, LABEL_PORTS);
+    emit(&a, INSN(BPF_LDX | BPF_H | BPF_MEM, 5, 2, L4 + 2, 0));
+    // in the range of the NAT, in host byte order
+    mark(&a, LABEL_RANGE);
+    emit(&a, INSN(BPF_ALU | BPF_END | BPF_TO_BE, 5, 0, 0, 16));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JLT | BPF_K, 5, 0, 0, lo), LABEL_PASS);
+    emit_jump(&a, INSN(BPF_JMP | BPF_JGT | BPF_K, 5, 0, 0, hi), LABEL_PASS);
+    // a port no flow uses is the kernel's
+    emit(&a, INSN(BPF_ALU64 | BPF_SUB | BPF_K, 5, 0, 0, lo));
+    emit(&a, INSN(BPF_ALU64 | BPF_LSH | BPF_K, 5, 0, 0, 2));
+    emit(&a, INSN(BPF_ALU64 | BPF_ADD | BPF_X, 5, 7, 0, 0));
+    emit(&a, INSN(BPF_STX | BPF_W | BPF_MEM, 10, 5, -4, 0));
+    emit_map_fd(&a, 1, filter->refs_fd);
+    emit(&a, INSN(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0));
+    emit(&a, INSN(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -4));
+    emit(&a, INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 0, 0), LABEL_PASS);
+    emit(&a, INSN(BPF_LDX | BPF_DW | BPF_MEM, 0, 0, 0, 0));
+    emit_jump(&a, INSN(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 0, 0), LABEL_PASS);
+    emit_tail(&a, filter, first_slot, queues);
+    return load_program(&a);
+}
+
+int queue_xdp_attach(nl_sock_t *nl, int ifindex, int prog_fd, uint32_t flags,
+                     const char *label, int *result) {
+    struct nlmsghdr *nlh = nl_msg_begin(nl, RTM_SETLINK, 0, label);
+    if (nlh == NULL) {
+        return -1;
+    }
+    nl_msg_req(nl)->result = result;
+    if (prog_fd < 0) {
+        nl_msg_req(nl)->ignore_errno = ENODEV; // the device is gone anyway
+    }
+    nl_put_ifinfo(nlh, ifindex, 0, 0);
+    struct rtattr *xdp = nl_nest_begin(nlh, IFLA_XDP);
+    nl_attr_u32(nlh, IFLA_XDP_FD, (uint32_t)prog_fd);
+    nl_attr_u32(nlh, IFLA_XDP_FLAGS, flags);
+    nl_nest_end(nlh, xdp);
+    nl_msg_end(nl);
+    return 0;
+}
+
+void xdp_umem_init(xdp_umem_t *umem, void *area, uint32_t frames) {
+    umem->area = area;
+    umem->size = (size_t)frames * XDP_FRAME_SIZE;
+    umem->frames = frames;
+    umem->owner_fd = -1;
+}
+
+static int map_ring(xdp_ring_t *ring, int fd, const struct xdp_ring_offset *off,
+                    size_t desc_size, off_t pgoff) {
+    ring->map_size = off->desc + XDP_RING_SIZE * desc_size;
+    ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        return -1;
+    }
+    char *base = ring->map;
+    ring->producer = (uint32_t *)(base + off->producer);
+    ring->consumer = (uint32_t *)(base + off->consumer);
+    ring->flags = (uint32_t *)(base + off->flags);
+    ring->descs = base + off->desc;
+    ring->mask = XDP_RING_SIZE - 1;
+    ring->cached_prod = __atomic_load_n(ring->producer, __ATOMIC_ACQUIRE);
+    ring->cached_cons = __atomic_load_n(ring->consumer, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+static void unmap_ring(xdp_ring_t *ring) {
+    if (ring->map != NULL) {
+        munmap(ring->map, ring->map_size);
+    }
+    ring->map = NULL;
+}
+
+int xsk_open(xsk_t *xsk, xdp_umem_t *umem, int ifindex, uint32_t queue) {
+    memset(xsk, 0, sizeof *xsk);
+    xsk->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (xsk->fd < 0) {
+        return errno;
+    }
+
+    bool owner = umem->owner_fd < 0;
+    if (owner) {
+        struct xdp_umem_reg reg = {
+            .addr = (uintptr_t)umem->area,
+            .len = umem->size,
+            .chunk_size = XDP_FRAME_SIZE,
+        };
+        if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof reg)) {
+            goto fail;
+        }
+    }
+    // every device needs its own fill and completion rings
+    int size = XDP_RING_SIZE;
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof size) ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size,
+                   sizeof size) ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_RX_RING, &size, sizeof size) ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_TX_RING, &size, sizeof size)) {
+        goto fail;
+    }
+
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof off;
+    if (getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) ||
+        map_ring(&xsk->rx, xsk->fd, &off.rx, sizeof(struct xdp_desc),
+                 XDP_PGOFF_RX_RING) ||
+        map_ring(&xsk->tx, xsk->fd, &off.tx, sizeof(struct xdp_desc),
+                 XDP_PGOFF_TX_RING) ||
+        map_ring(&xsk->fill, xsk->fd, &off.fr, sizeof(uint64_t),
+                 XDP_UMEM_PGOFF_FILL_RING) ||
+        map_ring(&xsk->comp, xsk->fd, &off.cr, sizeof(uint64_t),
+                 XDP_UMEM_PGOFF_COMPLETION_RING)) {
+        goto fail;
+    }
+
+    // sockets sharing the UMEM inherit its mode and may not set flags
+    struct sockaddr_xdp addr = {
+        .sxdp_family = AF_XDP,
+        .sxdp_ifindex = ifindex,
+        .sxdp_queue_id = queue,
+    };
+    if (owner) {
+        addr.sxdp_flags = (umem->zerocopy ? XDP_ZEROCOPY : XDP_COPY) |
+                          XDP_USE_NEED_WAKEUP;
+    } else {
+        addr.sxdp_flags = XDP_SHARED_UMEM;
+        addr.sxdp_shared_umem_fd = umem->owner_fd;
+    }
+    if (bind(xsk->fd, (struct sockaddr *)&addr, sizeof addr) != 0) {
+        goto fail;
+    }
+    if (owner) {
+        umem->owner_fd = xsk->fd;
+    }
+    return 0;
+
+fail:;
+    int error = errno;
+    xsk_close(xsk);
+    return error;
+}
+
+void xsk_close(xsk_t *xsk) {
+    unmap_ring(&xsk->rx);
+    unmap_ring(&xsk->tx);
+    unmap_ring(&xsk->fill);
+    unmap_ring(&xsk->comp);
+    if (xsk->fd >= 0) {
+        close(xsk->fd);
+    }
+    xsk->fd = -1;
+}
+
+uint32_t xdp_ring_peek(xdp_ring_t *ring, uint32_t max, uint32_t *idx) {
+    uint32_t entries = ring->cached_prod - ring->cached_cons;
+    if (entries < max) {
+        ring->cached_prod = __atomic_load_n(ring->producer, __ATOMIC_ACQUIRE);
+        entries = ring->cached_prod - ring->cached_cons;
+    }
+    *idx = ring->cached_cons;
+    return entries < max ? entries : max;
+}
+
+void xdp_ring_release(xdp_ring_t *ring, uint32_t n) {
+    ring->cached_cons += n;
+    __atomic_store_n(ring->consumer, ring->cached_cons, __ATOMIC_RELEASE);
+}
+
+uint32_t xdp_ring_reserve(xdp_ring_t *ring, uint32_t max, uint32_t *idx) {
+    uint32_t size = ring->mask + 1;
+    uint32_t free = size - (ring->cached_prod - ring->cached_cons);
+    if (free < max) {
+        ring->cached_cons = __atomic_load_n(ring->consumer, __ATOMIC_ACQUIRE);
+        free = size - (ring->cached_prod - ring->cached_cons);
+    }
+    uint32_t n = free < max ? free : max;
+    *idx = ring->cached_prod;
+    ring->cached_prod += n;
+    return n;
+}
+
+void xdp_ring_submit(xdp_ring_t *ring) {
+    __atomic_store_n(ring->producer, ring->cached_prod, __ATOMIC_RELEASE);
+}
+
+bool xdp_ring_needs_wakeup(const xdp_ring_t *ring) {
+    return __atomic_load_n(ring->flags, __ATOMIC_RELAXED) &
+           XDP_RING_NEED_WAKEUP;
+}
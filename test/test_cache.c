@@ -0,0 +1,208 @@
+#define _GNU_SOURCE
+#include "cache.h"
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(condition, message)                                        \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            printf("ASSERTION FAILED: %s\n", message);                         \
+            printf("  In file: %s, line: %d\n", __FILE__, __LINE__);           \
+            exit(EXIT_FAILURE);                                                \
+        }                                                                      \
+    } while (0)
+
+static const char *topology = "enable_ipv4_forwarding = true\n"
+                              "nat_outgoing_interface = ens160\n"
+                              "flow_offload = true\n"
+                              "dataplane = afxdp\n"
+                              "namespace = private1\n"
+                              "namespace.private1.ip = 192.168.100.2/24\n"
+                              "namespace.private1.connect_via = bridge:br0\n"
+                              "namespace = private2\n"
+                              "namespace.private2.ip = 192.168.101.2/24\n"
+                              "namespace.private2.connect_via = veth\n"
+                              "bridge = br0\n"
+                              "bridge.br0.ip = 192.168.100.1/24\n"
+                              "firewall_forward_default = DROP\n"
+                              "firewall_allow_forward = private1 -> INTERNET\n"
+                              "firewall_allow_forward = private1 -> private2\n"
+                              "enable_nat = 192.168.100.0/24\n";
+
+static void write_file(const char *path, const char *text) {
+    FILE *fp = fopen(path, "w");
+    TEST_ASSERT(fp != NULL, "Test file should be writable");
+    fputs(text, fp);
+    fclose(fp);
+}
+
+void test_config_cache() {
+    printf("Testing compile_config() and load_config_cache()...\n");
+
+    char filename[] = "/tmp/test_cache_XXXXXX";
+    int fd = mkstemp(filename);
+    TEST_ASSERT(fd >= 0, "Temporary file should be created");
+    close(fd);
+    write_file(filename, topology);
+    char *path = cache_path(filename);
+    TEST_ASSERT(path != NULL, "Cache path should be built");
+
+    config_t parsed;
+    init_config(&parsed);
+    TEST_ASSERT(parse_config_file(filename, &parsed) == 0,
+                "Test configuration should parse");
+
+    // Test case 1: No cache before compiling
+    {
+        config_t config;
+        init_config(&config);
+        TEST_ASSERT(load_config_cache(filename, &config) != 0,
+                    "Loading should fail without a compiled cache");
+        free_config(&config);
+    }
+
+    // Test case 2: The loaded configuration matches the parsed one
+    {
+        TEST_ASSERT(compile_config(filename, &parsed) == 0,
+                    "Configuration should compile");
+
+        config_t config;
+        init_config(&config);
+        TEST_ASSERT(load_config_cache(filename, &config) == 0,
+                    "Fresh cache should load");
+        TEST_ASSERT(config.cache != NULL, "Config should keep the mapping");
+        TEST_ASSERT(config.ipv4_forwrd && config.flow_offload &&
+                        config.dataplane == DATAPLANE_AFXDP,
+                    "Flags should round-trip");
+        TEST_ASSERT(strcmp(config.nat_outgoing_interface, "ens160") == 0,
+                    "NAT interface should round-trip");
+        TEST_ASSERT(config.namespace_count == 2 && config.bridge_count == 1,
+                    "Counts should round-trip");
+        TEST_ASSERT(strcmp(config.namespaces[0].connect_name, "bridge:br0") ==
+                        0,
+                    "Names should be read from the string table");
+        TEST_ASSERT(config.namespaces[1].connect_type == CONNECT_VETH,
+                    "Connection type should round-trip");
+        TEST_ASSERT(config.namespaces[1].ip_addr.s_addr ==
+                        parsed.namespaces[1].ip_addr.s_addr,
+                    "Addresses should round-trip");
+        TEST_ASSERT(config.fw_rule_count == 2 &&
+                        config.fw_rules[1].dst_ns == 1,
+                    "Firewall rules should round-trip");
+        TEST_ASSERT(config.nat_rule_count == 1 &&
+                        config.nat_rules[0].mask == 24,
+                    "NAT rules should round-trip");
+        TEST_ASSERT(find_namespace_by_name(&config, "private2") ==
+                        &config.namespaces[1],
+                    "Name index should work from the cache");
+        TEST_ASSERT(find_bridge_by_name(&config, "br0") == &config.bridges[0],
+                    "Bridge index should work from the cache");
+
+        // lines parsed on top of a loaded cache extend it
+        char line[] = "namespace = private3";
+        TEST_ASSERT(parse_config_line(line, &config) == 0 &&
+                        find_namespace_by_name(&config, "private3") ==
+                            &config.namespaces[2],
+                    "Loaded configuration should accept new entries");
+
+        free_config(&config);
+        TEST_ASSERT(config.cache == NULL, "Freeing should unmap the cache");
+    }
+
+    // Test case 3: An edited file makes the cache stale
+    {
+        write_file(filename, "namespace = other\n");
+        config_t config;
+        init_config(&config);
+        TEST_ASSERT(load_config_cache(filename, &config) != 0,
+                    "Stale cache should not load");
+        TEST_ASSERT(config.namespace_count == 0,
+                    "Failed load should leave the config empty");
+        free_config(&config);
+        write_file(filename, topology);
+    }
+
+    // Test case 4: A damaged cache is ignored
+    {
+        FILE *fp = fopen(path, "r+");
+        TEST_ASSERT(fp != NULL, "Cache should exist");
+        fseek(fp, sizeof(cache_header_t), SEEK_SET);
+        cache_namespace_t bad = {.name = 0xffffffffu};
+        fwrite(&bad, sizeof bad, 1, fp);
+        fclose(fp);
+
+        config_t config;
+        init_config(&config);
+        TEST_ASSERT(load_config_cache(filename, &config) != 0,
+                    "Damaged cache should not load");
+        free_config(&config);
+    }
+
+    // Test case 5: Loaded addresses are handed out against the previous ones
+    {
+        write_file(filename, "bridge = br0\n"
+                             "bridge.br0.ip = 10.9.0.1/24\n"
+                             "namespace = t[1..2]\n"
+                             "namespace.t[*].ip = auto\n"
+                             "namespace.t[*].connect_via = bridge:br0\n");
+        config_t written;
+        init_config(&written);
+        TEST_ASSERT(parse_config_file(filename, &written) == 0 &&
+                        config_expand(&written) == 0,
+                    "Configuration should parse");
+        TEST_ASSERT(compile_config(filename, &written) == 0,
+                    "Configuration should compile");
+        TEST_ASSERT(config_assign_addresses(&written, NULL) == 0 &&
+                        compile_config(filename, &written) != 0,
+                    "Assigned addresses should not be compiled");
+        free_config(&written);
+
+        // t2 is running with an address t1 would otherwise get
+        config_t previous;
+        init_config(&previous);
+        char line[] = "namespace = t2";
+        TEST_ASSERT(parse_config_line(line, &previous) == 0,
+                    "Previous configuration should parse");
+        namespace_t *prev = find_namespace_by_name(&previous, "t2");
+        inet_pton(AF_INET, "10.9.0.77", &prev->ip_addr);
+        prev->mask = 24;
+        prev->auto_ip = true;
+
+        config_t config;
+        init_config(&config);
+        TEST_ASSERT(load_config_cache(filename, &config) == 0,
+                    "Cache should load");
+        TEST_ASSERT(config_assign_addresses(&config, &previous) == 0,
+                    "Loaded configuration should get addresses");
+        char ip_str[INET_ADDRSTRLEN];
+        const namespace_t *ns = find_namespace_by_name(&config, "t2");
+        inet_ntop(AF_INET, &ns->ip_addr, ip_str, sizeof ip_str);
+        TEST_ASSERT(strcmp(ip_str, "10.9.0.77") == 0,
+                    "Running namespace should keep its address");
+        ns = find_namespace_by_name(&config, "t1");
+        inet_ntop(AF_INET, &ns->ip_addr, ip_str, sizeof ip_str);
+        TEST_ASSERT(strcmp(ip_str, "10.9.0.2") == 0 && ns->mask == 24,
+                    "New namespace should get the first free address");
+        inet_ntop(AF_INET, &ns->gateway, ip_str, sizeof ip_str);
+        TEST_ASSERT(strcmp(ip_str, "10.9.0.1") == 0,
+                    "Gateway should default to the bridge");
+        free_config(&config);
+        free_config(&previous);
+    }
+
+    free_config(&parsed);
+    unlink(path);
+    unlink(filename);
+    free(path);
+    printf("compile_config() and load_config_cache() tests passed!\n");
+}
+
+int main() {
+    test_config_cache();
+    return 0;
+}
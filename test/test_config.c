@@ -75,24 +75,32 @@ void test_parse_cidr() {
 void test_parse_fw_rule() {
     printf("Testing parse_fw_rule()...\n");
 
+    // Rules resolve namespace names against the configuration
+    config_t config;
+    init_config(&config);
+    char ns1[] = "namespace = private1";
+    char ns2[] = "namespace = private2";
+    TEST_ASSERT(parse_config_line(ns1, &config) == 0 &&
+                    parse_config_line(ns2, &config) == 0,
+                "Test namespaces should parse");
+
     // Test case 1: Valid rule with namespace source and internet destination
     {
         const char *rule_str = "private1 -> INTERNET";
         fw_rule_t rule;
 
-        int result = parse_fw_rule(rule_str, &rule);
+        int result = parse_fw_rule(rule_str, &config, &rule);
         TEST_ASSERT(result == 0,
                     "parse_fw_rule should return 0 for valid input");
 
         TEST_ASSERT(rule.src_type == ENDPOINT_NS,
                     "Source type should be ENDPOINT_NS");
-        TEST_ASSERT(strcmp(rule.src_name, "private1") == 0,
-                    "Source name should be 'private1'");
+        TEST_ASSERT(rule.src_ns == 0, "Source should be 'private1'");
 
         TEST_ASSERT(rule.dst_type == ENDPOINT_INTERNET,
                     "Destination type should be ENDPOINT_INTERNET");
-        TEST_ASSERT(strcmp(rule.dst_name, "INTERNET") == 0,
-                    "Destination name should be 'INTERNET'");
+        TEST_ASSERT(rule.dst_ns == -1,
+                    "Destination should not be a namespace");
 
         TEST_ASSERT(rule.action == FW_ALLOW,
                     "Default action should be FW_ALLOW");
@@ -103,19 +111,17 @@ void test_parse_fw_rule() {
         const char *rule_str = "INTERNET -> private2";
         fw_rule_t rule;
 
-        int result = parse_fw_rule(rule_str, &rule);
+        int result = parse_fw_rule(rule_str, &config, &rule);
         TEST_ASSERT(result == 0,
                     "parse_fw_rule should return 0 for valid input");
 
         TEST_ASSERT(rule.src_type == ENDPOINT_INTERNET,
                     "Source type should be ENDPOINT_INTERNET");
-        TEST_ASSERT(strcmp(rule.src_name, "INTERNET") == 0,
-                    "Source name should be 'INTERNET'");
+        TEST_ASSERT(rule.src_ns == -1, "Source should not be a namespace");
 
         TEST_ASSERT(rule.dst_type == ENDPOINT_NS,
                     "Destination type should be ENDPOINT_NS");
-        TEST_ASSERT(strcmp(rule.dst_name, "private2") == 0,
-                    "Destination name should be 'private2'");
+        TEST_ASSERT(rule.dst_ns == 1, "Destination should be 'private2'");
 
         TEST_ASSERT(rule.action == FW_ALLOW,
                     "Default action should be FW_ALLOW");
@@ -126,19 +132,17 @@ void test_parse_fw_rule() {
         const char *rule_str = "private1 -> private2";
         fw_rule_t rule;
 
-        int result = parse_fw_rule(rule_str, &rule);
+        int result = parse_fw_rule(rule_str, &config, &rule);
         TEST_ASSERT(result == 0,
                     "parse_fw_rule should return 0 for valid input");
 
         TEST_ASSERT(rule.src_type == ENDPOINT_NS,
                     "Source type should be ENDPOINT_NS");
-        TEST_ASSERT(strcmp(rule.src_name, "private1") == 0,
-                    "Source name should be 'private1'");
+        TEST_ASSERT(rule.src_ns == 0, "Source should be 'private1'");
 
         TEST_ASSERT(rule.dst_type == ENDPOINT_NS,
                     "Destination type should be ENDPOINT_NS");
-        TEST_ASSERT(strcmp(rule.dst_name, "private2") == 0,
-                    "Destination name should be 'private2'");
+        TEST_ASSERT(rule.dst_ns == 1, "Destination should be 'private2'");
     }
 
     // Test case 4: Invalid format (no arrow)
@@ -146,7 +150,7 @@ void test_parse_fw_rule() {
         const char *rule_str = "private1 INTERNET";
         fw_rule_t rule;
 
-        int result = parse_fw_rule(rule_str, &rule);
+        int result = parse_fw_rule(rule_str, &config, &rule);
         TEST_ASSERT(result != 0,
                     "parse_fw_rule should return error for missing arrow");
     }
@@ -156,7 +160,7 @@ void test_parse_fw_rule() {
         const char *rule_str = "private1 ->";
         fw_rule_t rule;
 
-        int result = parse_fw_rule(rule_str, &rule);
+        int result = parse_fw_rule(rule_str, &config, &rule);
         TEST_ASSERT(
             result != 0,
             "parse_fw_rule should return error for missing destination");
@@ -167,7 +171,7 @@ void test_parse_fw_rule() {
         const char *rule_str = "-> INTERNET";
         fw_rule_t rule;
 
-        int result = parse_fw_rule(rule_str, &rule);
+        int result = parse_fw_rule(rule_str, &config, &rule);
         TEST_ASSERT(result != 0,
                     "parse_fw_rule should return error for missing source");
     }
@@ -177,11 +181,22 @@ void test_parse_fw_rule() {
         const char *rule_str = "";
         fw_rule_t rule;
 
-        int result = parse_fw_rule(rule_str, &rule);
+        int result = parse_fw_rule(rule_str, &config, &rule);
         TEST_ASSERT(result != 0,
                     "parse_fw_rule should return error for empty string");
     }
 
+    // Test case 8: Undefined namespace
+    {
+        const char *rule_str = "private1 -> ghost";
+        fw_rule_t rule;
+
+        int result = parse_fw_rule(rule_str, &config, &rule);
+        TEST_ASSERT(result != 0,
+                    "parse_fw_rule should return error for unknown namespace");
+    }
+
+    free_config(&config);
     printf("parse_fw_rule() tests passed!\n");
 }
 
@@ -258,21 +273,22 @@ void test_parse_config_line() {
 
     // Test case 5: Firewall rule
     {
+        char ns_line[] = "namespace = private1";
         char line[] = "firewall_allow_forward = private1 -> INTERNET";
         init_config(&config);
 
+        TEST_ASSERT(parse_config_line(ns_line, &config) == 0,
+                    "Should parse namespace definition");
         int result = parse_config_line(line, &config);
         TEST_ASSERT(result == 0, "Should parse firewall rule successfully");
         TEST_ASSERT(config.fw_rule_count == 1,
                     "Should increment firewall rule count");
         TEST_ASSERT(config.fw_rules[0].src_type == ENDPOINT_NS,
                     "Should set source type correctly");
-        TEST_ASSERT(strcmp(config.fw_rules[0].src_name, "private1") == 0,
-                    "Should set source name correctly");
+        TEST_ASSERT(config.fw_rules[0].src_ns == 0,
+                    "Should resolve the source namespace");
         TEST_ASSERT(config.fw_rules[0].dst_type == ENDPOINT_INTERNET,
                     "Should set destination type correctly");
-        TEST_ASSERT(strcmp(config.fw_rules[0].dst_name, "INTERNET") == 0,
-                    "Should set destination name correctly");
 
         free_config(&config);
     }
@@ -359,6 +375,343 @@ void test_parse_config_line() {
         free_config(&config);
     }
 
+    // Test case 12: Flow offload flag
+    {
+        char line[] = "flow_offload = true";
+        init_config(&config);
+
+        int result = parse_config_line(line, &config);
+        TEST_ASSERT(result == 0, "Should parse flow offload flag");
+        TEST_ASSERT(config.flow_offload == true,
+                    "Should enable flow offload");
+
+        free_config(&config);
+    }
+
+    // Test case 13: Properties resolve by name among many namespaces
+    {
+        init_config(&config);
+        char line[100];
+        for (int i = 0; i < 1000; i++) {
+            snprintf(line, sizeof line, "namespace = ns%d", i);
+            TEST_ASSERT(parse_config_line(line, &config) == 0,
+                        "Should parse namespace definition");
+        }
+        for (int i = 0; i < 1000; i++) {
+            snprintf(line, sizeof line, "namespace.ns%d.ip = 10.%d.%d.2/24",
+                     i, i / 256, i % 256);
+            TEST_ASSERT(parse_config_line(line, &config) == 0,
+                        "Should find namespace by name");
+        }
+
+        namespace_t *ns = find_namespace_by_name(&config, "ns700");
+        char ip_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &ns->ip_addr, ip_str, sizeof ip_str);
+        TEST_ASSERT(ns == &config.namespaces[700],
+                    "Should look up the namespace with that name");
+        TEST_ASSERT(strcmp(ip_str, "10.2.188.2") == 0,
+                    "Should set the property on the right namespace");
+        TEST_ASSERT(find_namespace_by_name(&config, "ns1000") == NULL,
+                    "Should not find undefined namespaces");
+
+        free_config(&config);
+    }
+
+    // Test case 14: Entries start zeroed as the arrays grow
+    {
+        init_config(&config);
+        char line[100];
+        for (int i = 0; i < 100; i++) {
+            snprintf(line, sizeof line, "bridge = br%d", i);
+            TEST_ASSERT(parse_config_line(line, &config) == 0,
+                        "Should parse bridge definition");
+        }
+
+        TEST_ASSERT(config.bridge_count == 100, "Should keep every bridge");
+        TEST_ASSERT(config.bridge_cap >= config.bridge_count,
+                    "Capacity should cover the bridges");
+        TEST_ASSERT(config.bridges[99].ip_addr.s_addr == 0 &&
+                        config.bridges[99].mask == 0,
+                    "Unset properties should be zero");
+        TEST_ASSERT(find_bridge_by_name(&config, "br0") == &config.bridges[0],
+                    "Should find bridges after the array moved");
+
+        free_config(&config);
+        TEST_ASSERT(config.bridges == NULL && config.bridge_cap == 0,
+                    "Freeing should reset the arrays");
+    }
+
+    // Test case 15: Namespace ranges expand on demand
+    {
+        init_config(&config);
+        const char *lines[] = {
+            "namespace = tenant[1..500]",
+            "namespace.tenant[*].ip = 10.1.0.7/16 auto",
+            "namespace.tenant[*].gateway = 10.1.0.1",
+            "namespace.tenant[*].connect_via = bridge:br0",
+        };
+        for (size_t i = 0; i < sizeof lines / sizeof *lines; i++) {
+            char line[100];
+            snprintf(line, sizeof line, "%s", lines[i]);
+            TEST_ASSERT(parse_config_line(line, &config) == 0,
+                        "Should parse namespace range");
+        }
+        TEST_ASSERT(config.namespace_count == 0 &&
+                        config.ns_template_count == 1,
+                    "Range should not be expanded while parsing");
+
+        // names outside the range fail without expanding it
+        const char *misses[] = {
+            "firewall_allow_forward = tenant0 -> INTERNET",
+            "firewall_allow_forward = tenant501 -> INTERNET",
+            "firewall_allow_forward = tenant01 -> INTERNET",
+            "firewall_allow_forward = tennant1 -> INTERNET",
+        };
+        for (size_t i = 0; i < sizeof misses / sizeof *misses; i++) {
+            char miss[64];
+            snprintf(miss, sizeof miss, "%s", misses[i]);
+            TEST_ASSERT(parse_config_line(miss, &config) != 0,
+                        "Rule with an unknown name should fail");
+        }
+        TEST_ASSERT(config.namespace_count == 0,
+                    "Unknown names should not expand the range");
+
+        // naming an instance expands the range
+        char rule[] = "firewall_allow_forward = tenant500 -> tenant1";
+        TEST_ASSERT(parse_config_line(rule, &config) == 0,
+                    "Rule should resolve range instances");
+        TEST_ASSERT(config.namespace_count == 500,
+                    "Every instance should exist");
+        TEST_ASSERT(config.fw_rules[0].src_ns == 499 &&
+                        config.fw_rules[0].dst_ns == 0,
+                    "Rule should point at the instances");
+
+        namespace_t *ns = find_namespace_by_name(&config, "tenant42");
+        char ip_str[INET_ADDRSTRLEN];
+        TEST_ASSERT(ns != NULL, "Instance should be indexed");
+        TEST_ASSERT(strcmp(ns->connect_name, "bridge:br0") == 0,
+                    "Instances should inherit properties");
+
+        // range properties still apply after expansion, instance ones win
+        char line[] = "namespace.tenant[*].gateway = 10.1.0.254\n"
+                      "namespace.tenant7.gateway = 10.1.9.9";
+        TEST_ASSERT(parse_config_line(line, &config) == 0,
+                    "Should parse properties after expansion");
+        inet_ntop(AF_INET, &ns->gateway, ip_str, sizeof ip_str);
+        TEST_ASSERT(strcmp(ip_str, "10.1.0.254") == 0,
+                    "Expanded instances should follow the range");
+        ns = find_namespace_by_name(&config, "tenant7");
+        inet_ntop(AF_INET, &ns->gateway, ip_str, sizeof ip_str);
+        TEST_ASSERT(strcmp(ip_str, "10.1.9.9") == 0,
+                    "Instance property should override the range");
+        TEST_ASSERT(config_expand(&config) == 0 &&
+                        config.namespace_count == 500,
+                    "Expanding again should not add namespaces");
+
+        TEST_ASSERT(config_assign_addresses(&config, NULL) == 0,
+                    "Range should get addresses");
+        ns = find_namespace_by_name(&config, "tenant42");
+        inet_ntop(AF_INET, &ns->ip_addr, ip_str, sizeof ip_str);
+        TEST_ASSERT(strcmp(ip_str, "10.1.0.43") == 0 && ns->mask == 16,
+                    "Addresses should follow the gateway in order");
+        free_config(&config);
+    }
+
+    // Test case 16: Malformed ranges and ranges that do not fit
+    {
+        const char *bad[] = {
+            "namespace = tenant[5..1]",
+            "namespace = [1..5]",
+            "namespace = tenant[1-5]",
+            "namespace = tenant[1..x]",
+            "namespace = t[1..5]\nnamespace.t[*].ip = 10.0.0.0/30 auto",
+            "namespace.t[*].ip = 10.0.0.0/24",
+        };
+        for (size_t i = 0; i < sizeof bad / sizeof *bad; i++) {
+            char line[100];
+            init_config(&config);
+            snprintf(line, sizeof line, "%s", bad[i]);
+            TEST_ASSERT(parse_config_line(line, &config) != 0,
+                        "Bad range should be rejected");
+            free_config(&config);
+        }
+    }
+
+    // Test case 17: ip = auto takes addresses from the bridge subnet
+    {
+        init_config(&config);
+        char lines[] = "bridge = br0\n"
+                       "bridge.br0.ip = 10.2.0.1/24\n"
+                       "namespace = fixed\n"
+                       "namespace.fixed.ip = 10.2.0.2/24\n"
+                       "namespace = web\n"
+                       "namespace.web.ip = auto\n"
+                       "namespace.web.connect_via = bridge:br0\n"
+                       "namespace = db\n"
+                       "namespace.db.ip = auto\n"
+                       "namespace.db.connect_via = bridge:br0\n";
+        TEST_ASSERT(parse_config_line(lines, &config) == 0,
+                    "Should parse ip = auto");
+        TEST_ASSERT(config_assign_addresses(&config, NULL) == 0,
+                    "Addresses should be assigned");
+
+        char ip_str[INET_ADDRSTRLEN];
+        namespace_t *web = find_namespace_by_name(&config, "web");
+        inet_ntop(AF_INET, &web->ip_addr, ip_str, sizeof ip_str);
+        TEST_ASSERT(strcmp(ip_str, "10.2.0.3") == 0 && web->mask == 24,
+                    "Written addresses should be skipped");
+        TEST_ASSERT(web->gateway.s_addr == config.bridges[0].ip_addr.s_addr,
+                    "Gateway should default to the bridge");
+
+        // a reload without web keeps db where it was
+        config_t next;
+        init_config(&next);
+        char next_lines[] = "bridge = br0\n"
+                            "bridge.br0.ip = 10.2.0.1/24\n"
+                            "namespace = cache\n"
+                            "namespace.cache.ip = auto\n"
+                            "namespace.cache.connect_via = bridge:br0\n"
+                            "namespace = db\n"
+                            "namespace.db.ip = auto\n"
+                            "namespace.db.connect_via = bridge:br0\n";
+        TEST_ASSERT(parse_config_line(next_lines, &next) == 0 &&
+                        config_assign_addresses(&next, &config) == 0,
+                    "Reloaded configuration should be assigned");
+        namespace_t *db = find_namespace_by_name(&next, "db");
+        inet_ntop(AF_INET, &db->ip_addr, ip_str, sizeof ip_str);
+        TEST_ASSERT(strcmp(ip_str, "10.2.0.4") == 0,
+                    "Running namespace should keep its address");
+        namespace_t *cache = find_namespace_by_name(&next, "cache");
+        inet_ntop(AF_INET, &cache->ip_addr, ip_str, sizeof ip_str);
+        TEST_ASSERT(strcmp(ip_str, "10.2.0.2") == 0,
+                    "Freed addresses should be handed out again");
+        free_config(&next);
+        free_config(&config);
+    }
+
+    // Test case 18: ip = auto needs a subnet with room
+    {
+        const char *bad[] = {
+            "namespace = a\nnamespace.a.ip = auto\n"
+            "namespace.a.connect_via = veth",
+            "bridge = br0\nbridge.br0.ip = 10.3.0.1/30\n"
+            "namespace = a\nnamespace.a.ip = auto\n"
+            "namespace.a.connect_via = bridge:br0\n"
+            "namespace = b\nnamespace.b.ip = auto\n"
+            "namespace.b.connect_via = bridge:br0",
+        };
+        for (size_t i = 0; i < sizeof bad / sizeof *bad; i++) {
+            char line[300];
+            init_config(&config);
+            snprintf(line, sizeof line, "%s", bad[i]);
+            TEST_ASSERT(parse_config_line(line, &config) == 0,
+                        "Should parse ip = auto");
+            TEST_ASSERT(config_assign_addresses(&config, NULL) != 0,
+                        "Assignment should fail");
+            free_config(&config);
+        }
+    }
+
+    // Test case 19: Data plane selection
+    {
+        char line[] = "dataplane = afxdp";
+        init_config(&config);
+        TEST_ASSERT(config.dataplane == DATAPLANE_KERNEL,
+                    "Kernel should forward by default");
+        TEST_ASSERT(parse_config_line(line, &config) == 0,
+                    "Should parse dataplane");
+        TEST_ASSERT(config.dataplane == DATAPLANE_AFXDP,
+                    "Should select the AF_XDP data plane");
+        free_config(&config);
+
+        char bad[] = "dataplane = dpdk";
+        init_config(&config);
+        TEST_ASSERT(parse_config_line(bad, &config) != 0,
+                    "Should reject an unknown data plane");
+        free_config(&config);
+    }
+
+    // Test case 20: Connection tracking size
+    {
+        char line[] = "conntrack_flows = 4096";
+        init_config(&config);
+        TEST_ASSERT(config.conntrack_flows == CONNTRACK_FLOWS_DEFAULT,
+                    "Flows should have a default");
+        TEST_ASSERT(parse_config_line(line, &config) == 0,
+                    "Should parse conntrack_flows");
+        TEST_ASSERT(config.conntrack_flows == 4096, "Should set the flows");
+        free_config(&config);
+
+        const char *bad[] = {"conntrack_flows = 100",
+                             "conntrack_flows = 134217728",
+                             "conntrack_flows = many"};
+        for (size_t i = 0; i < sizeof bad / sizeof *bad; i++) {
+            char text[64];
+            snprintf(text, sizeof text, "%s", bad[i]);
+            init_config(&config);
+            TEST_ASSERT(parse_config_line(text, &config) != 0,
+                        "Should reject flows out of range");
+            free_config(&config);
+        }
+    }
+
+    // Test case 21: Forwarding threads
+    {
+        char line[] = "dataplane_workers = 4";
+        init_config(&config);
+        TEST_ASSERT(config.dataplane_workers == 1,
+                    "One worker should be the default");
+        TEST_ASSERT(parse_config_line(line, &config) == 0,
+                    "Should parse dataplane_workers");
+        TEST_ASSERT(config.dataplane_workers == 4, "Should set the workers");
+        free_config(&config);
+
+        const char *bad[] = {"dataplane_workers = 0", "dataplane_workers = 65",
+                             "dataplane_workers = -1"};
+        for (size_t i = 0; i < sizeof bad / sizeof *bad; i++) {
+            char text[64];
+            snprintf(text, sizeof text, "%s", bad[i]);
+            init_config(&config);
+            TEST_ASSERT(parse_config_line(text, &config) != 0,
+                        "Should reject workers out of range");
+            free_config(&config);
+        }
+    }
+
+    // Test case 22: An instance expands its range only, names are unique
+    {
+        char line[] = "namespace = a[1..3]\n"
+                      "namespace = b[1..4]\n"
+                      "namespace.b2.ip = 10.0.0.2/24";
+        init_config(&config);
+        TEST_ASSERT(parse_config_line(line, &config) == 0,
+                    "Should parse the ranges");
+        TEST_ASSERT(config.namespace_count == 4 &&
+                        find_namespace_by_name(&config, "b4") != NULL &&
+                        find_namespace_by_name(&config, "a1") == NULL,
+                    "Only the range of the instance should be expanded");
+        TEST_ASSERT(config_expand(&config) == 0 &&
+                        config.namespace_count == 7,
+                    "The other range should follow on demand");
+        free_config(&config);
+
+        const char *dups[] = {
+            "namespace = t[1..10]\nnamespace = t5",
+            "namespace = t5\nnamespace = t[1..10]",
+            "namespace = t[1..10]\nnamespace = t[5..20]",
+            "namespace = t5\nnamespace = t5",
+        };
+        for (size_t i = 0; i < sizeof dups / sizeof *dups; i++) {
+            char text[64];
+            snprintf(text, sizeof text, "%s", dups[i]);
+            init_config(&config);
+            TEST_ASSERT(parse_config_line(text, &config) != 0 ||
+                            config_expand(&config) != 0,
+                        "A name should not be taken twice");
+            free_config(&config);
+        }
+    }
+
     printf("parse_config_line() tests passed!\n");
 }
 
@@ -0,0 +1,289 @@
+#include "conntrack.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_ASSERT(condition, message)                                        \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            printf("ASSERTION FAILED: %s\n", message);                         \
+            printf("  In file: %s, line: %d\n", __FILE__, __LINE__);           \
+            exit(EXIT_FAILURE);                                                \
+        }                                                                      \
+    } while (0)
+
+#define TH_SYN 0x02
+#define TH_RST 0x04
+#define TH_ACK 0x10
+
+static ct_tuple_t make_tuple(uint32_t src, uint32_t dst, uint16_t sport,
+                             uint16_t dport, uint8_t proto) {
+    ct_tuple_t t;
+    memset(&t, 0, sizeof t);
+    t.src = htonl(src);
+    t.dst = htonl(dst);
+    t.sport = htons(sport);
+    t.dport = htons(dport);
+    t.proto = proto;
+    return t;
+}
+
+static ct_tuple_t reverse(const ct_tuple_t *t) {
+    ct_tuple_t r = *t;
+    r.src = t->dst;
+    r.dst = t->src;
+    r.sport = t->dport;
+    r.dport = t->sport;
+    return r;
+}
+
+/* Flow i of a table filled to capacity: distinct clients of one server */
+static ct_tuple_t client(uint32_t i) {
+    return make_tuple(0x0a000000 | i >> 8, 0xc0a80001, 1024 + (i & 0xff), 80,
+                      IPPROTO_TCP);
+}
+
+void test_ct_lookup() {
+    printf("Testing ct_insert() and ct_lookup()...\n");
+
+    // Test case 1: A full table finds every flow in both directions
+    {
+        enum { FLOWS = 100000 };
+        ct_table_t ct;
+        TEST_ASSERT(ct_init(&ct, FLOWS, 100) == 0, "Init should succeed");
+        for (uint32_t i = 0; i < FLOWS; i++) {
+            ct_tuple_t t = client(i), r = reverse(&t);
+            TEST_ASSERT(ct_insert(&ct, &t, &r, 0, 100) == i,
+                        "Insert should succeed until the table is full");
+        }
+        TEST_ASSERT(ct.count == FLOWS, "Every flow should be counted");
+        ct_tuple_t t = client(FLOWS), r = reverse(&t);
+        TEST_ASSERT(ct_insert(&ct, &t, &r, 0, 100) == CT_NONE,
+                    "Insert into a full table should fail");
+        for (uint32_t i = 0; i < FLOWS; i++) {
+            t = client(i);
+            r = reverse(&t);
+            TEST_ASSERT(ct_lookup(&ct, &t) == (i << 1 | CT_DIR_ORIGINAL),
+                        "Original direction should be found");
+            TEST_ASSERT(ct_lookup(&ct, &r) == (i << 1 | CT_DIR_REPLY),
+                        "Reply direction should be found");
+        }
+        t = client(FLOWS);
+        TEST_ASSERT(ct_lookup(&ct, &t) == CT_NONE,
+                    "Unknown flow should not be found");
+        t = client(7);
+        t.proto = IPPROTO_UDP;
+        TEST_ASSERT(ct_lookup(&ct, &t) == CT_NONE,
+                    "Protocol should be part of the key");
+        ct_free(&ct);
+    }
+
+    printf("ct_insert() and ct_lookup() tests passed!\n");
+}
+
+void test_ct_expire() {
+    printf("Testing ct_update() and ct_expire()...\n");
+
+    ct_table_t ct;
+    TEST_ASSERT(ct_init(&ct, 1024, 1000) == 0, "Init should succeed");
+    ct_tuple_t udp = make_tuple(0x0a000102, 0x0a000202, 5000, 53, IPPROTO_UDP);
+    ct_tuple_t tcp = make_tuple(0x0a000102, 0x0a000202, 5001, 22, IPPROTO_TCP);
+    ct_tuple_t udp_r = reverse(&udp), tcp_r = reverse(&tcp);
+    uint32_t u = ct_insert(&ct, &udp, &udp_r, 0, 1000);
+    uint32_t t = ct_insert(&ct, &tcp, &tcp_r, 0, 1000);
+    ct_update(&ct, t, CT_DIR_ORIGINAL, TH_SYN, 1000);
+    ct_update(&ct, t, CT_DIR_REPLY, TH_SYN | TH_ACK, 1001);
+
+    // Test case 1: Unanswered UDP times out, established TCP stays
+    uint32_t now = 1000;
+    while (now < 1000 + CT_TIMEOUT_UDP_NEW - 1) {
+        ct_expire(&ct, ++now);
+    }
+    TEST_ASSERT(ct_lookup(&ct, &udp) != CT_NONE,
+                "UDP flow should live until its timeout");
+    ct_expire(&ct, ++now);
+    TEST_ASSERT(ct_lookup(&ct, &udp) == CT_NONE &&
+                    ct_lookup(&ct, &udp_r) == CT_NONE,
+                "UDP flow should be gone after its timeout");
+    TEST_ASSERT(ct_lookup(&ct, &tcp) == (t << 1),
+                "Established TCP flow should stay");
+    TEST_ASSERT(ct.count == 1, "Only the TCP flow should be left");
+
+    // Test case 2: A released flow is handed out again
+    uint32_t again = ct_insert(&ct, &udp, &udp_r, 0, now);
+    TEST_ASSERT(again == u, "Released flow should be reused");
+
+    // Test case 3: A RST shortens the timeout of an established flow
+    ct_update(&ct, t, CT_DIR_ORIGINAL, TH_RST, now);
+    uint32_t reset = now;
+    while (now < reset + CT_TIMEOUT_TCP_RESET) {
+        ct_expire(&ct, ++now);
+    }
+    TEST_ASSERT(ct_lookup(&ct, &tcp) == CT_NONE,
+                "Reset TCP flow should be gone after the short timeout");
+
+    // Test case 4: A stall longer than the wheel still expires everything,
+    // a few seconds per call
+    uint32_t later = now + CT_WHEEL_SLOTS * 3;
+    for (int i = 0; i < CT_WHEEL_SLOTS / CT_EXPIRE_TICKS + 1; i++) {
+        ct_expire(&ct, later);
+    }
+    TEST_ASSERT(ct.count == 0, "Every flow should be gone after a stall");
+    TEST_ASSERT(ct.tick == later + 1, "Wheel should catch up with the clock");
+    ct_free(&ct);
+
+    printf("ct_update() and ct_expire() tests passed!\n");
+}
+
+void test_ct_nat_port() {
+    printf("Testing ct_nat_port()...\n");
+
+    ct_table_t ct;
+    TEST_ASSERT(ct_init(&ct, 1024, 1) == 0, "Init should succeed");
+    uint32_t nat = htonl(0xc6336401);
+    ct_nat_range(&ct, nat, 61000, 61003);
+
+    // Test case 1: Ports are unique per remote end, the original one kept
+    // where it is free
+    uint16_t sports[] = {61001, 61001, 40000, 40000};
+    uint16_t seen[4];
+    for (int i = 0; i < 4; i++) {
+        ct_tuple_t t = make_tuple(0x0a000102 + i, 0x08080808, sports[i], 53,
+                                  IPPROTO_UDP);
+        ct_tuple_t r = reverse(&t);
+        r.dst = nat;
+        TEST_ASSERT(ct_nat_port(&ct, &r) == 0, "Port should be found");
+        seen[i] = ntohs(r.dport);
+        TEST_ASSERT(seen[i] >= 61000 && seen[i] <= 61003,
+                    "Port should be in range");
+        for (int j = 0; j < i; j++) {
+            TEST_ASSERT(seen[j] != seen[i], "Ports should be unique");
+        }
+        TEST_ASSERT(ct_insert(&ct, &t, &r, CT_NAT, 1) != CT_NONE,
+                    "Insert should succeed");
+    }
+    TEST_ASSERT(seen[0] == 61001, "Free original port should be kept");
+
+    // Test case 2: A full range refuses, another remote end does not
+    ct_tuple_t t = make_tuple(0x0a000109, 0x08080808, 1234, 53, IPPROTO_UDP);
+    ct_tuple_t r = reverse(&t);
+    r.dst = nat;
+    TEST_ASSERT(ct_nat_port(&ct, &r) != 0, "Exhausted range should refuse");
+    t = make_tuple(0x0a000109, 0x01010101, 1234, 53, IPPROTO_UDP);
+    r = reverse(&t);
+    r.dst = nat;
+    TEST_ASSERT(ct_nat_port(&ct, &r) == 0,
+                "Ports should be reusable towards another remote end");
+
+    // Test case 3: ICMP echo translates its identifier
+    t = make_tuple(0x0a000102, 0x08080808, 7, 7, IPPROTO_ICMP);
+    r = reverse(&t);
+    r.dst = nat;
+    TEST_ASSERT(ct_nat_port(&ct, &r) == 0, "Identifier should be found");
+    TEST_ASSERT(r.sport == r.dport, "Echo identifier is both ports");
+
+    // Test case 4: Counters follow the flows of each port and protocol
+    _Atomic(uint64_t) *refs = calloc(CT_NAT_REFS, sizeof *refs);
+    TEST_ASSERT(refs != NULL, "Counters should be allocated");
+    ct_nat_refs(&ct, refs);
+    bool counted = true;
+    for (int i = 0; i < 4; i++) {
+        counted &= refs[(seen[i] - CT_NAT_PORT_MIN) * 4 + 1] == 1 &&
+                   refs[(seen[i] - CT_NAT_PORT_MIN) * 4] == 0;
+    }
+    TEST_ASSERT(counted, "Flows in the table should be counted in");
+    TEST_ASSERT(ct_insert(&ct, &t, &r, CT_NAT, 1) != CT_NONE,
+                "Insert should succeed");
+    TEST_ASSERT(refs[(ntohs(r.dport) - CT_NAT_PORT_MIN) * 4 + 2] == 1,
+                "New echo flow should count under ICMP");
+    for (uint32_t now = 2; ct.count > 0; now++) {
+        ct_expire(&ct, now);
+    }
+    uint64_t left = 0;
+    for (uint32_t i = 0; i < CT_NAT_REFS; i++) {
+        left += refs[i];
+    }
+    TEST_ASSERT(left == 0, "Expired flows should leave no count behind");
+    ct_nat_refs(&ct, NULL);
+    free(refs);
+    ct_free(&ct);
+
+    printf("ct_nat_port() tests passed!\n");
+}
+
+typedef struct {
+    ct_table_t *ct;
+    atomic_bool stop;
+    uint32_t lookups;
+    bool failed;
+} reader_test_t;
+
+/* Flows 0 to 999 never go away; anything else may come and go */
+static void *reader(void *arg) {
+    reader_test_t *test = arg;
+    while (!atomic_load(&test->stop)) {
+        for (uint32_t i = 0; i < 1000; i++) {
+            ct_tuple_t t = client(i);
+            test->failed |= ct_lookup(test->ct, &t) != (i << 1);
+            test->lookups++;
+        }
+    }
+    return NULL;
+}
+
+void test_ct_concurrent() {
+    printf("Testing ct_lookup() under concurrent changes...\n");
+
+    // Test case 1: A reader always finds flows that stay while the owner
+    // fills the table to capacity over and over, moving entries around
+    enum { FLOWS = 24000 }; // 84% of the bucket slots
+    ct_table_t ct;
+    TEST_ASSERT(ct_init(&ct, FLOWS, 0) == 0, "Init should succeed");
+    for (uint32_t i = 0; i < 1000; i++) {
+        ct_tuple_t t = client(i), r = reverse(&t);
+        TEST_ASSERT(ct_insert(&ct, &t, &r, 0, 0) != CT_NONE,
+                    "Insert should succeed");
+        ct_update(&ct, i, CT_DIR_REPLY, TH_ACK, 0); // established
+    }
+
+    reader_test_t test = {.ct = &ct, .lookups = 0, .failed = false};
+    atomic_init(&test.stop, false);
+    pthread_t thread;
+    TEST_ASSERT(pthread_create(&thread, NULL, reader, &test) == 0,
+                "Reader should start");
+    uint32_t now = 0, next = 1000;
+    for (int round = 0; round < 20; round++) {
+        // short-lived UDP flows, gone CT_TIMEOUT_UDP_NEW seconds later
+        while (ct.count < FLOWS) {
+            ct_tuple_t t = client(next++), r = reverse(&t);
+            t.proto = r.proto = IPPROTO_UDP;
+            TEST_ASSERT(ct_insert(&ct, &t, &r, 0, now) != CT_NONE,
+                        "Insert below capacity should succeed");
+        }
+        now += CT_TIMEOUT_UDP_NEW;
+        while (ct.tick <= now) {
+            ct_expire(&ct, now);
+        }
+        TEST_ASSERT(ct.count == 1000, "Only the TCP flows should be left");
+    }
+    atomic_store(&test.stop, true);
+    pthread_join(thread, NULL);
+    TEST_ASSERT(!test.failed, "Reader should find every lasting flow");
+    TEST_ASSERT(test.lookups > 0, "Reader should have run");
+    ct_free(&ct);
+
+    printf("ct_lookup() concurrency tests passed!\n");
+}
+
+int main() {
+    test_ct_lookup();
+    test_ct_expire();
+    test_ct_nat_port();
+    test_ct_concurrent();
+    return 0;
+}
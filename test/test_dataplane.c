@@ -0,0 +1,393 @@
+#include "config.h"
+#include "dataplane.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_ASSERT(condition, message)                                        \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            printf("ASSERTION FAILED: %s\n", message);                         \
+            printf("  In file: %s, line: %d\n", __FILE__, __LINE__);           \
+            exit(EXIT_FAILURE);                                                \
+        }                                                                      \
+    } while (0)
+
+static const char *topology = "namespace = a\n"
+                              "namespace.a.ip = 10.0.1.2/24\n"
+                              "namespace.a.gateway = 10.0.1.1\n"
+                              "namespace.a.connect_via = veth\n"
+                              "namespace = bridged\n"
+                              "namespace.bridged.ip = 10.0.9.2/24\n"
+                              "namespace.bridged.connect_via = bridge:br0\n"
+                              "namespace = b\n"
+                              "namespace.b.ip = 10.0.2.2/24\n"
+                              "namespace.b.gateway = 10.0.2.1\n"
+                              "namespace.b.connect_via = veth\n"
+                              "namespace = d\n"
+                              "namespace.d.ip = 10.0.3.2/24\n"
+                              "namespace.d.connect_via = veth\n"
+                              "bridge = br0\n"
+                              "bridge.br0.ip = 10.0.9.1/24\n"
+                              "firewall_forward_default = DROP\n"
+                              "firewall_allow_forward = a -> b\n"
+                              "dataplane = afxdp\n";
+
+static const char *nat_topology = "nat_outgoing_interface = up0\n"
+                                  "namespace = a\n"
+                                  "namespace.a.ip = 10.0.1.2/24\n"
+                                  "namespace.a.gateway = 10.0.1.1\n"
+                                  "namespace.a.connect_via = veth\n"
+                                  "namespace = b\n"
+                                  "namespace.b.ip = 10.0.2.2/24\n"
+                                  "namespace.b.gateway = 10.0.2.1\n"
+                                  "namespace.b.connect_via = veth\n"
+                                  "firewall_forward_default = DROP\n"
+                                  "firewall_allow_forward = a -> INTERNET\n"
+                                  "firewall_allow_forward = b -> INTERNET\n"
+                                  "enable_nat = 10.0.1.0/24\n"
+                                  "dataplane = afxdp\n";
+
+#define FRAME_LEN (ETH_HLEN + 20 + 8)
+
+static uint16_t ip_checksum(const uint8_t *ip) {
+    uint32_t sum = 0;
+    for (int i = 0; i < 20; i += 2) {
+        sum += ip[i] << 8 | ip[i + 1];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+/* Ones' complement sum of the UDP header of a frame and its pseudo header */
+static uint16_t udp_checksum(const uint8_t *frame) {
+    const uint8_t *ip = frame + ETH_HLEN;
+    uint32_t sum = 17 + 8;
+    for (int i = 12; i < 20; i += 2) {
+        sum += ip[i] << 8 | ip[i + 1];
+    }
+    for (int i = 20; i < 28; i += 2) {
+        sum += ip[i] << 8 | ip[i + 1];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+/* Give the UDP header of a frame ports and a valid checksum */
+static void set_ports(uint8_t *frame, uint16_t sport, uint16_t dport) {
+    uint8_t *udp = frame + ETH_HLEN + 20;
+    udp[0] = sport >> 8;
+    udp[1] = sport & 0xff;
+    udp[2] = dport >> 8;
+    udp[3] = dport & 0xff;
+    udp[5] = 8;
+    udp[6] = udp[7] = 0;
+    uint16_t check = udp_checksum(frame);
+    udp[6] = check >> 8;
+    udp[7] = check & 0xff;
+}
+
+static uint16_t get_port(const uint8_t *frame, int offset) {
+    const uint8_t *udp = frame + ETH_HLEN + 20;
+    return udp[offset] << 8 | udp[offset + 1];
+}
+
+/* A UDP frame from src to dst with a valid header checksum */
+static void make_frame(uint8_t *frame, const char *src, const char *dst,
+                       uint8_t ttl) {
+    memset(frame, 0, FRAME_LEN);
+    memset(frame, 0x11, ETH_ALEN);            // the host end
+    memset(frame + ETH_ALEN, 0xaa, ETH_ALEN); // the sender
+    frame[12] = 0x08;
+    uint8_t *ip = frame + ETH_HLEN;
+    ip[0] = 0x45;
+    ip[3] = 28;
+    ip[8] = ttl;
+    ip[9] = 17;
+    inet_pton(AF_INET, src, ip + 12);
+    inet_pton(AF_INET, dst, ip + 16);
+    uint16_t check = ip_checksum(ip);
+    ip[10] = check >> 8;
+    ip[11] = check & 0xff;
+}
+
+/* Give every port a host and a peer address, 0x10 + i and 0x20 + i */
+static void set_macs(dataplane_t *dp) {
+    for (int i = 0; i < dp->port_count; i++) {
+        uint8_t mac[sizeof(uint64_t)] = {0};
+        memset(dp->ports[i].host_mac, 0x10 + i, ETH_ALEN);
+        memset(mac, 0x20 + i, ETH_ALEN);
+        uint64_t peer;
+        memcpy(&peer, mac, sizeof peer);
+        atomic_store(&dp->ports[i].peer, peer);
+    }
+}
+
+void test_dataplane_route() {
+    printf("Testing dataplane_build() and dataplane_route()...\n");
+
+    config_t config;
+    init_config(&config);
+    char text[1024];
+    snprintf(text, sizeof text, "%s", topology);
+    TEST_ASSERT(parse_config_line(text, &config) == 0,
+                "Test topology should parse");
+
+    dataplane_t dp;
+    dataplane_init(&dp);
+    TEST_ASSERT(dataplane_build(&dp, &config) == 0, "Build should succeed");
+    free_config(&config);
+
+    // Test case 1: Only veth-connected namespaces get a port
+    TEST_ASSERT(dp.port_count == 3, "Bridged namespace should have no port");
+    TEST_ASSERT(strcmp(dp.ports[1].ns_name, "b") == 0,
+                "Ports should follow the namespace order");
+    TEST_ASSERT(strcmp(dp.ports[1].ifname, "vh-b") == 0,
+                "Port should be the host end of the veth pair");
+    set_macs(&dp);
+
+    // Test case 2: A frame to another port is rewritten for it
+    uint8_t frame[FRAME_LEN];
+    make_frame(frame, "10.0.1.2", "10.0.2.2", 64);
+    TEST_ASSERT(dataplane_route(&dp, 0, 0, frame, FRAME_LEN) == 1,
+                "Frame should go to the port of b");
+    TEST_ASSERT(frame[ETH_HLEN + 8] == 63, "TTL should be decremented");
+    TEST_ASSERT(ip_checksum(frame + ETH_HLEN) == 0,
+                "Header checksum should still be valid");
+    TEST_ASSERT(frame[0] == 0x21 && frame[ETH_ALEN - 1] == 0x21,
+                "Destination should be the namespace end of b");
+    TEST_ASSERT(frame[ETH_ALEN] == 0x11 && frame[2 * ETH_ALEN - 1] == 0x11,
+                "Source should be the host end of b");
+    uint64_t peer = atomic_load(&dp.ports[0].peer);
+    TEST_ASSERT(((uint8_t *)&peer)[0] == 0xaa,
+                "Sender address should be learned");
+
+    // Test case 3: The checksum stays valid whichever way it carries
+    for (int i = 0; i < 65536; i += 7) {
+        char src[INET_ADDRSTRLEN];
+        snprintf(src, sizeof src, "10.0.%d.%d", i >> 8, i & 0xff);
+        make_frame(frame, src, "10.0.2.2", 2 + i % 254);
+        TEST_ASSERT(dataplane_route(&dp, 0, 0, frame, FRAME_LEN) == 1,
+                    "Frame should go to the port of b");
+        TEST_ASSERT(ip_checksum(frame + ETH_HLEN) == 0,
+                    "Header checksum should still be valid");
+    }
+
+    // Test case 4: The policy follows the firewall rules, and replies
+    // follow their flow
+    make_frame(frame, "10.0.1.2", "10.0.3.2", 64);
+    TEST_ASSERT(dataplane_route(&dp, 0, 0, frame, FRAME_LEN) < 0,
+                "Frame between ports without a rule should be dropped");
+    make_frame(frame, "10.0.2.2", "10.0.1.9", 64);
+    TEST_ASSERT(dataplane_route(&dp, 0, 1, frame, FRAME_LEN) < 0,
+                "Frame against the rule should be dropped");
+    make_frame(frame, "10.0.2.2", "10.0.1.2", 64);
+    TEST_ASSERT(dataplane_route(&dp, 0, 1, frame, FRAME_LEN) == 0,
+                "Reply to a flow should be forwarded");
+
+    // Test case 5: Whatever the kernel handles is left alone
+    const char *kernel[] = {"10.0.2.1", "10.0.2.255", "10.0.2.0",
+                            "10.0.9.2", "8.8.8.8",    "10.0.1.7"};
+    for (size_t i = 0; i < sizeof kernel / sizeof *kernel; i++) {
+        make_frame(frame, "10.0.1.2", kernel[i], 64);
+        TEST_ASSERT(dataplane_route(&dp, 0, 0, frame, FRAME_LEN) < 0,
+                    "Frame for the kernel should not be forwarded");
+    }
+    make_frame(frame, "10.0.1.2", "10.0.2.2", 1);
+    TEST_ASSERT(dataplane_route(&dp, 0, 0, frame, FRAME_LEN) < 0,
+                "Frame with an expiring TTL should be dropped");
+    make_frame(frame, "10.0.1.2", "10.0.2.2", 64);
+    frame[12] = 0x86;
+    frame[13] = 0xdd;
+    TEST_ASSERT(dataplane_route(&dp, 0, 0, frame, FRAME_LEN) < 0,
+                "Non-IPv4 frame should not be forwarded");
+    make_frame(frame, "10.0.1.2", "10.0.2.2", 64);
+    TEST_ASSERT(dataplane_route(&dp, 0, 0, frame, ETH_HLEN + 10) < 0,
+                "Truncated frame should be dropped");
+
+    // Test case 6: Nothing goes to a namespace whose address is unknown
+    atomic_store(&dp.ports[1].peer, 0);
+    make_frame(frame, "10.0.1.2", "10.0.2.2", 64);
+    TEST_ASSERT(dataplane_route(&dp, 0, 0, frame, FRAME_LEN) < 0,
+                "Frame to an unresolved namespace should be dropped");
+
+    dataplane_free(&dp);
+    TEST_ASSERT(dp.port_count == 0, "Free should leave an empty data plane");
+
+    printf("dataplane_build() and dataplane_route() tests passed!\n");
+}
+
+void test_dataplane_nat() {
+    printf("Testing masquerading in dataplane_route()...\n");
+
+    config_t config;
+    init_config(&config);
+    char text[1024];
+    snprintf(text, sizeof text, "%s", nat_topology);
+    TEST_ASSERT(parse_config_line(text, &config) == 0,
+                "Test topology should parse");
+    dataplane_t dp;
+    dataplane_init(&dp);
+    TEST_ASSERT(dataplane_build(&dp, &config) == 0, "Build should succeed");
+    free_config(&config);
+
+    // Test case 1: The uplink is a port after the namespaces
+    TEST_ASSERT(dp.port_count == 3 && dp.uplink == 2,
+                "Uplink should be the last port");
+    TEST_ASSERT(strcmp(dp.ports[2].ifname, "up0") == 0,
+                "Uplink port should be the NAT outgoing interface");
+    TEST_ASSERT(dp.ports[0].nat && !dp.ports[1].nat,
+                "Only namespaces in a NAT prefix should be masqueraded");
+    set_macs(&dp);
+    uint32_t nat_addr;
+    inet_pton(AF_INET, "198.51.100.7", &nat_addr);
+    dp.workers[0].ct.nat_addr = nat_addr;
+
+    // Test case 2: Traffic to the internet leaves from the NAT address
+    uint8_t frame[FRAME_LEN];
+    make_frame(frame, "10.0.1.2", "8.8.8.8", 64);
+    set_ports(frame, 5000, 53);
+    TEST_ASSERT(dataplane_route(&dp, 0, 0, frame, FRAME_LEN) == 2,
+                "Frame to the internet should go to the uplink");
+    TEST_ASSERT(memcmp(frame + ETH_HLEN + 12, &nat_addr, 4) == 0,
+                "Source should be the NAT address");
+    uint16_t port = get_port(frame, 0);
+    TEST_ASSERT(port >= CT_NAT_PORT_MIN,
+                "Source port should be in the NAT range");
+    TEST_ASSERT(ip_checksum(frame + ETH_HLEN) == 0 &&
+                    udp_checksum(frame) == 0,
+                "Checksums should still be valid");
+    TEST_ASSERT(frame[0] == 0x22, "Destination should be the gateway");
+
+    // Test case 3: Its replies come back translated, nothing else does
+    make_frame(frame, "8.8.8.8", "198.51.100.7", 64);
+    set_ports(frame, 53, port);
+    TEST_ASSERT(dataplane_route(&dp, 0, 2, frame, FRAME_LEN) == 0,
+                "Reply should go to the namespace");
+    uint8_t addr[4] = {10, 0, 1, 2};
+    TEST_ASSERT(memcmp(frame + ETH_HLEN + 16, addr, 4) == 0 &&
+                    get_port(frame, 2) == 5000,
+                "Destination should be the original source");
+    TEST_ASSERT(ip_checksum(frame + ETH_HLEN) == 0 &&
+                    udp_checksum(frame) == 0,
+                "Checksums should still be valid");
+    make_frame(frame, "8.8.8.8", "198.51.100.7", 64);
+    set_ports(frame, 53, port + 1);
+    TEST_ASSERT(dataplane_route(&dp, 0, 2, frame, FRAME_LEN) < 0,
+                "Unsolicited frame from the uplink should be dropped");
+
+    // Test case 4: A missing UDP checksum stays missing
+    make_frame(frame, "10.0.1.2", "8.8.4.4", 64);
+    set_ports(frame, 5001, 53);
+    frame[ETH_HLEN + 26] = frame[ETH_HLEN + 27] = 0;
+    TEST_ASSERT(dataplane_route(&dp, 0, 0, frame, FRAME_LEN) == 2,
+                "Frame to the internet should go to the uplink");
+    TEST_ASSERT(frame[ETH_HLEN + 26] == 0 && frame[ETH_HLEN + 27] == 0,
+                "UDP checksum should still be absent");
+
+    // Test case 5: Namespaces outside the NAT prefixes are not translated
+    make_frame(frame, "10.0.2.2", "8.8.8.8", 64);
+    set_ports(frame, 5000, 53);
+    TEST_ASSERT(dataplane_route(&dp, 0, 1, frame, FRAME_LEN) < 0,
+                "Frame without NAT should not reach the uplink");
+
+    dataplane_free(&dp);
+    printf("Masquerading tests passed!\n");
+}
+
+void test_dataplane_owner() {
+    printf("Testing dataplane_owner()...\n");
+
+    config_t config;
+    init_config(&config);
+    char text[1024];
+    snprintf(text, sizeof text, "%sdataplane_workers = 4\n", nat_topology);
+    TEST_ASSERT(parse_config_line(text, &config) == 0,
+                "Test topology should parse");
+    dataplane_t dp;
+    dataplane_init(&dp);
+    TEST_ASSERT(dataplane_build(&dp, &config) == 0, "Build should succeed");
+    free_config(&config);
+    set_macs(&dp);
+    uint32_t nat_addr;
+    inet_pton(AF_INET, "198.51.100.7", &nat_addr);
+
+    // Test case 1: The workers split the NAT ports between them
+    TEST_ASSERT(dp.worker_count == 4 && dp.active == 4,
+                "Every configured worker should be built");
+    TEST_ASSERT(dp.workers[0].ct.port_lo == CT_NAT_PORT_MIN &&
+                    dp.workers[3].ct.port_hi == CT_NAT_PORT_MAX,
+                "NAT ports should all be used");
+    for (int w = 0; w < dp.worker_count; w++) {
+        dp.workers[w].ct.nat_addr = nat_addr;
+        TEST_ASSERT(w == 0 || dp.workers[w].ct.port_lo ==
+                                  dp.workers[w - 1].ct.port_hi + 1,
+                    "NAT ports should not overlap");
+    }
+
+    // Test case 2: Both directions of a flow have one owner, and flows
+    // spread over all workers
+    int flows[4] = {0};
+    uint8_t frame[FRAME_LEN];
+    for (int i = 0; i < 400; i++) {
+        make_frame(frame, "10.0.1.2", "10.0.2.2", 64);
+        set_ports(frame, 1024 + i, 80);
+        int w = dataplane_owner(&dp, 0, frame, FRAME_LEN);
+        TEST_ASSERT(w >= 0 && w < 4, "Flow should have an owner");
+        make_frame(frame, "10.0.2.2", "10.0.1.2", 64);
+        set_ports(frame, 80, 1024 + i);
+        TEST_ASSERT(dataplane_owner(&dp, 1, frame, FRAME_LEN) == w,
+                    "Reply should have the same owner");
+        flows[w]++;
+    }
+    for (int w = 0; w < 4; w++) {
+        TEST_ASSERT(flows[w] > 50, "Flows should spread over the workers");
+    }
+
+    // Test case 3: Replies to translated flows come back to the worker
+    // that translated them
+    for (int i = 0; i < 16; i++) {
+        make_frame(frame, "10.0.1.2", "8.8.8.8", 64);
+        set_ports(frame, 5000 + i, 53);
+        int w = dataplane_owner(&dp, 0, frame, FRAME_LEN);
+        TEST_ASSERT(dataplane_route(&dp, w, 0, frame, FRAME_LEN) == 2,
+                    "Frame to the internet should go to the uplink");
+        uint16_t port = get_port(frame, 0);
+        TEST_ASSERT(port >= dp.workers[w].ct.port_lo &&
+                        port <= dp.workers[w].ct.port_hi,
+                    "Port should be from the owner's share");
+        make_frame(frame, "8.8.8.8", "198.51.100.7", 64);
+        set_ports(frame, 53, port);
+        TEST_ASSERT(dataplane_owner(&dp, 2, frame, FRAME_LEN) == w,
+                    "Reply should go to the same worker");
+        TEST_ASSERT(dataplane_route(&dp, w, 2, frame, FRAME_LEN) == 0,
+                    "Reply should go to the namespace");
+    }
+
+    // Test case 4: Frames without a flow can go to any worker
+    make_frame(frame, "10.0.1.2", "10.0.2.2", 64);
+    frame[ETH_HLEN + 6] = 0x20; // a first fragment has no tuple either
+    TEST_ASSERT(dataplane_owner(&dp, 0, frame, FRAME_LEN) < 0,
+                "Fragment should have no owner");
+    make_frame(frame, "10.0.1.2", "10.0.2.2", 64);
+    frame[12] = 0x86;
+    frame[13] = 0xdd;
+    TEST_ASSERT(dataplane_owner(&dp, 0, frame, FRAME_LEN) < 0,
+                "Non-IPv4 frame should have no owner");
+
+    dataplane_free(&dp);
+    printf("dataplane_owner() tests passed!\n");
+}
+
+int main() {
+    test_dataplane_route();
+    test_dataplane_nat();
+    test_dataplane_owner();
+    return 0;
+}
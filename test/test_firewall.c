@@ -0,0 +1,257 @@
+#include "config.h"
+#include "network.h"
+
+#include <net/if.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_ASSERT(condition, message)                                        \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            printf("ASSERTION FAILED: %s\n", message);                         \
+            printf("  In file: %s, line: %d\n", __FILE__, __LINE__);           \
+            exit(EXIT_FAILURE);                                                \
+        }                                                                      \
+    } while (0)
+
+static void load_lines(config_t *config, const char *lines[], int count) {
+    init_config(config);
+    for (int i = 0; i < count; i++) {
+        char line[256];
+        strncpy(line, lines[i], sizeof line - 1);
+        line[sizeof line - 1] = '\0';
+        TEST_ASSERT(parse_config_line(line, config) == 0,
+                    "Test configuration should parse");
+    }
+}
+
+static int count_occurrences(const char *haystack, const char *needle) {
+    int count = 0;
+    for (const char *p = strstr(haystack, needle); p != NULL;
+         p = strstr(p + 1, needle)) {
+        count++;
+    }
+    return count;
+}
+
+void test_compile_ruleset() {
+    printf("Testing compile_ruleset()...\n");
+
+    // Test case 1: Rules become verdict map elements on host interfaces
+    {
+        const char *lines[] = {
+            "nat_outgoing_interface = ens160",
+            "namespace = private1",
+            "namespace.private1.connect_via = bridge:br0",
+            "namespace.private1.ip = 192.168.100.2/24",
+            "namespace = private2",
+            "namespace.private2.connect_via = veth",
+            "bridge = br0",
+            "firewall_forward_default = DROP",
+            "firewall_allow_forward = private1 -> INTERNET",
+            "firewall_allow_forward = private2 -> INTERNET",
+            "firewall_allow_forward = private1 -> private2",
+        };
+        config_t config;
+        load_lines(&config, lines, sizeof lines / sizeof *lines);
+
+        char *ruleset = compile_ruleset(&config);
+        TEST_ASSERT(ruleset != NULL, "Ruleset should compile");
+        TEST_ASSERT(strstr(ruleset, "\"br0\" . 192.168.100.2 . \"ens160\" : "
+                                    "accept") != NULL,
+                    "Bridged namespace should match on its bridge and address");
+        TEST_ASSERT(strstr(ruleset, "\"vh-private2\" . \"ens160\" : accept") !=
+                        NULL,
+                    "Veth namespace should match on its host veth end");
+        TEST_ASSERT(strstr(ruleset, "\"br0\" . 192.168.100.2 . "
+                                    "\"vh-private2\" : accept") != NULL,
+                    "Namespace pair should become a map element");
+        TEST_ASSERT(strstr(ruleset, "policy drop;") != NULL,
+                    "Default action should become the chain policy");
+        TEST_ASSERT(count_occurrences(ruleset, "vmap @forward_allow\n") == 1 &&
+                        count_occurrences(
+                            ruleset,
+                            "iifname . ip saddr . oifname vmap "
+                            "@forward_allow_saddr\n") == 1,
+                    "Pairs should share one verdict map rule per key type");
+        TEST_ASSERT(strstr(ruleset, "forward_allow_daddr") == NULL,
+                    "Key types without pairs should get no map");
+
+        free(ruleset);
+        free_config(&config);
+    }
+
+    // Test case 2: A rule about one namespace on a bridge admits no other
+    {
+        const char *lines[] = {
+            "nat_outgoing_interface = ens160",
+            "namespace = a",
+            "namespace.a.connect_via = bridge:br0",
+            "namespace.a.ip = 10.0.0.2/24",
+            "namespace = b",
+            "namespace.b.connect_via = bridge:br0",
+            "namespace.b.ip = 10.0.0.3/24",
+            "namespace = c",
+            "namespace.c.connect_via = veth",
+            "bridge = br0",
+            "firewall_allow_forward = a -> INTERNET",
+            "firewall_allow_forward = a -> INTERNET",
+            "firewall_allow_forward = c -> a",
+        };
+        config_t config;
+        load_lines(&config, lines, sizeof lines / sizeof *lines);
+
+        char *ruleset = compile_ruleset(&config);
+        TEST_ASSERT(ruleset != NULL, "Ruleset should compile");
+        TEST_ASSERT(count_occurrences(ruleset,
+                                      "\"br0\" . 10.0.0.2 . \"ens160\"") == 1,
+                    "Duplicate rules should be merged");
+        TEST_ASSERT(strstr(ruleset, "\"vh-c\" . \"br0\" . 10.0.0.2") != NULL,
+                    "Traffic to a bridged namespace should match its address");
+        TEST_ASSERT(strstr(ruleset, "10.0.0.3") == NULL &&
+                        strstr(ruleset, "\"br0\" . \"ens160\"") == NULL &&
+                        strstr(ruleset, "\"vh-c\" . \"br0\" :") == NULL,
+                    "Other namespaces on the bridge should not be allowed");
+
+        free(ruleset);
+        free_config(&config);
+    }
+
+    // Test case 3: Bridged namespaces without an address are rejected
+    {
+        const char *lines[] = {
+            "nat_outgoing_interface = ens160",
+            "namespace = a",
+            "namespace.a.connect_via = bridge:br0",
+            "bridge = br0",
+            "firewall_allow_forward = a -> INTERNET",
+        };
+        config_t config;
+        load_lines(&config, lines, sizeof lines / sizeof *lines);
+
+        char *ruleset = compile_ruleset(&config);
+        TEST_ASSERT(ruleset == NULL,
+                    "Rules about an unaddressed bridged namespace should fail");
+
+        free_config(&config);
+    }
+
+    // Test case 4: Namespaces behind unknown bridges are rejected
+    {
+        const char *lines[] = {
+            "nat_outgoing_interface = ens160",
+            "namespace = a",
+            "namespace.a.connect_via = bridge:ghost",
+            "firewall_allow_forward = a -> INTERNET",
+        };
+        config_t config;
+        load_lines(&config, lines, sizeof lines / sizeof *lines);
+
+        char *ruleset = compile_ruleset(&config);
+        TEST_ASSERT(ruleset == NULL,
+                    "Rules through unknown bridges should fail");
+
+        free_config(&config);
+    }
+
+    // Test case 5: NAT prefixes share one interval set and one rule
+    {
+        const char *lines[] = {
+            "nat_outgoing_interface = ens160",
+            "enable_nat = 192.168.100.0/24",
+            "enable_nat = 192.168.101.7/24",
+        };
+        config_t config;
+        load_lines(&config, lines, sizeof lines / sizeof *lines);
+
+        char *ruleset = compile_ruleset(&config);
+        TEST_ASSERT(ruleset != NULL, "Ruleset should compile");
+        TEST_ASSERT(strstr(ruleset, "flags interval") != NULL,
+                    "NAT prefixes should live in an interval set");
+        TEST_ASSERT(strstr(ruleset, "192.168.100.0/24") != NULL,
+                    "NAT prefix should be a set element");
+        TEST_ASSERT(strstr(ruleset, "192.168.101.0/24") != NULL,
+                    "Host bits should be cleared from NAT prefixes");
+        TEST_ASSERT(count_occurrences(ruleset, "masquerade") == 1,
+                    "All prefixes should share a single masquerade rule");
+        TEST_ASSERT(count_occurrences(ruleset, "table inet lvr {") == 1,
+                    "NAT should be loaded with the firewall table");
+
+        TEST_ASSERT(strstr(ruleset, "masquerade\n") != NULL,
+                    "Kernel data plane should masquerade to any port");
+        free(ruleset);
+
+        // the userspace data plane owns the ports from 61000 up
+        config.dataplane = DATAPLANE_AFXDP;
+        ruleset = compile_ruleset(&config);
+        TEST_ASSERT(ruleset != NULL, "Ruleset should compile");
+        TEST_ASSERT(strstr(ruleset, "masquerade to :1024-60999\n") != NULL,
+                    "Kernel masquerade should keep below the NAT ports");
+        free(ruleset);
+        free_config(&config);
+    }
+
+    // Test case 6: Flow offload covers all host interfaces
+    {
+        const char *lines[] = {
+            "nat_outgoing_interface = ens160",
+            "flow_offload = true",
+            "namespace = a",
+            "namespace.a.connect_via = bridge:br0",
+            "namespace.a.ip = 10.0.0.2/24",
+            "namespace = b",
+            "namespace.b.connect_via = veth",
+            "bridge = br0",
+            "firewall_allow_forward = a -> b",
+        };
+        config_t config;
+        load_lines(&config, lines, sizeof lines / sizeof *lines);
+
+        char *ruleset = compile_ruleset(&config);
+        TEST_ASSERT(ruleset != NULL, "Ruleset should compile");
+        TEST_ASSERT(strstr(ruleset, "devices = { \"vh-a\", \"vh-b\", "
+                                    "\"br0\" }") != NULL,
+                    "Flowtable should leave out an uplink that is missing");
+        TEST_ASSERT(strstr(ruleset, "flow add @ft") != NULL,
+                    "Established flows should be offloaded");
+        free(ruleset);
+
+        strcpy(config.nat_outgoing_interface, "lo");
+        ruleset = compile_ruleset(&config);
+        TEST_ASSERT(ruleset != NULL, "Ruleset should compile");
+        TEST_ASSERT(strstr(ruleset, "devices = { \"vh-a\", \"vh-b\", "
+                                    "\"br0\", \"lo\" }") != NULL,
+                    "Flowtable should span host veths, bridges and uplink");
+
+        free(ruleset);
+        free_config(&config);
+    }
+
+    printf("compile_ruleset() tests passed!\n");
+}
+
+void test_veth_host_ifname() {
+    printf("Testing veth_host_ifname()...\n");
+
+    // Test case 1: Hashed names never match a namespace's own name
+    {
+        namespace_t literal = {.name = "deadbeef"};
+        namespace_t hashed = {.name = "a-rather-long-tenant"};
+        char a[IF_NAMESIZE], b[IF_NAMESIZE];
+        veth_host_ifname(&literal, a);
+        veth_host_ifname(&hashed, b);
+        TEST_ASSERT(strcmp(a, "vh-deadbeef") == 0,
+                    "Short names should be used as they are");
+        TEST_ASSERT(strncmp(b, "vx-", 3) == 0 && strlen(b) == 11,
+                    "Long names should be hashed under their own prefix");
+    }
+
+    printf("veth_host_ifname() tests passed!\n");
+}
+
+int main() {
+    test_compile_ruleset();
+    test_veth_host_ifname();
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "ipam.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_ASSERT(condition, message)                                        \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            printf("ASSERTION FAILED: %s\n", message);                         \
+            printf("  In file: %s, line: %d\n", __FILE__, __LINE__);           \
+            exit(EXIT_FAILURE);                                                \
+        }                                                                      \
+    } while (0)
+
+static struct in_addr addr_of(const char *ip) {
+    struct in_addr addr;
+    inet_pton(AF_INET, ip, &addr);
+    return addr;
+}
+
+void test_ipam() {
+    printf("Testing ipam_alloc() and ipam_reserve()...\n");
+
+    // Test case 1: A small subnet hands out its hosts in order
+    {
+        arena_t arena = {0};
+        ipam_pool_t pool;
+        TEST_ASSERT(ipam_init(&pool, &arena, addr_of("10.0.0.3"), 29) == 0,
+                    "Pool should be created");
+        TEST_ASSERT(ipam_reserve(&pool, addr_of("10.0.0.1")) == 0,
+                    "Gateway should be reserved");
+        TEST_ASSERT(ipam_reserve(&pool, addr_of("10.0.0.1")) != 0,
+                    "Address should not be reserved twice");
+        TEST_ASSERT(ipam_reserve(&pool, addr_of("10.0.0.8")) != 0,
+                    "Address outside the subnet should be rejected");
+
+        struct in_addr addr;
+        for (int host = 2; host <= 6; host++) {
+            TEST_ASSERT(ipam_alloc(&pool, &addr) == 0,
+                        "Host address should be free");
+            TEST_ASSERT(ntohl(addr.s_addr) == (10u << 24 | host),
+                        "Addresses should come out in order");
+        }
+        TEST_ASSERT(ipam_alloc(&pool, &addr) != 0,
+                    "Network and broadcast should never be handed out");
+        arena_release(&arena);
+    }
+
+    // Test case 2: A large subnet fills up across words and summary words
+    {
+        arena_t arena = {0};
+        ipam_pool_t pool;
+        TEST_ASSERT(ipam_init(&pool, &arena, addr_of("10.0.0.0"), 16) == 0,
+                    "Pool should be created");
+
+        struct in_addr addr;
+        for (uint32_t n = 0; n < 65534; n++) {
+            TEST_ASSERT(ipam_alloc(&pool, &addr) == 0,
+                        "Every host should be allocated");
+        }
+        TEST_ASSERT(ntohl(addr.s_addr) == (10u << 24 | 0xfffe),
+                    "Last host should come last");
+        TEST_ASSERT(ipam_alloc(&pool, &addr) != 0 && pool.used == pool.size,
+                    "Pool should be exhausted");
+        arena_release(&arena);
+    }
+
+    // Test case 3: /31 and /32 subnets have no network or broadcast
+    {
+        arena_t arena = {0};
+        ipam_pool_t pool;
+        struct in_addr addr;
+        TEST_ASSERT(ipam_init(&pool, &arena, addr_of("10.0.0.4"), 31) == 0,
+                    "Pool should be created");
+        TEST_ASSERT(ipam_alloc(&pool, &addr) == 0 &&
+                        ipam_alloc(&pool, &addr) == 0 &&
+                        ipam_alloc(&pool, &addr) != 0,
+                    "Both addresses of a /31 should be usable");
+        TEST_ASSERT(ipam_init(&pool, &arena, addr_of("10.0.0.4"), 7) != 0,
+                    "Too large a subnet should be rejected");
+        arena_release(&arena);
+    }
+
+    printf("ipam_alloc() and ipam_reserve() tests passed!\n");
+}
+
+int main() {
+    test_ipam();
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include "lpm.h"
+#include "rcu.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_ASSERT(condition, message)                                        \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            printf("ASSERTION FAILED: %s\n", message);                         \
+            printf("  In file: %s, line: %d\n", __FILE__, __LINE__);           \
+            exit(EXIT_FAILURE);                                                \
+        }                                                                      \
+    } while (0)
+
+#define ADDR(a, b, c, d) ((uint32_t)(a) << 24 | (b) << 16 | (c) << 8 | (d))
+
+/* Longest match by scanning every route, later routes winning ties */
+static uint32_t reference(const lpm_prefix_t *prefixes, size_t count,
+                          uint32_t addr) {
+    int best = -1;
+    uint32_t hop = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t mask = prefixes[i].mask ? ~0u << (32 - prefixes[i].mask) : 0;
+        if ((addr & mask) == (prefixes[i].network & mask) &&
+            prefixes[i].mask >= best) {
+            best = prefixes[i].mask;
+            hop = prefixes[i].hop;
+        }
+    }
+    return hop;
+}
+
+/* xorshift, so the test sees the same addresses every run */
+static uint32_t next_random(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+void test_lpm_lookup() {
+    printf("Testing lpm_build() and lpm_lookup()...\n");
+
+    // Test case 1: Nested prefixes, the longest one wins
+    {
+        const lpm_prefix_t routes[] = {
+            {ADDR(10, 1, 2, 200), 32, 5}, {ADDR(10, 0, 0, 0), 8, 1},
+            {ADDR(10, 1, 0, 0), 16, 2},   {ADDR(10, 1, 2, 128), 25, 4},
+            {ADDR(10, 1, 2, 0), 24, 3},
+        };
+        lpm_table_t table;
+        TEST_ASSERT(lpm_build(&table, routes, 5) == 0,
+                    "Build should succeed");
+        TEST_ASSERT(lpm_lookup(&table, ADDR(10, 9, 9, 9)) == 1, "/8 match");
+        TEST_ASSERT(lpm_lookup(&table, ADDR(10, 1, 9, 9)) == 2, "/16 match");
+        TEST_ASSERT(lpm_lookup(&table, ADDR(10, 1, 2, 127)) == 3,
+                    "/24 should hold below its /25");
+        TEST_ASSERT(lpm_lookup(&table, ADDR(10, 1, 2, 128)) == 4,
+                    "/25 match");
+        TEST_ASSERT(lpm_lookup(&table, ADDR(10, 1, 2, 200)) == 5,
+                    "/32 match");
+        TEST_ASSERT(lpm_lookup(&table, ADDR(10, 1, 2, 255)) == 4,
+                    "/25 should hold around its /32");
+        TEST_ASSERT(lpm_lookup(&table, ADDR(11, 0, 0, 0)) == 0,
+                    "Address outside every route has none");
+        TEST_ASSERT(table.tbl8_count == 1, "Only one /24 should be split");
+        lpm_free(&table);
+    }
+
+    // Test case 2: The later of two equal prefixes wins
+    {
+        const lpm_prefix_t routes[] = {{ADDR(192, 168, 0, 0), 24, 7},
+                                       {ADDR(192, 168, 0, 9), 24, 8}};
+        lpm_table_t table;
+        TEST_ASSERT(lpm_build(&table, routes, 2) == 0,
+                    "Build should succeed");
+        TEST_ASSERT(lpm_lookup(&table, ADDR(192, 168, 0, 1)) == 8,
+                    "Later route should win");
+        lpm_free(&table);
+    }
+
+    // Test case 3: Hops the table cannot store are rejected
+    {
+        const lpm_prefix_t zero = {ADDR(10, 0, 0, 0), 8, 0};
+        const lpm_prefix_t high = {ADDR(10, 0, 0, 0), 8, LPM_EXTENDED};
+        const lpm_prefix_t mask = {ADDR(10, 0, 0, 0), 33, 1};
+        lpm_table_t table;
+        TEST_ASSERT(lpm_build(&table, &zero, 1) != 0, "Hop 0 is no route");
+        TEST_ASSERT(lpm_build(&table, &high, 1) != 0,
+                    "Hop with the extension bit should be rejected");
+        TEST_ASSERT(lpm_build(&table, &mask, 1) != 0,
+                    "Prefix longer than 32 should be rejected");
+    }
+
+    // Test case 4: Many tenant prefixes agree with a full scan, one by one
+    // and in batches
+    {
+        enum { ROUTES = 2000, PROBES = 4096 };
+        lpm_prefix_t *routes = malloc(ROUTES * sizeof *routes);
+        uint32_t *addrs = malloc(PROBES * sizeof *addrs);
+        uint32_t *hops = malloc(PROBES * sizeof *hops);
+        uint32_t state = 2463534242u;
+        for (int i = 0; i < ROUTES; i++) {
+            // mostly inside 10/8, so prefixes nest and overlap
+            uint32_t addr = ADDR(10, 0, 0, 0) | (next_random(&state) >> 8);
+            routes[i] = (lpm_prefix_t){addr, 12 + next_random(&state) % 21,
+                                       1 + i};
+        }
+        lpm_table_t table;
+        TEST_ASSERT(lpm_build(&table, routes, ROUTES) == 0,
+                    "Build should succeed");
+        for (int i = 0; i < PROBES; i++) {
+            // half the probes right at a route, the rest anywhere in 10/8
+            addrs[i] = i % 2 ? routes[next_random(&state) % ROUTES].network
+                             : ADDR(10, 0, 0, 0) | next_random(&state) >> 8;
+        }
+        lpm_lookup_batch(&table, addrs, hops, PROBES - 3);
+        for (int i = 0; i < PROBES - 3; i++) {
+            uint32_t want = reference(routes, ROUTES, addrs[i]);
+            TEST_ASSERT(lpm_lookup(&table, addrs[i]) == want,
+                        "Lookup should match a full scan");
+            TEST_ASSERT(hops[i] == want,
+                        "Batch lookup should match a full scan");
+        }
+        lpm_free(&table);
+        free(routes);
+        free(addrs);
+        free(hops);
+    }
+
+    printf("lpm_build() and lpm_lookup() tests passed!\n");
+}
+
+typedef struct {
+    rcu_t rcu;
+    _Atomic(lpm_table_t *) table;
+    atomic_bool stop;
+    bool failed;
+} swap_test_t;
+
+/* Every table routes 10/8 to one hop; a freed one would read as 0 */
+static void *reader(void *arg) {
+    swap_test_t *test = arg;
+    int slot = rcu_register(&test->rcu);
+    while (!atomic_load(&test->stop)) {
+        rcu_quiescent(&test->rcu, slot);
+        const lpm_table_t *table = atomic_load(&test->table);
+        for (uint32_t i = 0; i < 256; i++) {
+            test->failed |= lpm_lookup(table, ADDR(10, i, 0, 1)) == 0;
+        }
+    }
+    rcu_offline(&test->rcu, slot);
+    return NULL;
+}
+
+void test_rcu_swap() {
+    printf("Testing rcu_synchronize()...\n");
+
+    swap_test_t test = {.failed = false};
+    rcu_init(&test.rcu);
+    atomic_init(&test.stop, false);
+    lpm_prefix_t route = {ADDR(10, 0, 0, 0), 8, 1};
+    lpm_table_t *table = malloc(sizeof *table);
+    TEST_ASSERT(lpm_build(table, &route, 1) == 0, "Build should succeed");
+    atomic_init(&test.table, table);
+
+    // Test case 1: Tables swapped under a reader are freed only once it
+    // cannot see them any more
+    pthread_t thread;
+    TEST_ASSERT(pthread_create(&thread, NULL, reader, &test) == 0,
+                "Reader should start");
+    for (int i = 0; i < 50; i++) {
+        route.hop = 2 + i;
+        lpm_table_t *next = malloc(sizeof *next);
+        TEST_ASSERT(lpm_build(next, &route, 1) == 0, "Build should succeed");
+        lpm_table_t *old = atomic_exchange(&test.table, next);
+        rcu_synchronize(&test.rcu);
+        lpm_free(old); // unmapped: a reader still using it would crash
+        free(old);
+    }
+    atomic_store(&test.stop, true);
+    pthread_join(thread, NULL);
+    TEST_ASSERT(!test.failed, "Reader should only see live tables");
+
+    // Test case 2: An offline reader does not hold up a writer
+    int slot = rcu_register(&test.rcu);
+    TEST_ASSERT(slot >= 0, "Reader should register");
+    rcu_offline(&test.rcu, slot);
+    rcu_synchronize(&test.rcu);
+
+    lpm_free(atomic_load(&test.table));
+    free(atomic_load(&test.table));
+    printf("rcu_synchronize() tests passed!\n");
+}
+
+int main() {
+    test_lpm_lookup();
+    test_rcu_swap();
+    return 0;
+}
@@ -0,0 +1,160 @@
+#include "pktpool.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_ASSERT(condition, message)                                        \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            printf("ASSERTION FAILED: %s\n", message);                         \
+            printf("  In file: %s, line: %d\n", __FILE__, __LINE__);           \
+            exit(EXIT_FAILURE);                                                \
+        }                                                                      \
+    } while (0)
+
+enum { FRAMES = 4096, FRAME_SIZE = 2048, ROUNDS = 20000 };
+
+/* Takes frames and returns them in batches of varying size */
+static void *churn(void *arg) {
+    pktpool_t *pool = arg;
+    pktpool_cache_t *cache = malloc(sizeof *cache);
+    if (cache == NULL) {
+        return NULL;
+    }
+    pktpool_cache_init(cache, pool);
+    uint64_t addrs[64];
+    for (uint32_t round = 0; round < ROUNDS; round++) {
+        uint32_t n = pktpool_alloc(cache, addrs, 1 + round % 64);
+        pktpool_free(cache, addrs, n);
+        if (round % 256 == 0) {
+            sched_yield();
+        }
+    }
+    pktpool_cache_flush(cache);
+    free(cache);
+    return NULL;
+}
+
+void test_pktpool() {
+    printf("Testing pktpool_alloc() and pktpool_free()...\n");
+
+    // Test case 1: Every frame is handed out once, aligned and in range
+    {
+        pktpool_t pool;
+        TEST_ASSERT(pktpool_open(&pool, FRAMES, 3000) != 0,
+                    "Frame size that is no power of two should be refused");
+        TEST_ASSERT(pktpool_open(&pool, FRAMES, FRAME_SIZE) == 0,
+                    "Open should succeed");
+        TEST_ASSERT(pool.size >= (size_t)FRAMES * FRAME_SIZE &&
+                        pool.size % PKTPOOL_HUGE_PAGE == 0,
+                    "Region should be whole huge pages");
+        pktpool_cache_t *cache = malloc(sizeof *cache);
+        TEST_ASSERT(cache != NULL, "Cache should be allocated");
+        pktpool_cache_init(cache, &pool);
+        uint64_t *addrs = malloc(FRAMES * sizeof *addrs);
+        bool *seen = calloc(FRAMES, sizeof *seen);
+        TEST_ASSERT(addrs != NULL && seen != NULL, "Buffers should exist");
+        TEST_ASSERT(pktpool_alloc(cache, addrs, FRAMES) == FRAMES,
+                    "Every frame should be available");
+        bool unique = true;
+        for (uint32_t i = 0; i < FRAMES; i++) {
+            TEST_ASSERT(addrs[i] % FRAME_SIZE == 0 &&
+                            addrs[i] < (uint64_t)FRAMES * FRAME_SIZE,
+                        "Frames should be aligned and within the region");
+            unique = unique && !seen[addrs[i] / FRAME_SIZE];
+            seen[addrs[i] / FRAME_SIZE] = true;
+        }
+        TEST_ASSERT(unique, "No frame should be handed out twice");
+        uint64_t extra;
+        TEST_ASSERT(pktpool_alloc(cache, &extra, 1) == 0,
+                    "Exhausted pool should hand out nothing");
+        memset((char *)pool.area + addrs[FRAMES - 1], 0xab, FRAME_SIZE);
+
+        // an offset within a frame gives back the whole frame
+        uint64_t inner = addrs[7] + 256;
+        pktpool_free(cache, &inner, 1);
+        TEST_ASSERT(pktpool_alloc(cache, &extra, 1) == 1 &&
+                        extra == addrs[7],
+                    "Freed frame should round down to its start");
+        pktpool_free(cache, addrs, FRAMES);
+        TEST_ASSERT(cache->count <= PKTPOOL_CACHE_SIZE,
+                    "Cache should spill to the ring");
+        free(seen);
+        free(addrs);
+        free(cache);
+        pktpool_close(&pool);
+    }
+
+    // Test case 2: Frames one cache returns reach another through the ring
+    {
+        pktpool_t pool;
+        TEST_ASSERT(pktpool_open(&pool, 2 * PKTPOOL_BULK, FRAME_SIZE) == 0,
+                    "Open should succeed");
+        pktpool_cache_t *a = malloc(sizeof *a);
+        pktpool_cache_t *b = malloc(sizeof *b);
+        TEST_ASSERT(a != NULL && b != NULL, "Caches should be allocated");
+        pktpool_cache_init(a, &pool);
+        pktpool_cache_init(b, &pool);
+        uint64_t addrs[2 * PKTPOOL_BULK];
+        TEST_ASSERT(pktpool_alloc(a, addrs, 2 * PKTPOOL_BULK) ==
+                        2 * PKTPOOL_BULK,
+                    "First cache should take every frame");
+        TEST_ASSERT(pktpool_alloc(b, addrs, 1) == 0,
+                    "Second cache should find the ring empty");
+        pktpool_free(a, addrs, 2 * PKTPOOL_BULK);
+        TEST_ASSERT(pktpool_alloc(b, addrs, 1) == 0,
+                    "Frames should stay cached until the cache is flushed");
+        pktpool_cache_flush(a);
+        TEST_ASSERT(a->count == 0, "Flushed cache should be empty");
+        TEST_ASSERT(pktpool_alloc(b, addrs, 2 * PKTPOOL_BULK) ==
+                        2 * PKTPOOL_BULK,
+                    "Second cache should get every frame back");
+        free(a);
+        free(b);
+        pktpool_close(&pool);
+    }
+
+    // Test case 3: Threads sharing the ring neither lose nor duplicate
+    {
+        pktpool_t pool;
+        TEST_ASSERT(pktpool_open(&pool, FRAMES, FRAME_SIZE) == 0,
+                    "Open should succeed");
+        pthread_t threads[4];
+        for (int i = 0; i < 4; i++) {
+            TEST_ASSERT(pthread_create(&threads[i], NULL, churn, &pool) == 0,
+                        "Thread should start");
+        }
+        for (int i = 0; i < 4; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        pktpool_cache_t *cache = malloc(sizeof *cache);
+        TEST_ASSERT(cache != NULL, "Cache should be allocated");
+        pktpool_cache_init(cache, &pool);
+        uint64_t *addrs = malloc((FRAMES + 1) * sizeof *addrs);
+        bool *seen = calloc(FRAMES, sizeof *seen);
+        TEST_ASSERT(addrs != NULL && seen != NULL, "Buffers should exist");
+        TEST_ASSERT(pktpool_alloc(cache, addrs, FRAMES + 1) == FRAMES,
+                    "Every frame should be back in the ring");
+        bool unique = true;
+        for (uint32_t i = 0; i < FRAMES; i++) {
+            unique = unique && !seen[addrs[i] / FRAME_SIZE];
+            seen[addrs[i] / FRAME_SIZE] = true;
+        }
+        TEST_ASSERT(unique, "No frame should be in the ring twice");
+        free(seen);
+        free(addrs);
+        free(cache);
+        pktpool_close(&pool);
+    }
+
+    printf("pktpool_alloc() and pktpool_free() tests passed!\n");
+}
+
+int main() {
+    test_pktpool();
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "rss.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_ASSERT(condition, message)                                        \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            printf("ASSERTION FAILED: %s\n", message);                         \
+            printf("  In file: %s, line: %d\n", __FILE__, __LINE__);           \
+            exit(EXIT_FAILURE);                                                \
+        }                                                                      \
+    } while (0)
+
+/* The key of Microsoft's RSS verification suite */
+static const uint8_t verify_key[RSS_KEY_SIZE] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67,
+    0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb,
+    0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30,
+    0xf2, 0x0c, 0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+static void make_input(uint8_t *input, const char *src, const char *dst,
+                       uint16_t sport, uint16_t dport) {
+    inet_pton(AF_INET, src, input);
+    inet_pton(AF_INET, dst, input + 4);
+    sport = htons(sport);
+    dport = htons(dport);
+    memcpy(input + 8, &sport, 2);
+    memcpy(input + 10, &dport, 2);
+}
+
+void test_rss_hash() {
+    printf("Testing rss_hash()...\n");
+
+    // Test case 1: The verification suite's IPv4 results
+    {
+        static const struct {
+            const char *src, *dst;
+            uint16_t sport, dport;
+            uint32_t addrs_only, with_ports;
+        } vectors[] = {
+            {"66.9.149.187", "161.142.100.80", 2794, 1766, 0x323e8fc2,
+             0x51ccc178},
+            {"199.92.111.2", "65.69.140.83", 14230, 4739, 0xd718262a,
+             0xc626b0ea},
+            {"24.19.198.95", "12.22.207.184", 12898, 38024, 0xd2d0a5de,
+             0x5c2b394a},
+        };
+        rss_t rss;
+        rss_init(&rss, verify_key);
+        for (size_t i = 0; i < sizeof vectors / sizeof *vectors; i++) {
+            uint8_t input[RSS_INPUT_MAX];
+            make_input(input, vectors[i].src, vectors[i].dst,
+                       vectors[i].sport, vectors[i].dport);
+            TEST_ASSERT(rss_hash(&rss, input, 8) == vectors[i].addrs_only,
+                        "Address hash should match the suite");
+            TEST_ASSERT(rss_hash(&rss, input, 12) == vectors[i].with_ports,
+                        "Address and port hash should match the suite");
+        }
+    }
+
+    // Test case 2: The symmetric key hashes both directions alike
+    {
+        rss_t rss;
+        rss_init(&rss, rss_symmetric_key);
+        uint32_t state = 1;
+        for (int i = 0; i < 10000; i++) {
+            uint8_t there[RSS_INPUT_MAX], back[RSS_INPUT_MAX];
+            for (int b = 0; b < RSS_INPUT_MAX; b++) {
+                state = state * 1103515245 + 12345;
+                there[b] = state >> 16;
+            }
+            memcpy(back, there + 4, 4);
+            memcpy(back + 4, there, 4);
+            memcpy(back + 8, there + 10, 2);
+            memcpy(back + 10, there + 8, 2);
+            TEST_ASSERT(rss_hash(&rss, there, 12) == rss_hash(&rss, back, 12),
+                        "Reply should hash like its flow");
+        }
+    }
+
+    printf("rss_hash() tests passed!\n");
+}
+
+int main() {
+    test_rss_hash();
+    return 0;
+}
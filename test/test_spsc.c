@@ -0,0 +1,99 @@
+#include "spsc.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_ASSERT(condition, message)                                        \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            printf("ASSERTION FAILED: %s\n", message);                         \
+            printf("  In file: %s, line: %d\n", __FILE__, __LINE__);           \
+            exit(EXIT_FAILURE);                                                \
+        }                                                                      \
+    } while (0)
+
+enum { TOTAL = 200000 };
+
+/* Pushes frames 1 to TOTAL in batches of varying size */
+static void *producer(void *arg) {
+    spsc_ring_t *ring = arg;
+    spsc_frame_t batch[17];
+    uint64_t next = 1;
+    while (next <= TOTAL) {
+        uint32_t n = 1 + next % 17;
+        for (uint32_t i = 0; i < n; i++) {
+            batch[i] = (spsc_frame_t){next + i, (uint32_t)(next + i), 0};
+        }
+        if (next + n > TOTAL + 1) {
+            n = TOTAL + 1 - next;
+        }
+        next += spsc_push(ring, batch, n);
+    }
+    return NULL;
+}
+
+void test_spsc() {
+    printf("Testing spsc_push() and spsc_pop()...\n");
+
+    // Test case 1: Frames come out in order, as many as fit
+    {
+        spsc_ring_t ring;
+        TEST_ASSERT(spsc_init(&ring, 6) != 0,
+                    "Size that is no power of two should be refused");
+        TEST_ASSERT(spsc_init(&ring, 8) == 0, "Init should succeed");
+        TEST_ASSERT(spsc_empty(&ring), "New ring should be empty");
+        spsc_frame_t frames[10], out[10];
+        for (int i = 0; i < 10; i++) {
+            frames[i] = (spsc_frame_t){i * 2048, 60 + i, i};
+        }
+        TEST_ASSERT(spsc_push(&ring, frames, 10) == 8,
+                    "Only the free slots should be filled");
+        TEST_ASSERT(spsc_push(&ring, frames + 8, 2) == 0,
+                    "Full ring should take nothing");
+        TEST_ASSERT(spsc_pop(&ring, out, 3) == 3, "Pop should take 3");
+        TEST_ASSERT(spsc_push(&ring, frames + 8, 2) == 2,
+                    "Freed slots should be reused");
+        TEST_ASSERT(spsc_pop(&ring, out + 3, 10) == 7, "Pop should take 7");
+        for (int i = 0; i < 10; i++) {
+            TEST_ASSERT(out[i].addr == frames[i].addr &&
+                            out[i].len == frames[i].len &&
+                            out[i].port == frames[i].port,
+                        "Frames should come out in order");
+        }
+        TEST_ASSERT(spsc_empty(&ring), "Drained ring should be empty");
+        spsc_free(&ring);
+    }
+
+    // Test case 2: Nothing is lost or reordered between two threads
+    {
+        spsc_ring_t ring;
+        TEST_ASSERT(spsc_init(&ring, 1024) == 0, "Init should succeed");
+        pthread_t thread;
+        TEST_ASSERT(pthread_create(&thread, NULL, producer, &ring) == 0,
+                    "Producer should start");
+        uint64_t expect = 1;
+        bool ordered = true;
+        spsc_frame_t out[32];
+        while (expect <= TOTAL) {
+            uint32_t n = spsc_pop(&ring, out, 32);
+            for (uint32_t i = 0; i < n; i++) {
+                ordered &= out[i].addr == expect && out[i].len == expect;
+                expect++;
+            }
+        }
+        pthread_join(thread, NULL);
+        TEST_ASSERT(ordered, "Every frame should arrive once, in order");
+        TEST_ASSERT(spsc_empty(&ring), "Ring should be empty at the end");
+        spsc_free(&ring);
+    }
+
+    printf("spsc_push() and spsc_pop() tests passed!\n");
+}
+
+int main() {
+    test_spsc();
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include "tokenizer.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_ASSERT(condition, message)                                        \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            printf("ASSERTION FAILED: %s\n", message);                         \
+            printf("  In file: %s, line: %d\n", __FILE__, __LINE__);           \
+            exit(EXIT_FAILURE);                                                \
+        }                                                                      \
+    } while (0)
+
+void test_tokenizer_next() {
+    printf("Testing tokenizer_next()...\n");
+
+    // Test case 1: Blank lines and comments are skipped
+    {
+        const char text[] = "# comment\n\n   \n  namespace = private1  \n";
+        tokenizer_t tok;
+        tokenizer_init(&tok, text, sizeof text - 1);
+
+        config_token_t token;
+        TEST_ASSERT(tokenizer_next(&tok, &token) == 1, "Should find a token");
+        TEST_ASSERT(tok.line == 4, "Should count the skipped lines");
+        TEST_ASSERT(token.num_parts == 1 &&
+                        view_equals(token.key[0], "namespace"),
+                    "Key should be trimmed");
+        TEST_ASSERT(view_equals(token.value, "private1"),
+                    "Value should be trimmed");
+        TEST_ASSERT(tokenizer_next(&tok, &token) == 0,
+                    "Should end after the last line");
+    }
+
+    // Test case 2: Keys split on dots and comments end values
+    {
+        const char text[] = "namespace.private1.ip = 10.0.0.2/24 # host\r\n";
+        tokenizer_t tok;
+        tokenizer_init(&tok, text, sizeof text - 1);
+
+        config_token_t token;
+        TEST_ASSERT(tokenizer_next(&tok, &token) == 1, "Should find a token");
+        TEST_ASSERT(token.num_parts == 3, "Key should have three parts");
+        TEST_ASSERT(view_equals(token.key[1], "private1") &&
+                        view_equals(token.key[2], "ip"),
+                    "Key parts should be split on dots");
+        TEST_ASSERT(view_equals(token.value, "10.0.0.2/24"),
+                    "Comment and carriage return should be dropped");
+        TEST_ASSERT(token.value.data > text &&
+                        token.value.data < text + sizeof text,
+                    "Value should point into the buffer");
+    }
+
+    // Test case 3: The last line needs no newline
+    {
+        const char text[] = "bridge = br0";
+        tokenizer_t tok;
+        tokenizer_init(&tok, text, sizeof text - 1);
+
+        config_token_t token;
+        TEST_ASSERT(tokenizer_next(&tok, &token) == 1 &&
+                        view_equals(token.value, "br0"),
+                    "Unterminated line should be tokenized");
+    }
+
+    // Test case 4: Malformed lines report their number
+    {
+        const char *bad[] = {
+            "bridge = br0\nbridge br1\n",
+            "bridge = br0\nbridge = # nothing\n",
+            "bridge = br0\na.b.c.d = x\n",
+            "bridge = br0\n... = x\n",
+        };
+        for (size_t i = 0; i < sizeof bad / sizeof *bad; i++) {
+            tokenizer_t tok;
+            tokenizer_init(&tok, bad[i], strlen(bad[i]));
+
+            config_token_t token;
+            TEST_ASSERT(tokenizer_next(&tok, &token) == 1,
+                        "First line should be valid");
+            TEST_ASSERT(tokenizer_next(&tok, &token) == -1,
+                        "Malformed line should be rejected");
+            TEST_ASSERT(tok.line == 2, "Should report the malformed line");
+        }
+    }
+
+    printf("tokenizer_next() tests passed!\n");
+}
+
+void test_view_to_ipv4() {
+    printf("Testing view_to_ipv4()...\n");
+
+    const char *valid[] = {"0.0.0.0", "10.0.0.2", "192.168.100.1",
+                           "255.255.255.255"};
+    for (size_t i = 0; i < sizeof valid / sizeof *valid; i++) {
+        struct in_addr addr, expected;
+        inet_pton(AF_INET, valid[i], &expected);
+        TEST_ASSERT(view_to_ipv4(view_of(valid[i]), &addr) == 0,
+                    "Valid address should parse");
+        TEST_ASSERT(addr.s_addr == expected.s_addr,
+                    "Address should match inet_pton()");
+    }
+
+    const char *invalid[] = {"",          "10.0.0",   "10.0.0.2.1",
+                             "256.0.0.1", "10.0.0.x", "010.0.0.1",
+                             "1000.0.0.1", "10..0.1", "10.0.0.1 "};
+    for (size_t i = 0; i < sizeof invalid / sizeof *invalid; i++) {
+        struct in_addr addr;
+        TEST_ASSERT(view_to_ipv4(view_of(invalid[i]), &addr) != 0,
+                    "Invalid address should be rejected");
+    }
+
+    printf("view_to_ipv4() tests passed!\n");
+}
+
+void test_view_to_u32() {
+    printf("Testing view_to_u32()...\n");
+
+    uint32_t value;
+    TEST_ASSERT(view_to_u32(view_of("0"), &value) == 0 && value == 0,
+                "Zero should parse");
+    TEST_ASSERT(view_to_u32(view_of("4294967295"), &value) == 0 &&
+                    value == UINT32_MAX,
+                "Largest value should parse");
+
+    const char *invalid[] = {"", "4294967296", "-1", "012", "1k", " 1"};
+    for (size_t i = 0; i < sizeof invalid / sizeof *invalid; i++) {
+        TEST_ASSERT(view_to_u32(view_of(invalid[i]), &value) != 0,
+                    "Invalid number should be rejected");
+    }
+
+    printf("view_to_u32() tests passed!\n");
+}
+
+void test_view_equals() {
+    printf("Testing view_equals()...\n");
+
+    strview_t view = {"br0x", 3};
+    TEST_ASSERT(view_equals(view, "br0"), "Equal prefix should match");
+    TEST_ASSERT(!view_equals(view, "br"), "Shorter string should not match");
+    TEST_ASSERT(!view_equals(view, "br0x"), "Longer string should not match");
+
+    // a NUL inside the view must not end the comparison early
+    strview_t nul = {"br\0", 3};
+    TEST_ASSERT(!view_equals(nul, "br"), "Embedded NUL should not match");
+
+    printf("view_equals() tests passed!\n");
+}
+
+int main() {
+    test_tokenizer_next();
+    test_view_equals();
+    test_view_to_ipv4();
+    test_view_to_u32();
+    return 0;
+}
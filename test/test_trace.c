@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_ASSERT(condition, message)                                        \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            printf("ASSERTION FAILED: %s\n", message);                         \
+            printf("  In file: %s, line: %d\n", __FILE__, __LINE__);           \
+            exit(EXIT_FAILURE);                                                \
+        }                                                                      \
+    } while (0)
+
+#define WORKER_EVENTS 100
+
+static char *read_file(const char *path) {
+    FILE *fp = fopen(path, "r");
+    TEST_ASSERT(fp != NULL, "Trace should be readable");
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+    char *text = malloc(size + 1);
+    TEST_ASSERT(text != NULL && fread(text, 1, size, fp) == (size_t)size,
+                "Trace should be read");
+    text[size] = '\0';
+    fclose(fp);
+    return text;
+}
+
+static int count_matches(const char *text, const char *needle) {
+    int count = 0;
+    for (const char *p = strstr(text, needle); p != NULL;
+         p = strstr(p + 1, needle)) {
+        count++;
+    }
+    return count;
+}
+
+static void *worker(void *arg) {
+    (void)arg;
+    for (int i = 0; i < WORKER_EVENTS; i++) {
+        uint64_t begin = trace_begin();
+        trace_end(begin, "netlink", "RTM_NEWLINK", "veth0");
+    }
+    return NULL;
+}
+
+void test_trace() {
+    printf("Testing trace_record() and trace_write()...\n");
+
+    char filename[] = "/tmp/test_trace_XXXXXX";
+    int fd = mkstemp(filename);
+    TEST_ASSERT(fd >= 0, "Temporary file should be created");
+    close(fd);
+
+    // Test case 1: Nothing is recorded while tracing is disabled
+    {
+        TEST_ASSERT(trace_begin() == 0, "Disabled trace should not time");
+        trace_end(0, "netns", "create_namespace", "ns1");
+        trace_record("netns", "create_namespace", "ns1", 1, 2);
+
+        TEST_ASSERT(trace_start() == 0, "Tracing should start");
+        TEST_ASSERT(trace_start() != 0, "Tracing should not start twice");
+        TEST_ASSERT(trace_write(filename) == 0, "Empty trace should write");
+        char *text = read_file(filename);
+        TEST_ASSERT(strstr(text, "\"traceEvents\":[\n]") != NULL,
+                    "Trace should hold no events");
+        free(text);
+        trace_stop();
+    }
+
+    // Test case 2: Events of every thread end up in the file
+    {
+        TEST_ASSERT(trace_start() == 0, "Tracing should start");
+        uint64_t begin = trace_begin();
+        TEST_ASSERT(begin != 0, "Enabled trace should time");
+        trace_end(begin, "netns", "create_namespace", "ns \"1\"");
+
+        pthread_t threads[2];
+        for (int i = 0; i < 2; i++) {
+            TEST_ASSERT(pthread_create(&threads[i], NULL, worker, NULL) == 0,
+                        "Worker should start");
+        }
+        for (int i = 0; i < 2; i++) {
+            pthread_join(threads[i], NULL);
+        }
+
+        TEST_ASSERT(trace_write(filename) == 0, "Trace should write");
+        char *text = read_file(filename);
+        TEST_ASSERT(count_matches(text, "\"ph\":\"X\"") ==
+                        1 + 2 * WORKER_EVENTS,
+                    "Every event should be written");
+        TEST_ASSERT(count_matches(text, "\"name\":\"RTM_NEWLINK\"") ==
+                        2 * WORKER_EVENTS,
+                    "Worker events should keep their name");
+        TEST_ASSERT(strstr(text, "\"args\":{\"object\":\"ns \\\"1\\\"\"}") !=
+                        NULL,
+                    "Objects should be escaped");
+        TEST_ASSERT(strstr(text, "\"tid\":3") != NULL &&
+                        strstr(text, "\"tid\":4") == NULL,
+                    "Each thread should get its own track");
+        free(text);
+        trace_stop();
+    }
+
+    // Test case 3: A full ring keeps the most recent events
+    {
+        TEST_ASSERT(trace_start() == 0, "Tracing should start");
+        uint64_t now = trace_now();
+        for (unsigned i = 0; i < TRACE_RING_EVENTS + 10; i++) {
+            trace_record("plan", i < 10 ? "old" : "new",
+                         "an object name longer than the event holds", now,
+                         now + 1000);
+        }
+        TEST_ASSERT(trace_write(filename) == 0, "Trace should write");
+        char *text = read_file(filename);
+        TEST_ASSERT(count_matches(text, "\"name\":\"new\"") ==
+                            (int)TRACE_RING_EVENTS &&
+                        strstr(text, "\"name\":\"old\"") == NULL,
+                    "Oldest events should be overwritten");
+        TEST_ASSERT(strstr(text, "\"dur\":1.000") != NULL,
+                    "Durations should be in microseconds");
+        TEST_ASSERT(count_matches(text, "longer than the \"") ==
+                        (int)TRACE_RING_EVENTS,
+                    "Objects should be truncated");
+        free(text);
+        trace_stop();
+    }
+
+    TEST_ASSERT(trace_begin() == 0, "Stopped trace should not time");
+    unlink(filename);
+    printf("trace_record() and trace_write() tests passed!\n");
+}
+
+int main() {
+    test_trace();
+    return 0;
+}
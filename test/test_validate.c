@@ -0,0 +1,118 @@
+#include "config.h"
+#include "validate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_ASSERT(condition, message)                                        \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            printf("ASSERTION FAILED: %s\n", message);                         \
+            printf("  In file: %s, line: %d\n", __FILE__, __LINE__);           \
+            exit(EXIT_FAILURE);                                                \
+        }                                                                      \
+    } while (0)
+
+static const char *topology = "namespace = private1\n"
+                              "namespace.private1.ip = 192.168.100.2/24\n"
+                              "namespace.private1.gateway = 192.168.100.1\n"
+                              "namespace.private1.connect_via = bridge:br0\n"
+                              "namespace = private2\n"
+                              "namespace.private2.ip = 192.168.101.2/24\n"
+                              "namespace.private2.gateway = 192.168.101.1\n"
+                              "namespace.private2.connect_via = veth\n"
+                              "bridge = br0\n"
+                              "bridge.br0.ip = 192.168.100.1/24\n"
+                              "enable_nat = 192.168.100.0/24\n"
+                              "enable_nat = 192.168.101.0/24\n";
+
+/* Validate the example topology with some lines added after it */
+static int validate_with(const char *extra) {
+    char text[2048];
+    snprintf(text, sizeof text, "%s%s", topology, extra);
+    config_t config;
+    init_config(&config);
+    TEST_ASSERT(parse_config_line(text, &config) == 0,
+                "Test topology should parse");
+    int status = validate_config(&config);
+    free_config(&config);
+    return status;
+}
+
+void test_validate_config() {
+    printf("Testing validate_config()...\n");
+
+    // Test case 1: The example topology is consistent
+    TEST_ASSERT(validate_with("") == 0, "Example should be valid");
+
+    // Test case 2: A veth subnet inside a bridge subnet
+    TEST_ASSERT(validate_with("namespace = private3\n"
+                              "namespace.private3.ip = 192.168.100.64/26\n"
+                              "namespace.private3.connect_via = veth\n") != 0,
+                "Nested link subnets should be rejected");
+
+    // Test case 3: Two namespaces with one address
+    TEST_ASSERT(validate_with("namespace = private3\n"
+                              "namespace.private3.ip = 192.168.100.2/24\n"
+                              "namespace.private3.connect_via = "
+                              "bridge:br0\n") != 0,
+                "Duplicate address should be rejected");
+
+    // Test case 4: A gateway outside the subnet
+    TEST_ASSERT(validate_with("namespace.private2.gateway = 10.0.0.1\n") != 0,
+                "Gateway outside the subnet should be rejected");
+
+    // Test case 5: A bridge that does not exist
+    TEST_ASSERT(validate_with("namespace.private1.connect_via = "
+                              "bridge:br9\n") != 0,
+                "Missing bridge should be rejected");
+
+    // Test case 6: An address outside the subnet of its bridge
+    TEST_ASSERT(validate_with("namespace.private1.ip = 192.168.102.2/24\n"
+                              "namespace.private1.gateway = "
+                              "192.168.102.1\n") != 0,
+                "Address outside the bridge subnet should be rejected");
+
+    // Test case 7: Overlapping NAT prefixes
+    TEST_ASSERT(validate_with("enable_nat = 192.168.0.0/16\n") != 0,
+                "Overlapping NAT prefixes should be rejected");
+
+    // Test case 8: Many disjoint veth subnets pass the sweep
+    {
+        config_t config;
+        init_config(&config);
+        char line[128];
+        for (int i = 0; i < 4096; i++) {
+            snprintf(line, sizeof line,
+                     "namespace = n%d\n"
+                     "namespace.n%d.ip = 10.%d.%d.2/30\n"
+                     "namespace.n%d.connect_via = veth\n",
+                     i, i, i / 64, i % 64 * 4, i);
+            TEST_ASSERT(parse_config_line(line, &config) == 0,
+                        "Namespace should parse");
+        }
+        TEST_ASSERT(validate_config(&config) == 0,
+                    "Disjoint subnets should be valid");
+        free_config(&config);
+    }
+
+    // Test case 9: afxdp tracks connections, so one-way rules are enough
+    {
+        TEST_ASSERT(validate_with("namespace = private3\n"
+                                  "namespace.private3.ip = 192.168.102.2/24\n"
+                                  "namespace.private3.connect_via = veth\n"
+                                  "firewall_forward_default = DROP\n"
+                                  "dataplane = afxdp\n"
+                                  "firewall_allow_forward = private2 -> "
+                                  "private3\n") == 0,
+                    "One-way rule should be valid with afxdp");
+    }
+
+    printf("validate_config() tests passed!\n");
+}
+
+int main() {
+    test_validate_config();
+    return 0;
+}